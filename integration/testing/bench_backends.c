@@ -0,0 +1,151 @@
+/**
+ * @file bench_backends.c
+ * @author Mark Dervishaj
+ * @brief Compares the memory backends reading a target: single ranges of growing size and
+ * vectors of scattered 8-byte values. Nothing is written into the target
+ * @version 0.1
+ * @date 2022-10-15
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include "../../src/inc/mu_types.h"
+#include "../../src/inc/mu_memchunk.h"
+#include "../../src/inc/mu_backend.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MOD_CHUNKS      1
+#define BILLION         1000000000.0
+#define BENCH_BYTES     (256UL << 20)       /* Bytes moved per backend and size */
+#define MAX_READS       200000
+#define VECTOR_SIZE     1024                /* Iovecs per vector read */
+#define VECTOR_ROUNDS   200
+
+/**
+ * @brief Gets the seconds elapsed since a start time
+ * 
+ * @param start Start time
+ * @return Seconds elapsed
+ */
+REAL64 elapsed_since(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / BILLION;
+}
+
+/**
+ * @brief Times reads of one size at random aligned offsets of a chunk
+ * 
+ * @param backend Backend to time
+ * @param target PID of the target process
+ * @param chunk Chunk to read
+ * @param size Bytes per read
+ * @param buffer Buffer of at least size bytes
+ */
+void bench_ranges(const MU_BACKEND *backend, PID target, MU_MEM_CHUNK *chunk, ULONG size, UCHAR *buffer)
+{
+    struct timespec start;
+    ULONG n_reads = BENCH_BYTES / size;
+    ULONG n_failed = 0;
+    ULONG slots = chunk->chunk_size / size;
+
+    if(n_reads > MAX_READS) n_reads = MAX_READS;
+    srand(1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(ULONG i = 0; i < n_reads; i++)
+    {
+        ULONG address = chunk->addr_start + ((ULONG) rand() % slots) * size;
+        if(backend->read_range(target, address, buffer, size) != (INT64) size) n_failed++;
+    }
+    REAL64 secs = elapsed_since(&start);
+    printf("%-12s %10lu B   %9.0f ns/read   %9.1f MB/s   %lu failed\n", backend->name, size,
+           secs * BILLION / n_reads, n_reads * size / secs / 1e6, n_failed);
+}
+
+/**
+ * @brief Times vector reads of scattered 8-byte values, as filters do
+ * 
+ * @param backend Backend to time
+ * @param target PID of the target process
+ * @param chunk Chunk to read
+ * @param buffer Buffer of at least 8 * VECTOR_SIZE bytes
+ */
+void bench_vectors(const MU_BACKEND *backend, PID target, MU_MEM_CHUNK *chunk, UCHAR *buffer)
+{
+    struct timespec start;
+    struct iovec local[VECTOR_SIZE];
+    struct iovec remote[VECTOR_SIZE];
+    ULONG slots = chunk->chunk_size / sizeof(UINT64);
+    ULONG addresses[VECTOR_SIZE];
+
+    srand(2);
+    for(INT i = 0; i < VECTOR_SIZE; i++) addresses[i] = chunk->addr_start + ((ULONG) rand() % slots) * sizeof(UINT64);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(INT r = 0; r < VECTOR_ROUNDS; r++)
+    {
+        for(INT i = 0; i < VECTOR_SIZE; i++)
+        {
+            local[i].iov_base = buffer + i * sizeof(UINT64);
+            local[i].iov_len = sizeof(UINT64);
+            remote[i].iov_base = (void *) addresses[i];
+            remote[i].iov_len = sizeof(UINT64);
+        }
+        backend->read_vector(target, local, remote, VECTOR_SIZE);
+    }
+    REAL64 secs = elapsed_since(&start);
+    printf("%-12s %4d x 8 B vector   %9.0f ns/value\n", backend->name, VECTOR_SIZE, secs * BILLION / (VECTOR_ROUNDS * VECTOR_SIZE));
+}
+
+INT main(INT argc, CHAR **argv)
+{
+    const CHAR *names[] = {"process_vm", "procmem"};
+    const ULONG sizes[] = {8, 64, 512, 4096, 65536, 1UL << 20};
+    INT n_chunks = 0;
+
+    if(argc < 2)
+    {
+        fprintf(stderr, "NO PID PROVIDED!! Usage: ./bench_backends <target_pid>\n");
+        exit(255);
+    }
+    PID target = atoi(argv[1]);
+
+    /* Biggest writable chunk: likely to be resident and big enough for the largest reads */
+    MU_MEM_CHUNK *chunks = get_memory_chunks(target, MOD_CHUNKS, &n_chunks);
+    MU_MEM_CHUNK *chunk = NULL;
+    for(INT i = 0; i < n_chunks; i++)
+    {
+        if(chunk == NULL || chunks[i].chunk_size > chunk->chunk_size) chunk = &chunks[i];
+    }
+    if(chunk == NULL || chunk->chunk_size < sizes[sizeof sizes / sizeof *sizes - 1])
+    {
+        fprintf(stderr, "Target has no writable chunk of at least 1 MiB\n");
+        exit(255);
+    }
+    printf("Reading chunk %#lx (%lu bytes) of %d\n\n", chunk->addr_start, chunk->chunk_size, target);
+
+    UCHAR *buffer = malloc(sizes[sizeof sizes / sizeof *sizes - 1]);
+    for(ULONG s = 0; s < sizeof sizes / sizeof *sizes; s++)
+    {
+        for(ULONG b = 0; b < sizeof names / sizeof *names; b++)
+        {
+            bench_ranges(backend_find(names[b]), target, chunk, sizes[s], buffer);
+        }
+    }
+    printf("\n");
+    for(ULONG b = 0; b < sizeof names / sizeof *names; b++)
+    {
+        bench_vectors(backend_find(names[b]), target, chunk, buffer);
+    }
+    backend_close();
+    free(buffer);
+    free(chunks);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,452 @@
+/**
+ * @file bench_suite.c
+ * @author Mark Dervishaj
+ * @brief End-to-end benchmark of the scanner against bench_target: scan GB/s, filter candidates/s
+ * and write patches/s, with the peak RSS and the syscalls of each phase. Results are printed as one
+ * JSON object, so runs on different versions can be compared
+ * @version 0.1
+ * @date 2022-10-25
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * Usage: bench_suite [options] <truth_file>. The target is the pid written in the truth file. Each
+ * phase runs --repeat times and reports its best and median time:
+ *   scan              execute_scanner of the planted value. Recall is checked against the truth
+ *   filter_equal      execute_filtering of the matches with the same value
+ *   filter_unchanged  execute_relational_filtering of the matches with PRED_UNCHANGED
+ *   write             write_patches of the planted value over the planted addresses (no change)
+ */
+
+#include "../../src/inc/mu_types.h"
+#include "../../src/inc/mu_utils.h"
+#include "../../src/inc/mu_memchunk.h"
+#include "../../src/inc/mu_io.h"
+#include "../../src/inc/mu_backend.h"
+#include "../../src/inc/mu_kernels.h"
+#include "../../src/inc/mu_scanner.h"
+#include "../../src/inc/mu_matchset.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
+
+#define MOD_CHUNKS      1
+#define BILLION         1000000000.0
+#define KIBIBYTE        1024UL
+#define SUITE_VERSION   1
+#define MAX_REPEAT      100
+#define MAX_LINE        512
+
+/* Syscalls and memory of the process at a point in time */
+typedef struct bench_counters
+{
+    UINT64  vm_reads;       /* process_vm_readv calls */
+    UINT64  vm_writes;      /* process_vm_writev calls */
+    UINT64  read_calls;     /* read family (read, pread, preadv...): syscr of /proc/self/io */
+    UINT64  write_calls;    /* write family: syscw of /proc/self/io */
+
+} MU_BENCH_COUNTERS;
+
+/* Times and counters of the runs of a phase */
+typedef struct bench_phase
+{
+    const CHAR          *name;
+    REAL64              secs[MAX_REPEAT];
+    INT                 n_runs;
+    UINT64              items;          /* Bytes, candidates or patches handled by the last run */
+    UINT64              out;            /* Matches, kept candidates or patches written by the last run */
+    MU_BENCH_COUNTERS   calls;          /* Of the last run */
+    ULONG               peak_rss_kb;    /* Highest of all runs */
+
+} MU_BENCH_PHASE;
+
+static UINT64 n_vm_reads = 0;
+static UINT64 n_vm_writes = 0;
+
+/* The scanner is linked into this program, so these take the place of the C library functions for
+   it: each call is counted, then made as usual. /proc/self/io does not count them */
+ssize_t process_vm_readv(pid_t pid, const struct iovec *local, unsigned long liovcnt, const struct iovec *remote,
+                         unsigned long riovcnt, unsigned long flags)
+{
+    __atomic_add_fetch(&n_vm_reads, 1, __ATOMIC_RELAXED);
+    return syscall(SYS_process_vm_readv, pid, local, liovcnt, remote, riovcnt, flags);
+}
+
+ssize_t process_vm_writev(pid_t pid, const struct iovec *local, unsigned long liovcnt, const struct iovec *remote,
+                          unsigned long riovcnt, unsigned long flags)
+{
+    __atomic_add_fetch(&n_vm_writes, 1, __ATOMIC_RELAXED);
+    return syscall(SYS_process_vm_writev, pid, local, liovcnt, remote, riovcnt, flags);
+}
+
+/**
+ * @brief Gets the seconds elapsed since a start time
+ *
+ * @param start Start time
+ * @return Seconds elapsed
+ */
+REAL64 elapsed_since(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / BILLION;
+}
+
+/**
+ * @brief Gets a field of a /proc file made of "name: value" lines
+ *
+ * @param path Path of the file
+ * @param field Name of the field, with its colon
+ * @return Value of the field. 0 if it is missing
+ */
+UINT64 proc_field(const CHAR *path, const CHAR *field)
+{
+    CHAR line[MAX_LINE];
+    UINT64 value = 0;
+    FILE *file = fopen(path, "r");
+
+    while(file != NULL && fgets(line, sizeof line, file) != NULL)
+    {
+        if(strncmp(line, field, strlen(field)) == 0)
+        {
+            value = strtoull(line + strlen(field), NULL, 10);
+            break;
+        }
+    }
+    if(file != NULL) fclose(file);
+
+    return value;
+}
+
+void read_counters(MU_BENCH_COUNTERS *counters)
+{
+    counters->vm_reads = __atomic_load_n(&n_vm_reads, __ATOMIC_RELAXED);
+    counters->vm_writes = __atomic_load_n(&n_vm_writes, __ATOMIC_RELAXED);
+    counters->read_calls = proc_field("/proc/self/io", "syscr:");
+    counters->write_calls = proc_field("/proc/self/io", "syscw:");
+}
+
+/**
+ * @brief Resets the peak RSS of this process, so the next reading is the peak of one phase
+ */
+void reset_peak_rss()
+{
+    FILE *file = fopen("/proc/self/clear_refs", "w");
+
+    if(file == NULL) return;
+    fputs("5", file);
+    fclose(file);
+}
+
+/**
+ * @brief Starts a run of a phase
+ *
+ * @param start Stores the start time
+ * @param before Stores the counters before the run
+ */
+void run_start(struct timespec *start, MU_BENCH_COUNTERS *before)
+{
+    reset_peak_rss();
+    read_counters(before);
+    clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+/**
+ * @brief Ends a run of a phase, recording its time, its syscalls and its peak RSS
+ *
+ * @param phase Phase
+ * @param start Start time of the run
+ * @param before Counters before the run
+ */
+void run_end(MU_BENCH_PHASE *phase, struct timespec *start, MU_BENCH_COUNTERS *before)
+{
+    MU_BENCH_COUNTERS after;
+
+    phase->secs[phase->n_runs++] = elapsed_since(start);
+    read_counters(&after);
+    phase->calls.vm_reads = after.vm_reads - before->vm_reads;
+    phase->calls.vm_writes = after.vm_writes - before->vm_writes;
+    phase->calls.read_calls = after.read_calls - before->read_calls;
+    phase->calls.write_calls = after.write_calls - before->write_calls;
+
+    ULONG rss = proc_field("/proc/self/status", "VmHWM:");
+    if(rss > phase->peak_rss_kb) phase->peak_rss_kb = rss;
+}
+
+INT cmp_secs(const void *a, const void *b)
+{
+    REAL64 x = *(const REAL64 *) a;
+    REAL64 y = *(const REAL64 *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Prints a phase as a JSON object. Rates are taken from the best run
+ *
+ * @param phase Phase
+ * @param items Name of what was handled: bytes, candidates or patches
+ * @param rate Name of the rate, and scale of items for it
+ * @param scale Divisor of items per second
+ * @param last True if no phase follows
+ */
+void print_phase(MU_BENCH_PHASE *phase, const CHAR *items, const CHAR *rate, REAL64 scale, BOOL last)
+{
+    REAL64 sorted[MAX_REPEAT];
+
+    memcpy(sorted, phase->secs, phase->n_runs * sizeof *sorted);
+    qsort(sorted, phase->n_runs, sizeof *sorted, &cmp_secs);
+    REAL64 best = sorted[0];
+    REAL64 median = (phase->n_runs % 2 == 1) ? sorted[phase->n_runs / 2]
+                  : (sorted[phase->n_runs / 2 - 1] + sorted[phase->n_runs / 2]) / 2;
+
+    printf("    {\"phase\": \"%s\", \"runs\": %d, \"best_s\": %.6f, \"median_s\": %.6f, \"%s\": %lu, \"out\": %lu, "
+           "\"%s\": %.3f, \"peak_rss_kb\": %lu,\n", phase->name, phase->n_runs, best, median, items, phase->items,
+           phase->out, rate, (best > 0) ? phase->items / best / scale : 0, phase->peak_rss_kb);
+    printf("     \"syscalls\": {\"process_vm_readv\": %lu, \"process_vm_writev\": %lu, \"read_family\": %lu, "
+           "\"write_family\": %lu}}%s\n", phase->calls.vm_reads, phase->calls.vm_writes, phase->calls.read_calls,
+           phase->calls.write_calls, last ? "" : ",");
+}
+
+/**
+ * @brief Gets an option of the header of the truth file
+ *
+ * @param header Header line
+ * @param key Name of the option, with its equal sign
+ * @return Value of the option. 0 if it is missing
+ */
+INT64 header_field(const CHAR *header, const CHAR *key)
+{
+    const CHAR *p = strstr(header, key);
+    return (p == NULL) ? 0 : strtol(p + strlen(key), NULL, 10);
+}
+
+/**
+ * @brief Loads the addresses of a truth file written by bench_target. REMEMBER TO FREE
+ *
+ * @param path Path of the file
+ * @param header Stores the header line. MAX_LINE bytes
+ * @param n_planted Stores the number of addresses
+ * @return Addresses, in ascending order. NULL if the file cannot be read
+ */
+ULONG* load_truth(const CHAR *path, CHAR *header, ULONG *n_planted)
+{
+    CHAR line[MAX_LINE];
+    FILE *file = fopen(path, "r");
+
+    if(file == NULL || fgets(header, MAX_LINE, file) == NULL || strncmp(header, "# mu_bench_truth ", 17) != 0)
+    {
+        if(file != NULL) fclose(file);
+        return NULL;
+    }
+    header[strcspn(header, "\n")] = '\0';
+    *n_planted = header_field(header, "planted=");
+    ULONG *planted = malloc((*n_planted + 1) * sizeof *planted);
+    ULONG n = 0;
+    while(planted != NULL && n < *n_planted && fgets(line, sizeof line, file) != NULL)
+    {
+        planted[n++] = strtoul(line, NULL, 16);
+    }
+    fclose(file);
+    if(planted == NULL || n != *n_planted)
+    {
+        free(planted);
+        return NULL;
+    }
+    return planted;
+}
+
+/**
+ * @brief Counts the planted addresses found by a scan. Both lists are in ascending order
+ *
+ * @return Addresses in both lists
+ */
+ULONG count_found(ULONG *planted, ULONG n_planted, ULONG *found, ULONG n_found)
+{
+    ULONG hits = 0;
+
+    for(ULONG i = 0, j = 0; i < n_planted && j < n_found; )
+    {
+        if(planted[i] == found[j])
+        {
+            hits++;
+            i++;
+            j++;
+        }
+        else if(planted[i] < found[j]) i++;
+        else j++;
+    }
+    return hits;
+}
+
+/**
+ * @brief Prints a sensible usage message
+ *
+ */
+void show_help()
+{
+    printf("Usage: bench_suite [options] <truth_file>\n\n");
+    printf("Options:\n");
+    printf("  --repeat <n>          Runs of each phase, at most %d (default 5)\n", MAX_REPEAT);
+    printf("  --label <text>        Name of this run in the results, such as a version. No quotes (default none)\n");
+    printf("  --patches <n>         Planted addresses rewritten by the write phase (default all)\n");
+    printf("  --window <KiB>        Size of the window each thread reads at once\n");
+    printf("  --queue-depth <n>     Windows each thread keeps in flight with io_uring\n");
+    printf("  --pipeline <n>        Buffers per pair of threads of a pipelined scan\n");
+    printf("  --backend <name>      Memory access: process_vm, procmem or auto\n");
+    printf("  --kernels <name>      Search kernels: avx512, avx2, sse2 or scalar\n");
+}
+
+INT main(INT argc, CHAR **argv)
+{
+    INT repeat = 5;
+    const CHAR *label = "";
+    ULONG max_patches = 0;
+    CHAR header[MAX_LINE];
+    ULONG n_planted = 0;
+    INT n_chunks = 0;
+    struct timespec start;
+    MU_BENCH_COUNTERS before;
+    struct utsname host;
+
+    if(argc < 2 || argc % 2 != 0)
+    {
+        show_help();
+        exit(255);
+    }
+    for(INT i = 1; i < argc - 1; i += 2)
+    {
+        MU_ERROR opt_ok = ERR_OK;
+        CHAR *thrash = NULL;
+        ULONG value = strtoul(argv[i + 1], &thrash, 10);
+        BOOL number = *thrash == '\0';
+        if(number && strcmp(argv[i], "--repeat") == 0 && value >= 1 && value <= MAX_REPEAT) repeat = (INT) value;
+        else if(strcmp(argv[i], "--label") == 0 && strpbrk(argv[i + 1], "\"\\") == NULL) label = argv[i + 1];
+        else if(number && strcmp(argv[i], "--patches") == 0) max_patches = value;
+        else if(number && strcmp(argv[i], "--window") == 0) opt_ok = set_scan_window(value * KIBIBYTE);
+        else if(number && strcmp(argv[i], "--queue-depth") == 0) opt_ok = set_scan_queue_depth(value);
+        else if(number && strcmp(argv[i], "--pipeline") == 0) opt_ok = set_scan_pipeline(value);
+        else if(strcmp(argv[i], "--backend") == 0) opt_ok = backend_select(argv[i + 1]);
+        else if(strcmp(argv[i], "--kernels") == 0) opt_ok = kernels_select(argv[i + 1]);
+        else opt_ok = ERR_ARGS_MAIN;
+        if(opt_ok != ERR_OK)
+        {
+            show_help();
+            exit(255);
+        }
+    }
+
+    ULONG *planted = load_truth(argv[argc - 1], header, &n_planted);
+    if(planted == NULL)
+    {
+        fprintf(stderr, "Cannot read the truth file %s\n", argv[argc - 1]);
+        exit(255);
+    }
+    PID target = (PID) header_field(header, "pid=");
+    INT32 value = (INT32) header_field(header, "value=");
+    if(pid_exists(target) != ERR_OK)
+    {
+        fprintf(stderr, "Target %d of the truth file is not running\n", target);
+        exit(255);
+    }
+    if(max_patches == 0 || max_patches > n_planted) max_patches = n_planted;
+
+    /* Everything the scan reads */
+    MU_MEM_CHUNK *chunks = get_memory_chunks(target, MOD_CHUNKS, &n_chunks);
+    UINT64 scanned = 0;
+    for(INT i = 0; i < n_chunks; i++) scanned += chunks[i].chunk_size;
+    free(chunks);
+
+    MU_BENCH_PHASE scan = {"scan", {0}, 0, 0, 0, {0}, 0};
+    MU_BENCH_PHASE equal = {"filter_equal", {0}, 0, 0, 0, {0}, 0};
+    MU_BENCH_PHASE unchanged = {"filter_unchanged", {0}, 0, 0, 0, {0}, 0};
+    MU_BENCH_PHASE write = {"write", {0}, 0, 0, 0, {0}, 0};
+    MU_MATCH_SET *matches = NULL;
+    UINT64 n_matches = 0;
+    ULONG hits = 0;
+
+    for(INT r = 0; r < repeat; r++)
+    {
+        fprintf(stderr, "scan %d/%d\n", r + 1, repeat);
+        matchset_free(matches);
+        run_start(&start, &before);
+        matches = execute_scanner(target, (UCHAR *) &value, sizeof value, &n_matches);
+        run_end(&scan, &start, &before);
+        if(matches == NULL)
+        {
+            fprintf(stderr, "Scan failed\n");
+            exit(255);
+        }
+        scan.items = scanned;
+        scan.out = n_matches;
+    }
+    ULONG *found = matchset_to_addresses(matches);
+    hits = count_found(planted, n_planted, found, n_matches);
+    free(found);
+
+    /* Each pass filters the matches of the previous one. Nothing planted changes, so they all stay */
+    for(INT r = 0; r < repeat; r++)
+    {
+        fprintf(stderr, "filter %d/%d\n", r + 1, repeat);
+        equal.items = matches->n_matches;
+        run_start(&start, &before);
+        execute_filtering(target, matches, (UCHAR *) &value, sizeof value, &n_matches);
+        run_end(&equal, &start, &before);
+        equal.out = n_matches;
+
+        unchanged.items = matches->n_matches;
+        run_start(&start, &before);
+        execute_relational_filtering(target, matches, VAL_INT32, PRED_UNCHANGED, NULL, &n_matches);
+        run_end(&unchanged, &start, &before);
+        unchanged.out = n_matches;
+    }
+    matchset_free(matches);
+
+    MU_PATCH *patches = calloc(max_patches + 1, sizeof *patches);
+    for(INT r = 0; r < repeat && patches != NULL; r++)
+    {
+        fprintf(stderr, "write %d/%d\n", r + 1, repeat);
+        for(ULONG i = 0; i < max_patches; i++)
+        {
+            patches[i].address = planted[i];
+            patches[i].data = (UCHAR *) &value;
+            patches[i].data_size = sizeof value;
+        }
+        run_start(&start, &before);
+        write.out = write_patches(target, patches, max_patches, false);
+        run_end(&write, &start, &before);
+        write.items = max_patches;
+    }
+    free(patches);
+
+    /* RESULTS ----------------------------------------------------------------------- */
+
+    CHAR status_path[64];
+    snprintf(status_path, sizeof status_path, "/proc/%d/status", target);
+    uname(&host);
+    printf("{\n  \"suite\": \"mu_bench\", \"version\": %d, \"label\": \"%s\",\n", SUITE_VERSION, label);
+    printf("  \"host\": {\"kernel\": \"%s\", \"machine\": \"%s\", \"cores\": %d, \"backend\": \"%s\", \"kernels\": \"%s\"},\n",
+           host.release, host.machine, get_usable_cores(), backend_get()->name, kernels_get()->name);
+    printf("  \"target\": {\"pid\": %d, \"value\": %d, \"heap_bytes\": %ld, \"mappings\": %ld, \"density\": %ld, "
+           "\"mutate\": %ld, \"seed\": %ld, \"planted\": %lu, \"writable_bytes\": %lu, \"target_rss_kb\": %lu},\n",
+           target, value, header_field(header, "heap_bytes="), header_field(header, "mappings="),
+           header_field(header, "density="), header_field(header, "mutate="), header_field(header, "seed="),
+           n_planted, scanned, proc_field(status_path, "VmRSS:"));
+    printf("  \"recall\": {\"found\": %lu, \"missed\": %lu, \"extra\": %lu},\n", hits, n_planted - hits, scan.out - hits);
+    printf("  \"results\": [\n");
+    print_phase(&scan, "bytes", "gb_per_s", 1e9, false);
+    print_phase(&equal, "candidates", "candidates_per_s", 1, false);
+    print_phase(&unchanged, "candidates", "candidates_per_s", 1, false);
+    print_phase(&write, "patches", "patches_per_s", 1, true);
+    printf("  ]\n}\n");
+
+    free(planted);
+    backend_close();
+
+    return (hits == n_planted) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
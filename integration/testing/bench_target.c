@@ -0,0 +1,295 @@
+/**
+ * @file bench_target.c
+ * @author Mark Dervishaj
+ * @brief Synthetic target for bench_suite. Fills a heap of any size, spread over many mappings, with
+ * random data, plants a 32-bit value at a given density and writes where it went to a ground truth
+ * file. Optionally keeps rewriting random slots, never the planted ones, at a given rate
+ * @version 0.1
+ * @date 2022-10-25
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * The same options give the same contents on any host: each mapping is filled from its own seed, and
+ * the planted slots only depend on the seed and the sizes. Slots of the random data equal to the value
+ * are changed, so the truth file holds every aligned occurrence of the value in the heap.
+ * Usage: bench_target [options], then read the first line of its output (it is ready) and give the
+ * truth file to bench_suite. Runs until killed
+ */
+
+#include "../../src/inc/mu_types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define MEBIBYTE        (1UL << 20)
+#define PAGE_SZ         4096UL
+#define SLOTS_PER_MIB   (MEBIBYTE / sizeof(INT32))
+#define MUTATE_STEPS    100                 /* Batches of mutations per second */
+#define TRUTH_VERSION   1
+
+/* Options of the target */
+typedef struct bench_config
+{
+    ULONG       heap_mib;       /* Size of the heap, over all mappings */
+    ULONG       n_mappings;
+    ULONG       density;        /* Planted values per MiB */
+    ULONG       mutate;         /* Slots rewritten per second */
+    UINT64      seed;
+    INT32       value;
+    const CHAR  *truth;         /* Path of the ground truth file */
+
+} MU_BENCH_CONFIG;
+
+/* Mapping of the heap */
+typedef struct bench_mapping
+{
+    INT32       *base;
+    ULONG       n_slots;
+
+} MU_BENCH_MAPPING;
+
+static MU_BENCH_CONFIG config = {1024, 64, 64, 0, 1, 0x2545F491, "bench_truth.txt"};
+static MU_BENCH_MAPPING *mappings = NULL;
+static ULONG next_mapping = 0;          /* Next mapping to fill, taken by the fill threads */
+static ULONG *planted = NULL;           /* Addresses of the planted values, ascending */
+static ULONG n_planted = 0;
+
+/**
+ * @brief Advances a splitmix64 generator
+ *
+ * @param state State of the generator
+ * @return Next pseudo-random number
+ */
+static UINT64 splitmix(UINT64 *state)
+{
+    UINT64 z = (*state += 0x9E3779B97F4A7C15UL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Thread routine. Fills mappings with random data until none is left. The data of a mapping
+ * only depends on the seed and its position
+ *
+ * @param arg Unused
+ * @return NULL
+ */
+static void *fill_mappings(void *arg)
+{
+    (void) arg;
+    ULONG m;
+
+    while((m = __atomic_fetch_add(&next_mapping, 1, __ATOMIC_RELAXED)) < config.n_mappings)
+    {
+        UINT64 state = config.seed * 0x100000001B3UL + m;
+        UINT64 *words = (UINT64 *) mappings[m].base;
+        for(ULONG w = 0; w < mappings[m].n_slots / 2; w++) words[w] = splitmix(&state);
+
+        /* The value must only be where it is planted */
+        INT32 *slots = mappings[m].base;
+        for(ULONG s = 0; s < mappings[m].n_slots; s++)
+        {
+            if(slots[s] == config.value) slots[s] = config.value ^ 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Plants the value in each mapping, with gaps drawn from a geometric distribution so about
+ * density values land in each MiB. Records the addresses in ascending order
+ */
+static void plant_values()
+{
+    UINT64 state = config.seed ^ 0xD1B54A32D192ED03UL;
+    REAL64 p = (REAL64) config.density / SLOTS_PER_MIB;
+    ULONG cap = 0;
+
+    if(p <= 0) return;
+    for(ULONG m = 0; m < config.n_mappings; m++)
+    {
+        ULONG s = 0;
+        while(true)
+        {
+            REAL64 u = ((splitmix(&state) >> 11) + 1) / 9007199254740993.0;
+            if(p < 1) s += (ULONG) floor(log(u) / log1p(-p));
+            if(s >= mappings[m].n_slots) break;
+
+            if(n_planted == cap)
+            {
+                cap = (cap == 0) ? 4096 : cap * 2;
+                planted = realloc(planted, cap * sizeof *planted);
+                if(planted == NULL)
+                {
+                    fprintf(stderr, "Cannot reserve more dynamic memory!\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            mappings[m].base[s] = config.value;
+            planted[n_planted++] = (ULONG) &mappings[m].base[s];
+            s++;
+        }
+    }
+}
+
+/**
+ * @brief Writes the ground truth: a header line with the options, then the address of each
+ * planted value in hexadecimal, one per line and in ascending order
+ *
+ * @param heap_bytes Bytes of the heap, over all mappings
+ * @return True if the file was written
+ */
+static BOOL write_truth(ULONG heap_bytes)
+{
+    FILE *file = fopen(config.truth, "w");
+
+    if(file == NULL) return false;
+    setvbuf(file, NULL, _IOFBF, MEBIBYTE);
+    fprintf(file, "# mu_bench_truth version=%d pid=%d type=int32 value=%d planted=%lu heap_bytes=%lu mappings=%lu "
+            "density=%lu mutate=%lu seed=%lu\n", TRUTH_VERSION, getpid(), config.value, n_planted, heap_bytes,
+            config.n_mappings, config.density, config.mutate, config.seed);
+    for(ULONG i = 0; i < n_planted; i++) fprintf(file, "%#lx\n", planted[i]);
+
+    return fclose(file) == 0;
+}
+
+static INT cmp_address(const void *a, const void *b)
+{
+    ULONG x = *(const ULONG *) a;
+    ULONG y = *(const ULONG *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Rewrites random slots of the heap at the mutation rate, forever. Planted slots are kept, and
+ * the new data is never the value, so the truth file stays valid
+ */
+static void mutate_forever()
+{
+    UINT64 state = config.seed ^ 0x8CB92BA72F3D8DD7UL;
+    struct timespec next;
+    ULONG carry = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while(true)
+    {
+        next.tv_nsec += 1000000000L / MUTATE_STEPS;
+        if(next.tv_nsec >= 1000000000L)
+        {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        carry += config.mutate;
+        for(; carry >= MUTATE_STEPS; carry -= MUTATE_STEPS)
+        {
+            MU_BENCH_MAPPING *mapping = &mappings[splitmix(&state) % config.n_mappings];
+            INT32 *slot = &mapping->base[splitmix(&state) % mapping->n_slots];
+            ULONG address = (ULONG) slot;
+            if(bsearch(&address, planted, n_planted, sizeof *planted, &cmp_address) != NULL) continue;
+            INT32 data = (INT32) splitmix(&state);
+            *slot = (data == config.value) ? data ^ 1 : data;
+        }
+    }
+}
+
+/**
+ * @brief Prints a sensible usage message
+ *
+ */
+static void show_help()
+{
+    printf("Usage: bench_target [options]\n\n");
+    printf("Options:\n");
+    printf("  --heap <MiB>          Size of the heap, over all mappings (default 1024)\n");
+    printf("  --mappings <n>        Mappings the heap is split into, with a guard page between them (default 64)\n");
+    printf("  --density <n>         Planted values per MiB (default 64)\n");
+    printf("  --mutate <n>          Random slots rewritten per second, never the planted ones (default 0)\n");
+    printf("  --seed <n>            Seed of the contents (default 1)\n");
+    printf("  --value <int32>       Value planted (default %d)\n", config.value);
+    printf("  --truth <file>        Ground truth file (default bench_truth.txt)\n");
+}
+
+INT main(INT argc, CHAR **argv)
+{
+    for(INT i = 1; i < argc; i += 2)
+    {
+        CHAR *thrash = NULL;
+        if(i + 1 >= argc)
+        {
+            show_help();
+            exit(EXIT_FAILURE);
+        }
+        ULONG value = strtoul(argv[i + 1], &thrash, 0);
+        BOOL number = *thrash == '\0';
+        if(strcmp(argv[i], "--truth") == 0) config.truth = argv[i + 1];
+        else if(number && strcmp(argv[i], "--heap") == 0 && value > 0) config.heap_mib = value;
+        else if(number && strcmp(argv[i], "--mappings") == 0 && value > 0) config.n_mappings = value;
+        else if(number && strcmp(argv[i], "--density") == 0 && value <= SLOTS_PER_MIB) config.density = value;
+        else if(number && strcmp(argv[i], "--mutate") == 0) config.mutate = value;
+        else if(number && strcmp(argv[i], "--seed") == 0) config.seed = value;
+        else if(strcmp(argv[i], "--value") == 0)
+        {
+            config.value = (INT32) strtol(argv[i + 1], &thrash, 0);
+            if(*thrash != '\0')
+            {
+                show_help();
+                exit(EXIT_FAILURE);
+            }
+        }
+        else
+        {
+            show_help();
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* One reservation, cut into mappings by guard pages so each one is a region of its own */
+    ULONG map_size = (config.heap_mib * MEBIBYTE / config.n_mappings + PAGE_SZ - 1) / PAGE_SZ * PAGE_SZ;
+    ULONG stride = map_size + PAGE_SZ;
+    UCHAR *area = mmap(NULL, stride * config.n_mappings, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    mappings = calloc(config.n_mappings, sizeof *mappings);
+    if(area == MAP_FAILED || mappings == NULL)
+    {
+        fprintf(stderr, "Cannot reserve a heap of %lu MiB!\n", config.heap_mib);
+        exit(EXIT_FAILURE);
+    }
+    for(ULONG m = 0; m < config.n_mappings; m++)
+    {
+        mappings[m].base = (INT32 *) (area + m * stride);
+        mappings[m].n_slots = map_size / sizeof(INT32);
+        if(mprotect(mappings[m].base, map_size, PROT_READ | PROT_WRITE) != 0)
+        {
+            fprintf(stderr, "Cannot map %lu bytes!\n", map_size);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    INT64 n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n_threads < 1) n_threads = 1;
+    pthread_t *threads = malloc(n_threads * sizeof *threads);
+    for(INT64 t = 0; t < n_threads; t++) pthread_create(&threads[t], NULL, &fill_mappings, NULL);
+    for(INT64 t = 0; t < n_threads; t++) pthread_join(threads[t], NULL);
+    free(threads);
+    plant_values();
+
+    if(!write_truth(map_size * config.n_mappings))
+    {
+        fprintf(stderr, "Cannot write the ground truth to %s!\n", config.truth);
+        exit(EXIT_FAILURE);
+    }
+    printf("bench_target %d ready: %lu value<s> planted in %lu MiB over %lu mapping<s>, truth in %s\n",
+           getpid(), n_planted, map_size * config.n_mappings / MEBIBYTE, config.n_mappings, config.truth);
+    fflush(stdout);
+
+    if(config.mutate > 0) mutate_forever();
+    while(true) pause();
+
+    return EXIT_SUCCESS;
+}
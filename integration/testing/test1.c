@@ -9,15 +9,30 @@
  * 
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  /* _GNU_SOURCE */
+
 #include "../../src/inc/mu_types.h"
 #include "../../src/inc/mu_utils.h"
 #include "../../src/inc/mu_memchunk.h"
 #include "../../src/inc/mu_io.h"
 #include "../../src/inc/mu_scanner.h"
+#include "../../src/inc/mu_matchset.h"
+#include "../../src/inc/mu_signature.h"
+#include "../../src/inc/mu_pointer.h"
+#include "../../src/inc/mu_freeze.h"
+#include "../../src/inc/mu_session.h"
+#include "../../src/inc/mu_daemon.h"
+#include "../../src/inc/mu_metrics.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #define ALL_CHUNKS      0
 #define MOD_CHUNKS      1
@@ -100,8 +115,6 @@ MU_ERROR test_memchunks(PID target, INT option)
             printf("CHUNK %-2d | Start Addr: %-19ld, Size: %-7ld, R: %d, W: %d, P: %d, Name: %s (%ld)\n", i,
             chunk.addr_start, chunk.chunk_size, chunk.is_readable, chunk.is_writable,
             chunk.is_private, chunk.chunk_name, chunk.chnk_name_sz);
-
-            free(chunk.chunk_name);
         }
         free(chunks);
     }
@@ -128,11 +141,10 @@ MU_ERROR test_filter_chunks(PID target, INT option)
             printf("CHUNK %-2d | Start Addr: %-19ld, Size: %-7ld, R: %d, W: %d, P: %d, Name: %s (%ld)\n", i,
             chunk.addr_start, chunk.chunk_size, chunk.is_readable, chunk.is_writable,
             chunk.is_private, chunk.chunk_name, chunk.chnk_name_sz);
-
-            free(chunk.chunk_name);
         }
         free(filtered);
     }
+    free(chunks);
 
     return is_ok;
 }
@@ -162,15 +174,67 @@ MU_ERROR test_read_chunk_data(PID target)
                 if(j == 15) printf("...\n");
                 j++;
             }
-            free(chunk.chunk_name);
             free(r_buff);
         }
         free(filtered);
     }
+    free(chunks);
 
     return is_ok;  
 }
 
+MU_ERROR test_read_tolerant(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    const ULONG page = 4096;
+    const ULONG n_pages = 8;
+    /* Readable pages of each layout, as bits: a tail after a long hole, a single page between holes,
+       and a page between holes followed by a readable tail */
+    const UINT32 layouts[3] = {0xE0, 0x20, 0xF4};
+    (void) target;
+
+    /* Holes are made in this process, where nothing else maps into them during the test */
+    for(INT l = 0; l < 3 && is_ok == ERR_OK; l++)
+    {
+        UCHAR *area = mmap(NULL, n_pages * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        UCHAR *buffer = malloc(n_pages * page);
+        if(area == MAP_FAILED || buffer == NULL)
+        {
+            free(buffer);
+            return ERR_GENERIC;
+        }
+        memset(area, 0xA5, n_pages * page);
+        for(ULONG p = 0; p < n_pages; p++)
+        {
+            if(!((layouts[l] >> p) & 1)) munmap(area + p * page, page);
+        }
+
+        io_bad_ranges_reset(getpid());
+        ULONG n_read = read_memory_tolerant(getpid(), (ULONG) area, buffer, n_pages * page);
+        ULONG expected = 0;
+        for(ULONG p = 0; p < n_pages; p++)
+        {
+            BOOL readable = (layouts[l] >> p) & 1;
+            expected += (readable) ? page : 0;
+            for(ULONG b = 0; b < page; b++)
+            {
+                if(buffer[p * page + b] != ((readable) ? 0xA5 : 0)) is_ok = ERR_GENERIC;
+            }
+        }
+        if(n_read != expected) is_ok = ERR_GENERIC;
+        printf("Layout %#x: %lu of %lu readable bytes read\n", layouts[l], n_read, expected);
+
+        for(ULONG p = 0; p < n_pages; p++)
+        {
+            if((layouts[l] >> p) & 1) munmap(area + p * page, page);
+        }
+        free(buffer);
+    }
+    io_bad_ranges_reset(0);
+
+    return is_ok;
+}
+
 MU_ERROR test_modify_values(PID target)
 {
     MU_ERROR is_ok = ERR_OK;
@@ -204,17 +268,20 @@ MU_ERROR test_scanner_and_efficiency(PID target)
 
     printf("Finding matches of INT16 - 12500...\n");
 
-    INT n_matches = 0;
-    ULONG *matches;
+    UINT64 n_matches = 0;
+    MU_MATCH_SET *matches;
     clock_gettime(CLOCK_MONOTONIC, &start);
     matches = execute_scanner(target, bytes, size, &n_matches);
     clock_gettime(CLOCK_MONOTONIC, &end);
 
-    for(INT i = 0; i < n_matches; i++)
+    ULONG *addresses = matchset_to_addresses(matches);
+    for(UINT64 i = 0; i < n_matches; i++)
     {
-        printf("Match %i: %#lx\n", i+1, matches[i]);
+        printf("Match %lu: %#lx\n", i+1, addresses[i]);
     }
-    free(matches);
+    printf("Match storage: %lu bytes\n", matchset_footprint(matches));
+    free(addresses);
+    matchset_free(matches);
 
     elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / BILLION;
     printf("ELAPSED TIME: %f\n", elapsed_time);
@@ -232,30 +299,35 @@ MU_ERROR test_filtering(PID target)
 
     printf("Finding matches of INT32 - 1000...\n");
 
-    INT n_matches = 0;
-    ULONG *matches;
+    UINT64 n_matches = 0;
+    MU_MATCH_SET *matches;
+    ULONG *addresses;
 
     /* Scan and wait 5 seconds to change simulator values */
     matches = execute_scanner(target, bytes, size, &n_matches);
 
-    for(INT i = 0; i < n_matches; i++)
+    addresses = matchset_to_addresses(matches);
+    for(UINT64 i = 0; i < n_matches; i++)
     {
-        printf("Match %i: %#lx\n", i+1, matches[i]);
+        printf("Match %lu: %#lx\n", i+1, addresses[i]);
     }
+    free(addresses);
     sleep(5);
 
     printf("\nExecuting filtering with 999...\n\n");
     to_search = 999;
     memcpy(bytes, &to_search, size);
 
-    is_ok = execute_filtering(target, &matches, bytes, size, &n_matches);
+    is_ok = execute_filtering(target, matches, bytes, size, &n_matches);
 
-    for(INT i = 0; i < n_matches; i++)
+    addresses = matchset_to_addresses(matches);
+    for(UINT64 i = 0; i < n_matches; i++)
     {
-        printf("Match %i: %#lx\n", i+1, matches[i]);
+        printf("Match %lu: %#lx\n", i+1, addresses[i]);
     }
 
-    free(matches);
+    free(addresses);
+    matchset_free(matches);
 
     return is_ok;   
 }
@@ -270,27 +342,31 @@ MU_ERROR test_scan_filter_modidy(PID target)
 
     printf("Finding matches of INT32 - 1000...\n");
 
-    INT n_matches = 0;
-    ULONG *matches;
+    UINT64 n_matches = 0;
+    MU_MATCH_SET *matches;
+    ULONG *addresses;
 
     /* Scan and wait 5 seconds to change simulator values */
     matches = execute_scanner(target, bytes, size, &n_matches);
 
-    for(INT i = 0; i < n_matches; i++)
+    addresses = matchset_to_addresses(matches);
+    for(UINT64 i = 0; i < n_matches; i++)
     {
-        printf("Match %i: %#lx\n", i+1, matches[i]);
+        printf("Match %lu: %#lx\n", i+1, addresses[i]);
     }
+    free(addresses);
     sleep(5);
 
     printf("\nExecuting filtering with 999...\n\n");
     to_search = 998;
     memcpy(bytes, &to_search, size);
 
-    is_ok = execute_filtering(target, &matches, bytes, size, &n_matches);
+    is_ok = execute_filtering(target, matches, bytes, size, &n_matches);
 
-    for(INT i = 0; i < n_matches; i++)
+    addresses = matchset_to_addresses(matches);
+    for(UINT64 i = 0; i < n_matches; i++)
     {
-        printf("Match %i: %#lx\n", i+1, matches[i]);
+        printf("Match %lu: %#lx\n", i+1, addresses[i]);
     }
 
     /* Modify found value to 9999999 */
@@ -298,13 +374,582 @@ MU_ERROR test_scan_filter_modidy(PID target)
     memcpy(bytes, &new_val, size);
 
     printf("\nModify found value to 9999999...\n\n");
-    is_ok = modify_values(target, matches, n_matches, bytes, size);
+    is_ok = modify_values(target, addresses, n_matches, bytes, size);
 
-    free(matches);
+    free(addresses);
+    matchset_free(matches);
 
     return is_ok;   
 }
 
+MU_ERROR test_snapshot(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    UINT64 n_matches = 0;
+    MU_MATCH_SET *matches;
+    ULONG *addresses;
+
+    printf("Taking snapshot of INT32 values...\n");
+
+    /* Snapshot and wait 5 seconds to change simulator values */
+    MU_SNAPSHOT *snap = execute_snapshot(target, sizeof(INT32), VAL_INT32);
+    if(snap == NULL)
+    {
+        return ERR_GENERIC;
+    }
+    printf("Snapshot of %lu bytes taken\n", snap->total);
+    sleep(5);
+
+    printf("\nExecuting filtering of decreased values...\n\n");
+    matches = execute_snapshot_filter(snap, NULL, PRED_DECREASED, NULL, &n_matches);
+    printf("%lu decreased values\n", n_matches);
+    sleep(5);
+
+    printf("\nExecuting filtering of decreased values again...\n\n");
+    MU_MATCH_SET *narrowed = execute_snapshot_filter(snap, matches, PRED_DECREASED, NULL, &n_matches);
+    matchset_free(matches);
+    matches = narrowed;
+
+    addresses = matchset_to_addresses(matches);
+    for(UINT64 i = 0; i < n_matches; i++)
+    {
+        printf("Match %lu: %#lx\n", i+1, addresses[i]);
+    }
+
+    free(addresses);
+    matchset_free(matches);
+    snapshot_close(snap);
+
+    return is_ok;
+}
+
+MU_ERROR test_regions(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+
+    printf("Tracking regions of the target...\n");
+    MU_REGION_TABLE *regions = regions_open(target, MOD_CHUNKS);
+    if(regions == NULL)
+    {
+        return ERR_GENERIC;
+    }
+    printf("%d regions tracked\n", regions->n_chunks);
+    sleep(5);
+
+    is_ok = regions_refresh(regions);
+    for(INT i = 0; i < regions->n_deltas; i++)
+    {
+        MU_REGION_DELTA delta = regions->deltas[i];
+        printf("Delta %d: %#lx, %lu -> %lu bytes, changes %d\n", i, delta.addr_start, delta.old_size,
+               delta.new_size, delta.changes);
+    }
+    regions_close(regions);
+
+    return is_ok;
+}
+
+/**
+ * @brief Checks if ranges in address order cover all of [start, end)
+ */
+static BOOL ranges_cover(MU_MEM_CHUNK *ranges, INT n, ULONG start, ULONG end)
+{
+    for(INT i = 0; i < n && start < end; i++)
+    {
+        if(ranges[i].addr_start <= start && start < ranges[i].addr_start + ranges[i].chunk_size)
+        {
+            start = ranges[i].addr_start + ranges[i].chunk_size;
+        }
+    }
+
+    return start >= end;
+}
+
+/**
+ * @brief Checks if any of the ranges touches [start, end)
+ */
+static BOOL ranges_touch(MU_MEM_CHUNK *ranges, INT n, ULONG start, ULONG end)
+{
+    for(INT i = 0; i < n; i++)
+    {
+        if(ranges[i].addr_start < end && start < ranges[i].addr_start + ranges[i].chunk_size) return true;
+    }
+
+    return false;
+}
+
+MU_ERROR test_region_changes(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    const ULONG page = 4096;
+    const INT rw = PROT_READ | PROT_WRITE;
+    CHAR path[] = "/tmp/mu_regions_XXXXXX";
+    INT n_ranges = 0;
+    (void) target;
+
+    /* Regions are changed in this process: a region grown in place, a new one, and a file mapping
+       replaced by anonymous memory at the same address. They are placed between inaccessible pages
+       of a reserved area, so the kernel does not merge them with their neighbours */
+    INT fd = mkstemp(path);
+    if(fd < 0) return ERR_GENERIC;
+    unlink(path);
+    UCHAR *area = mmap(NULL, 16 * page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(area == MAP_FAILED || ftruncate(fd, 2 * page) != 0)
+    {
+        close(fd);
+        return ERR_GENERIC;
+    }
+    UCHAR *grown = area + page;
+    UCHAR *file = area + 6 * page;
+    UCHAR *added = area + 9 * page;
+    if(mmap(grown, 2 * page, rw, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != grown) is_ok = ERR_GENERIC;
+    if(mmap(file, 2 * page, rw, MAP_PRIVATE | MAP_FIXED, fd, 0) != file) is_ok = ERR_GENERIC;
+    close(fd);
+
+    MU_REGION_TABLE *regions = (is_ok == ERR_OK) ? regions_open(getpid(), MOD_CHUNKS) : NULL;
+    if(regions == NULL)
+    {
+        munmap(area, 16 * page);
+        return ERR_GENERIC;
+    }
+
+    munmap(grown + 2 * page, 2 * page);
+    if(mremap(grown, 2 * page, 4 * page, 0) != grown) is_ok = ERR_GENERIC;
+    if(mmap(added, 3 * page, rw, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != added) is_ok = ERR_GENERIC;
+    if(mmap(file, 2 * page, rw, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != file) is_ok = ERR_GENERIC;
+    if(is_ok == ERR_OK) is_ok = regions_refresh(regions);
+
+    if(is_ok == ERR_OK)
+    {
+        MU_MEM_CHUNK *ranges = regions_new_ranges(regions, &n_ranges);
+        BOOL file_removed = false;
+        for(INT i = 0; i < regions->n_deltas; i++)
+        {
+            if(regions->deltas[i].addr_start == (ULONG) file && (regions->deltas[i].changes & REGION_REMOVED)) file_removed = true;
+        }
+        printf("%d delta<s>, %d new range<s>\n", regions->n_deltas, n_ranges);
+
+        /* Only the tail of the grown region is new */
+        if(!ranges_cover(ranges, n_ranges, (ULONG) grown + 2 * page, (ULONG) grown + 4 * page)) is_ok = ERR_GENERIC;
+        if(ranges_touch(ranges, n_ranges, (ULONG) grown, (ULONG) grown + 2 * page)) is_ok = ERR_GENERIC;
+        if(!ranges_cover(ranges, n_ranges, (ULONG) added, (ULONG) added + 3 * page)) is_ok = ERR_GENERIC;
+        if(!file_removed || !ranges_cover(ranges, n_ranges, (ULONG) file, (ULONG) file + 2 * page)) is_ok = ERR_GENERIC;
+        free(ranges);
+    }
+
+    regions_close(regions);
+    munmap(area, 16 * page);
+
+    return is_ok;
+}
+
+MU_ERROR test_residency(PID target)
+{
+    INT size = 0;
+    INT n_runs = 0;
+    ULONG mapped = 0;
+    ULONG resident = 0;
+
+    MU_MEM_CHUNK *chunks = get_memory_chunks(target, MOD_CHUNKS, &size);
+    MU_MEM_CHUNK *runs = residency_filter(target, chunks, size, RESIDENCY_PRESENT, &n_runs);
+    if(runs == NULL)
+    {
+        free(chunks);
+        return ERR_GENERIC;
+    }
+    for(INT i = 0; i < size; i++) mapped += chunks[i].chunk_size;
+    for(INT i = 0; i < n_runs; i++) resident += runs[i].chunk_size;
+    printf("%d chunks (%lu bytes) -> %d resident runs (%lu bytes)\n", size, mapped, n_runs, resident);
+    free(runs);
+    free(chunks);
+
+    return ERR_OK;
+}
+
+MU_ERROR test_dirty_pages(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    INT size = 0;
+
+    MU_DIRTY_MAP *dirty = dirty_open(target, false);
+    if(dirty == NULL)
+    {
+        printf("Soft-dirty bits not available: passes read every page\n");
+        return is_ok;
+    }
+    sleep(5);
+    MU_MEM_CHUNK *chunks = get_memory_chunks(target, MOD_CHUNKS, &size);
+    is_ok = dirty_refresh(dirty, chunks, size);
+    printf("%lu of %lu page<s> written in 5 seconds\n", dirty->n_dirty, dirty->n_pages);
+    free(chunks);
+    dirty_close(dirty);
+
+    return is_ok;
+}
+
+MU_ERROR test_queue_depth(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    INT16 to_search = 12500;
+    UINT64 n_sync = 0;
+    UINT64 n_async = 0;
+
+    if(!uring_supported())
+    {
+        printf("io_uring not available, skipping\n");
+        return ERR_OK;
+    }
+
+    /* Same matches, in the same order, reading synchronously and through the ring */
+    MU_MATCH_SET *sync = execute_scanner(target, (UCHAR *) &to_search, sizeof to_search, &n_sync);
+    set_scan_queue_depth(16);
+    MU_MATCH_SET *async = execute_scanner(target, (UCHAR *) &to_search, sizeof to_search, &n_async);
+    set_scan_queue_depth(0);
+    if(sync == NULL || async == NULL) is_ok = ERR_GENERIC;
+    else if(n_sync != n_async) is_ok = ERR_GENERIC;
+    else
+    {
+        ULONG *a = matchset_to_addresses(sync);
+        ULONG *b = matchset_to_addresses(async);
+        if(n_sync > 0 && memcmp(a, b, n_sync * sizeof *a) != 0) is_ok = ERR_GENERIC;
+        free(a);
+        free(b);
+    }
+    printf("%lu matches synchronously, %lu with io_uring\n", n_sync, n_async);
+    matchset_free(sync);
+    matchset_free(async);
+
+    return is_ok;
+}
+
+MU_ERROR test_pipeline(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    INT16 to_search = 12500;
+    UINT64 n_plain = 0;
+    UINT64 n_piped = 0;
+    MU_PIPELINE_STATS stats;
+
+    /* Same matches, in the same order, with and without the reader threads */
+    MU_MATCH_SET *plain = execute_scanner(target, (UCHAR *) &to_search, sizeof to_search, &n_plain);
+    set_scan_pipeline(4);
+    MU_MATCH_SET *piped = execute_scanner(target, (UCHAR *) &to_search, sizeof to_search, &n_piped);
+    set_scan_pipeline(0);
+    if(plain == NULL || piped == NULL) is_ok = ERR_GENERIC;
+    else if(n_plain != n_piped) is_ok = ERR_GENERIC;
+    else
+    {
+        ULONG *a = matchset_to_addresses(plain);
+        ULONG *b = matchset_to_addresses(piped);
+        if(n_plain > 0 && memcmp(a, b, n_plain * sizeof *a) != 0) is_ok = ERR_GENERIC;
+        free(a);
+        free(b);
+    }
+    get_scan_pipeline_stats(&stats);
+    printf("%lu matches, %lu pipelined. Copy %lu us, search %lu us, wall %lu us\n", n_plain, n_piped,
+           stats.read_ns / 1000, stats.scan_ns / 1000, stats.wall_ns / 1000);
+    matchset_free(plain);
+    matchset_free(piped);
+
+    return is_ok;
+}
+
+MU_ERROR test_value_set(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    INT32 to_search[3] = {12500, 77777, 999999};
+    UINT64 n_single = 0;
+    UINT64 n_set = 0;
+
+    /* One pass over the set finds what one pass per value finds */
+    for(INT i = 0; i < 3; i++)
+    {
+        UINT64 n = 0;
+        MU_MATCH_SET *one = execute_scanner(target, (UCHAR *) &to_search[i], sizeof(INT32), &n);
+        n_single += n;
+        matchset_free(one);
+    }
+    MU_VALUE_SET *values = valueset_create((UCHAR *) to_search, 3, sizeof(INT32));
+    MU_MATCH_SET *matches = execute_scanner_set(target, values, &n_set);
+    if(matches == NULL || n_set != n_single) is_ok = ERR_GENERIC;
+    else
+    {
+        /* Each match knows which value it holds */
+        for(ULONG rid = 0; rid < matches->n_regions; rid++)
+        {
+            for(UINT64 i = 0; i < matches->regions[rid].n_matches; i++)
+            {
+                UCHAR value[sizeof(INT32)];
+                matchset_get_values(matches, rid, i, 1, value);
+                if(valueset_index(values, value) == VALUESET_NOT_FOUND) is_ok = ERR_GENERIC;
+            }
+        }
+    }
+    printf("%lu matches one value at a time, %lu with the set\n", n_single, n_set);
+    matchset_free(matches);
+    valueset_free(values);
+
+    return is_ok;
+}
+
+MU_ERROR test_signatures(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    const CHAR *texts[3] = {"48 8B 05 ?? ?? ?? ?? 89 ?? 24", "55 48 89 E5", "4? 8B&FF 0100x1xx ?? C3"};
+    MU_SIGNATURE sigs[3];
+    MU_SIGNATURE wrong;
+
+    if(signature_parse("48 8G", &wrong) != ERR_FUNC_OPT) is_ok = ERR_GENERIC;
+    for(INT i = 0; i < 3; i++)
+    {
+        if(signature_parse(texts[i], &sigs[i]) != ERR_OK) return ERR_GENERIC;
+    }
+    if(sigs[0].length != 10 || sigs[2].mask[0] != 0xF0 || sigs[2].mask[2] != 0xF4) is_ok = ERR_GENERIC;
+
+    /* Code regions are scanned too, all signatures in the same pass */
+    if(signature_scan(target, sigs, 3, SIG_ALL_CHUNKS, 0) != ERR_OK) is_ok = ERR_GENERIC;
+    for(INT i = 0; i < 3; i++)
+    {
+        printf("'%s': %lu match<es>\n", texts[i], sigs[i].n_matches);
+        signature_free(&sigs[i]);
+    }
+
+    return is_ok;
+}
+
+MU_ERROR test_pointers(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    const CHAR *path = "/tmp/test1_ptrmap.bin";
+    ULONG n_paths = 0;
+    ULONG address = 0;
+
+    MU_POINTER_MAP *built = ptrmap_build(target);
+    if(built == NULL) return ERR_GENERIC;
+    if(ptrmap_save(built, path) != ERR_OK) is_ok = ERR_GENERIC;
+    MU_POINTER_MAP *map = ptrmap_load(path);
+    if(map == NULL || map->n_entries != built->n_entries || map->n_statics != built->n_statics)
+    {
+        ptrmap_free(built);
+        ptrmap_free(map);
+        return ERR_GENERIC;
+    }
+    printf("%lu pointer(s), %lu module region(s)\n", map->n_entries, map->n_statics);
+
+    /* Any pointer stored in a module gives a path of depth 1 to its value */
+    for(UINT64 k = 0; k < map->n_entries; k++)
+    {
+        MU_POINTER_ENTRY entry = map->entries[k];
+        BOOL in_module = false;
+        for(UINT64 r = 0; r < map->n_statics && !in_module; r++)
+        {
+            in_module = entry.location >= map->statics[r].start && entry.location < map->statics[r].end;
+        }
+        if(!in_module) continue;
+
+        MU_POINTER_PATH *paths = ptrmap_find_paths(map, entry.value, 2, 64, 16, &n_paths);
+        if(n_paths == 0) is_ok = ERR_GENERIC;
+        for(ULONG p = 0; p < n_paths; p++)
+        {
+            CHAR text[512];
+            ptrmap_path_string(map, &paths[p], text, sizeof text);
+            if(ptrmap_resolve(target, map, &paths[p], &address) != ERR_OK) address = 0;
+            printf("%s = %#lx\n", text, address);
+        }
+        free(paths);
+        break;
+    }
+    ptrmap_free(built);
+    ptrmap_free(map);
+    unlink(path);
+
+    return is_ok;
+}
+
+MU_ERROR test_freeze(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    MU_FREEZE_STATS stats;
+    UINT64 values[64];
+    UINT64 ids[64];
+    INT size = 0;
+    ULONG n_entries = 0;
+
+    /* Freeze what is already there, so the target is not disturbed */
+    MU_MEM_CHUNK *chunks = get_memory_chunks(target, MOD_CHUNKS, &size);
+    if(chunks == NULL || size == 0) return ERR_GENERIC;
+    ULONG address = chunks[0].addr_start;
+    free(chunks);
+    if(read_memory_range(target, address, (UCHAR *) values, sizeof values) != sizeof values) return ERR_GENERIC;
+
+    MU_FREEZER *freezer = freeze_start(target, 1000);
+    if(freezer == NULL) return ERR_GENERIC;
+    for(INT i = 0; i < 64; i++)
+    {
+        if(freeze_add(freezer, address + i * sizeof(UINT64), (UCHAR *) &values[i], sizeof(UINT64), 1000, &ids[i]) != ERR_OK) is_ok = ERR_GENERIC;
+    }
+    usleep(50000);
+    for(INT i = 0; i < 32; i++)
+    {
+        if(freeze_remove(freezer, ids[i]) != ERR_OK) is_ok = ERR_GENERIC;
+    }
+    MU_FREEZE_ENTRY *list = freeze_list(freezer, &n_entries);
+    if(n_entries != 32 || list == NULL || list[0].id != ids[32] || memcmp(list[0].data, &values[32], sizeof(UINT64)) != 0) is_ok = ERR_GENERIC;
+    free(list);
+    freeze_stats(freezer, &stats);
+    freeze_stop(freezer);
+
+    /* The values are adjacent: one write per tick */
+    printf("%lu tick<s>, %lu write<s>, %lu value<s> written, %lu failed, %lu late\n", stats.ticks, stats.syscalls, stats.writes, stats.failures, stats.missed);
+    if(stats.ticks == 0 || stats.syscalls != stats.ticks || stats.failures != 0) is_ok = ERR_GENERIC;
+
+    return is_ok;
+}
+
+MU_ERROR test_session(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    const CHAR *path = "/tmp/test1_session.bin";
+    MU_SESSION session;
+    INT32 value = 0;
+    UINT64 n_matches = 0;
+    UINT64 n_filtered = 0;
+
+    memset(&session, 0, sizeof session);
+    session.target = target;
+    session.type = VAL_INT32;
+    session.chunks = get_memory_chunks(target, MOD_CHUNKS, &session.n_chunks);
+    session.matches = execute_scanner(target, (UCHAR *) &value, sizeof value, &n_matches);
+    if(session.matches == NULL || session_save(&session, path) != ERR_OK)
+    {
+        matchset_free(session.matches);
+        free(session.chunks);
+        return ERR_GENERIC;
+    }
+
+    /* The resumed set has the same matches, and filters like the original */
+    MU_SESSION *resumed = session_load(path);
+    if(resumed == NULL || resumed->matches == NULL || resumed->matches->n_matches != n_matches || resumed->n_chunks != session.n_chunks)
+    {
+        is_ok = ERR_GENERIC;
+    }
+    else
+    {
+        ULONG *saved = matchset_to_addresses(session.matches);
+        ULONG *loaded = matchset_to_addresses(resumed->matches);
+        if(memcmp(saved, loaded, n_matches * sizeof *saved) != 0) is_ok = ERR_GENERIC;
+        free(saved);
+        free(loaded);
+        if(execute_filtering(target, resumed->matches, (UCHAR *) &value, sizeof value, &n_filtered) != ERR_OK) is_ok = ERR_GENERIC;
+        printf("%lu match<es> saved, %lu after filtering the resumed session\n", n_matches, n_filtered);
+    }
+    session_close(resumed);
+    matchset_free(session.matches);
+    free(session.chunks);
+    unlink(path);
+
+    return is_ok;
+}
+
+static void *serve_daemon(void *arg)
+{
+    daemon_run((MU_DAEMON *) arg);
+    return NULL;
+}
+
+MU_ERROR test_daemon(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    struct sockaddr_un addr;
+    pthread_t tid;
+    CHAR responses[65536];
+    ULONG len = 0;
+    ssize_t got = 0;
+    const CHAR *path = "/tmp/test1_daemon.sock";
+
+    /* Sent at once: the responses come back in order, one line each */
+    const CHAR *requests =
+        "{\"id\":1,\"cmd\":\"ping\"}\n"
+        "{\"id\":2,\"cmd\":\"scan\",\"type\":\"int32\",\"value\":\"0\"}\n"
+        "{\"id\":3,\"cmd\":\"filter\",\"pred\":\"unchanged\"}\n"
+        "{\"id\":4,\"cmd\":\"matches\",\"max\":4}\n"
+        "{\"id\":\"five\",\"cmd\":\"targets\"}\n"
+        "{\"id\":6,\"cmd\":\"scan\",\"type\":\"int32\",\"value\":\"x\"}\n"
+        "{\"id\":7,\"cmd\":\"shutdown\"}\n";
+
+    MU_DAEMON *daemon = daemon_open(path);
+    if(daemon == NULL) return ERR_GENERIC;
+    if(daemon_attach(daemon, target) != ERR_OK || pthread_create(&tid, NULL, &serve_daemon, daemon) != 0)
+    {
+        daemon_close(daemon);
+        return ERR_GENERIC;
+    }
+
+    INT fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if(fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof addr) != 0 || write(fd, requests, strlen(requests)) != (ssize_t) strlen(requests))
+    {
+        is_ok = ERR_GENERIC;
+    }
+    /* Shut down after the last response, so the daemon closes the connection */
+    while(is_ok == ERR_OK && (got = read(fd, responses + len, sizeof responses - 1 - len)) > 0)
+    {
+        len += got;
+        responses[len] = '\0';
+        if(strstr(responses, "\"id\":7,") != NULL) break;
+    }
+    responses[len] = '\0';
+    pthread_join(tid, NULL);
+    daemon_close(daemon);
+    if(fd >= 0) close(fd);
+    printf("%s", responses);
+
+    ULONG n_ok = 0;
+    ULONG n_lines = 0;
+    for(CHAR *p = responses; (p = strstr(p, "\"ok\":true")) != NULL; p++) n_ok++;
+    for(CHAR *p = responses; (p = strchr(p, '\n')) != NULL; p++) n_lines++;
+    if(n_lines != 7 || n_ok != 6 || strstr(responses, "{\"id\":6,\"ok\":false") == NULL) is_ok = ERR_GENERIC;
+    if(strstr(responses, "{\"id\":\"five\",\"ok\":true,\"targets\"") == NULL) is_ok = ERR_GENERIC;
+
+    return is_ok;
+}
+
+MU_ERROR test_metrics(PID target)
+{
+    MU_ERROR is_ok = ERR_OK;
+    INT32 value = 0;
+    UINT64 n_matches = 0;
+    UINT64 n_filtered = 0;
+    MU_METRICS scan;
+    MU_METRICS filter;
+    CHAR text[METRICS_MAX_TEXT];
+
+    /* Each operation keeps what it counted, over all the threads that worked for it */
+    MU_MATCH_SET *matches = execute_scanner(target, (UCHAR *) &value, sizeof value, &n_matches);
+    const CHAR *name = metrics_last(&scan);
+    if(matches == NULL || name == NULL || strcmp(name, "scan") != 0) is_ok = ERR_GENERIC;
+    else if(scan.counters[MET_BYTES_READ] == 0 || scan.counters[MET_READ_CALLS] == 0 || scan.counters[MET_REGIONS_SCANNED] == 0)
+    {
+        is_ok = ERR_GENERIC;
+    }
+    if(matches != NULL && execute_filtering(target, matches, (UCHAR *) &value, sizeof value, &n_filtered) != ERR_OK) is_ok = ERR_GENERIC;
+    name = metrics_last(&filter);
+    if(name == NULL || strcmp(name, "filter") != 0 || filter.counters[MET_FILTER_IN] != n_matches || filter.counters[MET_FILTER_OUT] != n_filtered)
+    {
+        is_ok = ERR_GENERIC;
+    }
+
+    metrics_format(&scan, "scan", METRICS_TEXT, text, sizeof text);
+    printf("%s\n", text);
+    metrics_format(&filter, "filter", METRICS_JSON, text, sizeof text);
+    printf("%s\n", text);
+    if(strncmp(text, "{\"operation\":\"filter\",", 22) != 0 || text[strlen(text) - 1] != '}') is_ok = ERR_GENERIC;
+    matchset_free(matches);
+
+    return is_ok;
+}
+
 INT main(INT argc, CHAR **argv)
 {
     if(argc < 2)
@@ -328,12 +973,27 @@ INT main(INT argc, CHAR **argv)
     printf("****************************************************************"
             "****************************************************************\n\n");
     printf("RUN TEST READ_CHUNK_DATA:\t%d\n\n", test_read_chunk_data(target));
+    printf("RUN TEST READ_TOLERANT:\t%d\n\n", test_read_tolerant(target));
     printf("RUN TEST MODIFY_VALUES:\t%d\n\n", test_modify_values(target));
     printf("****************************************************************"
             "****************************************************************\n\n");
     printf("RUN TEST EXECUTE_SCAN_AND_EFFICIENCY:\t%d\n\n", test_scanner_and_efficiency(target));
     printf("RUN TEST EXECUTE_FILTERING:\t%d\n\n", test_filtering(target));
     printf("RUN TEST EXECUTE_SCAN_FILTER_MODIFY:\t%d\n\n", test_scan_filter_modidy(target));
+    printf("RUN TEST EXECUTE_SNAPSHOT:\t%d\n\n", test_snapshot(target));
+    printf("RUN TEST REGIONS_REFRESH:\t%d\n\n", test_regions(target));
+    printf("RUN TEST REGIONS_NEW:\t%d\n\n", test_region_changes(target));
+    printf("RUN TEST RESIDENCY:\t%d\n\n", test_residency(target));
+    printf("RUN TEST DIRTY_PAGES:\t%d\n\n", test_dirty_pages(target));
+    printf("RUN TEST QUEUE_DEPTH:\t%d\n\n", test_queue_depth(target));
+    printf("RUN TEST PIPELINE:\t%d\n\n", test_pipeline(target));
+    printf("RUN TEST VALUE_SET:\t%d\n\n", test_value_set(target));
+    printf("RUN TEST SIGNATURES:\t%d\n\n", test_signatures(target));
+    printf("RUN TEST POINTERS:\t%d\n\n", test_pointers(target));
+    printf("RUN TEST FREEZE:\t%d\n\n", test_freeze(target));
+    printf("RUN TEST SESSION:\t%d\n\n", test_session(target));
+    printf("RUN TEST DAEMON:\t%d\n\n", test_daemon(target));
+    printf("RUN TEST METRICS:\t%d\n\n", test_metrics(target));
     printf("****************************************************************"
             "****************************************************************\n\n");
     printf("N_CORES_ONLN: %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
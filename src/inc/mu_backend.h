@@ -0,0 +1,72 @@
+/**
+ * @file mu_backend.h
+ * @author Mark Dervishaj
+ * @brief Backends to access the memory of the target: process_vm_readv/writev or /proc/PID/mem
+ * @version 0.1
+ * @date 2022-10-15
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_BACKEND_H
+#define _MU_BACKEND_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  /* _GNU_SOURCE */
+
+#include "mu_types.h"
+#include <sys/uio.h>
+
+#define BACKEND_CAP_VECTORED    1       /* Scattered ranges move in one syscall */
+#define BACKEND_CAP_WRITE_RO    2       /* Can write into read-only pages, as a debugger does */
+
+/* Reads one range of the target. Returns the bytes read, which may be fewer than size, or -1 */
+typedef INT64 (*MU_READ_RANGE)(PID target, ULONG address, UCHAR *buffer, ULONG size);
+
+/* Transfers iovecs with the semantics of process_vm_readv/writev: stops at the first short
+   remote iovec and returns the bytes transferred, or -1 if nothing could be transferred */
+typedef INT64 (*MU_TRANSFER_VECTOR)(PID target, struct iovec *local, struct iovec *remote, INT n_iov);
+
+/* One way to access the memory of the target */
+typedef struct mem_backend
+{
+    const CHAR          *name;
+    UINT32              caps;           /* BACKEND_CAP_* flags */
+    MU_READ_RANGE       read_range;
+    MU_TRANSFER_VECTOR  read_vector;
+    MU_TRANSFER_VECTOR  write_vector;
+
+} MU_BACKEND;
+
+/**
+ * @brief Gets the backend in use. Unless one was selected, process_vm is used if this kernel
+ * and its seccomp policy allow it, /proc/PID/mem otherwise. The choice is made once
+ *
+ * @return Backend in use
+ */
+extern const MU_BACKEND* backend_get();
+
+/**
+ * @brief Selects the backend used by the scanner, the filters and the writer from now on
+ *
+ * @param name "process_vm", "procmem" or "auto"
+ * @return ERR_FUNC_OPT if the name is unknown
+ */
+extern MU_ERROR backend_select(const CHAR *name);
+
+/**
+ * @brief Finds a backend by name without selecting it. Useful to compare them
+ *
+ * @param name "process_vm" or "procmem"
+ * @return Backend, or NULL if the name is unknown
+ */
+extern const MU_BACKEND* backend_find(const CHAR *name);
+
+/**
+ * @brief Closes the /proc/PID/mem descriptor kept open by the procmem backend, if any
+ */
+extern void backend_close();
+
+#endif  /* _MU_BACKEND_H */
@@ -0,0 +1,78 @@
+/**
+ * @file mu_daemon.h
+ * @author Mark Dervishaj
+ * @brief Long-lived scanner serving scan, filter, write and freeze requests on a Unix socket
+ * @version 0.1
+ * @date 2022-10-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * Each request is one line holding a flat JSON object, and gets one line back, in order. A client can
+ * send many requests without waiting for their responses. "id" is echoed when given, "pid" can be left
+ * out while a single target is attached. Values are given as strings, in the type of the scan:
+ *
+ *   {"id":1,"cmd":"attach","pid":1234}
+ *   {"id":2,"cmd":"scan","type":"int32","value":"100"}                  types: uint8, int16, int32,
+ *   {"id":3,"cmd":"filter","value":"95"}                                int64, float, double, string
+ *   {"id":4,"cmd":"filter","pred":"decreased_by","delta":"5"}           preds: changed, unchanged,
+ *   {"id":5,"cmd":"matches","max":10}                                   increased, decreased,
+ *   {"id":6,"cmd":"write","value":"999","address":"0x7f..."}            increased_by, decreased_by
+ *   {"id":7,"cmd":"freeze","value":"999","interval_ms":10}
+ *   {"id":8,"cmd":"unfreeze","freeze_id":3}
+ *
+ * Other commands: detach, targets, freezes, save and load (with "path", see mu_session.h), metrics
+ * (of the last request and since the start, see mu_metrics.h), ping and shutdown. Responses carry
+ * "ok":true and the results, or "ok":false and an "error" message
+ */
+
+#ifndef _MU_DAEMON_H
+#define _MU_DAEMON_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  /* _GNU_SOURCE */
+
+#include "mu_types.h"
+
+#define DAEMON_MAX_LINE     65536       /* Longest request accepted */
+#define DAEMON_MAX_PENDING  (1UL << 20) /* Responses held for a client before its requests stop being read */
+#define DAEMON_MAX_LISTED   100000      /* Addresses returned by matches, and values added by freeze */
+
+/**
+ * @brief Opens a daemon listening on a Unix socket. A stale socket file left at the path is replaced.
+ * Scans run on a resident pool (see set_scan_resident_pool) until the daemon is closed.
+ * REMEMBER TO CLOSE returned daemon with daemon_close
+ *
+ * @param path Path of the socket
+ * @return Daemon. NULL if the socket cannot be created
+ */
+extern MU_DAEMON* daemon_open(const CHAR *path);
+
+/**
+ * @brief Attaches a process, so requests can name it. Its region table is read now and refreshed
+ * before each filter
+ *
+ * @param daemon Daemon
+ * @param pid PID of the process
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR daemon_attach(MU_DAEMON *daemon, PID pid);
+
+/**
+ * @brief Serves clients until one of them sends shutdown. Requests run one at a time, in the order
+ * they are read, since scans already use every core
+ *
+ * @param daemon Daemon
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR daemon_run(MU_DAEMON *daemon);
+
+/**
+ * @brief Closes the clients and the socket, detaches every target (stopping their freezers) and
+ * stops the resident pool
+ *
+ * @param daemon Daemon to close
+ */
+extern void daemon_close(MU_DAEMON *daemon);
+
+#endif  /* _MU_DAEMON_H */
@@ -0,0 +1,82 @@
+/**
+ * @file mu_freeze.h
+ * @author Mark Dervishaj
+ * @brief Background freezer: keeps values written in the target with batched periodic writes
+ * @version 0.1
+ * @date 2022-10-22
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_FREEZE_H
+#define _MU_FREEZE_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  /* _GNU_SOURCE */
+
+#include "mu_types.h"
+
+#define FREEZE_DEFAULT_TICK_US  1000    /* 1 kHz */
+
+/**
+ * @brief Starts a freezer on its own thread. The thread sleeps while no value is frozen.
+ * REMEMBER TO CALL freeze_stop
+ *
+ * @param target PID of the target process
+ * @param tick_us Period of the timer wheel in microseconds. Intervals are rounded up to whole ticks
+ * @return Freezer. NULL if the thread cannot be started
+ */
+extern MU_FREEZER* freeze_start(PID target, ULONG tick_us);
+
+/**
+ * @brief Stops the thread of a freezer and frees it. Values are left as last written
+ *
+ * @param freezer Freezer to stop
+ */
+extern void freeze_stop(MU_FREEZER *freezer);
+
+/**
+ * @brief Freezes a value: it is written on the next tick, then every interval. All the values due
+ * in a tick are sorted by address, adjacent ones are merged, and they go out in one vectored write
+ * with the memory backend (a write per IOV_MAX separate ranges)
+ *
+ * @param freezer Freezer
+ * @param address Address of the value in the target
+ * @param data Bytes to keep there. Copied
+ * @param data_size Size in bytes of the value
+ * @param interval_us Time between writes in microseconds
+ * @param id Stores the id of the entry, to remove it. Can be NULL
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR freeze_add(MU_FREEZER *freezer, ULONG address, const UCHAR *data, ULONG data_size, ULONG interval_us, UINT64 *id);
+
+/**
+ * @brief Stops freezing a value
+ *
+ * @param freezer Freezer
+ * @param id Id given by freeze_add
+ * @return Error code indicating this operation status. ERR_FUNC_OPT if no entry has the id
+ */
+extern MU_ERROR freeze_remove(MU_FREEZER *freezer, UINT64 id);
+
+/**
+ * @brief Gets a copy of the frozen values, in the order they were added. The data of each entry
+ * points into the same block. REMEMBER TO FREE returned list (a single block)
+ *
+ * @param freezer Freezer
+ * @param n_entries Stores the number of entries
+ * @return Entries. NULL if there are none
+ */
+extern MU_FREEZE_ENTRY* freeze_list(MU_FREEZER *freezer, ULONG *n_entries);
+
+/**
+ * @brief Gets the counters of a freezer, including the values written after their deadline
+ *
+ * @param freezer Freezer
+ * @param stats Stores the counters
+ */
+extern void freeze_stats(MU_FREEZER *freezer, MU_FREEZE_STATS *stats);
+
+#endif  /* _MU_FREEZE_H */
@@ -0,0 +1,59 @@
+/**
+ * @file mu_index.h
+ * @author Mark Dervishaj
+ * @brief Fast lookup of the chunk that contains an address
+ * @version 0.1
+ * @date 2022-10-06
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_INDEX_H
+#define _MU_INDEX_H
+
+#include "mu_types.h"
+
+#define INDEX_NOT_FOUND     -1
+
+/**
+ * @brief Builds an index over a list of chunks. The chunks are not referenced afterwards.
+ * REMEMBER TO FREE returned index with index_free
+ *
+ * @param chunks Chunks in address order, not overlapping (as returned by get_memory_chunks)
+ * @param n_chunks Number of chunks
+ * @return Index of the chunks
+ */
+extern MU_REGION_INDEX* index_build(MU_MEM_CHUNK *chunks, INT n_chunks);
+
+/**
+ * @brief Frees an index
+ *
+ * @param index Index to free
+ */
+extern void index_free(MU_REGION_INDEX *index);
+
+/**
+ * @brief Gets the chunk that contains a range of bytes
+ *
+ * @param index Index of the chunks
+ * @param address First byte of the range
+ * @param size Number of bytes. All must be inside the same chunk
+ * @return Position of the chunk in the list used to build the index. INDEX_NOT_FOUND if none
+ */
+extern INT index_lookup(MU_REGION_INDEX *index, ULONG address, ULONG size);
+
+/**
+ * @brief Gets the chunk of many ranges of the same size. Consecutive addresses between the same two
+ * chunk starts (sorted or clustered lists) skip the search
+ *
+ * @param index Index of the chunks
+ * @param addresses First byte of each range
+ * @param n_addr Number of addresses
+ * @param size Number of bytes of each range
+ * @param chunks Stores the chunk of each range, or INDEX_NOT_FOUND
+ * @return Number of ranges inside some chunk
+ */
+extern ULONG index_lookup_batch(MU_REGION_INDEX *index, ULONG *addresses, ULONG n_addr, ULONG size, INT *chunks);
+
+#endif  /* _MU_INDEX_H */
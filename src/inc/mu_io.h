@@ -18,8 +18,12 @@
 
 #include "mu_types.h"
 
+#define DEFAULT_WINDOW_SIZE     (1UL << 20)
+
 /**
- * @brief Reads the data from a target's memory chunk. REMEMBER TO FREE read data
+ * @brief Reads the data from a target's memory chunk. REMEMBER TO FREE read data.
+ * The whole chunk is held in memory; use a MU_CHUNK_READER to keep memory bounded.
+ * Pages that cannot be read are zero-filled (see read_memory_tolerant)
  * 
  * @param target PID of the target process
  * @param chunk Chunk which to read data from
@@ -27,6 +31,122 @@
  */
 extern UCHAR* read_chunk_data(PID target, MU_MEM_CHUNK chunk);
 
+/**
+ * @brief Reads a range of the target's memory into a caller provided buffer, with the memory backend in use
+ * 
+ * @param target PID of the target process
+ * @param address Starting address of the range to read
+ * @param buffer Buffer where the data is stored. Must hold at least size bytes
+ * @param size Size in bytes of the range
+ * @return Number of bytes read (may be less than size), or -1 if nothing could be read
+ */
+extern INT64 read_memory_range(PID target, ULONG address, UCHAR *buffer, ULONG size);
+
+/**
+ * @brief Reads a range of the target's memory, skipping the pages that cannot be read. After a short
+ * or failed read, the run of bad pages is found by probing each of its pages, and reading goes on after it.
+ * Bad pages are zero-filled and remembered in the bad range cache, so later reads skip them without syscalls
+ * 
+ * @param target PID of the target process
+ * @param address Starting address of the range to read
+ * @param buffer Buffer where the data is stored. Must hold at least size bytes
+ * @param size Size in bytes of the range
+ * @return Number of bytes that could be read
+ */
+extern ULONG read_memory_tolerant(PID target, ULONG address, UCHAR *buffer, ULONG size);
+
+/**
+ * @brief Empties the bad range cache and starts a new session for a target. The cache is also
+ * emptied when pages of another target are found to be bad
+ * 
+ * @param target PID of the target process
+ */
+extern void io_bad_ranges_reset(PID target);
+
+/**
+ * @brief Forgets the bad pages of a range, because it was mapped again
+ * 
+ * @param target PID of the target process
+ * @param address Starting address of the range
+ * @param size Size in bytes of the range
+ */
+extern void io_bad_ranges_forget(PID target, ULONG address, ULONG size);
+
+/**
+ * @brief Gets how much memory of a target is known to be unreadable
+ * 
+ * @param target PID of the target process
+ * @return Bytes in the bad range cache
+ */
+extern UINT64 io_bad_bytes(PID target);
+
+/**
+ * @brief Reads many small values of the same size in as few syscalls as possible. Values that
+ * start in the same page are read as one span and sliced locally, and spans are packed into
+ * batches of up to IOV_MAX iovecs per call to the memory backend. Values in known bad pages are not read
+ * 
+ * @param target PID of the target process
+ * @param addresses Addresses of the values, sorted in ascending order
+ * @param n_addr Number of addresses
+ * @param data_size Size in bytes of each value
+ * @param values Stores the value read at addresses[i] in values[i * data_size]. Must hold n_addr * data_size bytes
+ * @param valid Stores whether addresses[i] could be read
+ * @return Number of values read successfully
+ */
+extern ULONG read_values_batched(PID target, ULONG *addresses, ULONG n_addr, ULONG data_size, UCHAR *values, BOOL *valid);
+
+/**
+ * @brief Prepares a reader that streams memory through a window. The buffer is reserved
+ * once and can be reused for any number of ranges. REMEMBER TO CALL reader_free
+ * 
+ * @param reader Reader to initialize
+ * @param target PID of the target process
+ * @param window Bytes of new data read on each step
+ * @param overlap Bytes kept from the end of a window at the start of the next one.
+ * Use data_size - 1 to find matches crossing window edges
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR reader_init(MU_CHUNK_READER *reader, PID target, ULONG window, ULONG overlap);
+
+/**
+ * @brief Sets the range of memory to stream. Nothing is read until reader_next
+ * 
+ * @param reader Initialized reader
+ * @param address Starting address of the range
+ * @param size Size in bytes of the range
+ */
+extern void reader_seek(MU_CHUNK_READER *reader, ULONG address, ULONG size);
+
+/**
+ * @brief Reads the next window of the range. After the call, buffer holds win_len valid bytes
+ * starting at win_addr. Windows stop at the first bad page. A window starting in bad pages has
+ * win_len 0, and the reader skips the whole run of them
+ * 
+ * @param reader Reader positioned with reader_seek
+ * @return True if a window was produced, false when the range is exhausted
+ */
+extern BOOL reader_next(MU_CHUNK_READER *reader);
+
+/**
+ * @brief Frees the resources of a reader
+ * 
+ * @param reader Reader to free
+ */
+extern void reader_free(MU_CHUNK_READER *reader);
+
+/**
+ * @brief Writes many patches in as few syscalls as possible. Adjacent and overlapping patches are
+ * merged into one iovec (where they overlap, the patch later in the array wins) and iovecs are packed
+ * into batches of up to IOV_MAX per call to the memory backend (see mu_backend.h)
+ * 
+ * @param target PID of the target process
+ * @param patches Patches to write, in any order. The written field of each one is updated
+ * @param n_patches Number of patches
+ * @param verify True to read back each batch after writing it and check the bytes landed
+ * @return Number of patches written (and verified, if requested)
+ */
+extern ULONG write_patches(PID target, MU_PATCH *patches, ULONG n_patches, BOOL verify);
+
 /**
  * @brief Modifies the final matches with the wanted value
  * 
@@ -35,8 +155,8 @@ extern UCHAR* read_chunk_data(PID target, MU_MEM_CHUNK chunk);
  * @param addr_size Size of the addresses array
  * @param data Data to write
  * @param size Size in bytes of the data
- * @return Error code indicating this operation status 
+ * @return Error code indicating this operation status. ERR_GENERIC if any address could not be written
  */
-extern MU_ERROR modify_values(PID target, ULONG *addresses, INT addr_size, UCHAR *data, INT data_size);
+extern MU_ERROR modify_values(PID target, ULONG *addresses, UINT64 addr_size, UCHAR *data, ULONG data_size);
 
 #endif  /* _MU_IO_H */
\ No newline at end of file
@@ -0,0 +1,89 @@
+/**
+ * @file mu_kernels.h
+ * @author Mark Dervishaj
+ * @brief Vectorized search kernels, selected at startup for the running CPU
+ * @version 0.1
+ * @date 2022-09-26
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_KERNELS_H
+#define _MU_KERNELS_H
+
+#include "mu_types.h"
+
+#define MASK_WORD_BITS      64
+
+/* Compares n_slots consecutive slots of the kernel width against a value. Bit i of mask is set if slot i matches */
+typedef void (*MU_EQ_KERNEL)(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask);
+
+/* Compares n_slots packed values of a numeric type against their previous values. Bit i of mask is set if slot i meets pred */
+typedef void (*MU_CMP_KERNEL)(const UCHAR *cur, const UCHAR *old, ULONG n_slots, MU_VALUE_TYPE type, MU_PREDICATE pred,
+                              const UCHAR *delta, UINT64 *mask);
+
+/* Family of kernels for one instruction set, one per value width */
+typedef struct scan_kernels
+{
+    const CHAR      *name;
+    MU_EQ_KERNEL    eq8;
+    MU_EQ_KERNEL    eq16;
+    MU_EQ_KERNEL    eq32;
+    MU_EQ_KERNEL    eq64;
+    MU_CMP_KERNEL   cmp;
+
+} MU_KERNELS;
+
+/**
+ * @brief Gets the kernels chosen for this CPU (AVX-512, AVX2, SSE2 or scalar, best first).
+ * The choice is made once, the first time it is needed
+ *
+ * @return Kernel family in use
+ */
+extern const MU_KERNELS* kernels_get();
+
+/**
+ * @brief Forces a kernel family. Useful to compare them or to work around a faulty CPU
+ *
+ * @param name "avx512", "avx2", "sse2" or "scalar"
+ * @return ERR_FUNC_OPT if the name is unknown or the CPU does not support it
+ */
+extern MU_ERROR kernels_select(const CHAR *name);
+
+/**
+ * @brief Finds every slot of a buffer that holds the value. Slots start at multiples of stride.
+ * If stride equals the value width (1, 2, 4 or 8) a whole vector of slots is compared at once.
+ * Otherwise a vectorized first-byte prefilter is verified with memcmp
+ *
+ * @param buf Buffer to search
+ * @param len Size in bytes of the buffer
+ * @param value Value to find
+ * @param width Size in bytes of the value
+ * @param stride Distance in bytes between slots: 1, 2, 4 or 8
+ * @param mask Stores one bit per slot. Must hold len / stride / 64 + 1 words
+ * @return Number of slots covered by the mask (slots where the whole value fits)
+ */
+extern ULONG kernel_find(const UCHAR *buf, ULONG len, const UCHAR *value, ULONG width, ULONG stride, UINT64 *mask);
+
+/**
+ * @brief Compares every slot of a buffer against the same slot of a previous copy of it.
+ * Changed and unchanged compare the bytes, the others compare the values of the type. Packed values
+ * (stride equal to width) are compared a whole vector at once
+ *
+ * @param cur Current contents
+ * @param old Previous contents, same size as cur
+ * @param len Size in bytes of both buffers
+ * @param type Type of the values. Values of other width than the type are compared as strings
+ * @param width Size in bytes of the values
+ * @param stride Distance in bytes between slots: 1, 2, 4 or 8
+ * @param pred Predicate each slot must meet. Strings only support changed and unchanged
+ * @param delta Delta of PRED_INCREASED_BY and PRED_DECREASED_BY, as a value of the type. NULL for other predicates.
+ * Integer deltas wrap around. Float deltas match with a small relative tolerance
+ * @param mask Stores one bit per slot. Must hold len / stride / 64 + 1 words
+ * @return Number of slots covered by the mask. 0 if the predicate does not apply to the type
+ */
+extern ULONG kernel_compare(const UCHAR *cur, const UCHAR *old, ULONG len, MU_VALUE_TYPE type, ULONG width, ULONG stride,
+                            MU_PREDICATE pred, const UCHAR *delta, UINT64 *mask);
+
+#endif  /* _MU_KERNELS_H */
@@ -0,0 +1,176 @@
+/**
+ * @file mu_matchset.h
+ * @author Mark Dervishaj
+ * @brief Compact storage for the matches of a scan
+ * @version 0.1
+ * @date 2022-09-20
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#ifndef _MU_MATCHSET_H
+#define _MU_MATCHSET_H
+
+#include "mu_types.h"
+
+#define MATCH_REGION_MAX    (1UL << 32)     /* Biggest region addressable with 32-bit offsets */
+#define MATCH_BLOCK         1024            /* Offsets reserved the first time a region grows */
+
+/**
+ * @brief Creates an empty match set with one region per chunk. Chunks bigger than
+ * MATCH_REGION_MAX are split in several regions. REMEMBER TO FREE with matchset_free
+ * 
+ * @param chunks Chunks that will be scanned, in address order
+ * @param n_chunks Number of chunks
+ * @param stride Alignment of the matches: 1, 2, 4 or 8 bytes
+ * @param data_size Size in bytes of the matched value
+ * @return Empty match set
+ */
+extern MU_MATCH_SET* matchset_create(MU_MEM_CHUNK *chunks, INT n_chunks, ULONG stride, ULONG data_size);
+
+/**
+ * @brief Frees a match set and all its regions
+ * 
+ * @param set Match set to free
+ */
+extern void matchset_free(MU_MATCH_SET *set);
+
+/**
+ * @brief Adds a match to a region. Offsets must be pushed in ascending order. The region
+ * switches itself to a bitmap when the list of offsets becomes bigger than the bitmap
+ * 
+ * @param region Region where the match is stored
+ * @param stride Alignment of the matches of the set
+ * @param offset Offset of the match from the start of the region
+ */
+extern void matchset_region_push(MU_MATCH_REGION *region, ULONG stride, UINT32 offset);
+
+/**
+ * @brief Stores the value seen of the last match pushed to a region
+ * 
+ * @param region Region where the match was pushed
+ * @param data_size Size in bytes of the value
+ * @param value Value seen at the match
+ */
+extern void matchset_region_push_value(MU_MATCH_REGION *region, ULONG data_size, const UCHAR *value);
+
+/**
+ * @brief Moves the matches of a part (a region covering a sub-range of a set region) into the set.
+ * Parts of the same region must be appended in address order. The part is left empty
+ * 
+ * @param set Match set
+ * @param rid Region of the set that contains the part
+ * @param part Part to append. Its addr_start must be a multiple of 64 * stride from the region start
+ */
+extern void matchset_region_append(MU_MATCH_SET *set, ULONG rid, MU_MATCH_REGION *part);
+
+/**
+ * @brief Frees the storage of a region and leaves it empty
+ * 
+ * @param region Region to clear
+ */
+extern void matchset_region_clear(MU_MATCH_REGION *region);
+
+/**
+ * @brief Gets the addresses of the matches of a region, in ascending order, from a position
+ * 
+ * @param set Match set
+ * @param rid Region to read
+ * @param pos Position to start from (0 for the first match). Updated to continue with the next call
+ * @param addresses Stores the addresses
+ * @param max Maximum number of addresses to store
+ * @return Number of addresses stored. 0 when the region is exhausted
+ */
+extern ULONG matchset_gather(MU_MATCH_SET *set, ULONG rid, UINT64 *pos, ULONG *addresses, ULONG max);
+
+/**
+ * @brief Compacts a region in place, keeping only some of the addresses previously gathered
+ * from it, and optionally refreshing their values. Must be called in the same order as matchset_gather
+ * 
+ * @param set Match set
+ * @param rid Region being compacted
+ * @param kept Number of matches kept so far in the region (0 for the first call). Updated
+ * @param addresses Addresses gathered from the region
+ * @param keep Whether to keep each address
+ * @param values Values just seen at each address, stored for the kept ones. NULL to not store values
+ * @param n Number of addresses
+ */
+extern void matchset_keep(MU_MATCH_SET *set, ULONG rid, UINT64 *kept, ULONG *addresses, BOOL *keep, UCHAR *values, ULONG n);
+
+/**
+ * @brief Finishes the compaction of a region. Shrinks its storage and switches it back
+ * to a list of offsets if the bitmap became sparse
+ * 
+ * @param set Match set
+ * @param rid Region compacted
+ * @param kept Number of matches kept in the region
+ */
+extern void matchset_region_done(MU_MATCH_SET *set, ULONG rid, UINT64 kept);
+
+/**
+ * @brief Sets the same last value for all the matches, dropping the values stored per match
+ * 
+ * @param set Match set
+ * @param value Value of set->data_size bytes. NULL to forget the values
+ */
+extern void matchset_set_common_value(MU_MATCH_SET *set, const UCHAR *value);
+
+/**
+ * @brief Checks if the last value of every match is known
+ * 
+ * @param set Match set
+ * @return True if there is a common value or all regions store their values
+ */
+extern BOOL matchset_has_values(MU_MATCH_SET *set);
+
+/**
+ * @brief Gets the last values of consecutive matches of a region
+ * 
+ * @param set Match set with values
+ * @param rid Region to read
+ * @param first Position of the first match in the region (0 for the lowest address)
+ * @param n Number of matches
+ * @param values Stores n values of set->data_size bytes
+ */
+extern void matchset_get_values(MU_MATCH_SET *set, ULONG rid, UINT64 first, ULONG n, UCHAR *values);
+
+/**
+ * @brief Checks if an address is a match of a region. Fastest when called in ascending order
+ * 
+ * @param set Match set
+ * @param rid Region to look in
+ * @param address Address to check
+ * @param hint Position where the previous lookup stopped (0 for the first one). Updated
+ * @return True if the address is in the region
+ */
+extern BOOL matchset_contains(MU_MATCH_SET *set, ULONG rid, ULONG address, UINT64 *hint);
+
+/**
+ * @brief Drops the matches that are not inside the current memory of the target anymore. Regions fully
+ * mapped or fully unmapped are handled in bulk; only partly unmapped ones are walked
+ * 
+ * @param set Match set
+ * @param chunks Current chunks of the target, in address order (see mu_regions.h)
+ * @param n_chunks Number of chunks
+ * @return Number of matches dropped
+ */
+extern UINT64 matchset_drop_unmapped(MU_MATCH_SET *set, MU_MEM_CHUNK *chunks, INT n_chunks);
+
+/**
+ * @brief Gets all the addresses of the set in ascending order. REMEMBER TO FREE returned list
+ * 
+ * @param set Match set
+ * @return List of set->n_matches addresses
+ */
+extern ULONG* matchset_to_addresses(MU_MATCH_SET *set);
+
+/**
+ * @brief Gets the bytes used by the storage of the matches
+ * 
+ * @param set Match set
+ * @return Bytes used by lists and bitmaps of all regions
+ */
+extern ULONG matchset_footprint(MU_MATCH_SET *set);
+
+#endif  /* _MU_MATCHSET_H */
@@ -15,7 +15,9 @@
 #include "mu_types.h"
 
 /**
- * @brief Get the memory chunks from maps file. REMEMBER TO FREE the memory of the chunks array and chunk_name attrib
+ * @brief Get the memory chunks from maps file. The file is read at once and parsed in a single pass.
+ * Names live in the same block as the array, so they must not be freed one by one.
+ * REMEMBER TO FREE the memory of the chunks array
  * 
  * @param target PID of the target process
  * @param option 0 for all chunks, 1 for modifiable chunks
@@ -25,7 +27,8 @@
 extern MU_MEM_CHUNK* get_memory_chunks(PID target, INT option, INT *size);
 
 /**
- * @brief Filters the memory chunks by region. REMEMBER TO FREE the memory of the filtered chunks and chunk_name attrib
+ * @brief Filters the memory chunks by region. Names point into the original array, which must outlive
+ * the filtered one. REMEMBER TO FREE the memory of the filtered chunks
  * 
  * @param target PID of the target process
  * @param chunks Chunks which to apply filter
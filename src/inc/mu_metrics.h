@@ -0,0 +1,127 @@
+/**
+ * @file mu_metrics.h
+ * @author Mark Dervishaj
+ * @brief Counters of the hot paths, kept per thread and summed on demand
+ * @version 0.1
+ * @date 2022-10-26
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * Each thread adds to its own block, so counting takes no lock and shares no cache line. Blocks are
+ * summed when an operation ends or when totals are asked for, and the blocks of finished threads are
+ * kept in the totals. An operation (scan, filter, write) records the counters of every thread while
+ * it runs, background threads such as a freezer included
+ */
+
+#ifndef _MU_METRICS_H
+#define _MU_METRICS_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  /* _GNU_SOURCE */
+
+#include "mu_types.h"
+
+#define METRICS_MAX_TEXT    1024        /* Longest formatted operation */
+
+/**
+ * @brief Adds to a counter of the calling thread
+ *
+ * @param metric Counter
+ * @param value Amount to add
+ */
+extern void metrics_add(MU_METRIC metric, UINT64 value);
+
+/**
+ * @brief Gets the time used by the timed counters
+ *
+ * @return Nanoseconds of a monotonic clock. 0 while metrics are disabled
+ */
+extern UINT64 metrics_clock(void);
+
+/**
+ * @brief Adds the time elapsed since start to a timed counter
+ *
+ * @param metric Timed counter
+ * @param start Time given by metrics_clock
+ */
+extern void metrics_since(MU_METRIC metric, UINT64 start);
+
+/**
+ * @brief Counts one read syscall of a target: its bytes, whether it came back short or failed, and
+ * its time
+ *
+ * @param requested Bytes asked for
+ * @param got Result of the syscall
+ * @param start Time given by metrics_clock before the syscall
+ */
+extern void metrics_count_read(ULONG requested, INT64 got, UINT64 start);
+
+/**
+ * @brief Counts one write syscall into a target, as metrics_count_read
+ *
+ * @param requested Bytes to write
+ * @param got Result of the syscall
+ * @param start Time given by metrics_clock before the syscall
+ */
+extern void metrics_count_write(ULONG requested, INT64 got, UINT64 start);
+
+/**
+ * @brief Sums the counters of all threads, finished ones included
+ *
+ * @param totals Totals since the program started
+ */
+extern void metrics_total(MU_METRICS *totals);
+
+/**
+ * @brief Starts an operation. Operations nested in another one of the same thread are part of it
+ *
+ * @param mark Totals at the start, to give to metrics_end
+ */
+extern void metrics_begin(MU_METRICS *mark);
+
+/**
+ * @brief Ends an operation: keeps what it counted (see metrics_last) and reports it if asked to
+ * (see metrics_set_report)
+ *
+ * @param operation Name of the operation
+ * @param mark Totals given by metrics_begin
+ */
+extern void metrics_end(const CHAR *operation, const MU_METRICS *mark);
+
+/**
+ * @brief Gets what the last operation counted
+ *
+ * @param metrics Counters of the operation. Zero if none ended yet
+ * @return Name of the operation. NULL if none ended yet
+ */
+extern const CHAR* metrics_last(MU_METRICS *metrics);
+
+/**
+ * @brief Formats counters as one line of text ("name: counter=value ...") or as a JSON object
+ *
+ * @param metrics Counters
+ * @param operation Name given to the counters. NULL to leave it out
+ * @param format METRICS_TEXT or METRICS_JSON
+ * @param buffer Output, terminated even if truncated
+ * @param size Size of the output
+ * @return Length of the whole output, as snprintf
+ */
+extern ULONG metrics_format(const MU_METRICS *metrics, const CHAR *operation, MU_METRICS_FORMAT format, CHAR *buffer, ULONG size);
+
+/**
+ * @brief Chooses how the end of each operation is reported on stderr
+ *
+ * @param format METRICS_OFF (default), METRICS_TEXT or METRICS_JSON
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR metrics_set_report(MU_METRICS_FORMAT format);
+
+/**
+ * @brief Enables or disables counting. Enabled by default: it costs a clock read per window
+ *
+ * @param enable True to count
+ */
+extern void metrics_enable(BOOL enable);
+
+#endif  /* _MU_METRICS_H */
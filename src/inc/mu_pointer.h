@@ -0,0 +1,99 @@
+/**
+ * @file mu_pointer.h
+ * @author Mark Dervishaj
+ * @brief Pointer scans: paths from the modules of a target to an address, which survive restarts
+ * @version 0.1
+ * @date 2022-10-21
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_POINTER_H
+#define _MU_POINTER_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  /* _GNU_SOURCE */
+
+#include "mu_types.h"
+
+#define PTRMAP_VERSION      1
+
+/**
+ * @brief Builds the reverse pointer map of a target with one parallel pass over its readable memory.
+ * Every 8-byte aligned value that points into a mapped region is kept with its location, and the
+ * entries are sorted by value. Modules are the chunks backed by a file, plus the anonymous chunk right
+ * after a writable one (its .bss). REMEMBER TO FREE returned map with ptrmap_free
+ *
+ * @param target PID of the target process
+ * @return Pointer map. NULL if the chunks of the target cannot be read
+ */
+extern MU_POINTER_MAP* ptrmap_build(PID target);
+
+/**
+ * @brief Frees a pointer map, built or loaded
+ *
+ * @param map Map to free
+ */
+extern void ptrmap_free(MU_POINTER_MAP *map);
+
+/**
+ * @brief Saves a pointer map to a file laid out as the arrays in memory, so it can be mapped back
+ * with ptrmap_load without parsing
+ *
+ * @param map Map to save
+ * @param path Path of the file. Overwritten if it exists
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR ptrmap_save(MU_POINTER_MAP *map, const CHAR *path);
+
+/**
+ * @brief Maps a pointer map saved with ptrmap_save. The arrays of the map point into the file, which
+ * is read lazily by the kernel. REMEMBER TO FREE returned map with ptrmap_free
+ *
+ * @param path Path of the file
+ * @return Pointer map. NULL if the file is missing, truncated or of another version
+ */
+extern MU_POINTER_MAP* ptrmap_load(const CHAR *path);
+
+/**
+ * @brief Finds pointer paths from the modules to an address with a breadth-first search backwards:
+ * the locations pointing at most max_offset bytes before the address are found in the map, then the
+ * ones pointing near those, and so on. Each level of the search is shared among all cores. Shorter
+ * paths come first. REMEMBER TO FREE returned paths
+ *
+ * @param map Pointer map of the target
+ * @param address Address to reach
+ * @param max_depth Maximum number of pointers followed. 1 to POINTER_MAX_DEPTH
+ * @param max_offset Maximum offset added to each pointer
+ * @param max_paths Maximum number of paths returned
+ * @param n_paths Stores the number of paths found
+ * @return Paths found. NULL if there are none
+ */
+extern MU_POINTER_PATH* ptrmap_find_paths(MU_POINTER_MAP *map, ULONG address, UINT32 max_depth, ULONG max_offset,
+                                          ULONG max_paths, ULONG *n_paths);
+
+/**
+ * @brief Follows a pointer path in the current memory of a target. The module is looked up by name,
+ * so the path works after a restart of the target
+ *
+ * @param target PID of the target process
+ * @param map Map the path was found in
+ * @param path Path to follow
+ * @param address Stores the address the path leads to
+ * @return Error code indicating this operation status. ERR_GENERIC if the module is not mapped or a pointer cannot be read
+ */
+extern MU_ERROR ptrmap_resolve(PID target, MU_POINTER_MAP *map, const MU_POINTER_PATH *path, ULONG *address);
+
+/**
+ * @brief Writes a path as text, such as "libgame.so+0x1234 -> +0x18 -> +0x40"
+ *
+ * @param map Map the path was found in
+ * @param path Path to write
+ * @param text Stores the text
+ * @param size Size in bytes of text
+ */
+extern void ptrmap_path_string(MU_POINTER_MAP *map, const MU_POINTER_PATH *path, CHAR *text, ULONG size);
+
+#endif  /* _MU_POINTER_H */
@@ -0,0 +1,53 @@
+/**
+ * @file mu_regions.h
+ * @author Mark Dervishaj
+ * @brief Tracks the regions of a target between passes and finds how they changed
+ * @version 0.1
+ * @date 2022-10-04
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_REGIONS_H
+#define _MU_REGIONS_H
+
+#include "mu_types.h"
+
+/**
+ * @brief Starts tracking the regions of a target. REMEMBER TO CLOSE returned table with regions_close
+ *
+ * @param target PID of the target process
+ * @param option 0 for all chunks, 1 for modifiable chunks
+ * @return Table with the current regions and no changes. NULL if an user-error occurred
+ */
+extern MU_REGION_TABLE* regions_open(PID target, INT option);
+
+/**
+ * @brief Re-reads the regions of the target and diffs them with the previous ones. Regions are matched
+ * by their start address and backing (device, inode and offset): a region split or moved, or another
+ * mapping put in its place, shows up as removed and added
+ *
+ * @param table Table to refresh. Its chunks and deltas are replaced
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR regions_refresh(MU_REGION_TABLE *table);
+
+/**
+ * @brief Gets the memory that appeared in the last refresh: added regions and the tails of grown ones.
+ * Names point into the table, so they are valid until the next refresh. REMEMBER TO FREE returned array
+ *
+ * @param table Refreshed table
+ * @param size Stores the number of ranges
+ * @return Array with the new ranges
+ */
+extern MU_MEM_CHUNK* regions_new_ranges(MU_REGION_TABLE *table, INT *size);
+
+/**
+ * @brief Closes a table and frees its regions
+ *
+ * @param table Table to close
+ */
+extern void regions_close(MU_REGION_TABLE *table);
+
+#endif  /* _MU_REGIONS_H */
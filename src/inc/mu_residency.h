@@ -0,0 +1,47 @@
+/**
+ * @file mu_residency.h
+ * @author Mark Dervishaj
+ * @brief Narrows chunks down to the pages that are actually in memory, using smaps and pagemap
+ * @version 0.1
+ * @date 2022-10-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_RESIDENCY_H
+#define _MU_RESIDENCY_H
+
+#include "mu_types.h"
+
+#define RESIDENCY_OFF       0       /* Read every page of the chunks */
+#define RESIDENCY_PRESENT   1       /* Read only pages in RAM */
+#define RESIDENCY_SWAPPED   2       /* Read pages in RAM or in swap */
+
+/**
+ * @brief Gets the resident and swapped bytes of each chunk from /proc/PID/smaps
+ *
+ * @param target PID of the target process
+ * @param chunks Chunks in address order
+ * @param n_chunks Number of chunks
+ * @param rss Stores the resident bytes of each chunk
+ * @param swap Stores the swapped bytes of each chunk
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR residency_smaps(PID target, MU_MEM_CHUNK *chunks, INT n_chunks, ULONG *rss, ULONG *swap);
+
+/**
+ * @brief Narrows chunks down to runs of resident pages. Chunks with nothing resident are dropped using
+ * smaps alone, fully resident ones are kept whole, and only the rest have their pages checked in
+ * /proc/PID/pagemap. Names point into the original chunks. REMEMBER TO FREE returned array
+ *
+ * @param target PID of the target process
+ * @param chunks Chunks in address order
+ * @param n_chunks Number of chunks
+ * @param mode RESIDENCY_PRESENT or RESIDENCY_SWAPPED
+ * @param size Stores the number of runs
+ * @return Array with the runs, in address order. NULL if residency cannot be read
+ */
+extern MU_MEM_CHUNK* residency_filter(PID target, MU_MEM_CHUNK *chunks, INT n_chunks, INT mode, INT *size);
+
+#endif  /* _MU_RESIDENCY_H */
@@ -17,29 +17,214 @@
 #endif  /* _GNU_SOURCE */
 
 #include "mu_types.h"
+#include "mu_io.h"
+#include "mu_matchset.h"
+#include "mu_kernels.h"
+#include "mu_snapshot.h"
+#include "mu_regions.h"
+#include "mu_residency.h"
+#include "mu_softdirty.h"
+#include "mu_uring.h"
+#include "mu_valueset.h"
 
 /**
  * @brief Scans through the target memory in search of the desired value. 
- * This version uses optimized search with "memmem" from feature test macros.
+ * Chunks are cut into ranges that are searched with the vector kernels of mu_kernels.h by a pool
+ * of threads, one per online core. Only addresses aligned as set with set_scan_alignment are
+ * reported. REMEMBER TO FREE returned set with matchset_free
  * 
  * @param target PID of the target process
  * @param data Data bytes to search
  * @param data_size Size in bytes of the data
  * @param n_matches Stores the number of matching addresses
- * @return List of addresses that match the desired value
+ * @return Set with the addresses that match the desired value. NULL if the scan could not start
  */
-extern ULONG* execute_scanner(PID target, UCHAR *data, INT data_size, INT *n_matches);
+extern MU_MATCH_SET* execute_scanner(PID target, UCHAR *data, ULONG data_size, UINT64 *n_matches);
 
 /**
- * @brief Filters a list of addresses to narrow down the required address/es
+ * @brief Same as execute_scanner, but only searches some chunks of the target. Useful to scan only
+ * the memory that appeared since the previous pass (see regions_new_ranges in mu_regions.h).
+ * REMEMBER TO FREE returned set with matchset_free
  * 
  * @param target PID of the target process
- * @param addresses List of potential addresses narrowed down
+ * @param chunks Chunks to search, in address order
+ * @param n_chunks Number of chunks
  * @param data Data bytes to search
  * @param data_size Size in bytes of the data
  * @param n_matches Stores the number of matching addresses
+ * @return Set with the matching addresses. NULL if the scan could not start
+ */
+extern MU_MATCH_SET* execute_scanner_chunks(PID target, MU_MEM_CHUNK *chunks, INT n_chunks, UCHAR *data, ULONG data_size, UINT64 *n_matches);
+
+/**
+ * @brief Same as execute_scanner, but finds the slots that hold any value of a set in a single pass
+ * (see valueset_find in mu_valueset.h). The set keeps the value of each match, so valueset_index tells
+ * which value of the set it holds, and relational filters can follow. REMEMBER TO FREE returned set with matchset_free
+ * 
+ * @param target PID of the target process
+ * @param values Values to search, all of the same width
+ * @param n_matches Stores the number of matching addresses
+ * @return Set with the addresses that hold a value of the set. NULL if the scan could not start
+ */
+extern MU_MATCH_SET* execute_scanner_set(PID target, const MU_VALUE_SET *values, UINT64 *n_matches);
+
+/**
+ * @brief Sets the size of the window each scanning thread reads from the target at once.
+ * Peak memory used for reading is about (window + data_size) per thread. Default is DEFAULT_WINDOW_SIZE
+ * 
+ * @param window_size Window size in bytes. At least 4096
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR set_scan_window(ULONG window_size);
+
+/**
+ * @brief Sets a hard limit for the memory used by the read buffers of all scanning threads.
+ * Fewer threads, or a smaller window, are used when the configured ones do not fit
+ * 
+ * @param budget Budget in bytes. 0 means no limit (default)
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR set_scan_mem_budget(ULONG budget);
+
+/**
+ * @brief Sets the alignment of the addresses reported by the scanner. With the natural alignment,
+ * 2, 4 and 8 byte values are only searched at multiples of their size, anything else at every byte
+ * 
+ * @param alignment 1, 2, 4 or 8 bytes. 0 means natural alignment (default)
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR set_scan_alignment(ULONG alignment);
+
+/**
+ * @brief Sets whether scans only read the pages of the target that are in memory (see mu_residency.h).
+ * Untouched pages of big sparse mappings are then skipped, so the bytes read follow the RSS of the
+ * target instead of its mapped size. Only applies to new scans and snapshots
+ * 
+ * @param mode RESIDENCY_OFF (default), RESIDENCY_PRESENT or RESIDENCY_SWAPPED
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR set_scan_residency(INT mode);
+
+/**
+ * @brief Gets the mode set with set_scan_residency, for callers that scan their own chunks
+ * 
+ * @return RESIDENCY_OFF, RESIDENCY_PRESENT or RESIDENCY_SWAPPED
+ */
+extern INT get_scan_residency(void);
+
+/**
+ * @brief Sets the pages of the target written since the previous pass (see mu_softdirty.h). While the map
+ * is valid, snapshot comparisons and filters of matches with known values only read dirty pages: clean
+ * pages still hold the values of the previous pass. The map is not owned by the scanner
+ * 
+ * @param map Map refreshed right before each pass. NULL to read every page (default)
+ */
+extern void set_scan_dirty_map(MU_DIRTY_MAP *map);
+
+/**
+ * @brief Gets the map set with set_scan_dirty_map
+ * 
+ * @return Map of dirty pages, or NULL
+ */
+extern MU_DIRTY_MAP* get_scan_dirty_map(void);
+
+/**
+ * @brief Sets how many windows each thread of a value scan keeps in flight with io_uring (see mu_uring.h).
+ * Reads of the next windows then overlap with the search of the current one, and many small regions cost
+ * one syscall per batch instead of one per read. Each thread holds depth windows. Scans read synchronously
+ * when io_uring cannot be used
+ * 
+ * @param depth Reads in flight per thread, at most URING_MAX_DEPTH. 0 for synchronous reads (default)
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR set_scan_queue_depth(UINT32 depth);
+
+/**
+ * @brief Sets the pipeline of value scans. Each scanning thread gets a reader thread that copies the next
+ * windows into a ring of buffers while it searches the current one, handed over through a lock-free queue
+ * (see mu_spsc.h). The reader waits when every buffer is full. Half the cores read and half search, so a
+ * scan takes about max(copy, search) instead of their sum. Not used with a queue depth (set_scan_queue_depth)
+ * 
+ * @param n_buffers Buffers of window size per pair of threads, at least 2. 0 to disable the pipeline (default)
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR set_scan_pipeline(ULONG n_buffers);
+
+/**
+ * @brief Gets the time spent by each stage of the last pipelined scan, to see whether copying or
+ * searching is the bottleneck on this host
+ * 
+ * @param stats Stores the times, summed over all pairs of threads
+ */
+extern void get_scan_pipeline_stats(MU_PIPELINE_STATS *stats);
+
+/**
+ * @brief Keeps the threads of scans and filters alive between calls instead of creating and joining
+ * them each time. Parked threads also keep their read buffers, so a process running many scans on the
+ * same settings (a daemon) pays for neither again. The buffers stay reserved until the pool is disabled
+ * 
+ * @param resident True to start the pool, false to stop it and free its buffers (default)
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR set_scan_resident_pool(BOOL resident);
+
+/**
+ * @brief Starts a scan of an unknown value: copies the writable memory of the target into a
+ * snapshot on disk (see mu_snapshot.h). Threads stream the memory window by window, so only
+ * their read buffers are kept in RAM. REMEMBER TO CLOSE returned snapshot with snapshot_close
+ * 
+ * @param target PID of the target process
+ * @param data_size Size in bytes of the value searched
+ * @param type Type of the value searched
+ * @return Snapshot of the target. NULL if the scan could not start
+ */
+extern MU_SNAPSHOT* execute_snapshot(PID target, ULONG data_size, MU_VALUE_TYPE type);
+
+/**
+ * @brief Compares the memory of the target with its snapshot and keeps the slots that meet the
+ * predicate. Each window is compared and then copied over the snapshot, so the snapshot holds the
+ * current memory afterwards. Slots whose previous contents are unknown are dropped. The set
+ * keeps the current value of each match, so it can be narrowed down with execute_relational_filtering.
+ * REMEMBER TO FREE returned set with matchset_free
+ * 
+ * @param snap Snapshot of the target
+ * @param prev Matches of the previous pass, which are narrowed down. NULL for the first pass
+ * @param pred Predicate the slots must meet
+ * @param delta Delta of PRED_INCREASED_BY and PRED_DECREASED_BY, as a value of the type. NULL otherwise
+ * @param n_matches Stores the number of matching addresses
+ * @return Set with the addresses that meet the predicate. NULL if the filter could not start
+ */
+extern MU_MATCH_SET* execute_snapshot_filter(MU_SNAPSHOT *snap, MU_MATCH_SET *prev, MU_PREDICATE pred, const UCHAR *delta, UINT64 *n_matches);
+
+/**
+ * @brief Filters a set of matches to narrow down the required address/es. Candidates are
+ * re-read in batches and the survivors are compacted in place. Addresses that cannot be
+ * read anymore are dropped
+ * 
+ * @param target PID of the target process
+ * @param matches Set of potential addresses narrowed down
+ * @param data Data bytes to search
+ * @param data_size Size in bytes of the data. Must be the size of the matches
+ * @param n_matches Stores the number of matching addresses
  * @return MU_ERROR 
  */
-extern MU_ERROR execute_filtering(PID target, ULONG **addresses, UCHAR *data, ULONG data_size, INT *n_matches);
+extern MU_ERROR execute_filtering(PID target, MU_MATCH_SET *matches, UCHAR *data, ULONG data_size, UINT64 *n_matches);
+
+/**
+ * @brief Filters a set of matches by comparing each current value with the last one seen.
+ * One batched re-read per block both evaluates the predicate and refreshes the stored values,
+ * so passes can be chained. The set must know its values: it comes from execute_scanner,
+ * execute_filtering or execute_snapshot_filter
+ * 
+ * @param target PID of the target process
+ * @param matches Set of potential addresses narrowed down
+ * @param type Type of the values. Strings only support changed and unchanged
+ * @param pred Predicate the values must meet
+ * @param delta Delta of PRED_INCREASED_BY and PRED_DECREASED_BY, as a value of the type. NULL otherwise
+ * @param n_matches Stores the number of matching addresses
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR execute_relational_filtering(PID target, MU_MATCH_SET *matches, MU_VALUE_TYPE type, MU_PREDICATE pred,
+                                             UCHAR *delta, UINT64 *n_matches);
 
 #endif  /* _MU_SCANNER_H */
\ No newline at end of file
@@ -0,0 +1,54 @@
+/**
+ * @file mu_session.h
+ * @author Mark Dervishaj
+ * @brief Scan sessions saved to disk in a versioned file that is mapped back without parsing
+ * @version 0.1
+ * @date 2022-10-23
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_SESSION_H
+#define _MU_SESSION_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  /* _GNU_SOURCE */
+
+#include "mu_types.h"
+
+#define SESSION_VERSION     1
+
+/**
+ * @brief Saves a session: the region table, the match set with the last value of each match, and the
+ * pages of the snapshot. Sections are aligned and laid out as the arrays in memory: the offsets or
+ * bitmap of each match region, then its values. The file is written next to the path and renamed over
+ * it, so a crash never leaves a half-written session
+ *
+ * @param session Session to save. Its matches and snapshot can be NULL
+ * @param path Path of the file
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR session_save(MU_SESSION *session, const CHAR *path);
+
+/**
+ * @brief Resumes a session saved with session_save. The file is mapped, and the match set points
+ * into it: loading only builds the table of regions, whatever the number of matches. The arrays of a
+ * region are copied the first time a filter changes it. The pages of a snapshot are read from, and
+ * written to, the session file itself. REMEMBER TO CLOSE returned session with session_close
+ *
+ * @param path Path of the file
+ * @return Session. NULL if the file is missing, truncated or of another version
+ */
+extern MU_SESSION* session_load(const CHAR *path);
+
+/**
+ * @brief Closes a session returned by session_load, with the match set and snapshot still attached
+ * to it. Detach them (set them to NULL) to free them separately, before the session is closed
+ *
+ * @param session Session to close
+ */
+extern void session_close(MU_SESSION *session);
+
+#endif  /* _MU_SESSION_H */
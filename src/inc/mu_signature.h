@@ -0,0 +1,69 @@
+/**
+ * @file mu_signature.h
+ * @author Mark Dervishaj
+ * @brief Array-of-bytes signatures with wildcards, scanned in batches over all the memory of a target
+ * @version 0.1
+ * @date 2022-10-20
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_SIGNATURE_H
+#define _MU_SIGNATURE_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  /* _GNU_SOURCE */
+
+#include "mu_types.h"
+
+#define SIG_ALL_CHUNKS      0
+#define SIG_MODIF_CHUNKS    1
+
+/**
+ * @brief Parses an IDA-style signature. Bytes are separated by spaces and each one is:
+ * "8B" a known byte, "??" or "?" any byte, "4?" or "?B" a known nibble, "0100x1xx" known bits
+ * (x or ? for any bit), or "8B&F0" a value with an explicit mask. REMEMBER TO FREE with signature_free
+ *
+ * @param text Signature, for example "48 8B 05 ?? ?? ?? ?? 89 ?? 24"
+ * @param sig Signature to fill
+ * @return Error code indicating this operation status. ERR_FUNC_OPT if the text is not a signature
+ */
+extern MU_ERROR signature_parse(const CHAR *text, MU_SIGNATURE *sig);
+
+/**
+ * @brief Frees the contents of a signature
+ *
+ * @param sig Signature to free
+ */
+extern void signature_free(MU_SIGNATURE *sig);
+
+/**
+ * @brief Finds every position of a buffer where the signature matches. The first and last fully known
+ * bytes are searched with the vector kernels of mu_kernels.h, and only positions where both are found
+ * get the masked compare of the whole signature
+ *
+ * @param sig Signature
+ * @param buf Buffer to search
+ * @param len Size in bytes of the buffer
+ * @param mask Stores one bit per position. Must hold len / 64 + 1 words
+ * @return Number of positions covered by the mask (where the whole signature fits)
+ */
+extern ULONG signature_find(const MU_SIGNATURE *sig, const UCHAR *buf, ULONG len, UINT64 *mask);
+
+/**
+ * @brief Finds the addresses of a batch of signatures in one pass over the memory of a target.
+ * Each window is read once and every signature is searched in it while it is in cache. Code
+ * (r-x) regions are included with SIG_ALL_CHUNKS. Matches are stored in each signature
+ *
+ * @param target PID of the target process
+ * @param sigs Signatures to find. Their previous matches are discarded
+ * @param n_sigs Number of signatures
+ * @param option SIG_ALL_CHUNKS for every readable chunk, SIG_MODIF_CHUNKS for modifiable ones
+ * @param max_matches Matches kept per signature. 0 for no limit
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR signature_scan(PID target, MU_SIGNATURE *sigs, ULONG n_sigs, INT option, ULONG max_matches);
+
+#endif  /* _MU_SIGNATURE_H */
@@ -0,0 +1,91 @@
+/**
+ * @file mu_snapshot.h
+ * @author Mark Dervishaj
+ * @brief Disk-backed copy of the memory of a target, for scans of unknown initial values
+ * @version 0.1
+ * @date 2022-09-28
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_SNAPSHOT_H
+#define _MU_SNAPSHOT_H
+
+#include "mu_types.h"
+
+#define SNAP_PAGE_SIZE      4096            /* Granularity of the unknown pages of a snapshot */
+#define DEFAULT_SNAP_DIR    "/tmp"
+
+/**
+ * @brief Sets the directory where snapshot files are created. It should be on a filesystem with
+ * room for a full copy of the target. Default is $TMPDIR, or DEFAULT_SNAP_DIR if not set
+ *
+ * @param dir Path of the directory. It is not copied, so it must stay valid
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR set_snapshot_dir(const CHAR *dir);
+
+/**
+ * @brief Creates an empty snapshot for some chunks of a target. The copy is kept in an unlinked
+ * temporary file, so only the page cache holds it in memory. REMEMBER TO CLOSE with snapshot_close
+ *
+ * @param target PID of the target process
+ * @param chunks Chunks to copy, in address order. Names are not used
+ * @param n_chunks Number of chunks
+ * @param data_size Size in bytes of the value searched
+ * @param type Type of the value searched
+ * @return Empty snapshot (all pages unknown). NULL if the file cannot be created
+ */
+extern MU_SNAPSHOT* snapshot_open(PID target, MU_MEM_CHUNK *chunks, INT n_chunks, ULONG data_size, MU_VALUE_TYPE type);
+
+/**
+ * @brief Closes a snapshot and frees its file
+ *
+ * @param snap Snapshot to close
+ */
+extern void snapshot_close(MU_SNAPSHOT *snap);
+
+/**
+ * @brief Reads bytes of the copy. The range must be inside one chunk
+ *
+ * @param snap Snapshot
+ * @param address Address in the target of the first byte
+ * @param buffer Stores the bytes
+ * @param size Number of bytes
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR snapshot_load(MU_SNAPSHOT *snap, ULONG address, UCHAR *buffer, ULONG size);
+
+/**
+ * @brief Writes bytes into the copy. The range must be inside one chunk
+ *
+ * @param snap Snapshot
+ * @param address Address in the target of the first byte
+ * @param buffer Bytes to write
+ * @param size Number of bytes
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR snapshot_store(MU_SNAPSHOT *snap, ULONG address, UCHAR *buffer, ULONG size);
+
+/**
+ * @brief Marks or unmarks the pages touched by a range as unknown. Safe to call from several threads
+ *
+ * @param snap Snapshot
+ * @param address Address in the target of the first byte
+ * @param size Number of bytes
+ * @param bad True to mark as unknown, false to mark as known. Known pages must be fully covered by the range
+ */
+extern void snapshot_mark(MU_SNAPSHOT *snap, ULONG address, ULONG size, BOOL bad);
+
+/**
+ * @brief Checks if any page touched by a range is unknown
+ *
+ * @param snap Snapshot
+ * @param address Address in the target of the first byte
+ * @param size Number of bytes
+ * @return True if some byte of the range is unknown
+ */
+extern BOOL snapshot_is_bad(MU_SNAPSHOT *snap, ULONG address, ULONG size);
+
+#endif  /* _MU_SNAPSHOT_H */
@@ -0,0 +1,88 @@
+/**
+ * @file mu_softdirty.h
+ * @author Mark Dervishaj
+ * @brief Tracks the pages a target writes between passes, with the soft-dirty bits of the kernel
+ * @version 0.1
+ * @date 2022-10-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_SOFTDIRTY_H
+#define _MU_SOFTDIRTY_H
+
+#include "mu_types.h"
+
+/**
+ * @brief Checks if the kernel keeps soft-dirty bits (CONFIG_MEM_SOFT_DIRTY). Probed once on this process
+ *
+ * @return True if soft-dirty bits can be cleared and read
+ */
+extern BOOL dirty_supported(void);
+
+/**
+ * @brief Starts tracking the writes of a target by clearing its soft-dirty bits. Must be called before
+ * the first pass reads the target. REMEMBER TO CLOSE returned map with dirty_close
+ *
+ * @param target PID of the target process
+ * @param stop True to stop the target with SIGSTOP during each refresh. Otherwise a page written between
+ * reading the bits and clearing them is missed until it is written again
+ * @return Map with no valid bits yet. NULL if soft-dirty bits are not available for the target
+ */
+extern MU_DIRTY_MAP* dirty_open(PID target, BOOL stop);
+
+/**
+ * @brief Takes the pages written since the previous refresh (or dirty_open) and clears the bits again.
+ * The bits are cleared right after they are read; if the map was opened with stop, the target is stopped
+ * with SIGSTOP meanwhile, so no write falls in between.
+ * On failure the map is left invalid and every page counts as dirty
+ *
+ * @param map Map of the target
+ * @param chunks Current chunks of the target, in address order
+ * @param n_chunks Number of chunks
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR dirty_refresh(MU_DIRTY_MAP *map, MU_MEM_CHUNK *chunks, INT n_chunks);
+
+/**
+ * @brief Checks if any page of a range was written. Pages outside the chunks of the last refresh count as dirty
+ *
+ * @param map Map of the target. NULL counts every page as dirty
+ * @param address First byte of the range
+ * @param size Number of bytes
+ * @return True if the range may have changed since the previous pass
+ */
+extern BOOL dirty_range(MU_DIRTY_MAP *map, ULONG address, ULONG size);
+
+/**
+ * @brief Checks many ranges of the same size, sorted or clustered (see index_lookup_batch)
+ *
+ * @param map Map of the target. NULL counts every page as dirty
+ * @param addresses First byte of each range
+ * @param n_addr Number of addresses
+ * @param size Number of bytes of each range
+ * @param dirty Stores whether each range may have changed
+ * @return Number of dirty ranges
+ */
+extern ULONG dirty_range_batch(MU_DIRTY_MAP *map, ULONG *addresses, ULONG n_addr, ULONG size, BOOL *dirty);
+
+/**
+ * @brief Gets the end of a run of pages in the same state
+ *
+ * @param map Map of the target. NULL counts every page as dirty
+ * @param address Start of the run
+ * @param end Address where the search stops
+ * @param dirty State of the run: true for written pages
+ * @return First address from address on whose page is not in that state, or end
+ */
+extern ULONG dirty_run_end(MU_DIRTY_MAP *map, ULONG address, ULONG end, BOOL dirty);
+
+/**
+ * @brief Frees a map. The soft-dirty bits of the target are left as they are
+ *
+ * @param map Map to free
+ */
+extern void dirty_close(MU_DIRTY_MAP *map);
+
+#endif  /* _MU_SOFTDIRTY_H */
@@ -0,0 +1,97 @@
+/**
+ * @file mu_spsc.h
+ * @author Mark Dervishaj
+ * @brief Lock-free single-producer/single-consumer queue of slots
+ * @version 0.1
+ * @date 2022-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_SPSC_H
+#define _MU_SPSC_H
+
+#include "mu_types.h"
+
+/**
+ * @brief Prepares an empty queue. The queue only hands out slot numbers: the caller keeps an array
+ * of capacity items, so data is written in place and never copied into the queue
+ *
+ * @param queue Queue to initialize
+ * @param capacity Number of slots. At least 1
+ * @return Error code indicating this operation status
+ */
+extern MU_ERROR spsc_init(MU_SPSC *queue, ULONG capacity);
+
+/**
+ * @brief Releases what spsc_init set up. Neither side may be using the queue
+ *
+ * @param queue Queue
+ */
+extern void spsc_destroy(MU_SPSC *queue);
+
+/**
+ * @brief Gets the slot the producer must fill next. Producer only
+ *
+ * @param queue Queue
+ * @return Slot number, or -1 if the queue is full
+ */
+extern INT64 spsc_reserve(MU_SPSC *queue);
+
+/**
+ * @brief Gets the slot the producer must fill next, waiting for the consumer to free one if the queue
+ * is full. It spins for a short while and then sleeps until spsc_pop wakes it. Producer only
+ *
+ * @param queue Queue
+ * @return Slot number
+ */
+extern INT64 spsc_reserve_wait(MU_SPSC *queue);
+
+/**
+ * @brief Hands the slot got with spsc_reserve over to the consumer. Producer only
+ *
+ * @param queue Queue
+ */
+extern void spsc_publish(MU_SPSC *queue);
+
+/**
+ * @brief Tells the consumer that nothing else will be published. Producer only
+ *
+ * @param queue Queue
+ */
+extern void spsc_close(MU_SPSC *queue);
+
+/**
+ * @brief Gets the oldest published slot. Consumer only
+ *
+ * @param queue Queue
+ * @return Slot number, or -1 if the queue is empty
+ */
+extern INT64 spsc_front(MU_SPSC *queue);
+
+/**
+ * @brief Gets the oldest published slot, waiting for the producer if the queue is empty. It spins for a
+ * short while and then sleeps until spsc_publish or spsc_close wakes it. Consumer only
+ *
+ * @param queue Queue
+ * @return Slot number, or -1 if the queue is drained (see spsc_drained)
+ */
+extern INT64 spsc_front_wait(MU_SPSC *queue);
+
+/**
+ * @brief Gives the slot got with spsc_front back to the producer. Consumer only
+ *
+ * @param queue Queue
+ */
+extern void spsc_pop(MU_SPSC *queue);
+
+/**
+ * @brief Checks if the consumer is done: the queue is closed and every slot was consumed. Consumer only
+ *
+ * @param queue Queue
+ * @return True if nothing else will come out of the queue
+ */
+extern BOOL spsc_drained(MU_SPSC *queue);
+
+#endif  /* _MU_SPSC_H */
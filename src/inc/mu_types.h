@@ -16,6 +16,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 /* Redefinitions of types for more clarity */
 typedef unsigned char   UCHAR;
@@ -24,6 +25,8 @@ typedef short           INT16;
 typedef int             INT32;
 typedef int             INT;
 typedef long            INT64;
+typedef uint32_t        UINT32;
+typedef uint64_t        UINT64;
 typedef size_t          ULONG;
 typedef float           REAL32;
 typedef double          REAL64;
@@ -58,6 +61,31 @@ typedef enum error_codes
 
 } MU_ERROR;
 
+/* Type of the searched value. Same order as the types offered by mem_scan_linux */
+typedef enum value_types
+{
+    VAL_UINT8       =   0,
+    VAL_INT16       =   1,
+    VAL_INT32       =   2,
+    VAL_INT64       =   3,
+    VAL_REAL32      =   4,
+    VAL_REAL64      =   5,
+    VAL_STRING      =   6
+
+} MU_VALUE_TYPE;
+
+/* Predicate of a filter, comparing the current value of a slot to its previous one */
+typedef enum filter_predicates
+{
+    PRED_CHANGED        =   0,
+    PRED_UNCHANGED      =   1,
+    PRED_INCREASED      =   2,      /* Not for strings */
+    PRED_DECREASED      =   3,      /* Not for strings */
+    PRED_INCREASED_BY   =   4,      /* By a delta. Not for strings */
+    PRED_DECREASED_BY   =   5       /* By a delta. Not for strings */
+
+} MU_PREDICATE;
+
 /* Struct to store information about a memory chunk */
 typedef struct memory_chunk
 {
@@ -66,17 +94,448 @@ typedef struct memory_chunk
     BOOL    is_readable;
     BOOL    is_writable;
     BOOL    is_private;
-    CHAR*   chunk_name;
+    CHAR*   chunk_name;     /* Pathname, or "NULL" if not backed by a file. Owned by the chunks array */
     ULONG   chnk_name_sz;
+    ULONG   offset;         /* Offset in the backing file */
+    UINT32  dev_major;
+    UINT32  dev_minor;
+    ULONG   inode;          /* 0 if not backed by a file */
     
 } MU_MEM_CHUNK;
 
-/* Struct to store offsets and lengths of groups of chunks. Used for multithreading */
-typedef struct core_offsets
+/* Immutable index of the chunks of a target for address-to-chunk lookups. Starts are kept in
+   Eytzinger (BFS) order so a search touches one cache line per few levels and has no branches */
+typedef struct region_index
+{
+    ULONG   *keys;          /* Chunk starts in Eytzinger order, 1-based. keys[0] unused */
+    INT     *ranks;         /* Position in address order of each key */
+    ULONG   *starts;        /* Chunk starts, in address order */
+    ULONG   *ends;          /* Chunk ends (exclusive), in address order */
+    INT     n_chunks;
+
+} MU_REGION_INDEX;
+
+/* Ways a region can change between two passes. Grown, shrunk and perms can be combined */
+typedef enum region_change
+{
+    REGION_ADDED        =   1,
+    REGION_REMOVED      =   2,
+    REGION_GROWN        =   4,      /* Same start, bigger */
+    REGION_SHRUNK       =   8,      /* Same start, smaller */
+    REGION_PERMS        =   16      /* Same start, other permissions */
+
+} MU_REGION_CHANGE;
+
+/* Change of one region found by a refresh of a region table */
+typedef struct region_delta
+{
+    ULONG   addr_start;
+    ULONG   old_size;       /* 0 if added */
+    ULONG   new_size;       /* 0 if removed */
+    INT     changes;        /* MU_REGION_CHANGE flags */
+    INT     chunk;          /* Index of the region in the current table. -1 if removed */
+
+} MU_REGION_DELTA;
+
+/* Regions of a target tracked between passes */
+typedef struct region_table
+{
+    PID             target;
+    INT             option;         /* 0 for all chunks, 1 for modifiable chunks */
+    MU_MEM_CHUNK    *chunks;        /* Current regions, in address order */
+    INT             n_chunks;
+    MU_REGION_DELTA *deltas;        /* Changes found by the last refresh, in address order */
+    INT             n_deltas;
+
+} MU_REGION_TABLE;
+
+/* Pages of a target written between two refreshes, taken from the soft-dirty bits of /proc/PID/pagemap */
+typedef struct dirty_map
+{
+    PID             target;
+    BOOL            valid;          /* False until a refresh succeeds. Every page counts as dirty meanwhile */
+    MU_REGION_INDEX *index;         /* Chunks covered by the bits */
+    ULONG           *first_page;    /* Bit of the first page of each chunk */
+    UINT64          *bits;          /* One bit per page, set if the page was written */
+    ULONG           n_pages;
+    ULONG           n_dirty;
+    BOOL            stop;           /* Stop the target while the bits are taken (see dirty_open) */
+
+} MU_DIRTY_MAP;
+
+/* Set of values of the same width searched in one pass. Membership is tested with a hash of the
+   first (up to 8) bytes of a slot: a small bitmap, sized to stay in cache, rejects most slots, and an
+   open addressing table of value indexes confirms the rest */
+typedef struct value_set
+{
+    ULONG   width;          /* Size in bytes of each value */
+    ULONG   n_values;       /* Distinct values */
+    UCHAR   *values;        /* n_values * width bytes, in the order given (duplicates removed) */
+    UINT64  *filter;        /* Bitmap prefilter of 1 << filter_bits bits */
+    UINT32  filter_bits;
+    UINT32  *table;         /* Index of a value in each bucket, or UINT32_MAX if empty */
+    UINT32  table_bits;     /* The table has 1 << table_bits buckets */
+
+} MU_VALUE_SET;
+
+/* Array-of-bytes signature with wildcards, as in "48 8B 05 ?? ?? ?? ?? 89 ?? 24". Every byte has a mask
+   of the bits that must match, so whole-byte, nibble and bit wildcards are all the same case */
+typedef struct signature
+{
+    UCHAR   *bytes;         /* Value of each byte, with the wildcard bits cleared */
+    UCHAR   *mask;          /* Bits of each byte that must match */
+    ULONG   length;
+    INT64   anchor_first;   /* Offset of the first fully known byte, searched with the vector kernels. -1 if none */
+    INT64   anchor_last;    /* Offset of the last fully known byte, if not the first one. -1 if none */
+    ULONG   *matches;       /* Addresses found by the last scan, in ascending order */
+    ULONG   n_matches;
+    ULONG   cap_matches;
+
+} MU_SIGNATURE;
+
+/* Location of the target holding a pointer-sized value that points into a mapped region */
+typedef struct pointer_entry
+{
+    UINT64  value;
+    UINT64  location;
+
+} MU_POINTER_ENTRY;
+
+/* Region of a module. Its addresses are the same on every run, relative to the base of the module */
+typedef struct static_region
+{
+    UINT64  start;
+    UINT64  end;
+    UINT64  base;           /* Lowest address where the module is mapped */
+    CHAR    name[256];      /* Base name of the module file */
+
+} MU_STATIC_REGION;
+
+/* Reverse pointer map of a target: every aligned pointer, sorted by the address it points to */
+typedef struct pointer_map
+{
+    PID                 target;
+    MU_POINTER_ENTRY    *entries;       /* Sorted by value, then by location */
+    UINT64              n_entries;
+    MU_STATIC_REGION    *statics;       /* In address order */
+    UINT64              n_statics;
+    void                *mapping;       /* File holding both arrays when loaded from disk. NULL if built */
+    ULONG               map_size;
+
+} MU_POINTER_MAP;
+
+#define POINTER_MAX_DEPTH   8
+
+/* Path to an address: p = [base + module_offset], then for each level p = [p + offset],
+   except after the last offset, which gives the address itself */
+typedef struct pointer_path
+{
+    UINT64  static_region;  /* Index of the module region in the statics of the map */
+    UINT64  module_offset;  /* From the base of the module */
+    UINT32  depth;          /* Pointers followed */
+    INT64   offsets[POINTER_MAX_DEPTH];
+
+} MU_POINTER_PATH;
+
+/* Region of a match set. Matches are stored as 32-bit offsets from addr_start, or as a
+   bitmap with one bit per aligned slot when they are dense */
+typedef struct match_region
+{
+    ULONG   addr_start;
+    ULONG   size;           /* At most MATCH_REGION_MAX bytes, so offsets fit in 32 bits */
+    UINT64  n_matches;
+    BOOL    is_bitmap;
+    UINT32  *offsets;       /* Sorted offsets of the matches, when sparse */
+    UINT64  cap_offsets;
+    UINT64  *bitmap;        /* Bit i set if there is a match at offset i * stride, when dense */
+    UCHAR   *values;        /* Last value seen of each match, in address order. NULL if not known */
+    UINT64  cap_values;
+    BOOL    is_mapped;      /* Arrays point into a session file: copied before they are changed, never freed */
+
+} MU_MATCH_REGION;
+
+/* Set of matches of a scan, grouped by region. The region ID of a match is its index in regions */
+typedef struct match_set
+{
+    MU_MATCH_REGION *regions;
+    ULONG           n_regions;
+    ULONG           stride;         /* Alignment of the matches: 1, 2, 4 or 8 bytes */
+    ULONG           data_size;      /* Size in bytes of the matched value */
+    UINT64          n_matches;
+    UCHAR           *common_value;  /* Last value seen of every match, when it is the same for all. Else NULL */
+
+} MU_MATCH_SET;
+
+/* Struct to store a sub-range of a match set region. Used as unit of work for multithreading */
+typedef struct scan_range
+{
+    ULONG           addr_start;     /* First address where a match may start */
+    ULONG           scan_len;       /* Number of starting positions owned by this range */
+    ULONG           read_len;       /* Bytes to read: scan_len plus the overlap with the next range */
+    ULONG           region;         /* Region of the match set the range belongs to */
+    MU_MATCH_REGION part;           /* Matches found in the range, relative to addr_start */
+
+} MU_SCAN_RANGE;
+
+/* Struct to store a write of some bytes into the target's memory */
+typedef struct mem_patch
+{
+    ULONG   address;
+    UCHAR   *data;
+    ULONG   data_size;
+    BOOL    written;        /* Set by write_patches: true if all bytes were written (and verified) */
+
+} MU_PATCH;
+
+/* Struct to stream a range of memory through a fixed size window */
+typedef struct chunk_reader
+{
+    PID     target;
+    ULONG   window;         /* Bytes of new data read on each step */
+    ULONG   overlap;        /* Bytes from the end of a window kept at the start of the next one */
+    UCHAR   *buffer;        /* Holds window + overlap bytes */
+    ULONG   next;           /* Next address to read */
+    ULONG   addr_end;       /* End of the range being streamed */
+    ULONG   win_addr;       /* Address of buffer[0] */
+    ULONG   win_len;        /* Valid bytes in buffer */
+    BOOL    contiguous;     /* True if the window ends right before next, so its tail can be carried */
+
+} MU_CHUNK_READER;
+
+/* Read queued in an io_uring engine */
+typedef struct uring_read
+{
+    ULONG   address;
+    ULONG   size;
+    INT64   result;         /* Bytes read, or -errno. Valid once done */
+    BOOL    done;
+    UINT64  tag;            /* Caller data */
+
+} MU_URING_READ;
+
+/* Queue of asynchronous reads of /proc/PID/mem through io_uring. Reads complete in any order
+   but are consumed in the order they were queued */
+typedef struct uring_engine
+{
+    INT             ring_fd;
+    INT             mem_fd;
+    UINT32          depth;          /* Maximum reads outstanding */
+    ULONG           buf_size;
+    UCHAR           *buffers;       /* depth registered buffers of buf_size bytes, one per slot */
+    MU_URING_READ   *reads;         /* One per slot */
+    UINT32          head;           /* Slot of the oldest read */
+    UINT32          n_pending;      /* Reads queued and not consumed yet */
+    UINT32          n_unsubmitted;  /* Reads queued but not handed to the kernel yet */
+    void            *sq_ring;
+    ULONG           sq_ring_size;
+    void            *cq_ring;       /* Same mapping as sq_ring on kernels with a single mmap */
+    ULONG           cq_ring_size;
+    void            *sqes;
+    ULONG           sqes_size;
+    UINT32          *sq_tail;
+    UINT32          sq_mask;
+    UINT32          *sq_array;
+    UINT32          *cq_head;
+    UINT32          *cq_tail;
+    UINT32          cq_mask;
+    void            *cqes;
+    UINT64          n_enters;       /* Syscalls made to submit and wait */
+
+} MU_URING;
+
+/* Lock-free queue between one producer and one consumer thread. Counters only grow; a slot is
+   counter % capacity. Each counter has its own cache line so the two sides do not false share.
+   The lock is only taken by a side that waits too long, and by the other side to wake it */
+typedef struct spsc_queue
+{
+    ULONG           capacity;
+    UINT64          head __attribute__((aligned(64)));      /* Slots consumed. Written by the consumer */
+    UINT64          tail __attribute__((aligned(64)));      /* Slots published. Written by the producer */
+    BOOL            closed __attribute__((aligned(64)));    /* Set by the producer after its last publish */
+    BOOL            sleeping;                               /* A side is blocked on wake */
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+
+} MU_SPSC;
+
+/* Time spent by each stage of a pipelined scan, summed over all reader/scanner pairs */
+typedef struct pipeline_stats
+{
+    UINT64  read_ns;        /* Copying memory out of the target */
+    UINT64  scan_ns;        /* Searching the copied windows */
+    UINT64  read_wait_ns;   /* Readers blocked because every buffer was full */
+    UINT64  scan_wait_ns;   /* Scanners blocked because no buffer was ready */
+    UINT64  wall_ns;        /* Whole scan */
+    UINT64  bytes;          /* Bytes handed from readers to scanners */
+    UINT64  windows;
+
+} MU_PIPELINE_STATS;
+
+#define FREEZE_WHEEL_SLOTS  1024    /* Slots of the timer wheel of a freezer. Power of 2 */
+
+/* Value kept frozen by a freezer */
+typedef struct freeze_entry
+{
+    UINT64  id;             /* 0 if the slot is free */
+    ULONG   address;
+    UCHAR   *data;
+    ULONG   data_size;
+    ULONG   interval_us;
+    UINT64  due;            /* Tick of the next write */
+    UINT64  writes;         /* Writes that landed */
+    UINT64  failures;       /* Writes that did not land */
+    INT64   prev;           /* Neighbours in the slot of the wheel, or -1. next links free slots too */
+    INT64   next;
+
+} MU_FREEZE_ENTRY;
+
+/* Counter of the metrics. Times are in nanoseconds */
+typedef enum metric
+{
+    MET_BYTES_READ          =   0,      /* Copied out of targets */
+    MET_READ_CALLS          =   1,      /* Syscalls made to read targets */
+    MET_SHORT_READS         =   2,      /* Reads that returned less than asked */
+    MET_FAILED_READS        =   3,      /* Reads that returned nothing */
+    MET_BYTES_WRITTEN       =   4,
+    MET_WRITE_CALLS         =   5,
+    MET_FAILED_WRITES       =   6,      /* Writes that returned less than asked */
+    MET_REGIONS_SCANNED     =   7,
+    MET_REGIONS_SKIPPED     =   8,      /* Not resident, or without previous matches */
+    MET_FILTER_IN           =   9,      /* Candidates given to filters */
+    MET_FILTER_OUT          =   10,     /* Candidates kept by filters */
+    MET_ENUM_NS             =   11,     /* Reading region tables */
+    MET_COPY_NS             =   12,     /* Reading and writing targets */
+    MET_SEARCH_NS           =   13,     /* Searching and comparing copied memory */
+    MET_MERGE_NS            =   14,     /* Recording matches */
+    MET_COUNT               =   15
+
+} MU_METRIC;
+
+/* Format of exported metrics */
+typedef enum metrics_format
+{
+    METRICS_OFF     =   0,
+    METRICS_TEXT    =   1,
+    METRICS_JSON    =   2
+
+} MU_METRICS_FORMAT;
+
+/* Values of every counter, over all threads */
+typedef struct metrics
+{
+    UINT64  counters[MET_COUNT];
+
+} MU_METRICS;
+
+/* Counters of a freezer since it started */
+typedef struct freeze_stats
+{
+    UINT64  ticks;          /* Ticks with at least one value due */
+    UINT64  syscalls;       /* Vectored writes made */
+    UINT64  writes;         /* Values written */
+    UINT64  failures;       /* Values that could not be written */
+    UINT64  missed;         /* Values written after the tick they were due */
+    UINT64  max_late_us;    /* Worst delay of a wake-up after its tick */
+    UINT64  n_entries;      /* Values frozen now */
+
+} MU_FREEZE_STATS;
+
+/* Background thread rewriting values on a timer wheel of ticks. Each slot of the wheel links
+   the entries due in ticks congruent to it; all the values due in a tick go out in one batch */
+typedef struct freezer
+{
+    PID                 target;
+    ULONG               tick_us;
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      wake;           /* Signalled when the first entry is added, or on stop */
+    BOOL                running;
+    MU_FREEZE_ENTRY     *entries;       /* Slots, reused after a removal */
+    ULONG               n_slots;
+    ULONG               cap;
+    INT64               free_slot;      /* First free slot, or -1 */
+    INT64               wheel[FREEZE_WHEEL_SLOTS];
+    UINT64              next_id;
+    UINT64              tick;           /* Last tick processed */
+    UINT64              origin_ns;      /* Time of tick 0 */
+    UCHAR               *staging;       /* Bytes of the batch being written */
+    ULONG               staging_size;
+    MU_FREEZE_STATS     stats;
+
+} MU_FREEZER;
+
+/* Copy of the memory of a target kept on disk, for scans of unknown initial values */
+typedef struct snapshot
+{
+    PID             target;
+    INT             fd;             /* Unlinked temporary file holding the copy, or the session file it was resumed from */
+    ULONG           base_off;       /* Offset of the copy in the file */
+    MU_MEM_CHUNK    *chunks;        /* Chunks copied, in address order. Names are not kept */
+    INT             n_chunks;
+    ULONG           *file_off;      /* Offset in the file of each chunk */
+    ULONG           total;          /* Bytes copied */
+    UINT64          *bad;           /* Bit set for each page of the file whose contents are unknown */
+    ULONG           data_size;      /* Size in bytes of the value searched */
+    MU_VALUE_TYPE   type;
+
+} MU_SNAPSHOT;
+
+/* State of a scan kept across restarts of the scanner. A loaded session is a mapping of its file:
+   the match arrays and chunk names point into it, so it must stay open while they are used */
+typedef struct session
+{
+    PID             target;
+    MU_VALUE_TYPE   type;
+    MU_MEM_CHUNK    *chunks;        /* Region table of the target, in address order */
+    INT             n_chunks;
+    MU_MATCH_SET    *matches;       /* NULL if none */
+    MU_SNAPSHOT     *snap;          /* NULL if none */
+    void            *mapping;       /* File of a loaded session. NULL if built by the caller */
+    ULONG           map_size;
+
+} MU_SESSION;
+
+#define DAEMON_MAX_TARGETS  16
+#define DAEMON_MAX_CLIENTS  16
+
+/* Process attached to a daemon, with the state of its scan kept between commands */
+typedef struct daemon_target
+{
+    PID             pid;
+    MU_VALUE_TYPE   type;           /* Of the matches */
+    MU_REGION_TABLE *regions;
+    MU_MATCH_SET    *matches;       /* NULL before the first scan */
+    MU_SESSION      *session;       /* Loaded session the matches point into. NULL if none */
+    MU_FREEZER      *freezer;       /* NULL until a value is frozen */
+
+} MU_DAEMON_TARGET;
+
+/* Connection to a daemon. Requests are read into in, their responses wait in out until sent */
+typedef struct daemon_client
+{
+    INT             fd;             /* -1 if the slot is free */
+    CHAR            *in;
+    ULONG           in_len;
+    ULONG           in_cap;
+    CHAR            *out;
+    ULONG           out_len;
+    ULONG           out_sent;
+    ULONG           out_cap;
+    BOOL            eof;            /* Sent all its requests. Closed once its responses are out */
+
+} MU_DAEMON_CLIENT;
+
+/* Scanner serving requests on a Unix socket, with its targets resident in memory */
+typedef struct daemon
 {
-    ULONG off_start;
-    ULONG off_len;
+    INT                 listener;
+    CHAR                path[108];  /* Of the socket, as in sockaddr_un */
+    MU_DAEMON_TARGET    targets[DAEMON_MAX_TARGETS];
+    INT                 n_targets;
+    MU_DAEMON_CLIENT    clients[DAEMON_MAX_CLIENTS];
+    BOOL                quit;
+    UINT64              requests;   /* Served since it was opened */
 
-} MU_OFFSETS;
+} MU_DAEMON;
 
 #endif  /* _MU_TYPES_H */
\ No newline at end of file
@@ -0,0 +1,81 @@
+/**
+ * @file mu_uring.h
+ * @author Mark Dervishaj
+ * @brief Asynchronous reads of /proc/PID/mem with io_uring, through raw syscalls
+ * @version 0.1
+ * @date 2022-10-17
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_URING_H
+#define _MU_URING_H
+
+#include "mu_types.h"
+
+#define URING_MAX_DEPTH     256
+
+/**
+ * @brief Checks if io_uring can be used: the kernel has it and no policy (sysctl, seccomp) forbids it.
+ * Probed once
+ *
+ * @return True if rings can be created
+ */
+extern BOOL uring_supported();
+
+/**
+ * @brief Creates a ring with its own /proc/PID/mem descriptor and depth buffers, all registered
+ * with the kernel. REMEMBER TO CALL uring_close
+ *
+ * @param ring Engine to initialize
+ * @param target PID of the target process
+ * @param depth Maximum reads outstanding. At most URING_MAX_DEPTH
+ * @param buf_size Maximum bytes per read
+ * @return Error code indicating this operation status. ERR_FUNC_OPT if io_uring cannot be used
+ */
+extern MU_ERROR uring_open(MU_URING *ring, PID target, UINT32 depth, ULONG buf_size);
+
+/**
+ * @brief Checks if another read can be queued
+ *
+ * @param ring Engine
+ * @return True if fewer than depth reads are pending
+ */
+extern BOOL uring_can_queue(MU_URING *ring);
+
+/**
+ * @brief Queues a read. Nothing is handed to the kernel until uring_wait_head, so many reads
+ * go in one syscall
+ *
+ * @param ring Engine with room (see uring_can_queue)
+ * @param address Address of the target to read
+ * @param size Bytes to read. At most buf_size
+ * @param tag Caller data returned with the read
+ */
+extern void uring_queue(MU_URING *ring, ULONG address, ULONG size, UINT64 tag);
+
+/**
+ * @brief Submits the queued reads and waits until the oldest one completes
+ *
+ * @param ring Engine with pending reads
+ * @param buffer Stores the buffer of the read. Valid until uring_pop_head
+ * @return Oldest read. Its result may be short or negative if pages could not be read
+ */
+extern MU_URING_READ* uring_wait_head(MU_URING *ring, UCHAR **buffer);
+
+/**
+ * @brief Releases the oldest read, and its buffer, for a new read
+ *
+ * @param ring Engine
+ */
+extern void uring_pop_head(MU_URING *ring);
+
+/**
+ * @brief Waits for the pending reads and frees the ring
+ *
+ * @param ring Engine to close
+ */
+extern void uring_close(MU_URING *ring);
+
+#endif  /* _MU_URING_H */
@@ -48,4 +48,21 @@ extern CHAR* get_mem_path(PID target);
  */
 extern CHAR* get_exe_path(PID target);
 
+/**
+ * @brief Reads a whole file with a few large reads. /proc files have no size, so the buffer grows
+ * until a read returns nothing. REMEMBER TO FREE returned buffer
+ * 
+ * @param path Path of the file
+ * @param len Stores the number of bytes read
+ * @return Contents of the file, followed by a null byte. NULL if it cannot be opened or read
+ */
+extern CHAR* read_proc_file(const CHAR *path, ULONG *len);
+
+/**
+ * @brief Gets the number of cores online and available to this process
+ * 
+ * @return Number of cores, at least 1
+ */
+extern INT get_usable_cores();
+
 #endif  /* _MU_UTILS_H */
\ No newline at end of file
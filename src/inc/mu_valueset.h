@@ -0,0 +1,63 @@
+/**
+ * @file mu_valueset.h
+ * @author Mark Dervishaj
+ * @brief Sets of values searched in a single pass over memory
+ * @version 0.1
+ * @date 2022-10-19
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef _MU_VALUESET_H
+#define _MU_VALUESET_H
+
+#include "mu_types.h"
+
+#define VALUESET_NOT_FOUND      -1
+#define VALUESET_MAX_VALUES     (1UL << 24)
+#define VALUESET_BROADCAST_MAX  8           /* Sets up to this size are searched with one vector compare per value */
+
+/**
+ * @brief Builds a set from a list of values of the same width. Repeated values are kept once.
+ * REMEMBER TO FREE returned set with valueset_free
+ *
+ * @param values n_values * width bytes, one value after another
+ * @param n_values Number of values. 1 to VALUESET_MAX_VALUES
+ * @param width Size in bytes of each value
+ * @return Set of the values. NULL if the arguments are wrong
+ */
+extern MU_VALUE_SET* valueset_create(const UCHAR *values, ULONG n_values, ULONG width);
+
+/**
+ * @brief Frees a set
+ *
+ * @param set Set to free
+ */
+extern void valueset_free(MU_VALUE_SET *set);
+
+/**
+ * @brief Gets the position of a value in the set. Tells which value of the set a match holds
+ *
+ * @param set Set of values
+ * @param value width bytes to look up
+ * @return Index of the value in set->values, or VALUESET_NOT_FOUND
+ */
+extern INT64 valueset_index(const MU_VALUE_SET *set, const UCHAR *value);
+
+/**
+ * @brief Finds every slot of a buffer that holds any value of the set, as kernel_find does for one value.
+ * Small sets run the vector kernel of mu_kernels.h once per value. Bigger ones hash each slot and test the
+ * prefilter bitmap, and only slots that pass it are looked up in the table, so the cost barely grows with
+ * the size of the set
+ *
+ * @param set Set of values
+ * @param buf Buffer to search
+ * @param len Size in bytes of the buffer
+ * @param stride Distance in bytes between slots: 1, 2, 4 or 8
+ * @param mask Stores one bit per slot. Must hold len / stride / 64 + 1 words
+ * @return Number of slots covered by the mask (slots where a whole value fits)
+ */
+extern ULONG valueset_find(const MU_VALUE_SET *set, const UCHAR *buf, ULONG len, ULONG stride, UINT64 *mask);
+
+#endif  /* _MU_VALUESET_H */
@@ -11,16 +11,23 @@
 
 #include "inc/mu_types.h"
 #include "inc/mu_utils.h"
+#include "inc/mu_memchunk.h"
 #include "inc/mu_io.h"
+#include "inc/mu_backend.h"
 #include "inc/mu_scanner.h"
+#include "inc/mu_signature.h"
+#include "inc/mu_pointer.h"
+#include "inc/mu_freeze.h"
+#include "inc/mu_session.h"
+#include "inc/mu_daemon.h"
+#include "inc/mu_metrics.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <float.h>
 #include <time.h>
-
-/* #include <unistd.h> */
+#include <unistd.h>
 
 #define OPT_1BYTE   0
 #define OPT_INT16   1
@@ -32,17 +39,30 @@
 
 #define ASK_FILTER  0
 #define ASK_SCAN    1
+#define ASK_KNOWN   2
+
+#define MODIF_CHNKS 1
+
+#define FILTER_EQUAL    6   /* Filter choice after the predicates: equal to a given value */
+#define SNAPSHOT_KEEP   (1UL << 20) /* Candidates above which passes keep comparing against the snapshot */
 
 #define MAX_STR_SZ  1023
+#define MAX_SIGS    64      /* Signatures accepted with --aob */
+#define SHOWN_SIGS  16      /* Matches printed per signature */
+#define MAX_PATHS   64      /* Pointer paths printed with --pointers */
 
 #define BILLION     1000000000.0
+#define KIBIBYTE    1024UL
+#define MEBIBYTE    (1024UL * 1024UL)
 
 #define NEWL_TO_NUL(buf)    if(buf[strlen(buf) - 1] == '\n'){buf[strlen(buf) - 1] = '\0';}
 
 void show_help();
 void show_types();
 BOOL ask_for_more(INT option);
+INT ask_predicate(INT type_index, BOOL allow_equal, UCHAR **delta);
 INT ask_data(INT type_index, UCHAR **data);
+void save_session(const CHAR *path, PID target, INT type_index, MU_REGION_TABLE *regions, MU_MATCH_SET *matches);
 
 /**
  * @brief Main workflow
@@ -61,14 +81,126 @@ INT main(int argc, char **argv)
     struct timespec start;
     struct timespec end;
     REAL64 elapsed_time;
+    INT incremental = 0;
+    BOOL pipelined = false;
+    MU_SIGNATURE sigs[MAX_SIGS];
+    ULONG n_sigs = 0;
+    ULONG ptr_address = 0;
+    UINT32 ptr_depth = 4;
+    ULONG ptr_offset = 4096;
+    CHAR *ptr_map_path = NULL;
+    ULONG freeze_ms = 0;
+    MU_FREEZER *freezer = NULL;
+    CHAR *session_path = NULL;
+    MU_SESSION *resumed = NULL;
+    CHAR *daemon_path = NULL;
 
     /* CHECK ARGUMENTS ------------------------------------------------------------------- */
 
-    if(argc != 2)
+    if(argc < 2)
     {
         fprintf(stderr, "Error in arguments. See 'mem_scan_linux --help' for usage\n");
         exit(ERR_ARGS_MAIN);
     }
+    for(INT i = 1; i < argc - 1; i++)
+    {
+        /* Options come in pairs before the PID */
+        MU_ERROR opt_ok = ERR_ARGS_MAIN;
+        CHAR *thrash = NULL;
+        if(i + 1 < argc - 1)
+        {
+            ULONG value = strtoul(argv[i + 1], &thrash, 10);
+            if(*thrash == '\0' && strcmp(argv[i], "--window") == 0)
+            {
+                opt_ok = set_scan_window(value * KIBIBYTE);
+            }
+            else if(*thrash == '\0' && strcmp(argv[i], "--mem-budget") == 0)
+            {
+                opt_ok = set_scan_mem_budget(value * MEBIBYTE);
+            }
+            else if(*thrash == '\0' && strcmp(argv[i], "--align") == 0)
+            {
+                opt_ok = set_scan_alignment(value);
+            }
+            else if(*thrash == '\0' && value <= 2 && strcmp(argv[i], "--incremental") == 0)
+            {
+                incremental = value;
+                opt_ok = ERR_OK;
+            }
+            else if(*thrash == '\0' && strcmp(argv[i], "--resident") == 0)
+            {
+                opt_ok = set_scan_residency(value);
+            }
+            else if(*thrash == '\0' && strcmp(argv[i], "--queue-depth") == 0)
+            {
+                opt_ok = set_scan_queue_depth(value);
+            }
+            else if(*thrash == '\0' && strcmp(argv[i], "--pipeline") == 0)
+            {
+                pipelined = value > 0;
+                opt_ok = set_scan_pipeline(value);
+            }
+            else if(strcmp(argv[i], "--aob") == 0 && n_sigs < MAX_SIGS)
+            {
+                opt_ok = signature_parse(argv[i + 1], &sigs[n_sigs]);
+                if(opt_ok == ERR_OK) n_sigs++;
+            }
+            else if(strcmp(argv[i], "--pointers") == 0)
+            {
+                ptr_address = strtoul(argv[i + 1], &thrash, 0);
+                opt_ok = (*thrash == '\0' && ptr_address != 0) ? ERR_OK : ERR_ARGS_MAIN;
+            }
+            else if(*thrash == '\0' && value >= 1 && value <= POINTER_MAX_DEPTH && strcmp(argv[i], "--ptr-depth") == 0)
+            {
+                ptr_depth = value;
+                opt_ok = ERR_OK;
+            }
+            else if(*thrash == '\0' && strcmp(argv[i], "--freeze") == 0)
+            {
+                freeze_ms = value;
+                opt_ok = ERR_OK;
+            }
+            else if(*thrash == '\0' && strcmp(argv[i], "--ptr-offset") == 0)
+            {
+                ptr_offset = value;
+                opt_ok = ERR_OK;
+            }
+            else if(strcmp(argv[i], "--session") == 0)
+            {
+                session_path = argv[i + 1];
+                opt_ok = ERR_OK;
+            }
+            else if(strcmp(argv[i], "--daemon") == 0)
+            {
+                daemon_path = argv[i + 1];
+                opt_ok = ERR_OK;
+            }
+            else if(strcmp(argv[i], "--ptr-map") == 0)
+            {
+                ptr_map_path = argv[i + 1];
+                opt_ok = ERR_OK;
+            }
+            else if(strcmp(argv[i], "--kernels") == 0)
+            {
+                opt_ok = kernels_select(argv[i + 1]);
+            }
+            else if(strcmp(argv[i], "--backend") == 0)
+            {
+                opt_ok = backend_select(argv[i + 1]);
+            }
+            else if(strcmp(argv[i], "--metrics") == 0)
+            {
+                if(strcmp(argv[i + 1], "text") == 0) opt_ok = metrics_set_report(METRICS_TEXT);
+                else if(strcmp(argv[i + 1], "json") == 0) opt_ok = metrics_set_report(METRICS_JSON);
+            }
+        }
+        if(opt_ok != ERR_OK)
+        {
+            fprintf(stderr, "Error in arguments. See 'mem_scan_linux --help' for usage\n");
+            exit(ERR_ARGS_MAIN);
+        }
+        i++;
+    }
     PID target = atoi(argv[argc - 1]);
     if(target == 0)
     {
@@ -91,20 +223,119 @@ INT main(int argc, char **argv)
         exit(ERR_FUNC_OPT);
     }
 
+    /* SIGNATURES (NON-INTERACTIVE) ------------------------------------------------------ */
+
+    if(n_sigs > 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        MU_ERROR sig_ok = signature_scan(target, sigs, n_sigs, SIG_ALL_CHUNKS, 0);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / BILLION;
+        printf("Signature scan took %.3f second(s)\n", elapsed_time);
+        for(ULONG s = 0; s < n_sigs; s++)
+        {
+            printf("Signature %lu: %lu match<es>\n", s + 1, sigs[s].n_matches);
+            for(ULONG m = 0; m < sigs[s].n_matches && m < SHOWN_SIGS; m++)
+            {
+                printf("  %#lx\n", sigs[s].matches[m]);
+            }
+            signature_free(&sigs[s]);
+        }
+        backend_close();
+        exit(sig_ok);
+    }
+
+    /* POINTER PATHS (NON-INTERACTIVE) ------------------------------------------------- */
+
+    if(ptr_address != 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        MU_POINTER_MAP *map = NULL;
+        if(ptr_map_path != NULL && access(ptr_map_path, R_OK) == 0)
+        {
+            map = ptrmap_load(ptr_map_path);
+        }
+        else
+        {
+            map = ptrmap_build(target);
+            if(map != NULL && ptr_map_path != NULL) ptrmap_save(map, ptr_map_path);
+        }
+        if(map == NULL)
+        {
+            backend_close();
+            exit(ERR_GENERIC);
+        }
+        ULONG n_paths = 0;
+        MU_POINTER_PATH *paths = ptrmap_find_paths(map, ptr_address, ptr_depth, ptr_offset, MAX_PATHS, &n_paths);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / BILLION;
+        printf("Pointer scan took %.3f second(s). %lu pointer(s) in the map\n", elapsed_time, map->n_entries);
+        printf("%lu path(s) to %#lx\n", n_paths, ptr_address);
+        for(ULONG p = 0; p < n_paths; p++)
+        {
+            CHAR text[MAX_STR_SZ + 1];
+            ptrmap_path_string(map, &paths[p], text, sizeof text);
+            printf("  %s\n", text);
+        }
+        free(paths);
+        ptrmap_free(map);
+        backend_close();
+        exit(ERR_OK);
+    }
+
+    /* DAEMON (NON-INTERACTIVE) ------------------------------------------------------- */
+
+    if(daemon_path != NULL)
+    {
+        MU_DAEMON *daemon = daemon_open(daemon_path);
+        if(daemon == NULL || daemon_attach(daemon, target) != ERR_OK)
+        {
+            daemon_close(daemon);
+            backend_close();
+            exit(ERR_GENERIC);
+        }
+        printf("Serving on %s. Send {\"cmd\":\"shutdown\"} to stop\n", daemon_path);
+        fflush(stdout);
+        MU_ERROR daemon_ok = daemon_run(daemon);
+        daemon_close(daemon);
+        backend_close();
+        exit(daemon_ok);
+    }
+
     /* ASK VALUE TYPE -------------------------------------------------------------------- */
 
     const CHAR *data_types[] = {"8-Bit Integer", "16-Bit Integer", "32-Bit Integer", "64-Bit Integer", "Float", "Double", "String"};
 
+    /* A saved session is resumed on the first pass, going straight to filtering */
+    if(session_path != NULL && access(session_path, R_OK) == 0)
+    {
+        resumed = session_load(session_path);
+        if(resumed != NULL && (resumed->target != target || resumed->matches == NULL))
+        {
+            printf("Session %s is of another target, not resumed\n", session_path);
+            session_close(resumed);
+            resumed = NULL;
+        }
+    }
+
     BOOL keep_scan = true;
     while(keep_scan)
     {
         BOOL go_to_end = false;
-        printf("Available data types:\n");
-        show_types();
-        fflush(stdin);
-        printf("Please, select the value type: ");
         BOOL selected = false;
         INT c;
+        if(resumed != NULL)
+        {
+            c = resumed->type + 1;
+            selected = true;
+        }
+        else
+        {
+            printf("Available data types:\n");
+            show_types();
+            fflush(stdin);
+            printf("Please, select the value type: ");
+        }
         while(!selected)
         {
             /* Use to read input and parse numbers */
@@ -121,35 +352,116 @@ INT main(int argc, char **argv)
         }
         printf("Type selected: %s\n\n", data_types[c - 1]);
 
+        /* Pages found unreadable by a previous scan may be mapped again */
+        io_bad_ranges_reset(target);
+
+        /* Writes are tracked from before the first read, so later passes can skip clean pages */
+        MU_DIRTY_MAP *dirty = (incremental > 0) ? dirty_open(target, incremental == 2) : NULL;
+        set_scan_dirty_map(dirty);
+
     /* ASK DATA VALUE  ------------------------------------------------------------------- */
 
         INT type_index = c - 1;
-        printf("Please, select the value to search: ");
-
         UCHAR *data;
         INT data_size;
-        ULONG *matches;
-        INT n_matches;
+        MU_MATCH_SET *matches = NULL;
+        MU_SNAPSHOT *snap = NULL;
+        UINT64 n_matches = 0;
+        UCHAR *delta = NULL;
+        BOOL known_value = (resumed != NULL) || (type_index == OPT_STRNG) || ask_for_more(ASK_KNOWN);
 
-        data_size = ask_data(type_index, &data);
+        if(resumed != NULL)
+        {
+            matches = resumed->matches;
+            resumed->matches = NULL;
+            n_matches = matches->n_matches;
+            printf("Session resumed from %s: %lu address<es>\n", session_path, n_matches);
+        }
+        else if(known_value)
+        {
+            printf("Please, select the value to search: ");
+            data_size = ask_data(type_index, &data);
 
     /* SCANNING -------------------------------------------------------------------------- */
 
-        printf("Please wait...\n\n");
-        clock_gettime(CLOCK_MONOTONIC, &start);
-        matches = execute_scanner(target, data, data_size, &n_matches);
-        clock_gettime(CLOCK_MONOTONIC, &end);
-        elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / BILLION;
-        printf("Scanning took %.2f second(s)\n", elapsed_time);
-        free(data);
-        if(n_matches == 0)
-        {
-            printf("No matches found\n");
-            go_to_end = true;
+            printf("Please wait...\n\n");
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            matches = execute_scanner(target, data, data_size, &n_matches);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / BILLION;
+            printf("Scanning took %.2f second(s)\n", elapsed_time);
+            if(pipelined)
+            {
+                MU_PIPELINE_STATS stats;
+                get_scan_pipeline_stats(&stats);
+                printf("Pipeline: copy %.3fs, search %.3fs, readers waited %.3fs, scanners waited %.3fs (%lu windows)\n",
+                       stats.read_ns / BILLION, stats.scan_ns / BILLION, stats.read_wait_ns / BILLION,
+                       stats.scan_wait_ns / BILLION, stats.windows);
+            }
+            free(data);
+            if(n_matches == 0)
+            {
+                printf("No matches found\n");
+                go_to_end = true;
+            }
+            else
+            {
+                printf("%lu address<es> matching the value\n", n_matches);
+            }
         }
+
+    /* SNAPSHOT (UNKNOWN VALUE) ---------------------------------------------------------- */
+
         else
         {
-            printf("%i address<es> matching the value\n", n_matches);
+            const INT type_sizes[] = {1, 2, 4, 8, 4, 8};
+            printf("Taking a snapshot of the memory. Please wait...\n\n");
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            snap = execute_snapshot(target, type_sizes[type_index], (MU_VALUE_TYPE) type_index);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / BILLION;
+            printf("Snapshot took %.2f second(s)\n", elapsed_time);
+            if(snap == NULL)
+            {
+                printf("Snapshot could not be taken\n");
+                go_to_end = true;
+            }
+            /* First pass against the snapshot. While candidates are many the snapshot is kept for the next
+               passes instead of a value per match. Once they are few the matches keep their values */
+            else
+            {
+                INT choice = ask_predicate(type_index, false, &delta);
+                printf("Please wait...\n\n");
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                if(dirty != NULL)
+                {
+                    INT n_chunks = 0;
+                    MU_MEM_CHUNK *chunks = get_memory_chunks(target, MODIF_CHNKS, &n_chunks);
+                    dirty_refresh(dirty, chunks, n_chunks);
+                    free(chunks);
+                }
+                matches = execute_snapshot_filter(snap, NULL, (MU_PREDICATE) choice, delta, &n_matches);
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / BILLION;
+                printf("Filtering took %.2f second(s)\n", elapsed_time);
+                free(delta);
+                delta = NULL;
+                if(n_matches > SNAPSHOT_KEEP) matchset_set_common_value(matches, NULL);
+                else
+                {
+                    snapshot_close(snap);
+                    snap = NULL;
+                }
+                if(n_matches == 0)
+                {
+                    printf("No matches found\n");
+                    go_to_end = true;
+                }
+                else
+                {
+                    printf("%lu address<es> matching\n", n_matches);
+                }
+            }
         }
 
     /* FILTERING ------------------------------------------------------------------------- */
@@ -158,37 +470,89 @@ INT main(int argc, char **argv)
         {
             BOOL done_filter = true;
             BOOL stop_filter = false;
-            if(ask_for_more(ASK_FILTER))
+            /* Regions are tracked between passes, so candidates of unmapped memory are dropped */
+            MU_REGION_TABLE *regions = regions_open(target, MODIF_CHNKS);
+            if(session_path != NULL && regions != NULL) save_session(session_path, target, type_index, regions, matches);
+            if(regions != NULL && ask_for_more(ASK_FILTER))
             {
                 while(!stop_filter)
                 {
-                    printf("\nPlease, select the value to search: ");
-                    data_size = ask_data(type_index, &data);
+                    INT choice = ask_predicate(type_index, true, &delta);
+                    if(regions_refresh(regions) == ERR_OK)
+                    {
+                        UINT64 dropped = matchset_drop_unmapped(matches, regions->chunks, regions->n_chunks);
+                        if(regions->n_deltas > 0 || dropped > 0)
+                        {
+                            printf("%d region<s> changed, %lu address<es> no longer mapped\n", regions->n_deltas, dropped);
+                        }
+                    }
+                    if(choice == FILTER_EQUAL)
+                    {
+                        printf("\nPlease, select the value to search: ");
+                        data_size = ask_data(type_index, &data);
+                    }
                     printf("Please wait...\n\n");
                     clock_gettime(CLOCK_MONOTONIC, &start);
-                    execute_filtering(target, &matches, data, data_size, &n_matches);
+                    if(dirty != NULL && dirty_refresh(dirty, regions->chunks, regions->n_chunks) == ERR_OK)
+                    {
+                        printf("%lu of %lu page<s> written since the previous pass\n", dirty->n_dirty, dirty->n_pages);
+                    }
+                    if(choice == FILTER_EQUAL)
+                    {
+                        execute_filtering(target, matches, data, data_size, &n_matches);
+                        free(data);
+                        /* The snapshot did not see this pass, the matches now know their value */
+                        snapshot_close(snap);
+                        snap = NULL;
+                    }
+                    else if(snap != NULL)
+                    {
+                        MU_MATCH_SET *narrowed = execute_snapshot_filter(snap, matches, (MU_PREDICATE) choice, delta, &n_matches);
+                        if(narrowed != NULL)
+                        {
+                            matchset_free(matches);
+                            matches = narrowed;
+                        }
+                        free(delta);
+                        delta = NULL;
+                        if(n_matches > SNAPSHOT_KEEP) matchset_set_common_value(matches, NULL);
+                        else
+                        {
+                            snapshot_close(snap);
+                            snap = NULL;
+                        }
+                    }
+                    else
+                    {
+                        execute_relational_filtering(target, matches, (MU_VALUE_TYPE) type_index, (MU_PREDICATE) choice, delta, &n_matches);
+                        free(delta);
+                        delta = NULL;
+                    }
                     clock_gettime(CLOCK_MONOTONIC, &end);
                     elapsed_time = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / BILLION;
                     printf("Filtering took %.2f second(s)\n", elapsed_time);
-                    free(data);
                     if(n_matches == 0)
                     {
                         printf("No matches found\n");
                         done_filter = false;
                         break;
                     }
-                    printf("%i address<es> matching the value\n", n_matches);
+                    printf("%lu address<es> matching the value\n", n_matches);
+                    if(session_path != NULL) save_session(session_path, target, type_index, regions, matches);
                     if(!ask_for_more(ASK_FILTER))
                     {
                         stop_filter = true;
                     }
                 }
             }
+            regions_close(regions);
+            ULONG *addresses = NULL;
             if(done_filter)
             {
-                for(INT i = 0; i < n_matches; i++)
+                addresses = matchset_to_addresses(matches);
+                for(UINT64 i = 0; i < n_matches; i++)
                 {
-                    printf("Address: %#lx\n", matches[i]);
+                    printf("Address: %#lx\n", addresses[i]);
                 }
             }
 
@@ -199,17 +563,44 @@ INT main(int argc, char **argv)
                 printf("\nPlease, enter the value for the new address<es>: ");
                 data_size = ask_data(type_index, &data);
                 printf("Please wait...\n\n");
-                modify_values(target, matches, n_matches, data, data_size);
-                printf("Value<s> modified\n\n");
+                if(modify_values(target, addresses, n_matches, data, data_size) == ERR_OK)
+                {
+                    printf("Value<s> modified\n\n");
+                }
+                else printf("Some address<es> could not be modified\n\n");
+
+                /* Keep them written until the program exits */
+                if(freeze_ms > 0 && freezer == NULL) freezer = freeze_start(target, freeze_ms * 1000);
+                for(UINT64 i = 0; freezer != NULL && i < n_matches; i++)
+                {
+                    freeze_add(freezer, addresses[i], data, data_size, freeze_ms * 1000, NULL);
+                }
+                if(freezer != NULL) printf("Value<s> frozen every %lu ms\n\n", freeze_ms);
             }
+            free(addresses);
         }
-        free(matches);
+        matchset_free(matches);
+        snapshot_close(snap);
+        session_close(resumed);
+        resumed = NULL;
+        set_scan_dirty_map(NULL);
+        dirty_close(dirty);
 
         if(!ask_for_more(ASK_SCAN))
         {
             keep_scan = false;
         }
     }
+    if(freezer != NULL)
+    {
+        MU_FREEZE_STATS stats;
+        freeze_stats(freezer, &stats);
+        printf("Frozen value<s> written %lu time<s> in %lu write<s>, %lu failed, %lu late\n",
+               stats.writes, stats.syscalls, stats.failures, stats.missed);
+        freeze_stop(freezer);
+    }
+    backend_close();
+
     return ERR_OK;
 }
 
@@ -219,7 +610,28 @@ INT main(int argc, char **argv)
  */
 void show_help()
 {
-    printf("Usage: mem_scan_linux <pid_of_target>\n");
+    printf("Usage: mem_scan_linux [options] <pid_of_target>\n\n");
+    printf("Options:\n");
+    printf("  --window <KiB>        Size of the window each thread reads at once (default 1024)\n");
+    printf("  --mem-budget <MiB>    Hard limit for the memory used by read buffers (default no limit)\n");
+    printf("  --align <bytes>       Alignment of reported addresses: 1, 2, 4 or 8 (default natural for the type)\n");
+    printf("  --incremental <mode>  Only re-read pages written since the previous pass, using soft-dirty bits: 0 off, 1 on,\n"
+           "                        2 on and stopping the target while the bits are taken, so no write is missed (default 0)\n");
+    printf("  --resident <mode>     Only read pages in memory: 0 all pages, 1 in RAM, 2 in RAM or swap (default 0)\n");
+    printf("  --queue-depth <n>     Windows each thread keeps in flight with io_uring in value scans (default 0, synchronous)\n");
+    printf("  --pipeline <n>        Copy and search value scans in parallel through n buffers per thread pair (default 0, off)\n");
+    printf("  --aob <signature>     Find a signature such as \"48 8B 05 ?? ?? ?? ?? 89 ?? 24\" in all readable memory and exit.\n");
+    printf("                        Bytes may be ??, nibbles (4?), bits (0100x1xx) or masked (8B&F0). Can be repeated\n");
+    printf("  --freeze <ms>         Keep modified values frozen, rewriting them every ms milliseconds until exit (default 0, off)\n");
+    printf("  --session <file>      Save the matches after each pass, and resume from the file if it exists\n");
+    printf("  --pointers <address>  Find pointer paths from the modules to an address (such as 0x7f12...) and exit\n");
+    printf("  --ptr-depth <n>       Maximum pointers followed by a path: 1 to %d (default 4)\n", POINTER_MAX_DEPTH);
+    printf("  --ptr-offset <bytes>  Maximum offset added to each pointer (default 4096)\n");
+    printf("  --ptr-map <file>      Load the pointer map from a file, or build it and save it there if missing\n");
+    printf("  --daemon <socket>     Serve scans of the target and other processes as JSON lines on a Unix socket (see mu_daemon.h)\n");
+    printf("  --kernels <name>      Force search kernels: avx512, avx2, sse2 or scalar (default best for the CPU)\n");
+    printf("  --backend <name>      Memory access: process_vm, procmem (/proc/PID/mem, can write read-only pages) or auto (default)\n");
+    printf("  --metrics <format>    Print the counters of each scan, filter and write to stderr as text or json (default off)\n");
 }
 
 /**
@@ -240,7 +652,7 @@ void show_types()
 /**
  * @brief Asks if the user wants more scanning or filtering
  * 
- * @param option ASK_FILTER for filtering. ASK_SCAN for scanning
+ * @param option ASK_FILTER for filtering. ASK_SCAN for scanning. ASK_KNOWN for a known initial value
  * @return True if user wants more filter or scanning. False otherwise
  */
 BOOL ask_for_more(INT option)
@@ -255,6 +667,10 @@ BOOL ask_for_more(INT option)
         {
             printf("Do you want to filter the matches? (0: no; 1: yes): ");
         }
+        else if(option == ASK_KNOWN)
+        {
+            printf("Do you know the initial value? (0: no, take a snapshot; 1: yes): ");
+        }
         else printf("Do you want to scan more values? (0: no; 1: yes): ");
 
         fgets(input_buff, MAX_STR_SZ, stdin);
@@ -270,6 +686,50 @@ BOOL ask_for_more(INT option)
     return (keep_searching == 1) ? true : false;
 }
 
+/**
+ * @brief Asks how the values must have changed since the previous pass, and the delta if it is needed.
+ * REMEMBER TO FREE delta array
+ * 
+ * @param type_index Data type
+ * @param allow_equal True to also offer filtering by a given value
+ * @param delta Stores the delta of the increased/decreased by choices. NULL otherwise
+ * @return Predicate selected, or FILTER_EQUAL
+ */
+INT ask_predicate(INT type_index, BOOL allow_equal, UCHAR **delta)
+{
+    INT choice = 0;
+    INT n_choices = allow_equal ? FILTER_EQUAL + 1 : FILTER_EQUAL;
+    CHAR input_buff[MAX_STR_SZ];
+    CHAR *thrash;
+
+    printf("\n1) Changed\n2) Unchanged\n3) Increased\n4) Decreased\n5) Increased by\n6) Decreased by\n");
+    if(allow_equal) printf("7) Equal to a value\n");
+    printf("Please, select how the value changed: ");
+    while(true)
+    {
+        fgets(input_buff, MAX_STR_SZ, stdin);
+        NEWL_TO_NUL(input_buff);
+        choice = (INT32) strtol(input_buff, &thrash, 10);
+        if(*thrash != '\0' || choice < 1 || choice > n_choices)
+        {
+            printf("Please, select a correct choice (between 1 and %d): ", n_choices);
+        }
+        /* Strings have no order */
+        else if(type_index == OPT_STRNG && choice > PRED_UNCHANGED + 1 && choice <= FILTER_EQUAL)
+        {
+            printf("Strings can only be changed or unchanged. Select another choice: ");
+        }
+        else break;
+    }
+    *delta = NULL;
+    if(choice - 1 == PRED_INCREASED_BY || choice - 1 == PRED_DECREASED_BY)
+    {
+        printf("Please, select the delta: ");
+        ask_data(type_index, delta);
+    }
+    return choice - 1;
+}
+
 /**
  * @brief Asks the user for the data value, checks if value is within type limits, 
  * and provides with a byte array representation of the value. REMEMBER TO FREE data array
@@ -419,3 +879,28 @@ INT ask_data(INT type_index, UCHAR **data)
 
     return ret_val;
 }
+
+/**
+ * @brief Saves the matches of a pass, so the scan can be resumed after the program exits
+ * 
+ * @param path Path of the session file
+ * @param target PID of the target process
+ * @param type_index Data type
+ * @param regions Regions of the target
+ * @param matches Matches of the last pass
+ */
+void save_session(const CHAR *path, PID target, INT type_index, MU_REGION_TABLE *regions, MU_MATCH_SET *matches)
+{
+    MU_SESSION session;
+
+    memset(&session, 0, sizeof session);
+    session.target = target;
+    session.type = (MU_VALUE_TYPE) type_index;
+    session.chunks = regions->chunks;
+    session.n_chunks = regions->n_chunks;
+    session.matches = matches;
+    if(session_save(&session, path) != ERR_OK)
+    {
+        printf("Session could not be saved to %s\n", path);
+    }
+}
@@ -0,0 +1,240 @@
+/**
+ * @file mu_backend.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_backend.h
+ * @version 0.1
+ * @date 2022-10-15
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_backend.h"
+#include "inc/mu_utils.h"
+#include "inc/mu_diag.h"
+#include "inc/mu_metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Descriptor of /proc/PID/mem kept open for the whole session: opening it costs a path walk
+   and a ptrace access check, far more than a read */
+static INT mem_fd = -1;
+static PID mem_target = 0;
+static BOOL mem_writable = false;
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Gets the /proc/PID/mem descriptor of a target, opening it the first time
+ *
+ * @param target PID of the target process
+ * @param write True if the descriptor is needed to write
+ * @return Descriptor, or -1 if it cannot be opened
+ */
+static INT get_mem_fd(PID target, BOOL write)
+{
+    diag_trace trace;
+
+    pthread_mutex_lock(&mem_lock);
+    if(mem_fd >= 0 && mem_target != target)
+    {
+        close(mem_fd);
+        mem_fd = -1;
+    }
+    if(mem_fd < 0)
+    {
+        CHAR *path = get_mem_path(target);
+        mem_fd = open(path, O_RDWR | O_CLOEXEC);
+        mem_writable = mem_fd >= 0;
+        if(mem_fd < 0) mem_fd = open(path, O_RDONLY | O_CLOEXEC);
+        if(mem_fd < 0)
+        {
+            sprintf(trace, "%s | Cannot open the memory of %d!", __func__, target);
+            diag_error(trace, ERR_GENERIC);
+        }
+        else mem_target = target;
+        free(path);
+    }
+    INT fd = (write && !mem_writable) ? -1 : mem_fd;
+    pthread_mutex_unlock(&mem_lock);
+
+    return fd;
+}
+
+/**
+ * @brief Sums the bytes of some iovecs
+ *
+ * @param iov Iovecs
+ * @param n_iov Number of iovecs
+ * @return Bytes
+ */
+static ULONG iov_bytes(const struct iovec *iov, INT n_iov)
+{
+    ULONG total = 0;
+
+    for(INT i = 0; i < n_iov; i++) total += iov[i].iov_len;
+
+    return total;
+}
+
+static INT64 pvm_read_range(PID target, ULONG address, UCHAR *buffer, ULONG size)
+{
+    struct iovec local = {buffer, size};
+    struct iovec remote = {(void *) address, size};
+    UINT64 start = metrics_clock();
+
+    INT64 n = process_vm_readv(target, &local, 1, &remote, 1, 0);
+    metrics_count_read(size, n, start);
+
+    return n;
+}
+
+static INT64 pvm_read_vector(PID target, struct iovec *local, struct iovec *remote, INT n_iov)
+{
+    UINT64 start = metrics_clock();
+
+    INT64 n = process_vm_readv(target, local, n_iov, remote, n_iov, 0);
+    metrics_count_read(iov_bytes(remote, n_iov), n, start);
+
+    return n;
+}
+
+static INT64 pvm_write_vector(PID target, struct iovec *local, struct iovec *remote, INT n_iov)
+{
+    UINT64 start = metrics_clock();
+
+    INT64 n = process_vm_writev(target, local, n_iov, remote, n_iov, 0);
+    metrics_count_write(iov_bytes(remote, n_iov), n, start);
+
+    return n;
+}
+
+static INT64 mem_read_range(PID target, ULONG address, UCHAR *buffer, ULONG size)
+{
+    INT fd = get_mem_fd(target, false);
+    if(fd < 0) return -1;
+
+    /* Addresses above 2^63 are negative offsets: the kernel never maps them for user space */
+    UINT64 start = metrics_clock();
+    INT64 n = pread(fd, buffer, size, (off_t) address);
+    metrics_count_read(size, n, start);
+
+    return n;
+}
+
+/**
+ * @brief Transfers iovecs through /proc/PID/mem, one pread or pwrite per remote iovec
+ *
+ * @param target PID of the target process
+ * @param local Local iovecs
+ * @param remote Remote iovecs, one per local iovec
+ * @param n_iov Number of iovecs
+ * @param write True to write into the target
+ * @return Bytes transferred up to the first short iovec, or -1 if nothing could be transferred
+ */
+static INT64 mem_transfer(PID target, struct iovec *local, struct iovec *remote, INT n_iov, BOOL write)
+{
+    INT fd = get_mem_fd(target, write);
+    INT64 total = 0;
+
+    if(fd < 0) return -1;
+    for(INT i = 0; i < n_iov; i++)
+    {
+        UINT64 start = metrics_clock();
+        ssize_t n = (write) ? pwrite(fd, local[i].iov_base, remote[i].iov_len, (off_t) remote[i].iov_base)
+                            : pread(fd, local[i].iov_base, remote[i].iov_len, (off_t) remote[i].iov_base);
+        if(write) metrics_count_write(remote[i].iov_len, n, start);
+        else metrics_count_read(remote[i].iov_len, n, start);
+        if(n > 0) total += n;
+        if(n != (ssize_t) remote[i].iov_len) break;
+    }
+
+    return (total > 0) ? total : -1;
+}
+
+static INT64 mem_read_vector(PID target, struct iovec *local, struct iovec *remote, INT n_iov)
+{
+    return mem_transfer(target, local, remote, n_iov, false);
+}
+
+static INT64 mem_write_vector(PID target, struct iovec *local, struct iovec *remote, INT n_iov)
+{
+    return mem_transfer(target, local, remote, n_iov, true);
+}
+
+static const MU_BACKEND backend_pvm = {"process_vm", BACKEND_CAP_VECTORED, pvm_read_range, pvm_read_vector, pvm_write_vector};
+static const MU_BACKEND backend_mem = {"procmem", BACKEND_CAP_WRITE_RO, mem_read_range, mem_read_vector, mem_write_vector};
+
+static const MU_BACKEND *active = NULL;
+static pthread_once_t active_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Chooses process_vm unless reading this process with it is refused (ENOSYS on kernels
+ * without CONFIG_CROSS_MEMORY_ATTACH, EPERM under some seccomp policies)
+ */
+static void choose_backend()
+{
+    diag_trace trace;
+    UINT64 probe = 0;
+    UINT64 copy = 0;
+
+    if(active != NULL) return;
+    active = &backend_pvm;
+    if(pvm_read_range(getpid(), (ULONG) &probe, (UCHAR *) &copy, sizeof copy) < 0 && (errno == ENOSYS || errno == EPERM))
+    {
+        active = &backend_mem;
+    }
+    sprintf(trace, "%s | Using %s memory backend", __func__, active->name);
+    diag_info(trace);
+}
+
+const MU_BACKEND* backend_get()
+{
+    if(active == NULL) pthread_once(&active_once, choose_backend);
+
+    return active;
+}
+
+const MU_BACKEND* backend_find(const CHAR *name)
+{
+    if(strcmp(name, backend_pvm.name) == 0) return &backend_pvm;
+    if(strcmp(name, backend_mem.name) == 0) return &backend_mem;
+
+    return NULL;
+}
+
+MU_ERROR backend_select(const CHAR *name)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+
+    if(strcmp(name, "auto") == 0)
+    {
+        active = NULL;
+        choose_backend();
+        return is_ok;
+    }
+
+    const MU_BACKEND *found = backend_find(name);
+    if(found == NULL)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Memory backend '%s' is unknown!", __func__, name);
+        diag_error(trace, is_ok);
+    }
+    else active = found;
+
+    return is_ok;
+}
+
+void backend_close()
+{
+    pthread_mutex_lock(&mem_lock);
+    if(mem_fd >= 0) close(mem_fd);
+    mem_fd = -1;
+    mem_target = 0;
+    pthread_mutex_unlock(&mem_lock);
+}
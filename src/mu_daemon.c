@@ -0,0 +1,1260 @@
+/**
+ * @file mu_daemon.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_daemon.h
+ * @version 0.1
+ * @date 2022-10-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_daemon.h"
+#include "inc/mu_utils.h"
+#include "inc/mu_io.h"
+#include "inc/mu_regions.h"
+#include "inc/mu_matchset.h"
+#include "inc/mu_scanner.h"
+#include "inc/mu_residency.h"
+#include "inc/mu_freeze.h"
+#include "inc/mu_session.h"
+#include "inc/mu_metrics.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define MODIF_CHNKS         1
+#define MAX_FIELDS          16          /* Fields of a request */
+#define MAX_VALUE_SZ        1024        /* Bytes of a value, as the strings of mem_scan_linux */
+#define READ_STEP           4096        /* Free space ensured before each read from a client */
+#define GATHER_BATCH        256         /* Addresses gathered from a region at once */
+#define FREEZE_INTERVAL_MS  10          /* Default interval of freeze */
+
+/* Field of a request. Both strings point into the line, unescaped in place */
+typedef struct json_field
+{
+    CHAR    *key;
+    CHAR    *value;
+    BOOL    is_string;
+
+} MU_JSON_FIELD;
+
+typedef struct request
+{
+    MU_JSON_FIELD   fields[MAX_FIELDS];
+    INT             n_fields;
+
+} MU_REQUEST;
+
+/* Runs a command. Appends its results to the response and returns NULL, or returns an error message
+   without appending anything */
+typedef const CHAR* (*MU_COMMAND_FN)(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client);
+
+typedef struct command
+{
+    const CHAR      *name;
+    MU_COMMAND_FN   run;
+
+} MU_COMMAND;
+
+/* Names of MU_VALUE_TYPE and MU_PREDICATE, in the order of their values */
+static const CHAR *type_names[] = {"uint8", "int16", "int32", "int64", "float", "double", "string"};
+static const CHAR *pred_names[] = {"changed", "unchanged", "increased", "decreased", "increased_by", "decreased_by"};
+
+/**
+ * @brief Gets the monotonic time in milliseconds
+ */
+static REAL64 now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* REQUESTS -------------------------------------------------------------------------- */
+
+static CHAR* skip_space(CHAR *p)
+{
+    while(*p == ' ' || *p == '\t' || *p == '\r') p++;
+    return p;
+}
+
+/**
+ * @brief Unescapes a JSON string in place. Escapes of characters outside ASCII are not supported
+ *
+ * @param p Opening quote
+ * @param text Stores the start of the unescaped string, terminated by a null byte
+ * @return Position after the closing quote. NULL if the string is malformed
+ */
+static CHAR* parse_string(CHAR *p, CHAR **text)
+{
+    CHAR *out = ++p;
+
+    *text = out;
+    while(*p != '"')
+    {
+        if(*p == '\0') return NULL;
+        if(*p != '\\')
+        {
+            *out++ = *p++;
+            continue;
+        }
+        switch(*++p)
+        {
+            case '"':
+            case '\\':
+            case '/':   *out++ = *p; break;
+            case 'n':   *out++ = '\n'; break;
+            case 't':   *out++ = '\t'; break;
+            case 'r':   *out++ = '\r'; break;
+            case 'u':
+            {
+                CHAR hex[5] = {0};
+                CHAR *thrash;
+                if(strlen(p + 1) < 4) return NULL;
+                memcpy(hex, p + 1, 4);
+                ULONG code = strtoul(hex, &thrash, 16);
+                if(*thrash != '\0' || code == 0 || code > 0x7F) return NULL;
+                *out++ = (CHAR) code;
+                p += 4;
+                break;
+            }
+            default:    return NULL;
+        }
+        p++;
+    }
+    *out = '\0';
+
+    return p + 1;
+}
+
+/**
+ * @brief Parses a request: a flat JSON object whose values are strings, numbers, booleans or null.
+ * The line is modified, and the fields point into it
+ *
+ * @param line Line of the request, without its newline
+ * @param req Stores the fields
+ * @return True if the line is such an object
+ */
+static BOOL parse_request(CHAR *line, MU_REQUEST *req)
+{
+    CHAR *p = skip_space(line);
+
+    req->n_fields = 0;
+    if(*p++ != '{') return false;
+    p = skip_space(p);
+    if(*p == '}') return *skip_space(p + 1) == '\0';
+
+    while(true)
+    {
+        if(req->n_fields == MAX_FIELDS || *p != '"') return false;
+        MU_JSON_FIELD *field = &req->fields[req->n_fields++];
+        p = parse_string(p, &field->key);
+        if(p == NULL) return false;
+        p = skip_space(p);
+        if(*p++ != ':') return false;
+        p = skip_space(p);
+
+        CHAR sep;
+        field->is_string = *p == '"';
+        if(field->is_string)
+        {
+            p = parse_string(p, &field->value);
+            if(p == NULL) return false;
+            p = skip_space(p);
+            sep = *p;
+        }
+        else
+        {
+            /* Bare values end at the separator, which is read before the value is terminated */
+            field->value = p;
+            while(*p == '-' || *p == '+' || *p == '.' || (*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')) p++;
+            if(p == field->value) return false;
+            CHAR *stop = p;
+            p = skip_space(p);
+            sep = *p;
+            *stop = '\0';
+        }
+
+        if(sep == '}') return *skip_space(p + 1) == '\0';
+        if(sep != ',') return false;
+        p = skip_space(p + 1);
+    }
+}
+
+/**
+ * @brief Checks that a bare value is valid JSON: a number, true, false or null
+ *
+ * @param text Value
+ * @return True if it can be copied as it is into a response
+ */
+static BOOL is_json_literal(const CHAR *text)
+{
+    const CHAR *p = text;
+
+    if(strcmp(text, "true") == 0 || strcmp(text, "false") == 0 || strcmp(text, "null") == 0) return true;
+
+    /* -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? */
+    if(*p == '-') p++;
+    if(*p == '0') p++;
+    else if(*p >= '1' && *p <= '9') while(*p >= '0' && *p <= '9') p++;
+    else return false;
+    if(*p == '.')
+    {
+        if(*++p < '0' || *p > '9') return false;
+        while(*p >= '0' && *p <= '9') p++;
+    }
+    if(*p == 'e' || *p == 'E')
+    {
+        if(*++p == '+' || *p == '-') p++;
+        if(*p < '0' || *p > '9') return false;
+        while(*p >= '0' && *p <= '9') p++;
+    }
+
+    return *p == '\0';
+}
+
+static CHAR* req_get(MU_REQUEST *req, const CHAR *key)
+{
+    for(INT i = 0; i < req->n_fields; i++)
+    {
+        if(strcmp(req->fields[i].key, key) == 0) return req->fields[i].value;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Gets a field as an unsigned number. Numbers may also be given as strings, such as "0x7f..."
+ *
+ * @param req Request
+ * @param key Name of the field
+ * @param value Stores the number. Untouched if the field is missing
+ * @return ERR_OK, ERR_FUNC_OPT if the field is missing or ERR_ARGS_MAIN if it is not a number
+ */
+static MU_ERROR req_ulong(MU_REQUEST *req, const CHAR *key, ULONG *value)
+{
+    CHAR *text = req_get(req, key);
+    CHAR *thrash;
+
+    if(text == NULL) return ERR_FUNC_OPT;
+    if(*text == '-' || *text == '\0') return ERR_ARGS_MAIN;
+    errno = 0;
+    ULONG number = strtoul(text, &thrash, 0);
+    if(*thrash != '\0' || errno != 0) return ERR_ARGS_MAIN;
+    *value = number;
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Finds a type or predicate by name
+ *
+ * @return Position of the name. -1 if it is not in the list
+ */
+static INT find_name(const CHAR **names, INT n_names, const CHAR *name)
+{
+    for(INT i = 0; name != NULL && i < n_names; i++)
+    {
+        if(strcmp(names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Parses a value of a type with the same ranges as mem_scan_linux. Strings keep their null byte
+ *
+ * @param type Type of the value
+ * @param text Value as text
+ * @param data Stores the bytes of the value. MAX_VALUE_SZ bytes
+ * @param data_size Stores the size of the value
+ * @return True if the value is valid for the type
+ */
+static BOOL parse_value(MU_VALUE_TYPE type, const CHAR *text, UCHAR *data, ULONG *data_size)
+{
+    MU_TYPES value;
+    CHAR *thrash = NULL;
+
+    if(text == NULL || (type != VAL_STRING && *text == '\0')) return false;
+    errno = 0;
+    switch(type)
+    {
+        case VAL_UINT8:
+            value.int64 = strtol(text, &thrash, 10);
+            if(value.int64 < 0 || value.int64 > UCHAR_MAX) return false;
+            value.byte = (UCHAR) value.int64;
+            *data_size = 1;
+            break;
+        case VAL_INT16:
+            value.int64 = strtol(text, &thrash, 10);
+            if(value.int64 < SHRT_MIN || value.int64 > SHRT_MAX) return false;
+            value.int16 = (INT16) value.int64;
+            *data_size = 2;
+            break;
+        case VAL_INT32:
+            value.int64 = strtol(text, &thrash, 10);
+            if(value.int64 < INT_MIN || value.int64 > INT_MAX) return false;
+            value.int32 = (INT32) value.int64;
+            *data_size = 4;
+            break;
+        case VAL_INT64:
+            value.int64 = strtol(text, &thrash, 10);
+            *data_size = 8;
+            break;
+        case VAL_REAL32:
+            value.real32 = strtof(text, &thrash);
+            *data_size = 4;
+            break;
+        case VAL_REAL64:
+            value.real64 = strtod(text, &thrash);
+            *data_size = 8;
+            break;
+        case VAL_STRING:
+            *data_size = strlen(text) + 1;
+            if(*data_size > MAX_VALUE_SZ) return false;
+            memcpy(data, text, *data_size);
+            return true;
+    }
+    if(*thrash != '\0' || errno != 0) return false;
+    memcpy(data, value.bytes64, *data_size);
+
+    return true;
+}
+
+/* RESPONSES ------------------------------------------------------------------------- */
+
+/**
+ * @brief Appends text to the responses waiting for a client
+ *
+ * @param client Client
+ * @param format Format of printf
+ */
+static void out_printf(MU_DAEMON_CLIENT *client, const CHAR *format, ...)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    va_list args;
+
+    va_start(args, format);
+    INT len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if(client->out_len + len + 1 > client->out_cap)
+    {
+        ULONG cap = (client->out_cap == 0) ? READ_STEP : client->out_cap;
+        while(client->out_len + len + 1 > cap) cap *= 2;
+        CHAR *out = realloc(client->out, cap);
+        if(out == NULL)
+        {
+            is_ok = ERR_GENERIC;
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+        client->out = out;
+        client->out_cap = cap;
+    }
+    va_start(args, format);
+    vsnprintf(client->out + client->out_len, len + 1, format, args);
+    va_end(args);
+    client->out_len += len;
+}
+
+/**
+ * @brief Appends a string to the responses of a client, quoted and escaped for JSON
+ */
+static void out_string(MU_DAEMON_CLIENT *client, const CHAR *text)
+{
+    out_printf(client, "\"");
+    for(const UCHAR *p = (const UCHAR *) text; *p != '\0'; p++)
+    {
+        if(*p == '"' || *p == '\\') out_printf(client, "\\%c", *p);
+        else if(*p < 0x20) out_printf(client, "\\u%04x", *p);
+        else out_printf(client, "%c", *p);
+    }
+    out_printf(client, "\"");
+}
+
+/* TARGETS --------------------------------------------------------------------------- */
+
+/**
+ * @brief Drops the matches of a target, and the session they were loaded from
+ */
+static void drop_matches(MU_DAEMON_TARGET *target)
+{
+    matchset_free(target->matches);
+    target->matches = NULL;
+    session_close(target->session);
+    target->session = NULL;
+}
+
+/**
+ * @brief Frees the state of a target and removes it from the daemon
+ *
+ * @param daemon Daemon
+ * @param index Position of the target
+ */
+static void detach_target(MU_DAEMON *daemon, INT index)
+{
+    MU_DAEMON_TARGET *target = &daemon->targets[index];
+
+    if(target->freezer != NULL) freeze_stop(target->freezer);
+    drop_matches(target);
+    regions_close(target->regions);
+    daemon->targets[index] = daemon->targets[--daemon->n_targets];
+}
+
+/**
+ * @brief Gets the target named by a request. The pid can be left out while a single target is attached
+ *
+ * @param daemon Daemon
+ * @param req Request
+ * @param error Stores the error message if there is no such target
+ * @return Target. NULL if it is not attached
+ */
+static MU_DAEMON_TARGET* find_target(MU_DAEMON *daemon, MU_REQUEST *req, const CHAR **error)
+{
+    ULONG pid = 0;
+    MU_ERROR has_pid = req_ulong(req, "pid", &pid);
+
+    if(has_pid == ERR_ARGS_MAIN)
+    {
+        *error = "pid is not a number";
+        return NULL;
+    }
+    if(has_pid == ERR_FUNC_OPT)
+    {
+        if(daemon->n_targets == 1) return &daemon->targets[0];
+        *error = "pid is needed unless a single target is attached";
+        return NULL;
+    }
+    for(INT i = 0; i < daemon->n_targets; i++)
+    {
+        if(daemon->targets[i].pid == (PID) pid) return &daemon->targets[i];
+    }
+    *error = "Target is not attached";
+
+    return NULL;
+}
+
+/**
+ * @brief Parses a value of a request in the type of its target: the type of its matches, or the
+ * "type" of the request
+ *
+ * @param target Target
+ * @param req Request
+ * @param key Name of the field holding the value
+ * @param data Stores the bytes of the value. MAX_VALUE_SZ bytes
+ * @param data_size Stores the size of the value
+ * @return NULL, or an error message
+ */
+static const CHAR* target_value(MU_DAEMON_TARGET *target, MU_REQUEST *req, const CHAR *key, UCHAR *data, ULONG *data_size)
+{
+    INT type = (target->matches != NULL) ? (INT) target->type : -1;
+    CHAR *type_name = req_get(req, "type");
+
+    if(type_name != NULL) type = find_name(type_names, VAL_STRING + 1, type_name);
+    if(type < 0) return (type_name != NULL) ? "Unknown type" : "type is needed before the first scan";
+    if(req_get(req, key) == NULL) return (strcmp(key, "value") == 0) ? "value is needed" : "delta is needed";
+    if(!parse_value((MU_VALUE_TYPE) type, req_get(req, key), data, data_size)) return "Value out of the range of its type";
+
+    return NULL;
+}
+
+/**
+ * @brief Gets the addresses a write or freeze applies to: its "address", or else every match
+ *
+ * @param target Target
+ * @param req Request
+ * @param n_addresses Stores the number of addresses
+ * @param error Stores the error message, if any
+ * @return Addresses. REMEMBER TO FREE. NULL on error
+ */
+static ULONG* target_addresses(MU_DAEMON_TARGET *target, MU_REQUEST *req, UINT64 *n_addresses, const CHAR **error)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    ULONG address = 0;
+    ULONG *addresses = NULL;
+    MU_ERROR has_address = req_ulong(req, "address", &address);
+
+    *n_addresses = 0;
+    if(has_address == ERR_ARGS_MAIN)
+    {
+        *error = "address is not a number";
+        return NULL;
+    }
+    if(has_address == ERR_OK)
+    {
+        addresses = malloc(sizeof *addresses);
+        if(addresses == NULL)
+        {
+            is_ok = ERR_GENERIC;
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+        addresses[0] = address;
+        *n_addresses = 1;
+        return addresses;
+    }
+    if(target->matches == NULL || target->matches->n_matches == 0)
+    {
+        *error = "No matches, give an address";
+        return NULL;
+    }
+    *n_addresses = target->matches->n_matches;
+
+    return matchset_to_addresses(target->matches);
+}
+
+/* COMMANDS -------------------------------------------------------------------------- */
+
+static const CHAR* cmd_ping(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    (void) req;
+    out_printf(client, ",\"requests\":%lu", daemon->requests);
+    return NULL;
+}
+
+static const CHAR* cmd_shutdown(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    (void) req;
+    (void) client;
+    daemon->quit = true;
+    return NULL;
+}
+
+static const CHAR* cmd_attach(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    ULONG pid = 0;
+
+    if(req_ulong(req, "pid", &pid) != ERR_OK || pid == 0 || pid > INT_MAX) return "pid is needed";
+    if(daemon_attach(daemon, (PID) pid) != ERR_OK) return "Cannot attach the process";
+    for(INT i = 0; i < daemon->n_targets; i++)
+    {
+        if(daemon->targets[i].pid == (PID) pid)
+        {
+            out_printf(client, ",\"pid\":%d,\"regions\":%d", (PID) pid, daemon->targets[i].regions->n_chunks);
+        }
+    }
+    return NULL;
+}
+
+static const CHAR* cmd_detach(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    const CHAR *error = NULL;
+    MU_DAEMON_TARGET *target = find_target(daemon, req, &error);
+
+    if(target == NULL) return error;
+    out_printf(client, ",\"pid\":%d", target->pid);
+    detach_target(daemon, (INT) (target - daemon->targets));
+
+    return NULL;
+}
+
+static const CHAR* cmd_targets(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    (void) req;
+    out_printf(client, ",\"targets\":[");
+    for(INT i = 0; i < daemon->n_targets; i++)
+    {
+        MU_DAEMON_TARGET *target = &daemon->targets[i];
+        MU_FREEZE_STATS stats = {0};
+        if(target->freezer != NULL) freeze_stats(target->freezer, &stats);
+        out_printf(client, "%s{\"pid\":%d,\"regions\":%d,", (i > 0) ? "," : "", target->pid, target->regions->n_chunks);
+        if(target->matches != NULL)
+        {
+            out_printf(client, "\"type\":\"%s\",\"matches\":%lu,", type_names[target->type], target->matches->n_matches);
+        }
+        out_printf(client, "\"frozen\":%lu}", stats.n_entries);
+    }
+    out_printf(client, "]");
+
+    return NULL;
+}
+
+static const CHAR* cmd_scan(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    const CHAR *error = NULL;
+    MU_DAEMON_TARGET *target = find_target(daemon, req, &error);
+    UCHAR data[MAX_VALUE_SZ];
+    ULONG data_size = 0;
+    UINT64 n_matches = 0;
+
+    if(target == NULL) return error;
+    if(req_get(req, "type") == NULL) return "type is needed";
+    error = target_value(target, req, "value", data, &data_size);
+    if(error != NULL) return error;
+
+    REAL64 start = now_ms();
+    drop_matches(target);
+    target->type = (MU_VALUE_TYPE) find_name(type_names, VAL_STRING + 1, req_get(req, "type"));
+    io_bad_ranges_reset(target->pid);
+    regions_refresh(target->regions);
+
+    /* The region table was just refreshed: the maps are not read again for the scan */
+    MU_MEM_CHUNK *chunks = target->regions->chunks;
+    INT n_chunks = target->regions->n_chunks;
+    MU_MEM_CHUNK *runs = NULL;
+    if(get_scan_residency() != RESIDENCY_OFF)
+    {
+        runs = residency_filter(target->pid, chunks, n_chunks, get_scan_residency(), &n_chunks);
+        if(runs != NULL) chunks = runs;
+        else n_chunks = target->regions->n_chunks;
+    }
+    target->matches = execute_scanner_chunks(target->pid, chunks, n_chunks, data, data_size, &n_matches);
+    free(runs);
+    if(target->matches == NULL) return "Scan failed";
+    out_printf(client, ",\"matches\":%lu,\"ms\":%.3f", n_matches, now_ms() - start);
+
+    return NULL;
+}
+
+static const CHAR* cmd_filter(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    const CHAR *error = NULL;
+    MU_DAEMON_TARGET *target = find_target(daemon, req, &error);
+    UCHAR data[MAX_VALUE_SZ];
+    ULONG data_size = 0;
+    UCHAR delta[MAX_VALUE_SZ];
+    ULONG delta_size = 0;
+    UINT64 n_matches = 0;
+    UINT64 dropped = 0;
+    MU_ERROR is_ok = ERR_OK;
+
+    if(target == NULL) return error;
+    if(target->matches == NULL) return "No scan to filter";
+    if(req_get(req, "type") != NULL) return "type is that of the scan";
+
+    CHAR *pred_name = req_get(req, "pred");
+    INT pred = find_name(pred_names, PRED_DECREASED_BY + 1, pred_name);
+    if(pred_name == NULL)
+    {
+        error = target_value(target, req, "value", data, &data_size);
+    }
+    else if(pred < 0) error = "Unknown pred";
+    else if(target->type == VAL_STRING && pred != PRED_CHANGED && pred != PRED_UNCHANGED)
+    {
+        error = "Strings only support changed and unchanged";
+    }
+    else if(pred == PRED_INCREASED_BY || pred == PRED_DECREASED_BY)
+    {
+        error = target_value(target, req, "delta", delta, &delta_size);
+    }
+    if(error != NULL) return error;
+
+    /* Candidates of regions unmapped since the last pass cannot be read */
+    REAL64 start = now_ms();
+    if(regions_refresh(target->regions) == ERR_OK)
+    {
+        dropped = matchset_drop_unmapped(target->matches, target->regions->chunks, target->regions->n_chunks);
+    }
+    if(pred_name == NULL)
+    {
+        is_ok = execute_filtering(target->pid, target->matches, data, data_size, &n_matches);
+    }
+    else
+    {
+        is_ok = execute_relational_filtering(target->pid, target->matches, target->type, (MU_PREDICATE) pred,
+                                             (delta_size > 0) ? delta : NULL, &n_matches);
+    }
+    if(is_ok != ERR_OK) return "Filter failed";
+    out_printf(client, ",\"matches\":%lu,\"dropped\":%lu,\"ms\":%.3f", n_matches, dropped, now_ms() - start);
+
+    return NULL;
+}
+
+static const CHAR* cmd_matches(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    const CHAR *error = NULL;
+    MU_DAEMON_TARGET *target = find_target(daemon, req, &error);
+    ULONG max = 100;
+    ULONG batch[GATHER_BATCH];
+    ULONG listed = 0;
+
+    if(target == NULL) return error;
+    if(target->matches == NULL) return "No scan yet";
+    if(req_ulong(req, "max", &max) == ERR_ARGS_MAIN) return "max is not a number";
+    if(max > DAEMON_MAX_LISTED) max = DAEMON_MAX_LISTED;
+
+    out_printf(client, ",\"matches\":%lu,\"addresses\":[", target->matches->n_matches);
+    for(ULONG rid = 0; rid < target->matches->n_regions && listed < max; rid++)
+    {
+        UINT64 pos = 0;
+        ULONG n = 0;
+        ULONG want = (max - listed < GATHER_BATCH) ? max - listed : GATHER_BATCH;
+        while(listed < max && (n = matchset_gather(target->matches, rid, &pos, batch, want)) > 0)
+        {
+            for(ULONG i = 0; i < n; i++, listed++)
+            {
+                out_printf(client, "%s\"%#lx\"", (listed > 0) ? "," : "", batch[i]);
+            }
+            want = (max - listed < GATHER_BATCH) ? max - listed : GATHER_BATCH;
+        }
+    }
+    out_printf(client, "]");
+
+    return NULL;
+}
+
+static const CHAR* cmd_write(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    const CHAR *error = NULL;
+    MU_DAEMON_TARGET *target = find_target(daemon, req, &error);
+    UCHAR data[MAX_VALUE_SZ];
+    ULONG data_size = 0;
+    UINT64 n_addresses = 0;
+
+    if(target == NULL) return error;
+    error = target_value(target, req, "value", data, &data_size);
+    if(error != NULL) return error;
+    ULONG *addresses = target_addresses(target, req, &n_addresses, &error);
+    if(addresses == NULL) return error;
+
+    MU_ERROR is_ok = modify_values(target->pid, addresses, n_addresses, data, data_size);
+    free(addresses);
+    if(is_ok != ERR_OK) return "Some addresses could not be written";
+    out_printf(client, ",\"written\":%lu", n_addresses);
+
+    return NULL;
+}
+
+static const CHAR* cmd_freeze(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    const CHAR *error = NULL;
+    MU_DAEMON_TARGET *target = find_target(daemon, req, &error);
+    UCHAR data[MAX_VALUE_SZ];
+    ULONG data_size = 0;
+    UINT64 n_addresses = 0;
+    ULONG interval_ms = FREEZE_INTERVAL_MS;
+
+    if(target == NULL) return error;
+    if(req_ulong(req, "interval_ms", &interval_ms) == ERR_ARGS_MAIN || interval_ms == 0) return "interval_ms must be a positive number";
+    error = target_value(target, req, "value", data, &data_size);
+    if(error != NULL) return error;
+    if(req_get(req, "address") == NULL && target->matches != NULL && target->matches->n_matches > DAEMON_MAX_LISTED)
+    {
+        return "Too many matches to freeze";
+    }
+    ULONG *addresses = target_addresses(target, req, &n_addresses, &error);
+    if(addresses == NULL) return error;
+
+    if(target->freezer == NULL) target->freezer = freeze_start(target->pid, FREEZE_DEFAULT_TICK_US);
+    if(target->freezer == NULL)
+    {
+        free(addresses);
+        return "Cannot start the freezer";
+    }
+    out_printf(client, ",\"frozen\":%lu,\"ids\":[", n_addresses);
+    for(UINT64 i = 0; i < n_addresses; i++)
+    {
+        UINT64 id = 0;
+        freeze_add(target->freezer, addresses[i], data, data_size, interval_ms * 1000, &id);
+        out_printf(client, "%s%lu", (i > 0) ? "," : "", id);
+    }
+    out_printf(client, "]");
+    free(addresses);
+
+    return NULL;
+}
+
+static const CHAR* cmd_unfreeze(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    const CHAR *error = NULL;
+    MU_DAEMON_TARGET *target = find_target(daemon, req, &error);
+    ULONG id = 0;
+    MU_FREEZE_STATS stats = {0};
+
+    if(target == NULL) return error;
+    MU_ERROR has_id = req_ulong(req, "freeze_id", &id);
+    if(has_id == ERR_ARGS_MAIN) return "freeze_id is not a number";
+    if(has_id == ERR_OK)
+    {
+        if(target->freezer == NULL || freeze_remove(target->freezer, id) != ERR_OK) return "No frozen value has the id";
+        freeze_stats(target->freezer, &stats);
+    }
+    /* Without an id, every value of the target */
+    else if(target->freezer != NULL)
+    {
+        freeze_stop(target->freezer);
+        target->freezer = NULL;
+    }
+    out_printf(client, ",\"frozen\":%lu", stats.n_entries);
+
+    return NULL;
+}
+
+static const CHAR* cmd_freezes(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    const CHAR *error = NULL;
+    MU_DAEMON_TARGET *target = find_target(daemon, req, &error);
+    MU_FREEZE_STATS stats = {0};
+    ULONG n_entries = 0;
+    MU_FREEZE_ENTRY *entries = NULL;
+
+    if(target == NULL) return error;
+    if(target->freezer != NULL)
+    {
+        entries = freeze_list(target->freezer, &n_entries);
+        freeze_stats(target->freezer, &stats);
+    }
+    out_printf(client, ",\"entries\":[");
+    for(ULONG i = 0; i < n_entries; i++)
+    {
+        out_printf(client, "%s{\"id\":%lu,\"address\":\"%#lx\",\"interval_ms\":%lu,\"writes\":%lu,\"failures\":%lu}",
+                   (i > 0) ? "," : "", entries[i].id, entries[i].address, entries[i].interval_us / 1000,
+                   entries[i].writes, entries[i].failures);
+    }
+    out_printf(client, "],\"writes\":%lu,\"syscalls\":%lu,\"failures\":%lu,\"missed\":%lu",
+               stats.writes, stats.syscalls, stats.failures, stats.missed);
+    free(entries);
+
+    return NULL;
+}
+
+static const CHAR* cmd_save(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    const CHAR *error = NULL;
+    MU_DAEMON_TARGET *target = find_target(daemon, req, &error);
+    MU_SESSION session;
+
+    if(target == NULL) return error;
+    if(req_get(req, "path") == NULL) return "path is needed";
+    if(target->matches == NULL) return "No scan to save";
+
+    memset(&session, 0, sizeof session);
+    session.target = target->pid;
+    session.type = target->type;
+    session.chunks = target->regions->chunks;
+    session.n_chunks = target->regions->n_chunks;
+    session.matches = target->matches;
+    if(session_save(&session, req_get(req, "path")) != ERR_OK) return "Session could not be saved";
+    out_printf(client, ",\"matches\":%lu", target->matches->n_matches);
+
+    return NULL;
+}
+
+static const CHAR* cmd_load(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    const CHAR *error = NULL;
+    MU_DAEMON_TARGET *target = find_target(daemon, req, &error);
+
+    if(target == NULL) return error;
+    if(req_get(req, "path") == NULL) return "path is needed";
+    MU_SESSION *session = session_load(req_get(req, "path"));
+    if(session == NULL) return "Session could not be loaded";
+    if(session->target != target->pid || session->matches == NULL)
+    {
+        session_close(session);
+        return "Session is of another target";
+    }
+
+    /* The matches point into the mapping of the session, which is kept open with them */
+    drop_matches(target);
+    target->type = session->type;
+    target->matches = session->matches;
+    target->session = session;
+    session->matches = NULL;
+    out_printf(client, ",\"matches\":%lu", target->matches->n_matches);
+
+    return NULL;
+}
+
+static const CHAR* cmd_metrics(MU_DAEMON *daemon, MU_REQUEST *req, MU_DAEMON_CLIENT *client)
+{
+    CHAR text[METRICS_MAX_TEXT];
+    MU_METRICS metrics;
+    (void) daemon;
+    (void) req;
+
+    const CHAR *operation = metrics_last(&metrics);
+    metrics_format(&metrics, operation, METRICS_JSON, text, sizeof text);
+    out_printf(client, ",\"last\":%s", text);
+    metrics_total(&metrics);
+    metrics_format(&metrics, NULL, METRICS_JSON, text, sizeof text);
+    out_printf(client, ",\"total\":%s", text);
+
+    return NULL;
+}
+
+static const MU_COMMAND commands[] =
+{
+    {"ping",        &cmd_ping},
+    {"shutdown",    &cmd_shutdown},
+    {"attach",      &cmd_attach},
+    {"detach",      &cmd_detach},
+    {"targets",     &cmd_targets},
+    {"scan",        &cmd_scan},
+    {"filter",      &cmd_filter},
+    {"matches",     &cmd_matches},
+    {"write",       &cmd_write},
+    {"freeze",      &cmd_freeze},
+    {"unfreeze",    &cmd_unfreeze},
+    {"freezes",     &cmd_freezes},
+    {"save",        &cmd_save},
+    {"load",        &cmd_load},
+    {"metrics",     &cmd_metrics}
+};
+
+/**
+ * @brief Runs one request and appends its response line. The id is echoed as it was given
+ *
+ * @param daemon Daemon
+ * @param client Client that sent the request
+ * @param line Request, without its newline
+ */
+static void handle_request(MU_DAEMON *daemon, MU_DAEMON_CLIENT *client, CHAR *line)
+{
+    MU_REQUEST req;
+    const CHAR *error = NULL;
+    ULONG mark = client->out_len;
+
+    daemon->requests++;
+    if(!parse_request(line, &req))
+    {
+        out_printf(client, "{\"ok\":false,\"error\":\"Request is not a flat JSON object\"}\n");
+        return;
+    }
+
+    MU_JSON_FIELD *id = NULL;
+    for(INT i = 0; i < req.n_fields; i++)
+    {
+        if(strcmp(req.fields[i].key, "id") == 0) id = &req.fields[i];
+    }
+    CHAR *name = req_get(&req, "cmd");
+    const MU_COMMAND *command = NULL;
+    for(ULONG c = 0; name != NULL && c < sizeof commands / sizeof commands[0]; c++)
+    {
+        if(strcmp(commands[c].name, name) == 0) command = &commands[c];
+    }
+
+    /* Echoing it would not give JSON back */
+    if(id != NULL && !id->is_string && !is_json_literal(id->value))
+    {
+        out_printf(client, "{\"id\":null,\"ok\":false,\"error\":\"id must be a number, a string, true, false or null\"}\n");
+        return;
+    }
+
+    for(INT attempt = 0; attempt < 2; attempt++)
+    {
+        out_printf(client, "{");
+        if(id != NULL && id->is_string)
+        {
+            out_printf(client, "\"id\":");
+            out_string(client, id->value);
+            out_printf(client, ",");
+        }
+        else if(id != NULL) out_printf(client, "\"id\":%s,", id->value);
+
+        /* The command appends nothing when it fails: the response is written again with the error */
+        if(attempt == 1)
+        {
+            out_printf(client, "\"ok\":false,\"error\":");
+            out_string(client, error);
+            break;
+        }
+        out_printf(client, "\"ok\":true");
+        if(command == NULL) error = (name == NULL) ? "cmd is needed" : "Unknown cmd";
+        else if(command->run == &cmd_metrics) error = command->run(daemon, &req, client);
+        else
+        {
+            /* The whole request is one operation, refreshing the regions of the target included */
+            MU_METRICS metrics;
+            metrics_begin(&metrics);
+            error = command->run(daemon, &req, client);
+            metrics_end(command->name, &metrics);
+        }
+        if(error == NULL) break;
+        client->out_len = mark;
+    }
+    out_printf(client, "}\n");
+}
+
+/* CLIENTS --------------------------------------------------------------------------- */
+
+static void client_close(MU_DAEMON_CLIENT *client)
+{
+    close(client->fd);
+    free(client->in);
+    free(client->out);
+    memset(client, 0, sizeof *client);
+    client->fd = -1;
+}
+
+/**
+ * @brief Sends as much of the pending responses as the socket takes without blocking
+ *
+ * @return False if the connection is broken
+ */
+static BOOL client_flush(MU_DAEMON_CLIENT *client)
+{
+    while(client->out_sent < client->out_len)
+    {
+        ssize_t sent = send(client->fd, client->out + client->out_sent, client->out_len - client->out_sent,
+                            MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return true;
+        if(sent <= 0) return false;
+        client->out_sent += sent;
+    }
+    client->out_len = 0;
+    client->out_sent = 0;
+
+    return true;
+}
+
+/**
+ * @brief Reads what a client sent and runs each complete line, in order
+ *
+ * @param daemon Daemon
+ * @param client Client
+ * @return False if the connection is broken or sent a line too long
+ */
+static BOOL client_read(MU_DAEMON *daemon, MU_DAEMON_CLIENT *client)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+
+    if(client->in_cap - client->in_len < READ_STEP + 1)
+    {
+        ULONG cap = (client->in_cap == 0) ? 4 * READ_STEP : client->in_cap * 2;
+        CHAR *in = realloc(client->in, cap);
+        if(in == NULL)
+        {
+            is_ok = ERR_GENERIC;
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+        client->in = in;
+        client->in_cap = cap;
+    }
+    ssize_t got = recv(client->fd, client->in + client->in_len, client->in_cap - client->in_len - 1, MSG_DONTWAIT);
+    if(got < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    if(got == 0) client->eof = true;
+    client->in_len += got;
+    client->in[client->in_len] = '\0';
+
+    /* Requests stop being run at shutdown, as for the other clients */
+    ULONG start = 0;
+    CHAR *newline = NULL;
+    while(!daemon->quit && (newline = memchr(client->in + start, '\n', client->in_len - start)) != NULL)
+    {
+        *newline = '\0';
+        if(newline > client->in + start && newline[-1] == '\r') newline[-1] = '\0';
+        if(client->in[start] != '\0') handle_request(daemon, client, client->in + start);
+        start = newline - client->in + 1;
+    }
+    memmove(client->in, client->in + start, client->in_len - start);
+    client->in_len -= start;
+
+    if(client->in_len > DAEMON_MAX_LINE)
+    {
+        sprintf(trace, "%s | Request longer than %d bytes, closing the client", __func__, DAEMON_MAX_LINE);
+        diag_error(trace, ERR_FUNC_OPT);
+        return false;
+    }
+    return true;
+}
+
+/* DAEMON ---------------------------------------------------------------------------- */
+
+MU_DAEMON* daemon_open(const CHAR *path)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    struct sockaddr_un addr;
+    struct stat st;
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof addr.sun_path)
+    {
+        sprintf(trace, "%s | Socket path is too long!", __func__);
+        diag_error(trace, ERR_FUNC_OPT);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    INT fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        sprintf(trace, "%s | Cannot create the socket!", __func__);
+        diag_error(trace, ERR_GENERIC);
+        return NULL;
+    }
+
+    /* A socket nobody listens on is left by a daemon that did not close */
+    if(stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        INT probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        BOOL live = probe >= 0 && connect(probe, (struct sockaddr *) &addr, sizeof addr) == 0;
+        if(probe >= 0) close(probe);
+        if(!live) unlink(path);
+    }
+    if(bind(fd, (struct sockaddr *) &addr, sizeof addr) != 0 || listen(fd, DAEMON_MAX_CLIENTS) != 0)
+    {
+        sprintf(trace, "%s | Cannot listen on %.80s!", __func__, path);
+        diag_error(trace, ERR_GENERIC);
+        close(fd);
+        return NULL;
+    }
+
+    MU_DAEMON *daemon = calloc(1, sizeof *daemon);
+    if(daemon == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    daemon->listener = fd;
+    strcpy(daemon->path, path);
+    for(INT i = 0; i < DAEMON_MAX_CLIENTS; i++) daemon->clients[i].fd = -1;
+
+    /* Threads and read buffers are kept between requests */
+    set_scan_resident_pool(true);
+
+    return daemon;
+}
+
+MU_ERROR daemon_attach(MU_DAEMON *daemon, PID pid)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+
+    for(INT i = 0; i < daemon->n_targets; i++)
+    {
+        if(daemon->targets[i].pid == pid) return is_ok;
+    }
+    if(daemon->n_targets == DAEMON_MAX_TARGETS)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Cannot attach more than %d targets!", __func__, DAEMON_MAX_TARGETS);
+        diag_error(trace, is_ok);
+        return is_ok;
+    }
+    is_ok = pid_exists(pid);
+    if(is_ok != ERR_OK) return is_ok;
+
+    /* Reading the maps of a process is fatal to the chunk functions when denied */
+    CHAR *maps_path = get_maps_path(pid);
+    INT maps_fd = open(maps_path, O_RDONLY | O_CLOEXEC);
+    BOOL readable = maps_fd >= 0;
+    if(readable) close(maps_fd);
+    free(maps_path);
+    if(!readable)
+    {
+        is_ok = ERR_EPERM;
+        sprintf(trace, "%s | Cannot read the maps of process %d!", __func__, pid);
+        diag_error(trace, is_ok);
+        return is_ok;
+    }
+
+    MU_DAEMON_TARGET *target = &daemon->targets[daemon->n_targets];
+    memset(target, 0, sizeof *target);
+    target->pid = pid;
+    target->regions = regions_open(pid, MODIF_CHNKS);
+    if(target->regions == NULL) return ERR_GENERIC;
+    daemon->n_targets++;
+
+    return is_ok;
+}
+
+MU_ERROR daemon_run(MU_DAEMON *daemon)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    struct pollfd fds[DAEMON_MAX_CLIENTS + 1];
+    MU_DAEMON_CLIENT *polled[DAEMON_MAX_CLIENTS + 1];
+
+    sprintf(trace, "%s | Listening on %.80s", __func__, daemon->path);
+    diag_info(trace);
+
+    while(!daemon->quit)
+    {
+        INT n_fds = 0;
+        fds[n_fds].fd = daemon->listener;
+        fds[n_fds].events = POLLIN;
+        polled[n_fds++] = NULL;
+        for(INT i = 0; i < DAEMON_MAX_CLIENTS; i++)
+        {
+            MU_DAEMON_CLIENT *client = &daemon->clients[i];
+            if(client->fd < 0) continue;
+            /* A client not reading its responses is not read either */
+            fds[n_fds].fd = client->fd;
+            fds[n_fds].events = (!client->eof && client->out_len - client->out_sent < DAEMON_MAX_PENDING) ? POLLIN : 0;
+            if(client->out_sent < client->out_len) fds[n_fds].events |= POLLOUT;
+            polled[n_fds++] = client;
+        }
+
+        if(poll(fds, n_fds, -1) < 0)
+        {
+            if(errno == EINTR) continue;
+            is_ok = ERR_GENERIC;
+            sprintf(trace, "%s | poll failed!", __func__);
+            diag_error(trace, is_ok);
+            break;
+        }
+
+        if(fds[0].revents & POLLIN)
+        {
+            INT fd = accept4(daemon->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            INT slot = 0;
+            while(slot < DAEMON_MAX_CLIENTS && daemon->clients[slot].fd >= 0) slot++;
+            if(fd >= 0 && slot == DAEMON_MAX_CLIENTS)
+            {
+                sprintf(trace, "%s | More than %d clients, connection refused", __func__, DAEMON_MAX_CLIENTS);
+                diag_info(trace);
+                close(fd);
+            }
+            else if(fd >= 0) daemon->clients[slot].fd = fd;
+        }
+
+        for(INT i = 1; i < n_fds; i++)
+        {
+            MU_DAEMON_CLIENT *client = polled[i];
+            BOOL alive = true;
+            if(fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                alive = (fds[i].events & POLLIN) ? client_read(daemon, client) : !(fds[i].revents & POLLERR);
+            }
+            if(alive) alive = client_flush(client);
+            if(!alive || (client->eof && client->out_len == 0)) client_close(client);
+        }
+    }
+
+    /* Last responses, the one to shutdown included */
+    for(INT i = 0; i < DAEMON_MAX_CLIENTS; i++)
+    {
+        if(daemon->clients[i].fd >= 0) client_flush(&daemon->clients[i]);
+    }
+
+    return is_ok;
+}
+
+void daemon_close(MU_DAEMON *daemon)
+{
+    if(daemon == NULL) return;
+
+    for(INT i = 0; i < DAEMON_MAX_CLIENTS; i++)
+    {
+        if(daemon->clients[i].fd >= 0) client_close(&daemon->clients[i]);
+    }
+    while(daemon->n_targets > 0) detach_target(daemon, daemon->n_targets - 1);
+    close(daemon->listener);
+    unlink(daemon->path);
+    set_scan_resident_pool(false);
+    free(daemon);
+}
@@ -0,0 +1,508 @@
+/**
+ * @file mu_freeze.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_freeze.h
+ * @version 0.1
+ * @date 2022-10-22
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_freeze.h"
+#include "inc/mu_backend.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX             1024
+#endif  /* IOV_MAX */
+
+#define WHEEL_MASK          (FREEZE_WHEEL_SLOTS - 1)
+#define NO_SLOT             -1
+
+/* Entry due in the tick being written */
+typedef struct due_ref
+{
+    ULONG   address;
+    ULONG   slot;
+
+} MU_DUE_REF;
+
+/**
+ * @brief Gets the monotonic time in nanoseconds
+ */
+static UINT64 now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (UINT64) ts.tv_sec * 1000000000UL + (UINT64) ts.tv_nsec;
+}
+
+/**
+ * @brief Links an entry in the slot of the wheel of its due tick
+ */
+static void wheel_insert(MU_FREEZER *freezer, ULONG slot)
+{
+    MU_FREEZE_ENTRY *entry = &freezer->entries[slot];
+    INT64 *head = &freezer->wheel[entry->due & WHEEL_MASK];
+
+    entry->prev = NO_SLOT;
+    entry->next = *head;
+    if(*head != NO_SLOT) freezer->entries[*head].prev = (INT64) slot;
+    *head = (INT64) slot;
+}
+
+/**
+ * @brief Unlinks an entry from the slot of the wheel of its due tick
+ */
+static void wheel_remove(MU_FREEZER *freezer, ULONG slot)
+{
+    MU_FREEZE_ENTRY *entry = &freezer->entries[slot];
+
+    if(entry->prev != NO_SLOT) freezer->entries[entry->prev].next = entry->next;
+    else freezer->wheel[entry->due & WHEEL_MASK] = entry->next;
+    if(entry->next != NO_SLOT) freezer->entries[entry->next].prev = entry->prev;
+}
+
+/**
+ * @brief Orders due entries by address, then by slot
+ */
+static INT cmp_due(const void *a, const void *b)
+{
+    const MU_DUE_REF *x = a;
+    const MU_DUE_REF *y = b;
+
+    if(x->address != y->address) return (x->address < y->address) ? -1 : 1;
+
+    return (x->slot < y->slot) ? -1 : (x->slot > y->slot);
+}
+
+/**
+ * @brief Writes the spans of a batch with as few vectored writes as possible. A failing span stops a
+ * write, so the next one is issued right after it
+ *
+ * @param freezer Freezer
+ * @param local Local iovecs, in the staging buffer
+ * @param remote Remote iovecs, one per local iovec
+ * @param n_iov Number of iovecs
+ * @param done Stores whether each span was written whole
+ */
+static void write_spans(MU_FREEZER *freezer, struct iovec *local, struct iovec *remote, INT n_iov, BOOL *done)
+{
+    const MU_BACKEND *backend = backend_get();
+    INT k = 0;
+
+    while(k < n_iov)
+    {
+        INT64 n = backend->write_vector(freezer->target, &local[k], &remote[k], n_iov - k);
+        ULONG avail = (n < 0) ? 0 : (ULONG) n;
+        freezer->stats.syscalls++;
+        while(k < n_iov)
+        {
+            done[k] = (avail >= remote[k].iov_len);
+            avail = done[k] ? avail - remote[k].iov_len : 0;
+            k++;
+            if(!done[k - 1]) break;
+        }
+    }
+}
+
+/**
+ * @brief Writes the values due, merging the ranges that touch or overlap into one span. Where two
+ * values overlap, the one added later wins
+ *
+ * @param freezer Freezer, locked
+ * @param refs Entries due
+ * @param n_refs Number of entries due
+ */
+static void write_due(MU_FREEZER *freezer, MU_DUE_REF *refs, ULONG n_refs)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    struct iovec local[IOV_MAX];
+    struct iovec remote[IOV_MAX];
+    BOOL done[IOV_MAX];
+    ULONG first[IOV_MAX + 1];       /* First ref of each span */
+    ULONG i = 0;
+
+    qsort(refs, n_refs, sizeof *refs, cmp_due);
+    while(i < n_refs)
+    {
+        INT n_iov = 0;
+        ULONG bytes = 0;
+
+        /* Size of the staging area for this batch */
+        ULONG need = 0;
+        for(ULONG k = i; k < n_refs; k++) need += freezer->entries[refs[k].slot].data_size;
+        if(need > freezer->staging_size)
+        {
+            freezer->staging = realloc(freezer->staging, need);
+            freezer->staging_size = need;
+            if(freezer->staging == NULL)
+            {
+                sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+                diag_critical(trace, is_ok);
+                exit(is_ok);
+            }
+        }
+
+        while(i < n_refs && n_iov < IOV_MAX)
+        {
+            ULONG start = refs[i].address;
+            ULONG end = start + freezer->entries[refs[i].slot].data_size;
+            ULONG j = i + 1;
+            while(j < n_refs && refs[j].address <= end)
+            {
+                ULONG r_end = refs[j].address + freezer->entries[refs[j].slot].data_size;
+                if(r_end > end) end = r_end;
+                j++;
+            }
+
+            /* Stage in id order so later values win where they overlap */
+            UCHAR *span = freezer->staging + bytes;
+            for(ULONG k = i + 1; k < j; k++)
+            {
+                for(ULONG m = k; m > i && freezer->entries[refs[m].slot].id < freezer->entries[refs[m - 1].slot].id; m--)
+                {
+                    MU_DUE_REF tmp = refs[m];
+                    refs[m] = refs[m - 1];
+                    refs[m - 1] = tmp;
+                }
+            }
+            for(ULONG k = i; k < j; k++)
+            {
+                MU_FREEZE_ENTRY *entry = &freezer->entries[refs[k].slot];
+                memcpy(span + (entry->address - start), entry->data, entry->data_size);
+            }
+
+            local[n_iov].iov_base = span;
+            local[n_iov].iov_len = end - start;
+            remote[n_iov].iov_base = (void *) start;
+            remote[n_iov].iov_len = end - start;
+            first[n_iov++] = i;
+            bytes += end - start;
+            i = j;
+        }
+        first[n_iov] = i;
+
+        write_spans(freezer, local, remote, n_iov, done);
+        for(INT s = 0; s < n_iov; s++)
+        {
+            for(ULONG k = first[s]; k < first[s + 1]; k++)
+            {
+                MU_FREEZE_ENTRY *entry = &freezer->entries[refs[k].slot];
+                if(done[s]) entry->writes++;
+                else entry->failures++;
+            }
+            if(done[s]) freezer->stats.writes += first[s + 1] - first[s];
+            else freezer->stats.failures += first[s + 1] - first[s];
+        }
+    }
+}
+
+/**
+ * @brief Thread routine of a freezer. Wakes up on each tick, collects the entries due since the
+ * previous wake-up from the wheel, writes them in one batch and schedules them again
+ *
+ * @param arg Pointer to the MU_FREEZER
+ * @return NULL
+ */
+static void *freeze_loop(void *arg)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    MU_FREEZER *freezer = (MU_FREEZER *) arg;
+    UINT64 tick_ns = (UINT64) freezer->tick_us * 1000UL;
+    MU_DUE_REF *refs = NULL;
+    ULONG refs_cap = 0;
+
+    pthread_mutex_lock(&freezer->lock);
+    while(freezer->running)
+    {
+        if(freezer->stats.n_entries == 0)
+        {
+            pthread_cond_wait(&freezer->wake, &freezer->lock);
+            continue;
+        }
+
+        /* Sleep until the next tick without holding the lock */
+        UINT64 wake_ns = freezer->origin_ns + (freezer->tick + 1) * tick_ns;
+        struct timespec ts = {(time_t) (wake_ns / 1000000000UL), (long) (wake_ns % 1000000000UL)};
+        pthread_mutex_unlock(&freezer->lock);
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        pthread_mutex_lock(&freezer->lock);
+        if(!freezer->running) break;
+
+        UINT64 now = now_ns();
+        UINT64 late_us = (now > wake_ns) ? (now - wake_ns) / 1000UL : 0;
+        if(late_us > freezer->stats.max_late_us) freezer->stats.max_late_us = late_us;
+        UINT64 tick = (now - freezer->origin_ns) / tick_ns;
+        if(tick <= freezer->tick) tick = freezer->tick + 1;
+
+        /* Ticks missed while asleep are caught up with the current one, in the same batch */
+        ULONG n_refs = 0;
+        UINT64 behind = tick - freezer->tick;
+        UINT64 n_wheel = (behind < FREEZE_WHEEL_SLOTS) ? behind : FREEZE_WHEEL_SLOTS;
+        for(UINT64 t = 0; t < n_wheel; t++)
+        {
+            for(INT64 s = freezer->wheel[(tick - t) & WHEEL_MASK]; s != NO_SLOT; s = freezer->entries[s].next)
+            {
+                if(freezer->entries[s].due > tick) continue;
+                if(n_refs == refs_cap)
+                {
+                    refs_cap = (refs_cap == 0) ? 256 : refs_cap * 2;
+                    refs = realloc(refs, refs_cap * sizeof *refs);
+                    if(refs == NULL)
+                    {
+                        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+                        diag_critical(trace, is_ok);
+                        exit(is_ok);
+                    }
+                }
+                refs[n_refs].address = freezer->entries[s].address;
+                refs[n_refs++].slot = (ULONG) s;
+            }
+        }
+
+        if(n_refs > 0)
+        {
+            freezer->stats.ticks++;
+            write_due(freezer, refs, n_refs);
+            for(ULONG r = 0; r < n_refs; r++)
+            {
+                MU_FREEZE_ENTRY *entry = &freezer->entries[refs[r].slot];
+                UINT64 period = (entry->interval_us + freezer->tick_us - 1) / freezer->tick_us;
+                if(entry->due < tick) freezer->stats.missed++;
+                wheel_remove(freezer, refs[r].slot);
+                entry->due += (period == 0) ? 1 : period;
+                if(entry->due <= tick) entry->due = tick + 1;
+                wheel_insert(freezer, refs[r].slot);
+            }
+        }
+        freezer->tick = tick;
+    }
+    pthread_mutex_unlock(&freezer->lock);
+    free(refs);
+
+    return NULL;
+}
+
+MU_FREEZER* freeze_start(PID target, ULONG tick_us)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+
+    MU_FREEZER *freezer = calloc(1, sizeof *freezer);
+    if(freezer == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    freezer->target = target;
+    freezer->tick_us = (tick_us == 0) ? FREEZE_DEFAULT_TICK_US : tick_us;
+    freezer->free_slot = NO_SLOT;
+    freezer->next_id = 1;
+    freezer->running = true;
+    freezer->origin_ns = now_ns();
+    for(INT s = 0; s < FREEZE_WHEEL_SLOTS; s++) freezer->wheel[s] = NO_SLOT;
+    pthread_mutex_init(&freezer->lock, NULL);
+    pthread_cond_init(&freezer->wake, NULL);
+
+    if(pthread_create(&freezer->thread, NULL, freeze_loop, freezer) != 0)
+    {
+        sprintf(trace, "%s | Error creating the freezer thread!", __func__);
+        diag_error(trace, is_ok);
+        pthread_mutex_destroy(&freezer->lock);
+        pthread_cond_destroy(&freezer->wake);
+        free(freezer);
+        return NULL;
+    }
+
+    return freezer;
+}
+
+void freeze_stop(MU_FREEZER *freezer)
+{
+    if(freezer == NULL) return;
+
+    pthread_mutex_lock(&freezer->lock);
+    freezer->running = false;
+    pthread_cond_signal(&freezer->wake);
+    pthread_mutex_unlock(&freezer->lock);
+    pthread_join(freezer->thread, NULL);
+
+    for(ULONG s = 0; s < freezer->n_slots; s++) free(freezer->entries[s].data);
+    free(freezer->entries);
+    free(freezer->staging);
+    pthread_mutex_destroy(&freezer->lock);
+    pthread_cond_destroy(&freezer->wake);
+    free(freezer);
+}
+
+MU_ERROR freeze_add(MU_FREEZER *freezer, ULONG address, const UCHAR *data, ULONG data_size, ULONG interval_us, UINT64 *id)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    ULONG slot = 0;
+
+    if(data == NULL || data_size == 0)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Nothing to freeze at %#lx!", __func__, address);
+        diag_error(trace, is_ok);
+        return is_ok;
+    }
+    UCHAR *copy = malloc(data_size);
+    if(copy == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    memcpy(copy, data, data_size);
+
+    pthread_mutex_lock(&freezer->lock);
+    if(freezer->free_slot != NO_SLOT)
+    {
+        slot = (ULONG) freezer->free_slot;
+        freezer->free_slot = freezer->entries[slot].next;
+    }
+    else
+    {
+        if(freezer->n_slots == freezer->cap)
+        {
+            freezer->cap = (freezer->cap == 0) ? 64 : freezer->cap * 2;
+            freezer->entries = realloc(freezer->entries, freezer->cap * sizeof *freezer->entries);
+            if(freezer->entries == NULL)
+            {
+                is_ok = ERR_GENERIC;
+                sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+                diag_critical(trace, is_ok);
+                exit(is_ok);
+            }
+        }
+        slot = freezer->n_slots++;
+    }
+
+    MU_FREEZE_ENTRY *entry = &freezer->entries[slot];
+    memset(entry, 0, sizeof *entry);
+    entry->id = freezer->next_id++;
+    entry->address = address;
+    entry->data = copy;
+    entry->data_size = data_size;
+    entry->interval_us = interval_us;
+    if(id != NULL) *id = entry->id;
+
+    /* The thread sleeps while nothing is frozen: ticks start again from now */
+    if(freezer->stats.n_entries++ == 0)
+    {
+        freezer->tick = (now_ns() - freezer->origin_ns) / ((UINT64) freezer->tick_us * 1000UL);
+        pthread_cond_signal(&freezer->wake);
+    }
+    entry->due = freezer->tick + 1;
+    wheel_insert(freezer, slot);
+    pthread_mutex_unlock(&freezer->lock);
+
+    return is_ok;
+}
+
+MU_ERROR freeze_remove(MU_FREEZER *freezer, UINT64 id)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_FUNC_OPT;
+
+    pthread_mutex_lock(&freezer->lock);
+    for(ULONG s = 0; s < freezer->n_slots && is_ok != ERR_OK; s++)
+    {
+        MU_FREEZE_ENTRY *entry = &freezer->entries[s];
+        if(id == 0 || entry->id != id) continue;
+        wheel_remove(freezer, s);
+        free(entry->data);
+        memset(entry, 0, sizeof *entry);
+        entry->next = freezer->free_slot;
+        freezer->free_slot = (INT64) s;
+        freezer->stats.n_entries--;
+        is_ok = ERR_OK;
+    }
+    pthread_mutex_unlock(&freezer->lock);
+
+    if(is_ok != ERR_OK)
+    {
+        sprintf(trace, "%s | No frozen value has id %lu", __func__, id);
+        diag_error(trace, is_ok);
+    }
+
+    return is_ok;
+}
+
+/**
+ * @brief Orders entries by id
+ */
+static INT cmp_ids(const void *a, const void *b)
+{
+    const MU_FREEZE_ENTRY *x = a;
+    const MU_FREEZE_ENTRY *y = b;
+
+    return (x->id < y->id) ? -1 : (x->id > y->id);
+}
+
+MU_FREEZE_ENTRY* freeze_list(MU_FREEZER *freezer, ULONG *n_entries)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    ULONG bytes = 0;
+    ULONG n = 0;
+
+    pthread_mutex_lock(&freezer->lock);
+    for(ULONG s = 0; s < freezer->n_slots; s++)
+    {
+        if(freezer->entries[s].id != 0) bytes += freezer->entries[s].data_size;
+    }
+    *n_entries = freezer->stats.n_entries;
+    if(*n_entries == 0)
+    {
+        pthread_mutex_unlock(&freezer->lock);
+        return NULL;
+    }
+
+    /* Entries first, then their data */
+    MU_FREEZE_ENTRY *list = malloc(*n_entries * sizeof *list + bytes);
+    if(list == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    UCHAR *data = (UCHAR *) (list + *n_entries);
+    for(ULONG s = 0; s < freezer->n_slots; s++)
+    {
+        if(freezer->entries[s].id == 0) continue;
+        list[n] = freezer->entries[s];
+        list[n].data = data;
+        list[n].prev = NO_SLOT;
+        list[n].next = NO_SLOT;
+        memcpy(data, freezer->entries[s].data, freezer->entries[s].data_size);
+        data += freezer->entries[s].data_size;
+        n++;
+    }
+    pthread_mutex_unlock(&freezer->lock);
+    qsort(list, n, sizeof *list, cmp_ids);
+
+    return list;
+}
+
+void freeze_stats(MU_FREEZER *freezer, MU_FREEZE_STATS *stats)
+{
+    pthread_mutex_lock(&freezer->lock);
+    *stats = freezer->stats;
+    pthread_mutex_unlock(&freezer->lock);
+}
@@ -0,0 +1,146 @@
+/**
+ * @file mu_index.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_index.h
+ * @version 0.1
+ * @date 2022-10-06
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_index.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CACHE_LINE          64
+#define KEYS_PER_LINE       8       /* Keys of 8 bytes in a cache line */
+
+/**
+ * @brief Fills the Eytzinger layout with an in-order walk of the implicit tree
+ *
+ * @param index Index being built
+ * @param i Sorted position of the next key
+ * @param k Node of the tree (1 is the root)
+ * @return Sorted position of the next key after the subtree
+ */
+static INT fill_keys(MU_REGION_INDEX *index, INT i, INT k)
+{
+    if(k <= index->n_chunks)
+    {
+        i = fill_keys(index, i, 2 * k);
+        index->keys[k] = index->starts[i];
+        index->ranks[k] = i;
+        i++;
+        i = fill_keys(index, i, 2 * k + 1);
+    }
+    return i;
+}
+
+MU_REGION_INDEX* index_build(MU_MEM_CHUNK *chunks, INT n_chunks)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+
+    MU_REGION_INDEX *index = calloc(1, sizeof *index);
+    if(index == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    index->n_chunks = n_chunks;
+    /* Aligned so the KEYS_PER_LINE descendants of a node three levels down share one cache line */
+    ULONG keys_bytes = ((n_chunks + 1) * sizeof *index->keys + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    index->keys = aligned_alloc(CACHE_LINE, keys_bytes);
+    index->ranks = malloc((n_chunks + 1) * sizeof *index->ranks);
+    index->starts = malloc((n_chunks + 1) * sizeof *index->starts);
+    index->ends = malloc((n_chunks + 1) * sizeof *index->ends);
+    if(index->keys == NULL || index->ranks == NULL || index->starts == NULL || index->ends == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    for(INT i = 0; i < n_chunks; i++)
+    {
+        index->starts[i] = chunks[i].addr_start;
+        index->ends[i] = chunks[i].addr_start + chunks[i].chunk_size;
+    }
+    fill_keys(index, 0, 1);
+
+    return index;
+}
+
+void index_free(MU_REGION_INDEX *index)
+{
+    if(index == NULL) return;
+
+    free(index->keys);
+    free(index->ranks);
+    free(index->starts);
+    free(index->ends);
+    free(index);
+}
+
+/**
+ * @brief Gets the last chunk that starts at or before an address
+ *
+ * @param index Index of the chunks
+ * @param address Address to look for
+ * @return Sorted position of the chunk. -1 if all chunks start after the address
+ */
+static inline INT find_floor(MU_REGION_INDEX *index, ULONG address)
+{
+    ULONG k = 1;
+
+    /* Branchless descent: go right while keys are not above the address */
+    while(k <= (ULONG) index->n_chunks)
+    {
+        /* Nodes three levels down; prefetches never fault, even past the end */
+        __builtin_prefetch(index->keys + k * KEYS_PER_LINE);
+        k = 2 * k + (index->keys[k] <= address);
+    }
+    /* Drop the trailing right turns: k is then the first key above the address, 0 if none */
+    k >>= __builtin_ffsl(~k);
+
+    return (k == 0) ? index->n_chunks - 1 : index->ranks[k] - 1;
+}
+
+INT index_lookup(MU_REGION_INDEX *index, ULONG address, ULONG size)
+{
+    INT c = find_floor(index, address);
+
+    if(c < 0 || address + size > index->ends[c]) return INDEX_NOT_FOUND;
+
+    return c;
+}
+
+ULONG index_lookup_batch(MU_REGION_INDEX *index, ULONG *addresses, ULONG n_addr, ULONG size, INT *chunks)
+{
+    ULONG n_found = 0;
+    INT floor = INDEX_NOT_FOUND;
+    ULONG lo = 1;       /* Addresses in [lo, hi) have the same floor: empty until the first search */
+    ULONG hi = 0;
+
+    for(ULONG i = 0; i < n_addr; i++)
+    {
+        ULONG address = addresses[i];
+        if(address < lo || address >= hi)
+        {
+            floor = find_floor(index, address);
+            lo = (floor < 0) ? 0 : index->starts[floor];
+            hi = (floor + 1 < index->n_chunks) ? index->starts[floor + 1] : ~0UL;
+        }
+        if(floor >= 0 && address + size <= index->ends[floor])
+        {
+            chunks[i] = floor;
+            n_found++;
+        }
+        else chunks[i] = INDEX_NOT_FOUND;
+    }
+
+    return n_found;
+}
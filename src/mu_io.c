@@ -12,75 +12,763 @@
 #include "inc/mu_io.h"
 #include "inc/mu_memchunk.h"
 #include "inc/mu_diag.h"
+#include "inc/mu_index.h"
+#include "inc/mu_backend.h"
+#include "inc/mu_metrics.h"
 #include <stdio.h>
 #include <sys/uio.h>
 #include <string.h>
+#include <limits.h>
+#include <pthread.h>
 
-static MU_ERROR write_chunk_data(PID target, ULONG address, UCHAR *data, ULONG data_size)
+#define ALL_CHNKS           0
+#define SPAN_PAGE_SIZE      4096                /* Values starting in the same page share one span */
+#define FAULT_PAGE_SIZE     4096                /* Reads of the target fail with page granularity */
+#define PAGE_DOWN(addr)     ((addr) & ~((ULONG) FAULT_PAGE_SIZE - 1))
+#define NO_BAD_RANGE        (~0UL)
+#define BATCH_MAX_BYTES     (4UL << 20)         /* Local buffer for the spans of one batch */
+
+#ifndef IOV_MAX
+#define IOV_MAX             1024
+#endif  /* IOV_MAX */
+
+/* Contiguous remote range transferred as one iovec, holding the values or patches [first, last) */
+typedef struct io_span
+{
+    ULONG   addr_start;
+    ULONG   len;
+    ULONG   local_off;
+    ULONG   first;
+    ULONG   last;
+
+} MU_IO_SPAN;
+
+/* Patch sorted by address, keeping its position in the caller's array */
+typedef struct patch_ref
+{
+    ULONG   address;
+    ULONG   index;
+
+} MU_PATCH_REF;
+
+/* Page ranges of the target known to be unreadable. Shared by all the threads of a session */
+typedef struct bad_ranges
+{
+    PID                 target;
+    ULONG               *starts;        /* Sorted, not overlapping */
+    ULONG               *ends;
+    ULONG               n_ranges;
+    ULONG               cap_ranges;
+    pthread_rwlock_t    lock;
+
+} MU_BAD_RANGES;
+
+static MU_BAD_RANGES bad_cache = {0, NULL, NULL, 0, 0, PTHREAD_RWLOCK_INITIALIZER};
+
+/**
+ * @brief Finds the first cached range that ends after an address. Lock must be held
+ * 
+ * @param address Address to look for
+ * @return Position of the range, n_ranges if none
+ */
+static ULONG bad_position(ULONG address)
+{
+    ULONG lo = 0;
+    ULONG hi = bad_cache.n_ranges;
+
+    while(lo < hi)
+    {
+        ULONG mid = lo + (hi - lo) / 2;
+        if(bad_cache.ends[mid] <= address) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+/**
+ * @brief Checks the bad range cache for an address
+ * 
+ * @param target PID of the target process
+ * @param address Address to check
+ * @param bound Stores the end of the bad range if the address is in one. Otherwise, the start of
+ * the next bad range (NO_BAD_RANGE if none), so reads can stop before it
+ * @return True if the address is known to be unreadable
+ */
+static BOOL bad_lookup(PID target, ULONG address, ULONG *bound)
+{
+    BOOL is_bad = false;
+
+    *bound = NO_BAD_RANGE;
+    pthread_rwlock_rdlock(&bad_cache.lock);
+    if(bad_cache.target == target && bad_cache.n_ranges > 0)
+    {
+        ULONG pos = bad_position(address);
+        if(pos < bad_cache.n_ranges)
+        {
+            is_bad = (bad_cache.starts[pos] <= address);
+            *bound = is_bad ? bad_cache.ends[pos] : bad_cache.starts[pos];
+        }
+    }
+    pthread_rwlock_unlock(&bad_cache.lock);
+
+    return is_bad;
+}
+
+/**
+ * @brief Adds a range of unreadable pages to the cache, merging it with the ranges it touches
+ * 
+ * @param target PID of the target process. The cache is emptied when it changes
+ * @param start First address of the range
+ * @param end Address after the range
+ */
+static void bad_insert(PID target, ULONG start, ULONG end)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+
+    start = PAGE_DOWN(start);
+    end = PAGE_DOWN(end + FAULT_PAGE_SIZE - 1);
+    if(start >= end) return;
+
+    pthread_rwlock_wrlock(&bad_cache.lock);
+    if(bad_cache.target != target)
+    {
+        bad_cache.target = target;
+        bad_cache.n_ranges = 0;
+    }
+    /* Ranges [first, last) touch the new one */
+    ULONG first = bad_position(start > 0 ? start - 1 : 0);
+    ULONG last = first;
+    while(last < bad_cache.n_ranges && bad_cache.starts[last] <= end)
+    {
+        if(bad_cache.starts[last] < start) start = bad_cache.starts[last];
+        if(bad_cache.ends[last] > end) end = bad_cache.ends[last];
+        last++;
+    }
+    if(first == last && bad_cache.n_ranges == bad_cache.cap_ranges)
+    {
+        bad_cache.cap_ranges = (bad_cache.cap_ranges == 0) ? 64 : bad_cache.cap_ranges * 2;
+        bad_cache.starts = realloc(bad_cache.starts, bad_cache.cap_ranges * sizeof *bad_cache.starts);
+        bad_cache.ends = realloc(bad_cache.ends, bad_cache.cap_ranges * sizeof *bad_cache.ends);
+        if(bad_cache.starts == NULL || bad_cache.ends == NULL)
+        {
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+    }
+    /* Replace the touched ranges with the merged one */
+    ULONG tail = bad_cache.n_ranges - last;
+    ULONG new_last = first + 1;
+    memmove(&bad_cache.starts[new_last], &bad_cache.starts[last], tail * sizeof *bad_cache.starts);
+    memmove(&bad_cache.ends[new_last], &bad_cache.ends[last], tail * sizeof *bad_cache.ends);
+    bad_cache.starts[first] = start;
+    bad_cache.ends[first] = end;
+    bad_cache.n_ranges = new_last + tail;
+    pthread_rwlock_unlock(&bad_cache.lock);
+}
+
+void io_bad_ranges_reset(PID target)
+{
+    pthread_rwlock_wrlock(&bad_cache.lock);
+    bad_cache.target = target;
+    bad_cache.n_ranges = 0;
+    pthread_rwlock_unlock(&bad_cache.lock);
+}
+
+void io_bad_ranges_forget(PID target, ULONG address, ULONG size)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    ULONG start = PAGE_DOWN(address);
+    ULONG end = PAGE_DOWN(address + size + FAULT_PAGE_SIZE - 1);
+
+    pthread_rwlock_wrlock(&bad_cache.lock);
+    if(bad_cache.target == target && bad_cache.n_ranges > 0)
+    {
+        /* Rare: rebuild the cache without [start, end). A range around it is cut in two */
+        ULONG *starts = malloc((bad_cache.n_ranges + 1) * sizeof *starts);
+        ULONG *ends = malloc((bad_cache.n_ranges + 1) * sizeof *ends);
+        ULONG cap = bad_cache.n_ranges + 1;
+        ULONG kept = 0;
+        if(starts == NULL || ends == NULL)
+        {
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+        for(ULONG i = 0; i < bad_cache.n_ranges; i++)
+        {
+            ULONG s = bad_cache.starts[i];
+            ULONG e = bad_cache.ends[i];
+            if(s < start)
+            {
+                starts[kept] = s;
+                ends[kept++] = (e < start) ? e : start;
+            }
+            if(e > end)
+            {
+                starts[kept] = (s > end) ? s : end;
+                ends[kept++] = e;
+            }
+        }
+        free(bad_cache.starts);
+        free(bad_cache.ends);
+        bad_cache.starts = starts;
+        bad_cache.ends = ends;
+        bad_cache.n_ranges = kept;
+        bad_cache.cap_ranges = cap;
+    }
+    pthread_rwlock_unlock(&bad_cache.lock);
+}
+
+UINT64 io_bad_bytes(PID target)
+{
+    UINT64 bytes = 0;
+
+    pthread_rwlock_rdlock(&bad_cache.lock);
+    if(bad_cache.target == target)
+    {
+        for(ULONG i = 0; i < bad_cache.n_ranges; i++) bytes += bad_cache.ends[i] - bad_cache.starts[i];
+    }
+    pthread_rwlock_unlock(&bad_cache.lock);
+
+    return bytes;
+}
+
+/**
+ * @brief Finds where a run of unreadable pages ends by probing one byte of each page after it, until
+ * one can be read. Pages skipped by a sparser probe could be readable islands, so every page of the
+ * run is probed: a syscall per bad page, once per session since the run is added to the bad range cache
+ * 
+ * @param target PID of the target process
+ * @param address Address in the first unreadable page
+ * @param end Address after the range being read
+ * @return First readable address after the run, or end if the rest of the range is unreadable
+ */
+static ULONG skip_bad_run(PID target, ULONG address, ULONG end)
+{
+    UCHAR probe;
+    ULONG good = PAGE_DOWN(address) + FAULT_PAGE_SIZE;
+
+    while(good < end && read_memory_range(target, good, &probe, 1) != 1) good += FAULT_PAGE_SIZE;
+    if(good > end) good = end;
+    bad_insert(target, address, good);
+
+    return good;
+}
+
+ULONG read_memory_tolerant(PID target, ULONG address, UCHAR *buffer, ULONG size)
+{
+    ULONG end = address + size;
+    ULONG pos = address;
+    ULONG n_good = 0;
+
+    while(pos < end)
+    {
+        ULONG bound;
+        ULONG next;
+        if(bad_lookup(target, pos, &bound))
+        {
+            /* Known bad: no syscall */
+            next = (bound < end) ? bound : end;
+        }
+        else
+        {
+            ULONG stop = (bound < end) ? bound : end;
+            INT64 n_read = read_memory_range(target, pos, buffer + (pos - address), stop - pos);
+            if(n_read > 0)
+            {
+                n_good += (ULONG) n_read;
+                pos += (ULONG) n_read;
+                continue;
+            }
+            next = skip_bad_run(target, pos, end);
+        }
+        memset(buffer + (pos - address), 0, next - pos);
+        pos = next;
+    }
+
+    return n_good;
+}
+
+/**
+ * @brief Transfers a vector of iovecs in as few syscalls as possible with the memory backend.
+ * A failing iovec stops the transfer, so it is reissued right after it
+ * 
+ * @param target PID of the target process
+ * @param local Local iovecs
+ * @param remote Remote iovecs, one per local iovec
+ * @param n_iov Number of iovecs
+ * @param write True to write into the target, false to read from it
+ * @param done Stores the bytes transferred for each iovec
+ */
+static void transfer_iovecs(PID target, struct iovec *local, struct iovec *remote, INT n_iov, BOOL write, ULONG *done)
+{
+    const MU_BACKEND *backend = backend_get();
+    INT k = 0;
+    while(k < n_iov)
+    {
+        INT64 n = (write) ? backend->write_vector(target, &local[k], &remote[k], n_iov - k)
+                          : backend->read_vector(target, &local[k], &remote[k], n_iov - k);
+        ULONG avail = (n < 0) ? 0 : (ULONG) n;
+
+        while(k < n_iov)
+        {
+            done[k] = (avail < remote[k].iov_len) ? avail : remote[k].iov_len;
+            avail -= done[k];
+            BOOL partial = (done[k] < remote[k].iov_len);
+            k++;
+            if(partial) break;
+        }
+    }
+}
+
+UCHAR* read_chunk_data(PID target, MU_MEM_CHUNK chunk)
 {
     diag_trace trace;
     MU_ERROR is_ok = ERR_OK;
 
-    struct iovec local[1];
-    struct iovec remote[1];
+    UCHAR *r_buffer = malloc(chunk.chunk_size + 1);
+    if(r_buffer == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
 
-    local[0].iov_base = (void *) data;
-    local[0].iov_len = data_size;
-    remote[0].iov_base = (void *) address;
-    remote[0].iov_len = data_size;
+    /* Unreadable pages are zero-filled instead of left uninitialised */
+    ULONG n_read = read_memory_tolerant(target, chunk.addr_start, r_buffer, chunk.chunk_size);
+    if(n_read < chunk.chunk_size)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Only %lu of %lu bytes at %#lx could be read", __func__, n_read, chunk.chunk_size, chunk.addr_start);
+        diag_error(trace, is_ok);
+    }
 
-    INT64 written = process_vm_writev(target, local, 1, remote, 1, 0);
+    return r_buffer;
+}
 
-    /* If written < 0, it enters. If not, value is unsigned and can be safely casted to size_t for comparision */
-    if(written < 0 || (ULONG) written != data_size)
+INT64 read_memory_range(PID target, ULONG address, UCHAR *buffer, ULONG size)
+{
+    return backend_get()->read_range(target, address, buffer, size);
+}
+
+ULONG read_values_batched(PID target, ULONG *addresses, ULONG n_addr, ULONG data_size, UCHAR *values, BOOL *valid)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    struct iovec local[IOV_MAX];
+    struct iovec remote[IOV_MAX];
+    MU_IO_SPAN spans[IOV_MAX];
+    ULONG done[IOV_MAX];
+    ULONG buf_size = (data_size + SPAN_PAGE_SIZE > BATCH_MAX_BYTES) ? data_size + SPAN_PAGE_SIZE : BATCH_MAX_BYTES;
+    UCHAR *buffer = malloc(buf_size);
+    ULONG n_valid = 0;
+    ULONG i = 0;
+
+    if(buffer == NULL)
     {
         is_ok = ERR_GENERIC;
-        sprintf(trace, "%s | Error writing into memory of target process!", __func__);
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
         diag_critical(trace, is_ok);
         exit(is_ok);
     }
 
-    return is_ok;
+    while(i < n_addr)
+    {
+        /* Pack spans into one batch until the iovecs or the local buffer are full */
+        INT n_spans = 0;
+        ULONG bytes = 0;
+        while(i < n_addr && n_spans < IOV_MAX)
+        {
+            ULONG start = addresses[i];
+            ULONG page_end = (start & ~((ULONG) SPAN_PAGE_SIZE - 1)) + SPAN_PAGE_SIZE;
+            ULONG end = start + data_size;
+            ULONG j = i + 1;
+            while(j < n_addr && addresses[j] < page_end)
+            {
+                if(addresses[j] + data_size > end) end = addresses[j] + data_size;
+                j++;
+            }
+            /* Values in known bad pages fail without a syscall */
+            ULONG bound;
+            if(bad_lookup(target, start, &bound))
+            {
+                for(ULONG v = i; v < j; v++) valid[v] = false;
+                i = j;
+                continue;
+            }
+            if(bytes + (end - start) > buf_size) break;
+
+            spans[n_spans].addr_start = start;
+            spans[n_spans].len = end - start;
+            spans[n_spans].local_off = bytes;
+            spans[n_spans].first = i;
+            spans[n_spans].last = j;
+            local[n_spans].iov_base = buffer + bytes;
+            local[n_spans].iov_len = end - start;
+            remote[n_spans].iov_base = (void *) start;
+            remote[n_spans].iov_len = end - start;
+            bytes += end - start;
+            n_spans++;
+            i = j;
+        }
+
+        transfer_iovecs(target, local, remote, n_spans, false, done);
+
+        /* Slice the values out of the spans. A value is valid only if all its bytes arrived */
+        for(INT k = 0; k < n_spans; k++)
+        {
+            MU_IO_SPAN *sp = &spans[k];
+            if(done[k] < sp->len)
+            {
+                bad_insert(target, sp->addr_start + done[k], sp->addr_start + done[k] + 1);
+            }
+            for(ULONG v = sp->first; v < sp->last; v++)
+            {
+                ULONG off = addresses[v] - sp->addr_start;
+                valid[v] = (off + data_size <= done[k]);
+                if(valid[v])
+                {
+                    memcpy(values + v * data_size, buffer + sp->local_off + off, data_size);
+                    n_valid++;
+                }
+            }
+        }
+    }
+
+    free(buffer);
+
+    return n_valid;
 }
 
-UCHAR* read_chunk_data(PID target, MU_MEM_CHUNK chunk)
+MU_ERROR reader_init(MU_CHUNK_READER *reader, PID target, ULONG window, ULONG overlap)
 {
     diag_trace trace;
     MU_ERROR is_ok = ERR_OK;
 
-    struct iovec local[1];
-    struct iovec remote[1];
+    if(window == 0)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Window size must be greater than 0!", __func__);
+        diag_error(trace, is_ok);
+        return is_ok;
+    }
+
+    reader->target = target;
+    reader->window = window;
+    reader->overlap = overlap;
+    reader->buffer = malloc(window + overlap);
+    if(reader->buffer == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    reader_seek(reader, 0, 0);
+
+    return is_ok;
+}
+
+void reader_seek(MU_CHUNK_READER *reader, ULONG address, ULONG size)
+{
+    reader->next = address;
+    reader->addr_end = address + size;
+    reader->win_addr = address;
+    reader->win_len = 0;
+    reader->contiguous = false;
+}
+
+BOOL reader_next(MU_CHUNK_READER *reader)
+{
+    diag_trace trace;
+
+    if(reader->next >= reader->addr_end)
+    {
+        return false;
+    }
+
+    /* Carry the tail of the previous window so matches crossing the edge are not lost */
+    ULONG keep = 0;
+    if(reader->contiguous)
+    {
+        keep = (reader->win_len < reader->overlap) ? reader->win_len : reader->overlap;
+        memmove(reader->buffer, reader->buffer + reader->win_len - keep, keep);
+    }
+
+    ULONG to_read = reader->addr_end - reader->next;
+    if(to_read > reader->window) to_read = reader->window;
+
+    /* Known bad pages are skipped without a syscall, and reads stop before the next ones */
+    ULONG bound;
+    if(bad_lookup(reader->target, reader->next, &bound))
+    {
+        reader->win_addr = reader->next;
+        reader->win_len = 0;
+        reader->contiguous = false;
+        reader->next = (bound < reader->addr_end) ? bound : reader->addr_end;
+        return true;
+    }
+    if(bound - reader->next < to_read) to_read = bound - reader->next;
+
+    INT64 n_read = read_memory_range(reader->target, reader->next, reader->buffer + keep, to_read);
+    if(n_read <= 0)
+    {
+        /* The first page is bad: find where the run ends and go on from there */
+        ULONG good = skip_bad_run(reader->target, reader->next, reader->addr_end);
+        sprintf(trace, "%s | Cannot read %lu bytes at %#lx, skipping them", __func__, good - reader->next, reader->next);
+        diag_error(trace, ERR_GENERIC);
+        reader->win_addr = reader->next;
+        reader->win_len = 0;
+        reader->contiguous = false;
+        reader->next = good;
+    }
+    else
+    {
+        /* A short read stops at a bad page: the next window starts there */
+        reader->win_addr = reader->next - keep;
+        reader->win_len = keep + (ULONG) n_read;
+        reader->contiguous = ((ULONG) n_read == to_read);
+        reader->next += (ULONG) n_read;
+    }
+
+    return true;
+}
 
-    ULONG to_read = chunk.chunk_size;
-    UCHAR *r_buffer = malloc(to_read);
+void reader_free(MU_CHUNK_READER *reader)
+{
+    free(reader->buffer);
+    reader->buffer = NULL;
+    reader->win_len = 0;
+}
 
-    local[0].iov_base = r_buffer;
-    local[0].iov_len = to_read;
-    remote[0].iov_base = (void *) chunk.addr_start;
-    remote[0].iov_len = to_read;
+/**
+ * @brief Compares two patch references by address, then by position, for qsort
+ * 
+ * @param a Pointer to first reference
+ * @param b Pointer to second reference
+ * @return Negative, zero or positive as in strcmp
+ */
+static INT cmp_patch_addr(const void *a, const void *b)
+{
+    const MU_PATCH_REF *x = (const MU_PATCH_REF *) a;
+    const MU_PATCH_REF *y = (const MU_PATCH_REF *) b;
 
-    INT64 n_read = process_vm_readv(target, local, 1, remote, 1, 0);
+    if(x->address != y->address) return (x->address > y->address) - (x->address < y->address);
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/**
+ * @brief Compares two patch references by position, for qsort
+ * 
+ * @param a Pointer to first reference
+ * @param b Pointer to second reference
+ * @return Negative, zero or positive as in strcmp
+ */
+static INT cmp_patch_index(const void *a, const void *b)
+{
+    const MU_PATCH_REF *x = (const MU_PATCH_REF *) a;
+    const MU_PATCH_REF *y = (const MU_PATCH_REF *) b;
 
-    /* If n_read < 0, it enters. If not, value is unsigned and can be safely casted to size_t for comparision */
-    if(n_read < 0)
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+ULONG write_patches(PID target, MU_PATCH *patches, ULONG n_patches, BOOL verify)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    struct iovec local[IOV_MAX];
+    struct iovec remote[IOV_MAX];
+    struct iovec check[IOV_MAX];
+    MU_IO_SPAN spans[IOV_MAX];
+    ULONG done[IOV_MAX];
+    ULONG buf_size = BATCH_MAX_BYTES;
+    ULONG n_written = 0;
+    ULONG i = 0;
+    MU_METRICS mark;
+
+    metrics_begin(&mark);
+    MU_PATCH_REF *refs = malloc((sizeof *refs)*(n_patches + 1));
+    UCHAR *buffer = malloc(buf_size);
+    UCHAR *readback = (verify) ? malloc(buf_size) : NULL;
+    if(refs == NULL || buffer == NULL || (verify && readback == NULL))
     {
         is_ok = ERR_GENERIC;
-        sprintf(trace, "%s | Error reading memory of target process!", __func__);
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
         diag_critical(trace, is_ok);
         exit(is_ok);
     }
 
-    return r_buffer;
+    for(ULONG p = 0; p < n_patches; p++)
+    {
+        refs[p].address = patches[p].address;
+        refs[p].index = p;
+        patches[p].written = false;
+    }
+    qsort(refs, n_patches, sizeof *refs, cmp_patch_addr);
+
+    while(i < n_patches)
+    {
+        INT n_spans = 0;
+        ULONG bytes = 0;
+        while(i < n_patches && n_spans < IOV_MAX)
+        {
+            /* Overlapping patches must share a span. Adjacent ones join it while it stays in budget */
+            ULONG start = refs[i].address;
+            ULONG end = start + patches[refs[i].index].data_size;
+            ULONG j = i + 1;
+            while(j < n_patches)
+            {
+                ULONG p_end = refs[j].address + patches[refs[j].index].data_size;
+                BOOL overlaps = (refs[j].address < end);
+                BOOL adjacent = (refs[j].address == end && p_end - start <= BATCH_MAX_BYTES);
+                if(!overlaps && !adjacent) break;
+                if(p_end > end) end = p_end;
+                j++;
+            }
+
+            if(bytes + (end - start) > buf_size)
+            {
+                if(n_spans > 0) break;
+
+                /* A single span bigger than the buffer: grow the buffers for it */
+                buf_size = end - start;
+                buffer = realloc(buffer, buf_size);
+                readback = (verify) ? realloc(readback, buf_size) : NULL;
+                if(buffer == NULL || (verify && readback == NULL))
+                {
+                    is_ok = ERR_GENERIC;
+                    sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+                    diag_critical(trace, is_ok);
+                    exit(is_ok);
+                }
+            }
+
+            /* Stage the span, applying patches in array order so later ones win */
+            qsort(&refs[i], j - i, sizeof *refs, cmp_patch_index);
+            for(ULONG k = i; k < j; k++)
+            {
+                MU_PATCH *pt = &patches[refs[k].index];
+                memcpy(buffer + bytes + (pt->address - start), pt->data, pt->data_size);
+            }
+
+            spans[n_spans].addr_start = start;
+            spans[n_spans].len = end - start;
+            spans[n_spans].local_off = bytes;
+            spans[n_spans].first = i;
+            spans[n_spans].last = j;
+            local[n_spans].iov_base = buffer + bytes;
+            local[n_spans].iov_len = end - start;
+            remote[n_spans].iov_base = (void *) start;
+            remote[n_spans].iov_len = end - start;
+            bytes += end - start;
+            n_spans++;
+            i = j;
+        }
+
+        transfer_iovecs(target, local, remote, n_spans, true, done);
+
+        for(INT k = 0; k < n_spans; k++)
+        {
+            for(ULONG r = spans[k].first; r < spans[k].last; r++)
+            {
+                MU_PATCH *pt = &patches[refs[r].index];
+                pt->written = (pt->address - spans[k].addr_start + pt->data_size <= done[k]);
+            }
+        }
+
+        /* Read the whole batch back at once and compare it with what was staged */
+        if(verify)
+        {
+            for(INT k = 0; k < n_spans; k++)
+            {
+                check[k].iov_base = readback + spans[k].local_off;
+                check[k].iov_len = spans[k].len;
+            }
+            transfer_iovecs(target, check, remote, n_spans, false, done);
+
+            for(INT k = 0; k < n_spans; k++)
+            {
+                for(ULONG r = spans[k].first; r < spans[k].last; r++)
+                {
+                    MU_PATCH *pt = &patches[refs[r].index];
+                    ULONG off = pt->address - spans[k].addr_start;
+                    if(pt->written)
+                    {
+                        pt->written = (off + pt->data_size <= done[k]) &&
+                            memcmp(readback + spans[k].local_off + off, buffer + spans[k].local_off + off, pt->data_size) == 0;
+                    }
+                }
+            }
+        }
+
+        for(INT k = 0; k < n_spans; k++)
+        {
+            for(ULONG r = spans[k].first; r < spans[k].last; r++)
+            {
+                n_written += patches[refs[r].index].written;
+            }
+        }
+    }
+
+    free(refs);
+    free(buffer);
+    free(readback);
+    metrics_end("write", &mark);
+
+    return n_written;
 }
 
-MU_ERROR modify_values(PID target, ULONG *addresses, INT addr_size, UCHAR *data, INT data_size)
+MU_ERROR modify_values(PID target, ULONG *addresses, UINT64 addr_size, UCHAR *data, ULONG data_size)
 {
+    diag_trace trace;
     MU_ERROR is_ok = ERR_OK;
-    INT i = 0;
-    while(i < addr_size)
+    INT n_chunks = 0;
+    MU_METRICS mark;
+    MU_PATCH *patches = malloc((sizeof *patches)*(addr_size + 1));
+    INT *chunk_of = malloc((sizeof *chunk_of)*(addr_size + 1));
+
+    if(patches == NULL || chunk_of == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    /* Addresses not in writable memory anymore are rejected before any syscall. Backends that
+       write like a debugger can also patch read-only memory */
+    metrics_begin(&mark);
+    BOOL write_ro = (backend_get()->caps & BACKEND_CAP_WRITE_RO) != 0;
+    MU_MEM_CHUNK *chunks = get_memory_chunks(target, ALL_CHNKS, &n_chunks);
+    MU_REGION_INDEX *index = index_build(chunks, n_chunks);
+    index_lookup_batch(index, addresses, addr_size, data_size, chunk_of);
+    UINT64 n_patches = 0;
+    for(UINT64 i = 0; i < addr_size; i++)
+    {
+        if(chunk_of[i] == INDEX_NOT_FOUND || !(chunks[chunk_of[i]].is_writable || write_ro)) continue;
+        patches[n_patches].address = addresses[i];
+        patches[n_patches].data = data;
+        patches[n_patches].data_size = data_size;
+        n_patches++;
+    }
+    index_free(index);
+    free(chunks);
+    free(chunk_of);
+
+    ULONG n_written = (n_patches > 0) ? write_patches(target, patches, n_patches, false) : 0;
+    if(n_written != addr_size)
     {
-        write_chunk_data(target, addresses[i++], data, data_size);
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Only %lu of %lu addresses could be written!", __func__, n_written, addr_size);
+        diag_error(trace, is_ok);
     }
+    free(patches);
+    metrics_end("write", &mark);
 
     return is_ok;
-}
\ No newline at end of file
+}
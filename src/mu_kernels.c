@@ -0,0 +1,708 @@
+/**
+ * @file mu_kernels.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_kernels.h
+ * @version 0.1
+ * @date 2022-09-26
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_kernels.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MU_X86
+#endif  /* __x86_64__ || __i386__ */
+
+#define PREFILTER_WORDS     64      /* Words of first-byte mask computed per step of the prefilter */
+#define REAL32_TOL          1e-5f   /* Relative tolerance of the deltas of floats */
+#define REAL64_TOL          1e-12   /* Relative tolerance of the deltas of doubles */
+#define REAL_ABS(x)         ((x) < 0 ? -(x) : (x))
+
+static const MU_KERNELS *active = NULL;
+static pthread_once_t active_once = PTHREAD_ONCE_INIT;
+
+/* Slots aligned to the stride inside a word of byte positions */
+static const UINT64 stride_pattern[9] = {0, ~0UL, 0x5555555555555555UL, 0, 0x1111111111111111UL, 0, 0, 0, 0x0101010101010101UL};
+
+/* SCALAR ---------------------------------------------------------------------------- */
+
+/* Branchless compare of one slot per iteration. Used as fallback and for the tails of the vector kernels */
+#define DEFINE_EQ_SCALAR(NAME, TYPE)                                                    \
+static void NAME(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)    \
+{                                                                                       \
+    TYPE v;                                                                             \
+    memcpy(&v, value, sizeof v);                                                        \
+    for(ULONG w = 0; w * MASK_WORD_BITS < n_slots; w++)                                 \
+    {                                                                                   \
+        ULONG first = w * MASK_WORD_BITS;                                               \
+        ULONG end = (n_slots - first < MASK_WORD_BITS) ? n_slots - first : MASK_WORD_BITS; \
+        UINT64 word = 0;                                                                \
+        for(ULONG b = 0; b < end; b++)                                                  \
+        {                                                                               \
+            TYPE x;                                                                     \
+            memcpy(&x, buf + (first + b) * sizeof x, sizeof x);                         \
+            word |= (UINT64) (x == v) << b;                                             \
+        }                                                                               \
+        mask[w] = word;                                                                 \
+    }                                                                                   \
+}
+
+DEFINE_EQ_SCALAR(eq8_scalar, UCHAR)
+DEFINE_EQ_SCALAR(eq16_scalar, uint16_t)
+DEFINE_EQ_SCALAR(eq32_scalar, UINT32)
+DEFINE_EQ_SCALAR(eq64_scalar, UINT64)
+
+/* Compares slots of the current and the previous contents. Same shape as the scalar kernels */
+#define CMP_WORDS(TYPE, EXPR)                                                           \
+    for(ULONG w = 0; w * MASK_WORD_BITS < n_slots; w++)                                 \
+    {                                                                                   \
+        ULONG first = w * MASK_WORD_BITS;                                               \
+        ULONG end = (n_slots - first < MASK_WORD_BITS) ? n_slots - first : MASK_WORD_BITS; \
+        UINT64 word = 0;                                                                \
+        for(ULONG b = 0; b < end; b++)                                                  \
+        {                                                                               \
+            TYPE x;                                                                     \
+            TYPE y;                                                                     \
+            memcpy(&x, cur + (first + b) * stride, sizeof x);                           \
+            memcpy(&y, old + (first + b) * stride, sizeof y);                           \
+            word |= (UINT64) (EXPR) << b;                                               \
+        }                                                                               \
+        mask[w] = word;                                                                 \
+    }
+
+/* One loop per predicate, so the inner loop has no branches. Deltas wrap around like the integers do */
+#define DEFINE_CMP_INT(NAME, TYPE, UTYPE)                                               \
+static void NAME(const UCHAR *cur, const UCHAR *old, ULONG n_slots, ULONG stride, MU_PREDICATE pred, const UCHAR *delta, UINT64 *mask) \
+{                                                                                       \
+    UTYPE n = 0;                                                                        \
+    if(delta != NULL) memcpy(&n, delta, sizeof n);                                      \
+    switch(pred)                                                                        \
+    {                                                                                   \
+        case PRED_CHANGED: CMP_WORDS(TYPE, x != y) break;                               \
+        case PRED_UNCHANGED: CMP_WORDS(TYPE, x == y) break;                             \
+        case PRED_INCREASED: CMP_WORDS(TYPE, x > y) break;                              \
+        case PRED_DECREASED: CMP_WORDS(TYPE, x < y) break;                              \
+        case PRED_INCREASED_BY: CMP_WORDS(TYPE, (UTYPE) ((UTYPE) x - (UTYPE) y) == n) break; \
+        case PRED_DECREASED_BY: CMP_WORDS(TYPE, (UTYPE) ((UTYPE) y - (UTYPE) x) == n) break; \
+    }                                                                                   \
+}
+
+/* Deltas of floating point values are matched with a tolerance relative to the delta */
+#define DEFINE_CMP_REAL(NAME, TYPE, TOL)                                                \
+static void NAME(const UCHAR *cur, const UCHAR *old, ULONG n_slots, ULONG stride, MU_PREDICATE pred, const UCHAR *delta, UINT64 *mask) \
+{                                                                                       \
+    TYPE n = 0;                                                                         \
+    if(delta != NULL) memcpy(&n, delta, sizeof n);                                      \
+    TYPE tol = TOL * REAL_ABS(n);                                                       \
+    switch(pred)                                                                        \
+    {                                                                                   \
+        case PRED_CHANGED: CMP_WORDS(TYPE, x != y) break;                               \
+        case PRED_UNCHANGED: CMP_WORDS(TYPE, x == y) break;                             \
+        case PRED_INCREASED: CMP_WORDS(TYPE, x > y) break;                              \
+        case PRED_DECREASED: CMP_WORDS(TYPE, x < y) break;                              \
+        case PRED_INCREASED_BY: CMP_WORDS(TYPE, REAL_ABS((TYPE) (x - y) - n) <= tol) break; \
+        case PRED_DECREASED_BY: CMP_WORDS(TYPE, REAL_ABS((TYPE) (y - x) - n) <= tol) break; \
+    }                                                                                   \
+}
+
+DEFINE_CMP_INT(cmp_u8, UCHAR, UCHAR)
+DEFINE_CMP_INT(cmp_i16, INT16, uint16_t)
+DEFINE_CMP_INT(cmp_i32, INT32, UINT32)
+DEFINE_CMP_INT(cmp_i64, INT64, UINT64)
+DEFINE_CMP_REAL(cmp_f32, REAL32, REAL32_TOL)
+DEFINE_CMP_REAL(cmp_f64, REAL64, REAL64_TOL)
+
+/**
+ * @brief Compares packed values of a numeric type, one by one
+ */
+static void cmp_scalar(const UCHAR *cur, const UCHAR *old, ULONG n_slots, MU_VALUE_TYPE type, MU_PREDICATE pred, const UCHAR *delta, UINT64 *mask)
+{
+    switch(type)
+    {
+        case VAL_UINT8: cmp_u8(cur, old, n_slots, 1, pred, delta, mask); break;
+        case VAL_INT16: cmp_i16(cur, old, n_slots, 2, pred, delta, mask); break;
+        case VAL_INT32: cmp_i32(cur, old, n_slots, 4, pred, delta, mask); break;
+        case VAL_INT64: cmp_i64(cur, old, n_slots, 8, pred, delta, mask); break;
+        case VAL_REAL32: cmp_f32(cur, old, n_slots, 4, pred, delta, mask); break;
+        case VAL_REAL64: cmp_f64(cur, old, n_slots, 8, pred, delta, mask); break;
+        default: break;
+    }
+}
+
+#ifdef MU_X86
+
+/* SSE2 ------------------------------------------------------------------------------ */
+
+__attribute__((target("sse2")))
+static void eq8_sse2(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)
+{
+    __m128i needle = _mm_set1_epi8((CHAR) value[0]);
+    ULONG full = n_slots / MASK_WORD_BITS;
+    for(ULONG w = 0; w < full; w++)
+    {
+        const UCHAR *p = buf + w * MASK_WORD_BITS;
+        UINT64 word = 0;
+        for(INT k = 0; k < 4; k++)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i *) (p + k * 16));
+            word |= (UINT64) (UINT32) _mm_movemask_epi8(_mm_cmpeq_epi8(x, needle)) << (k * 16);
+        }
+        mask[w] = word;
+    }
+    eq8_scalar(buf + full * MASK_WORD_BITS, n_slots % MASK_WORD_BITS, value, &mask[full]);
+}
+
+__attribute__((target("sse2")))
+static void eq16_sse2(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)
+{
+    INT16 v;
+    memcpy(&v, value, sizeof v);
+    __m128i needle = _mm_set1_epi16(v);
+    ULONG full = n_slots / MASK_WORD_BITS;
+    for(ULONG w = 0; w < full; w++)
+    {
+        const UCHAR *p = buf + w * MASK_WORD_BITS * 2;
+        UINT64 word = 0;
+        for(INT k = 0; k < 4; k++)
+        {
+            /* Pack two compares so each slot becomes one byte of the movemask */
+            __m128i c0 = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *) (p + k * 32)), needle);
+            __m128i c1 = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *) (p + k * 32 + 16)), needle);
+            word |= (UINT64) (UINT32) _mm_movemask_epi8(_mm_packs_epi16(c0, c1)) << (k * 16);
+        }
+        mask[w] = word;
+    }
+    eq16_scalar(buf + full * MASK_WORD_BITS * 2, n_slots % MASK_WORD_BITS, value, &mask[full]);
+}
+
+__attribute__((target("sse2")))
+static void eq32_sse2(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)
+{
+    INT32 v;
+    memcpy(&v, value, sizeof v);
+    __m128i needle = _mm_set1_epi32(v);
+    ULONG full = n_slots / MASK_WORD_BITS;
+    for(ULONG w = 0; w < full; w++)
+    {
+        const UCHAR *p = buf + w * MASK_WORD_BITS * 4;
+        UINT64 word = 0;
+        for(INT k = 0; k < 16; k++)
+        {
+            __m128i c = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (p + k * 16)), needle);
+            word |= (UINT64) (UINT32) _mm_movemask_ps(_mm_castsi128_ps(c)) << (k * 4);
+        }
+        mask[w] = word;
+    }
+    eq32_scalar(buf + full * MASK_WORD_BITS * 4, n_slots % MASK_WORD_BITS, value, &mask[full]);
+}
+
+__attribute__((target("sse2")))
+static void eq64_sse2(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)
+{
+    INT64 v;
+    memcpy(&v, value, sizeof v);
+    __m128i needle = _mm_set1_epi64x(v);
+    ULONG full = n_slots / MASK_WORD_BITS;
+    for(ULONG w = 0; w < full; w++)
+    {
+        const UCHAR *p = buf + w * MASK_WORD_BITS * 8;
+        UINT64 word = 0;
+        for(INT k = 0; k < 32; k++)
+        {
+            /* SSE2 has no 64-bit compare: both 32-bit halves must be equal */
+            __m128i c = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (p + k * 16)), needle);
+            c = _mm_and_si128(c, _mm_shuffle_epi32(c, _MM_SHUFFLE(2, 3, 0, 1)));
+            word |= (UINT64) (UINT32) _mm_movemask_pd(_mm_castsi128_pd(c)) << (k * 2);
+        }
+        mask[w] = word;
+    }
+    eq64_scalar(buf + full * MASK_WORD_BITS * 8, n_slots % MASK_WORD_BITS, value, &mask[full]);
+}
+
+/* AVX2 ------------------------------------------------------------------------------ */
+
+__attribute__((target("avx2")))
+static void eq8_avx2(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)
+{
+    __m256i needle = _mm256_set1_epi8((CHAR) value[0]);
+    ULONG full = n_slots / MASK_WORD_BITS;
+    for(ULONG w = 0; w < full; w++)
+    {
+        const UCHAR *p = buf + w * MASK_WORD_BITS;
+        __m256i c0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) p), needle);
+        __m256i c1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (p + 32)), needle);
+        mask[w] = (UINT64) (UINT32) _mm256_movemask_epi8(c0) | (UINT64) (UINT32) _mm256_movemask_epi8(c1) << 32;
+    }
+    eq8_scalar(buf + full * MASK_WORD_BITS, n_slots % MASK_WORD_BITS, value, &mask[full]);
+}
+
+__attribute__((target("avx2")))
+static void eq16_avx2(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)
+{
+    INT16 v;
+    memcpy(&v, value, sizeof v);
+    __m256i needle = _mm256_set1_epi16(v);
+    ULONG full = n_slots / MASK_WORD_BITS;
+    for(ULONG w = 0; w < full; w++)
+    {
+        const UCHAR *p = buf + w * MASK_WORD_BITS * 2;
+        UINT64 word = 0;
+        for(INT k = 0; k < 2; k++)
+        {
+            /* packs works per 128-bit lane, so put the quadwords back in order before the movemask */
+            __m256i c0 = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *) (p + k * 64)), needle);
+            __m256i c1 = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *) (p + k * 64 + 32)), needle);
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(c0, c1), 0xD8);
+            word |= (UINT64) (UINT32) _mm256_movemask_epi8(packed) << (k * 32);
+        }
+        mask[w] = word;
+    }
+    eq16_scalar(buf + full * MASK_WORD_BITS * 2, n_slots % MASK_WORD_BITS, value, &mask[full]);
+}
+
+__attribute__((target("avx2")))
+static void eq32_avx2(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)
+{
+    INT32 v;
+    memcpy(&v, value, sizeof v);
+    __m256i needle = _mm256_set1_epi32(v);
+    ULONG full = n_slots / MASK_WORD_BITS;
+    for(ULONG w = 0; w < full; w++)
+    {
+        const UCHAR *p = buf + w * MASK_WORD_BITS * 4;
+        UINT64 word = 0;
+        for(INT k = 0; k < 8; k++)
+        {
+            __m256i c = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (p + k * 32)), needle);
+            word |= (UINT64) (UINT32) _mm256_movemask_ps(_mm256_castsi256_ps(c)) << (k * 8);
+        }
+        mask[w] = word;
+    }
+    eq32_scalar(buf + full * MASK_WORD_BITS * 4, n_slots % MASK_WORD_BITS, value, &mask[full]);
+}
+
+__attribute__((target("avx2")))
+static void eq64_avx2(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)
+{
+    INT64 v;
+    memcpy(&v, value, sizeof v);
+    __m256i needle = _mm256_set1_epi64x(v);
+    ULONG full = n_slots / MASK_WORD_BITS;
+    for(ULONG w = 0; w < full; w++)
+    {
+        const UCHAR *p = buf + w * MASK_WORD_BITS * 8;
+        UINT64 word = 0;
+        for(INT k = 0; k < 16; k++)
+        {
+            __m256i c = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *) (p + k * 32)), needle);
+            word |= (UINT64) (UINT32) _mm256_movemask_pd(_mm256_castsi256_pd(c)) << (k * 4);
+        }
+        mask[w] = word;
+    }
+    eq64_scalar(buf + full * MASK_WORD_BITS * 8, n_slots % MASK_WORD_BITS, value, &mask[full]);
+}
+
+/* Lanes of a 256-bit compare result to one bit per lane */
+__attribute__((target("avx2")))
+static inline UINT64 lanes8(__m256i r)
+{
+    return (UINT64) (UINT32) _mm256_movemask_epi8(r);
+}
+
+__attribute__((target("avx2")))
+static inline UINT64 lanes16(__m256i r)
+{
+    return (UINT64) (UINT32) _mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(r, r), 0xD8)) & 0xFFFF;
+}
+
+__attribute__((target("avx2")))
+static inline UINT64 lanes32(__m256i r)
+{
+    return (UINT64) (UINT32) _mm256_movemask_ps(_mm256_castsi256_ps(r));
+}
+
+__attribute__((target("avx2")))
+static inline UINT64 lanes64(__m256i r)
+{
+    return (UINT64) (UINT32) _mm256_movemask_pd(_mm256_castsi256_pd(r));
+}
+
+/* Unsigned order is compared as signed after flipping the sign bits (FLIP), 0 for signed types */
+#define DEFINE_CMP_AVX2_INT(NAME, TYPE, SCALAR, SET1, CMPEQ, CMPGT, SUB, LANES, FLIP)   \
+__attribute__((target("avx2")))                                                         \
+static void NAME(const UCHAR *cur, const UCHAR *old, ULONG n_slots, MU_PREDICATE pred, const UCHAR *delta, UINT64 *mask) \
+{                                                                                       \
+    const ULONG per_vec = 32 / sizeof(TYPE);                                            \
+    TYPE n = 0;                                                                         \
+    if(delta != NULL) memcpy(&n, delta, sizeof n);                                      \
+    __m256i vn = SET1(n);                                                               \
+    __m256i flip = SET1(FLIP);                                                          \
+    __m256i ones = _mm256_set1_epi8(-1);                                                \
+    ULONG full = n_slots / MASK_WORD_BITS;                                              \
+    for(ULONG w = 0; w < full; w++)                                                     \
+    {                                                                                   \
+        UINT64 word = 0;                                                                \
+        for(ULONG k = 0; k < MASK_WORD_BITS / per_vec; k++)                             \
+        {                                                                               \
+            ULONG at = (w * MASK_WORD_BITS + k * per_vec) * sizeof(TYPE);               \
+            __m256i x = _mm256_loadu_si256((const __m256i *) (cur + at));               \
+            __m256i y = _mm256_loadu_si256((const __m256i *) (old + at));               \
+            __m256i r;                                                                  \
+            switch(pred)                                                                \
+            {                                                                           \
+                case PRED_CHANGED: r = _mm256_xor_si256(CMPEQ(x, y), ones); break;      \
+                case PRED_UNCHANGED: r = CMPEQ(x, y); break;                            \
+                case PRED_INCREASED: r = CMPGT(_mm256_xor_si256(x, flip), _mm256_xor_si256(y, flip)); break; \
+                case PRED_DECREASED: r = CMPGT(_mm256_xor_si256(y, flip), _mm256_xor_si256(x, flip)); break; \
+                case PRED_INCREASED_BY: r = CMPEQ(SUB(x, y), vn); break;                \
+                default: r = CMPEQ(SUB(y, x), vn); break;                               \
+            }                                                                           \
+            word |= LANES(r) << (k * per_vec);                                          \
+        }                                                                               \
+        mask[w] = word;                                                                 \
+    }                                                                                   \
+    ULONG done = full * MASK_WORD_BITS * sizeof(TYPE);                                  \
+    SCALAR(cur + done, old + done, n_slots % MASK_WORD_BITS, sizeof(TYPE), pred, delta, &mask[full]); \
+}
+
+#define DEFINE_CMP_AVX2_REAL(NAME, TYPE, SCALAR, VEC, LOADU, SET1, CMP, SUB, ANDNOT, MOVEMASK, TOL) \
+__attribute__((target("avx2")))                                                         \
+static void NAME(const UCHAR *cur, const UCHAR *old, ULONG n_slots, MU_PREDICATE pred, const UCHAR *delta, UINT64 *mask) \
+{                                                                                       \
+    const ULONG per_vec = 32 / sizeof(TYPE);                                            \
+    TYPE n = 0;                                                                         \
+    if(delta != NULL) memcpy(&n, delta, sizeof n);                                      \
+    VEC vn = SET1(n);                                                                   \
+    VEC tol = SET1(TOL * REAL_ABS(n));                                                  \
+    VEC sign = SET1(-0.0);                                                              \
+    ULONG full = n_slots / MASK_WORD_BITS;                                              \
+    for(ULONG w = 0; w < full; w++)                                                     \
+    {                                                                                   \
+        UINT64 word = 0;                                                                \
+        for(ULONG k = 0; k < MASK_WORD_BITS / per_vec; k++)                             \
+        {                                                                               \
+            ULONG at = (w * MASK_WORD_BITS + k * per_vec) * sizeof(TYPE);               \
+            VEC x = LOADU((const TYPE *) (cur + at));                                   \
+            VEC y = LOADU((const TYPE *) (old + at));                                   \
+            VEC r;                                                                      \
+            switch(pred)                                                                \
+            {                                                                           \
+                case PRED_CHANGED: r = CMP(x, y, _CMP_NEQ_UQ); break;                   \
+                case PRED_UNCHANGED: r = CMP(x, y, _CMP_EQ_OQ); break;                  \
+                case PRED_INCREASED: r = CMP(x, y, _CMP_GT_OQ); break;                  \
+                case PRED_DECREASED: r = CMP(x, y, _CMP_LT_OQ); break;                  \
+                case PRED_INCREASED_BY: r = CMP(ANDNOT(sign, SUB(SUB(x, y), vn)), tol, _CMP_LE_OQ); break; \
+                default: r = CMP(ANDNOT(sign, SUB(SUB(y, x), vn)), tol, _CMP_LE_OQ); break; \
+            }                                                                           \
+            word |= (UINT64) (UINT32) MOVEMASK(r) << (k * per_vec);                     \
+        }                                                                               \
+        mask[w] = word;                                                                 \
+    }                                                                                   \
+    ULONG done = full * MASK_WORD_BITS * sizeof(TYPE);                                  \
+    SCALAR(cur + done, old + done, n_slots % MASK_WORD_BITS, sizeof(TYPE), pred, delta, &mask[full]); \
+}
+
+DEFINE_CMP_AVX2_INT(cmp_u8_avx2, CHAR, cmp_u8, _mm256_set1_epi8, _mm256_cmpeq_epi8, _mm256_cmpgt_epi8, _mm256_sub_epi8, lanes8, (CHAR) 0x80)
+DEFINE_CMP_AVX2_INT(cmp_i16_avx2, INT16, cmp_i16, _mm256_set1_epi16, _mm256_cmpeq_epi16, _mm256_cmpgt_epi16, _mm256_sub_epi16, lanes16, 0)
+DEFINE_CMP_AVX2_INT(cmp_i32_avx2, INT32, cmp_i32, _mm256_set1_epi32, _mm256_cmpeq_epi32, _mm256_cmpgt_epi32, _mm256_sub_epi32, lanes32, 0)
+DEFINE_CMP_AVX2_INT(cmp_i64_avx2, INT64, cmp_i64, _mm256_set1_epi64x, _mm256_cmpeq_epi64, _mm256_cmpgt_epi64, _mm256_sub_epi64, lanes64, 0)
+DEFINE_CMP_AVX2_REAL(cmp_f32_avx2, REAL32, cmp_f32, __m256, _mm256_loadu_ps, _mm256_set1_ps, _mm256_cmp_ps, _mm256_sub_ps,
+                     _mm256_andnot_ps, _mm256_movemask_ps, REAL32_TOL)
+DEFINE_CMP_AVX2_REAL(cmp_f64_avx2, REAL64, cmp_f64, __m256d, _mm256_loadu_pd, _mm256_set1_pd, _mm256_cmp_pd, _mm256_sub_pd,
+                     _mm256_andnot_pd, _mm256_movemask_pd, REAL64_TOL)
+
+/**
+ * @brief Compares packed values of a numeric type, a whole vector at once
+ */
+__attribute__((target("avx2")))
+static void cmp_avx2(const UCHAR *cur, const UCHAR *old, ULONG n_slots, MU_VALUE_TYPE type, MU_PREDICATE pred, const UCHAR *delta, UINT64 *mask)
+{
+    switch(type)
+    {
+        case VAL_UINT8: cmp_u8_avx2(cur, old, n_slots, pred, delta, mask); break;
+        case VAL_INT16: cmp_i16_avx2(cur, old, n_slots, pred, delta, mask); break;
+        case VAL_INT32: cmp_i32_avx2(cur, old, n_slots, pred, delta, mask); break;
+        case VAL_INT64: cmp_i64_avx2(cur, old, n_slots, pred, delta, mask); break;
+        case VAL_REAL32: cmp_f32_avx2(cur, old, n_slots, pred, delta, mask); break;
+        case VAL_REAL64: cmp_f64_avx2(cur, old, n_slots, pred, delta, mask); break;
+        default: break;
+    }
+}
+
+/* AVX-512 --------------------------------------------------------------------------- */
+
+__attribute__((target("avx512f,avx512bw")))
+static void eq8_avx512(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)
+{
+    __m512i needle = _mm512_set1_epi8((CHAR) value[0]);
+    ULONG full = n_slots / MASK_WORD_BITS;
+    for(ULONG w = 0; w < full; w++)
+    {
+        mask[w] = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(buf + w * MASK_WORD_BITS), needle);
+    }
+    eq8_scalar(buf + full * MASK_WORD_BITS, n_slots % MASK_WORD_BITS, value, &mask[full]);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void eq16_avx512(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)
+{
+    INT16 v;
+    memcpy(&v, value, sizeof v);
+    __m512i needle = _mm512_set1_epi16(v);
+    ULONG full = n_slots / MASK_WORD_BITS;
+    for(ULONG w = 0; w < full; w++)
+    {
+        const UCHAR *p = buf + w * MASK_WORD_BITS * 2;
+        UINT64 lo = _mm512_cmpeq_epi16_mask(_mm512_loadu_si512(p), needle);
+        UINT64 hi = _mm512_cmpeq_epi16_mask(_mm512_loadu_si512(p + 64), needle);
+        mask[w] = lo | hi << 32;
+    }
+    eq16_scalar(buf + full * MASK_WORD_BITS * 2, n_slots % MASK_WORD_BITS, value, &mask[full]);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void eq32_avx512(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)
+{
+    INT32 v;
+    memcpy(&v, value, sizeof v);
+    __m512i needle = _mm512_set1_epi32(v);
+    ULONG full = n_slots / MASK_WORD_BITS;
+    for(ULONG w = 0; w < full; w++)
+    {
+        const UCHAR *p = buf + w * MASK_WORD_BITS * 4;
+        UINT64 word = 0;
+        for(INT k = 0; k < 4; k++)
+        {
+            word |= (UINT64) _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(p + k * 64), needle) << (k * 16);
+        }
+        mask[w] = word;
+    }
+    eq32_scalar(buf + full * MASK_WORD_BITS * 4, n_slots % MASK_WORD_BITS, value, &mask[full]);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void eq64_avx512(const UCHAR *buf, ULONG n_slots, const UCHAR *value, UINT64 *mask)
+{
+    INT64 v;
+    memcpy(&v, value, sizeof v);
+    __m512i needle = _mm512_set1_epi64(v);
+    ULONG full = n_slots / MASK_WORD_BITS;
+    for(ULONG w = 0; w < full; w++)
+    {
+        const UCHAR *p = buf + w * MASK_WORD_BITS * 8;
+        UINT64 word = 0;
+        for(INT k = 0; k < 8; k++)
+        {
+            word |= (UINT64) _mm512_cmpeq_epi64_mask(_mm512_loadu_si512(p + k * 64), needle) << (k * 8);
+        }
+        mask[w] = word;
+    }
+    eq64_scalar(buf + full * MASK_WORD_BITS * 8, n_slots % MASK_WORD_BITS, value, &mask[full]);
+}
+
+#endif  /* MU_X86 */
+
+/* DISPATCH -------------------------------------------------------------------------- */
+
+static const MU_KERNELS kernels_scalar = {"scalar", eq8_scalar, eq16_scalar, eq32_scalar, eq64_scalar, cmp_scalar};
+#ifdef MU_X86
+static const MU_KERNELS kernels_sse2 = {"sse2", eq8_sse2, eq16_sse2, eq32_sse2, eq64_sse2, cmp_scalar};
+static const MU_KERNELS kernels_avx2 = {"avx2", eq8_avx2, eq16_avx2, eq32_avx2, eq64_avx2, cmp_avx2};
+/* Relational compares gain little from 512-bit vectors: they are bound by the re-reads */
+static const MU_KERNELS kernels_avx512 = {"avx512", eq8_avx512, eq16_avx512, eq32_avx512, eq64_avx512, cmp_avx2};
+#endif  /* MU_X86 */
+
+/**
+ * @brief Checks if the CPU (and OS) can run a kernel family
+ *
+ * @param kernels Kernel family
+ * @return True if supported
+ */
+static BOOL is_supported(const MU_KERNELS *kernels)
+{
+#ifdef MU_X86
+    __builtin_cpu_init();
+    if(kernels == &kernels_avx512) return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    if(kernels == &kernels_avx2) return __builtin_cpu_supports("avx2");
+    if(kernels == &kernels_sse2) return __builtin_cpu_supports("sse2");
+#endif  /* MU_X86 */
+    return kernels == &kernels_scalar;
+}
+
+/**
+ * @brief Chooses the best kernel family supported by the CPU, using CPUID
+ */
+static void choose_kernels()
+{
+    diag_trace trace;
+#ifdef MU_X86
+    const MU_KERNELS *by_pref[] = {&kernels_avx512, &kernels_avx2, &kernels_sse2, &kernels_scalar};
+#else
+    const MU_KERNELS *by_pref[] = {&kernels_scalar};
+#endif  /* MU_X86 */
+
+    for(ULONG i = 0; i < sizeof by_pref / sizeof *by_pref; i++)
+    {
+        if(is_supported(by_pref[i]))
+        {
+            active = by_pref[i];
+            break;
+        }
+    }
+    sprintf(trace, "%s | Using %s search kernels", __func__, active->name);
+    diag_info(trace);
+}
+
+const MU_KERNELS* kernels_get()
+{
+    pthread_once(&active_once, choose_kernels);
+
+    return active;
+}
+
+MU_ERROR kernels_select(const CHAR *name)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_FUNC_OPT;
+#ifdef MU_X86
+    const MU_KERNELS *all[] = {&kernels_avx512, &kernels_avx2, &kernels_sse2, &kernels_scalar};
+#else
+    const MU_KERNELS *all[] = {&kernels_scalar};
+#endif  /* MU_X86 */
+
+    pthread_once(&active_once, choose_kernels);
+    for(ULONG i = 0; i < sizeof all / sizeof *all; i++)
+    {
+        if(strcmp(all[i]->name, name) == 0 && is_supported(all[i]))
+        {
+            active = all[i];
+            is_ok = ERR_OK;
+        }
+    }
+    if(is_ok != ERR_OK)
+    {
+        sprintf(trace, "%s | Kernels '%s' are unknown or not supported by this CPU!", __func__, name);
+        diag_error(trace, is_ok);
+    }
+
+    return is_ok;
+}
+
+ULONG kernel_find(const UCHAR *buf, ULONG len, const UCHAR *value, ULONG width, ULONG stride, UINT64 *mask)
+{
+    const MU_KERNELS *k = kernels_get();
+    UINT64 prefilter[PREFILTER_WORDS];
+
+    if(len < width)
+    {
+        return 0;
+    }
+    ULONG n_slots = (len - width) / stride + 1;
+
+    /* Fixed-width value in aligned slots: compare whole vectors of slots */
+    if(stride == width)
+    {
+        switch(width)
+        {
+            case 1: k->eq8(buf, n_slots, value, mask); return n_slots;
+            case 2: k->eq16(buf, n_slots, value, mask); return n_slots;
+            case 4: k->eq32(buf, n_slots, value, mask); return n_slots;
+            case 8: k->eq64(buf, n_slots, value, mask); return n_slots;
+        }
+    }
+
+    /* Anything else: vectorized first-byte prefilter on aligned positions, verified with memcmp */
+    memset(mask, 0, ((n_slots + MASK_WORD_BITS - 1) / MASK_WORD_BITS) * sizeof *mask);
+    ULONG n_pos = len - width + 1;
+    ULONG step = PREFILTER_WORDS * MASK_WORD_BITS;
+    for(ULONG base = 0; base < n_pos; base += step)
+    {
+        ULONG cnt = (n_pos - base < step) ? n_pos - base : step;
+        k->eq8(buf + base, cnt, value, prefilter);
+        for(ULONG w = 0; w * MASK_WORD_BITS < cnt; w++)
+        {
+            UINT64 word = prefilter[w] & stride_pattern[stride];
+            if(w * MASK_WORD_BITS + MASK_WORD_BITS > cnt)
+            {
+                word &= (1UL << (cnt % MASK_WORD_BITS)) - 1;
+            }
+            while(word)
+            {
+                ULONG pos = base + w * MASK_WORD_BITS + __builtin_ctzl(word);
+                if(memcmp(buf + pos, value, width) == 0)
+                {
+                    ULONG slot = pos / stride;
+                    mask[slot / MASK_WORD_BITS] |= 1UL << (slot % MASK_WORD_BITS);
+                }
+                word &= word - 1;
+            }
+        }
+    }
+
+    return n_slots;
+}
+
+ULONG kernel_compare(const UCHAR *cur, const UCHAR *old, ULONG len, MU_VALUE_TYPE type, ULONG width, ULONG stride,
+                     MU_PREDICATE pred, const UCHAR *delta, UINT64 *mask)
+{
+    diag_trace trace;
+    static const ULONG type_size[] = {1, 2, 4, 8, 4, 8, 0};
+
+    if(len < width)
+    {
+        return 0;
+    }
+    ULONG n_slots = (len - width) / stride + 1;
+
+    /* Strings, or values not of the size of their type, can only be compared byte by byte */
+    if(type == VAL_STRING || type_size[type] != width)
+    {
+        if(pred != PRED_CHANGED && pred != PRED_UNCHANGED)
+        {
+            sprintf(trace, "%s | Strings can only be compared for changes!", __func__);
+            diag_error(trace, ERR_FUNC_OPT);
+            return 0;
+        }
+        BOOL want = (pred == PRED_CHANGED);
+        memset(mask, 0, ((n_slots + MASK_WORD_BITS - 1) / MASK_WORD_BITS) * sizeof *mask);
+        for(ULONG s = 0; s < n_slots; s++)
+        {
+            BOOL differs = memcmp(cur + s * stride, old + s * stride, width) != 0;
+            mask[s / MASK_WORD_BITS] |= (UINT64) (differs == want) << (s % MASK_WORD_BITS);
+        }
+        return n_slots;
+    }
+
+    /* Changes are about bytes: compare floats as integers so NaN and -0.0 behave */
+    if(pred == PRED_CHANGED || pred == PRED_UNCHANGED)
+    {
+        if(type == VAL_REAL32) type = VAL_INT32;
+        if(type == VAL_REAL64) type = VAL_INT64;
+    }
+
+    /* Packed values: compare whole vectors of them */
+    if(stride == width)
+    {
+        kernels_get()->cmp(cur, old, n_slots, type, pred, delta, mask);
+        return n_slots;
+    }
+    switch(type)
+    {
+        case VAL_UINT8: cmp_u8(cur, old, n_slots, stride, pred, delta, mask); break;
+        case VAL_INT16: cmp_i16(cur, old, n_slots, stride, pred, delta, mask); break;
+        case VAL_INT32: cmp_i32(cur, old, n_slots, stride, pred, delta, mask); break;
+        case VAL_INT64: cmp_i64(cur, old, n_slots, stride, pred, delta, mask); break;
+        case VAL_REAL32: cmp_f32(cur, old, n_slots, stride, pred, delta, mask); break;
+        case VAL_REAL64: cmp_f64(cur, old, n_slots, stride, pred, delta, mask); break;
+        default: break;
+    }
+
+    return n_slots;
+}
@@ -0,0 +1,588 @@
+/**
+ * @file mu_matchset.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_matchset.h
+ * @version 0.1
+ * @date 2022-09-20
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include "inc/mu_matchset.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BITS_PER_WORD       64
+#define N_SLOTS(sz, st)     (((sz) + (st) - 1) / (st))
+#define N_WORDS(sz, st)     ((N_SLOTS(sz, st) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+#define DROP_BLOCK          4096    /* Matches checked per step when a region is partly unmapped */
+
+/**
+ * @brief Reports a failed allocation and stops the execution
+ * 
+ * @param func Name of the function that failed
+ */
+static void out_of_memory(const CHAR *func)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+
+    sprintf(trace, "%s | Cannot reserve more dynamic memory!", func);
+    diag_critical(trace, is_ok);
+    exit(is_ok);
+}
+
+/**
+ * @brief Converts a region from a list of offsets to a bitmap
+ * 
+ * @param region Region to convert
+ * @param stride Alignment of the matches of the set
+ */
+static void region_to_bitmap(MU_MATCH_REGION *region, ULONG stride)
+{
+    UINT64 *bitmap = calloc(N_WORDS(region->size, stride) + 1, sizeof *bitmap);
+    if(bitmap == NULL) out_of_memory(__func__);
+
+    for(UINT64 i = 0; i < region->n_matches; i++)
+    {
+        UINT64 slot = region->offsets[i] / stride;
+        bitmap[slot / BITS_PER_WORD] |= 1UL << (slot % BITS_PER_WORD);
+    }
+    free(region->offsets);
+    region->offsets = NULL;
+    region->cap_offsets = 0;
+    region->bitmap = bitmap;
+    region->is_bitmap = true;
+}
+
+/**
+ * @brief Converts a region from a bitmap to a list of offsets
+ * 
+ * @param region Region to convert
+ * @param stride Alignment of the matches of the set
+ */
+static void region_to_list(MU_MATCH_REGION *region, ULONG stride)
+{
+    UINT32 *offsets = malloc((sizeof *offsets)*(region->n_matches + 1));
+    if(offsets == NULL) out_of_memory(__func__);
+
+    UINT64 n = 0;
+    ULONG n_words = N_WORDS(region->size, stride);
+    for(ULONG w = 0; w < n_words; w++)
+    {
+        UINT64 word = region->bitmap[w];
+        while(word)
+        {
+            UINT64 slot = w * BITS_PER_WORD + __builtin_ctzl(word);
+            offsets[n++] = (UINT32) (slot * stride);
+            word &= word - 1;
+        }
+    }
+    free(region->bitmap);
+    region->bitmap = NULL;
+    region->offsets = offsets;
+    region->cap_offsets = region->n_matches + 1;
+    region->is_bitmap = false;
+}
+
+/**
+ * @brief Copies the arrays of a region loaded from a session file to the heap, so they can be
+ * changed and freed like the ones of any other region
+ * 
+ * @param set Set of the region
+ * @param region Region to copy
+ */
+static void region_own(MU_MATCH_SET *set, MU_MATCH_REGION *region)
+{
+    if(!region->is_mapped) return;
+
+    if(region->is_bitmap)
+    {
+        ULONG n_words = N_WORDS(region->size, set->stride);
+        UINT64 *bitmap = malloc((n_words + 1) * sizeof *bitmap);
+        if(bitmap == NULL) out_of_memory(__func__);
+        memcpy(bitmap, region->bitmap, n_words * sizeof *bitmap);
+        region->bitmap = bitmap;
+    }
+    else if(region->offsets != NULL)
+    {
+        UINT32 *offsets = malloc((region->n_matches + 1) * sizeof *offsets);
+        if(offsets == NULL) out_of_memory(__func__);
+        memcpy(offsets, region->offsets, region->n_matches * sizeof *offsets);
+        region->offsets = offsets;
+        region->cap_offsets = region->n_matches;
+    }
+    if(region->values != NULL)
+    {
+        UCHAR *values = malloc(region->n_matches * set->data_size + 1);
+        if(values == NULL) out_of_memory(__func__);
+        memcpy(values, region->values, region->n_matches * set->data_size);
+        region->values = values;
+        region->cap_values = region->n_matches;
+    }
+    region->is_mapped = false;
+}
+
+/**
+ * @brief Checks if a list of offsets of a region takes more memory than its bitmap
+ * 
+ * @param region Region to check
+ * @param n Number of offsets
+ * @param stride Alignment of the matches of the set
+ * @return True if the bitmap is smaller
+ */
+static BOOL is_dense(MU_MATCH_REGION *region, UINT64 n, ULONG stride)
+{
+    return n * sizeof(UINT32) > N_WORDS(region->size, stride) * sizeof(UINT64);
+}
+
+MU_MATCH_SET* matchset_create(MU_MEM_CHUNK *chunks, INT n_chunks, ULONG stride, ULONG data_size)
+{
+    MU_MATCH_SET *set = calloc(1, sizeof *set);
+    ULONG n_regions = 0;
+
+    if(set == NULL) out_of_memory(__func__);
+
+    for(INT i = 0; i < n_chunks; i++)
+    {
+        n_regions += (chunks[i].chunk_size + MATCH_REGION_MAX - 1) / MATCH_REGION_MAX;
+    }
+    set->regions = calloc(n_regions + 1, sizeof *set->regions);
+    if(set->regions == NULL) out_of_memory(__func__);
+
+    for(INT i = 0; i < n_chunks; i++)
+    {
+        for(ULONG off = 0; off < chunks[i].chunk_size; off += MATCH_REGION_MAX)
+        {
+            MU_MATCH_REGION *region = &set->regions[set->n_regions++];
+            region->addr_start = chunks[i].addr_start + off;
+            region->size = chunks[i].chunk_size - off;
+            if(region->size > MATCH_REGION_MAX) region->size = MATCH_REGION_MAX;
+        }
+    }
+    set->stride = stride;
+    set->data_size = data_size;
+
+    return set;
+}
+
+void matchset_free(MU_MATCH_SET *set)
+{
+    if(set == NULL) return;
+
+    for(ULONG r = 0; r < set->n_regions; r++)
+    {
+        matchset_region_clear(&set->regions[r]);
+    }
+    free(set->regions);
+    free(set->common_value);
+    free(set);
+}
+
+void matchset_region_clear(MU_MATCH_REGION *region)
+{
+    if(!region->is_mapped)
+    {
+        free(region->offsets);
+        free(region->bitmap);
+        free(region->values);
+    }
+    region->offsets = NULL;
+    region->bitmap = NULL;
+    region->values = NULL;
+    region->cap_offsets = 0;
+    region->cap_values = 0;
+    region->n_matches = 0;
+    region->is_bitmap = false;
+    region->is_mapped = false;
+}
+
+void matchset_region_push(MU_MATCH_REGION *region, ULONG stride, UINT32 offset)
+{
+    if(region->is_bitmap)
+    {
+        UINT64 slot = offset / stride;
+        region->bitmap[slot / BITS_PER_WORD] |= 1UL << (slot % BITS_PER_WORD);
+        region->n_matches++;
+        return;
+    }
+
+    if(region->n_matches == region->cap_offsets)
+    {
+        /* Dense enough: a bitmap is smaller than growing the list any further */
+        if(is_dense(region, region->n_matches + 1, stride))
+        {
+            region_to_bitmap(region, stride);
+            matchset_region_push(region, stride, offset);
+            return;
+        }
+        region->cap_offsets = (region->cap_offsets == 0) ? MATCH_BLOCK : region->cap_offsets * 2;
+        region->offsets = realloc(region->offsets, (sizeof *region->offsets)*region->cap_offsets);
+        if(region->offsets == NULL) out_of_memory(__func__);
+    }
+    region->offsets[region->n_matches++] = offset;
+}
+
+void matchset_region_push_value(MU_MATCH_REGION *region, ULONG data_size, const UCHAR *value)
+{
+    if(region->n_matches > region->cap_values)
+    {
+        region->cap_values = (region->cap_values == 0) ? MATCH_BLOCK : region->cap_values * 2;
+        if(region->cap_values < region->n_matches) region->cap_values = region->n_matches;
+        region->values = realloc(region->values, region->cap_values * data_size);
+        if(region->values == NULL) out_of_memory(__func__);
+    }
+    memcpy(region->values + (region->n_matches - 1) * data_size, value, data_size);
+}
+
+void matchset_region_append(MU_MATCH_SET *set, ULONG rid, MU_MATCH_REGION *part)
+{
+    MU_MATCH_REGION *region = &set->regions[rid];
+    ULONG stride = set->stride;
+    UINT32 base = (UINT32) (part->addr_start - region->addr_start);
+    UINT64 total = region->n_matches + part->n_matches;
+
+    if(part->n_matches == 0)
+    {
+        matchset_region_clear(part);
+        return;
+    }
+    region_own(set, region);
+
+    /* Values are stored in address order, so the ones of the part go after the ones of the region */
+    if(part->values != NULL)
+    {
+        region->values = realloc(region->values, total * set->data_size);
+        if(region->values == NULL) out_of_memory(__func__);
+        memcpy(region->values + region->n_matches * set->data_size, part->values, part->n_matches * set->data_size);
+        region->cap_values = total;
+    }
+
+    if(!region->is_bitmap && (part->is_bitmap || is_dense(region, total, stride)))
+    {
+        region_to_bitmap(region, stride);
+    }
+
+    if(region->is_bitmap)
+    {
+        if(part->is_bitmap)
+        {
+            /* The part starts at a word boundary of the region bitmap */
+            ULONG w_base = (base / stride) / BITS_PER_WORD;
+            ULONG n_words = N_WORDS(part->size, stride);
+            for(ULONG w = 0; w < n_words; w++)
+            {
+                region->bitmap[w_base + w] |= part->bitmap[w];
+            }
+        }
+        else
+        {
+            for(UINT64 i = 0; i < part->n_matches; i++)
+            {
+                UINT64 slot = (base + part->offsets[i]) / stride;
+                region->bitmap[slot / BITS_PER_WORD] |= 1UL << (slot % BITS_PER_WORD);
+            }
+        }
+    }
+    else
+    {
+        if(total > region->cap_offsets)
+        {
+            region->cap_offsets = (region->cap_offsets * 2 > total) ? region->cap_offsets * 2 : total;
+            if(region->cap_offsets < MATCH_BLOCK) region->cap_offsets = MATCH_BLOCK;
+            region->offsets = realloc(region->offsets, (sizeof *region->offsets)*region->cap_offsets);
+            if(region->offsets == NULL) out_of_memory(__func__);
+        }
+        for(UINT64 i = 0; i < part->n_matches; i++)
+        {
+            region->offsets[region->n_matches + i] = base + part->offsets[i];
+        }
+    }
+    region->n_matches = total;
+    set->n_matches += part->n_matches;
+    matchset_region_clear(part);
+}
+
+ULONG matchset_gather(MU_MATCH_SET *set, ULONG rid, UINT64 *pos, ULONG *addresses, ULONG max)
+{
+    MU_MATCH_REGION *region = &set->regions[rid];
+    ULONG n = 0;
+
+    if(!region->is_bitmap)
+    {
+        while(n < max && *pos < region->n_matches)
+        {
+            addresses[n++] = region->addr_start + region->offsets[(*pos)++];
+        }
+        return n;
+    }
+
+    /* For bitmaps, pos is the next slot to look at */
+    UINT64 n_slots = N_SLOTS(region->size, set->stride);
+    while(n < max && *pos < n_slots)
+    {
+        UINT64 word = region->bitmap[*pos / BITS_PER_WORD] >> (*pos % BITS_PER_WORD);
+        if(word == 0)
+        {
+            *pos = (*pos / BITS_PER_WORD + 1) * BITS_PER_WORD;
+            continue;
+        }
+        *pos += __builtin_ctzl(word);
+        addresses[n++] = region->addr_start + (*pos) * set->stride;
+        (*pos)++;
+    }
+
+    return n;
+}
+
+void matchset_keep(MU_MATCH_SET *set, ULONG rid, UINT64 *kept, ULONG *addresses, BOOL *keep, UCHAR *values, ULONG n)
+{
+    MU_MATCH_REGION *region = &set->regions[rid];
+    ULONG data_size = set->data_size;
+
+    /* Compacted in place: a region of a session is copied first */
+    region_own(set, region);
+
+    /* First refresh of a region whose matches shared a common value */
+    if(values != NULL && region->values == NULL)
+    {
+        region->values = malloc(region->n_matches * data_size + 1);
+        if(region->values == NULL) out_of_memory(__func__);
+        region->cap_values = region->n_matches;
+    }
+
+    for(ULONG i = 0; i < n; i++)
+    {
+        if(keep[i])
+        {
+            if(!region->is_bitmap)
+            {
+                region->offsets[*kept] = (UINT32) (addresses[i] - region->addr_start);
+            }
+            /* Never ahead of the matches being read, so nothing still needed is overwritten */
+            if(values != NULL)
+            {
+                memcpy(region->values + (*kept) * data_size, values + i * data_size, data_size);
+            }
+            (*kept)++;
+        }
+        else if(region->is_bitmap)
+        {
+            UINT64 slot = (addresses[i] - region->addr_start) / set->stride;
+            region->bitmap[slot / BITS_PER_WORD] &= ~(1UL << (slot % BITS_PER_WORD));
+        }
+    }
+}
+
+void matchset_region_done(MU_MATCH_SET *set, ULONG rid, UINT64 kept)
+{
+    MU_MATCH_REGION *region = &set->regions[rid];
+
+    set->n_matches -= region->n_matches - kept;
+    region->n_matches = kept;
+    if(kept > 0) region_own(set, region);
+
+    if(kept == 0)
+    {
+        matchset_region_clear(region);
+    }
+    else if(region->is_bitmap)
+    {
+        /* Hysteresis: only go back to a list when it is less than half the bitmap */
+        if(is_dense(region, kept * 2, set->stride) == false)
+        {
+            region_to_list(region, set->stride);
+        }
+    }
+    else if(kept * 2 < region->cap_offsets)
+    {
+        region->cap_offsets = kept;
+        region->offsets = realloc(region->offsets, (sizeof *region->offsets)*region->cap_offsets);
+        if(region->offsets == NULL) out_of_memory(__func__);
+    }
+
+    if(region->values != NULL && kept * 2 < region->cap_values)
+    {
+        region->cap_values = kept;
+        region->values = realloc(region->values, region->cap_values * set->data_size);
+        if(region->values == NULL) out_of_memory(__func__);
+    }
+}
+
+void matchset_set_common_value(MU_MATCH_SET *set, const UCHAR *value)
+{
+    for(ULONG r = 0; r < set->n_regions; r++)
+    {
+        if(!set->regions[r].is_mapped) free(set->regions[r].values);
+        set->regions[r].values = NULL;
+        set->regions[r].cap_values = 0;
+    }
+    free(set->common_value);
+    set->common_value = NULL;
+
+    if(value != NULL)
+    {
+        set->common_value = malloc(set->data_size);
+        if(set->common_value == NULL) out_of_memory(__func__);
+        memcpy(set->common_value, value, set->data_size);
+    }
+}
+
+BOOL matchset_has_values(MU_MATCH_SET *set)
+{
+    if(set->common_value != NULL) return true;
+
+    for(ULONG r = 0; r < set->n_regions; r++)
+    {
+        if(set->regions[r].n_matches > 0 && set->regions[r].values == NULL) return false;
+    }
+
+    return true;
+}
+
+void matchset_get_values(MU_MATCH_SET *set, ULONG rid, UINT64 first, ULONG n, UCHAR *values)
+{
+    ULONG data_size = set->data_size;
+
+    if(set->common_value != NULL)
+    {
+        for(ULONG i = 0; i < n; i++)
+        {
+            memcpy(values + i * data_size, set->common_value, data_size);
+        }
+    }
+    else memcpy(values, set->regions[rid].values + first * data_size, n * data_size);
+}
+
+BOOL matchset_contains(MU_MATCH_SET *set, ULONG rid, ULONG address, UINT64 *hint)
+{
+    MU_MATCH_REGION *region = &set->regions[rid];
+
+    if(address < region->addr_start || address - region->addr_start >= region->size || region->n_matches == 0)
+    {
+        return false;
+    }
+    ULONG offset = address - region->addr_start;
+
+    if(region->is_bitmap)
+    {
+        if(offset % set->stride != 0) return false;
+        UINT64 slot = offset / set->stride;
+        return (region->bitmap[slot / BITS_PER_WORD] >> (slot % BITS_PER_WORD)) & 1;
+    }
+
+    /* Lower bound of the offset, starting from the hint when lookups go forward */
+    UINT64 lo = (*hint < region->n_matches && region->offsets[*hint] <= offset) ? *hint : 0;
+    UINT64 hi = region->n_matches;
+    while(lo < hi)
+    {
+        UINT64 mid = lo + (hi - lo) / 2;
+        if(region->offsets[mid] < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    *hint = lo;
+
+    return lo < region->n_matches && region->offsets[lo] == offset;
+}
+
+UINT64 matchset_drop_unmapped(MU_MATCH_SET *set, MU_MEM_CHUNK *chunks, INT n_chunks)
+{
+    UINT64 before = set->n_matches;
+    INT c = 0;
+    ULONG *addresses = NULL;
+    BOOL *keep = NULL;
+    UCHAR *values = NULL;
+
+    for(ULONG r = 0; r < set->n_regions; r++)
+    {
+        MU_MATCH_REGION *region = &set->regions[r];
+        ULONG region_end = region->addr_start + region->size;
+        if(region->n_matches == 0) continue;
+
+        /* Regions and chunks are both in address order */
+        while(c < n_chunks && chunks[c].addr_start + chunks[c].chunk_size <= region->addr_start) c++;
+
+        /* Usual cases, in bulk: still fully mapped, or not mapped at all */
+        if(c < n_chunks && chunks[c].addr_start <= region->addr_start &&
+           chunks[c].addr_start + chunks[c].chunk_size >= region_end)
+        {
+            continue;
+        }
+        if(c >= n_chunks || chunks[c].addr_start >= region_end)
+        {
+            set->n_matches -= region->n_matches;
+            matchset_region_clear(region);
+            continue;
+        }
+
+        /* Partly mapped: keep the matches whose value is inside one chunk */
+        if(addresses == NULL)
+        {
+            addresses = malloc((sizeof *addresses)*DROP_BLOCK);
+            keep = malloc((sizeof *keep)*DROP_BLOCK);
+            values = malloc(set->data_size * DROP_BLOCK);
+            if(addresses == NULL || keep == NULL || values == NULL) out_of_memory(__func__);
+        }
+        BOOL own_values = (region->values != NULL);
+        UINT64 pos = 0;
+        UINT64 seen = 0;
+        UINT64 kept = 0;
+        INT k = c;
+        ULONG n;
+        while((n = matchset_gather(set, r, &pos, addresses, DROP_BLOCK)) > 0)
+        {
+            for(ULONG i = 0; i < n; i++)
+            {
+                while(k < n_chunks && chunks[k].addr_start + chunks[k].chunk_size <= addresses[i]) k++;
+                keep[i] = k < n_chunks && chunks[k].addr_start <= addresses[i] &&
+                          addresses[i] + set->data_size <= chunks[k].addr_start + chunks[k].chunk_size;
+            }
+            if(own_values) matchset_get_values(set, r, seen, n, values);
+            matchset_keep(set, r, &kept, addresses, keep, own_values ? values : NULL, n);
+            seen += n;
+        }
+        matchset_region_done(set, r, kept);
+    }
+    free(addresses);
+    free(keep);
+    free(values);
+
+    return before - set->n_matches;
+}
+
+ULONG* matchset_to_addresses(MU_MATCH_SET *set)
+{
+    ULONG *addresses = malloc((sizeof *addresses)*(set->n_matches + 1));
+    ULONG n = 0;
+
+    if(addresses == NULL) out_of_memory(__func__);
+
+    for(ULONG r = 0; r < set->n_regions; r++)
+    {
+        UINT64 pos = 0;
+        n += matchset_gather(set, r, &pos, &addresses[n], set->regions[r].n_matches);
+    }
+
+    return addresses;
+}
+
+ULONG matchset_footprint(MU_MATCH_SET *set)
+{
+    ULONG bytes = 0;
+
+    for(ULONG r = 0; r < set->n_regions; r++)
+    {
+        MU_MATCH_REGION *region = &set->regions[r];
+        if(region->is_bitmap)
+        {
+            bytes += N_WORDS(region->size, set->stride) * sizeof(UINT64);
+        }
+        else bytes += region->cap_offsets * sizeof(UINT32);
+        bytes += region->cap_values * set->data_size;
+    }
+
+    return bytes;
+}
@@ -12,105 +12,107 @@
 #include "inc/mu_memchunk.h"
 #include "inc/mu_utils.h"
 #include "inc/mu_diag.h"
+#include "inc/mu_metrics.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <regex.h>
 
 #define ALL_CHUNKS          0
 #define MODIFIABLE_CHUNKS   1
 #define LINE_BUFFER         256
 #define IS_MODIFIABLE(chnk) (chnk.is_readable && chnk.is_writable && chnk.is_private)
-#define REQ_MATCHES         6
-#define OFFSET_CHNK_NAME    73
+#define ANON_CHNK_NAME      "NULL"  /* Name of the chunks not backed by a file */
 
 /**
- * @brief Parses a line from the maps file. REMEMBER TO FREE returned chunk
+ * @brief Parses a hexadecimal field and moves past it
  * 
- * @param maps_line Line from the maps file
- * @return Pointer to a memory chunk struct, containing all neccessary fields
+ * @param cursor Position in the line. Left after the last digit
+ * @return Value of the field
  */
-static MU_MEM_CHUNK parse_maps_line(CHAR* maps_line)
+static inline ULONG parse_hex(const CHAR **cursor)
 {
-    diag_trace trace;
-    MU_ERROR is_ok = ERR_OK;
-    regex_t regex;
-    MU_MEM_CHUNK chunk;
-    const CHAR *re = "([0-9A-Fa-f]+)-([0-9A-Fa-f]+) ([-r])([-w])[-x]([sp]).*";
+    const CHAR *c = *cursor;
+    ULONG value = 0;
 
-    if(regcomp(&regex, re, REG_EXTENDED) != 0){
-        is_ok = ERR_GENERIC;
-        sprintf(trace, "%s | Error compiling regular expression!", __func__);
-        diag_critical(trace, is_ok);
-        exit(is_ok);
-    }
-    regmatch_t matches[REQ_MATCHES]; 
-    if(regexec(&regex, maps_line, REQ_MATCHES, matches, 0) != 0){
-        is_ok = ERR_GENERIC;
-        sprintf(trace, "%s | Error in memory map line format!", __func__);
-        diag_critical(trace, is_ok);
-        exit(is_ok);
+    while(true)
+    {
+        ULONG digit;
+        if(*c >= '0' && *c <= '9') digit = *c - '0';
+        else if(*c >= 'a' && *c <= 'f') digit = *c - 'a' + 10;
+        else if(*c >= 'A' && *c <= 'F') digit = *c - 'A' + 10;
+        else break;
+        value = (value << 4) | digit;
+        c++;
     }
+    *cursor = c;
 
-    /* Get starting chunk memory address */
-    CHAR *start = malloc(matches[1].rm_eo - matches[1].rm_so + 1);
-    memcpy(start, maps_line + matches[1].rm_so, matches[1].rm_eo - matches[1].rm_so);
-
-    /* Get ending chunk memory address */
-    CHAR *end = malloc(matches[2].rm_eo - matches[2].rm_so + 1);
-    memcpy(end, maps_line + matches[2].rm_so, matches[2].rm_eo - matches[2].rm_so);
-
-    /* Get read permissions */
-    CHAR *r = malloc(matches[3].rm_eo - matches[3].rm_so + 1);
-    memcpy(r, maps_line + matches[3].rm_so, matches[3].rm_eo - matches[3].rm_so);
+    return value;
+}
 
-    /* Get write permissions */
-    CHAR *w = malloc(matches[4].rm_eo - matches[4].rm_so + 1);
-    memcpy(w, maps_line + matches[4].rm_so, matches[4].rm_eo - matches[4].rm_so);
-    
-    /* Get private status */
-    CHAR *p = malloc(matches[5].rm_eo - matches[5].rm_so + 1); 
-    memcpy(p, maps_line + matches[5].rm_so, matches[5].rm_eo - matches[5].rm_so);
+/**
+ * @brief Parses a decimal field and moves past it
+ * 
+ * @param cursor Position in the line. Left after the last digit
+ * @return Value of the field
+ */
+static inline ULONG parse_dec(const CHAR **cursor)
+{
+    const CHAR *c = *cursor;
+    ULONG value = 0;
 
-    /* Get name of the region */
-    INT sz = matches[0].rm_eo - matches[0].rm_so;
-    if(sz > OFFSET_CHNK_NAME)
+    while(*c >= '0' && *c <= '9')
     {
-        sz = matches[0].rm_eo - OFFSET_CHNK_NAME - 1;
-        chunk.chunk_name = malloc(sz + 1);
-        memcpy(chunk.chunk_name, maps_line + OFFSET_CHNK_NAME, sz);
-        chunk.chnk_name_sz = sz;
-    }
-    else
-    {
-        INT to_reserve = 4; /* "NULL has 4 bytes" */
-        chunk.chunk_name = malloc(to_reserve + 1);
-        memcpy(chunk.chunk_name, "NULL", to_reserve);
-        chunk.chnk_name_sz = to_reserve;
+        value = value * 10 + (ULONG) (*c - '0');
+        c++;
     }
+    *cursor = c;
 
-    ULONG addr_start = (ULONG) strtoll(start, NULL, 16);
-    ULONG addr_end = (ULONG) strtoll(end, NULL, 16);
-    ULONG size = addr_end - addr_start;
+    return value;
+}
 
-    BOOL readable = r[0] == 'r';
-    BOOL writable = w[0] == 'w';
-    BOOL priv = p[0] == 'p';
+/**
+ * @brief Parses a line from the maps file in place. The name is left pointing into the line
+ * 
+ * @param line First character of the line
+ * @param chunk Stores the fields of the line
+ * @param name Stores the start of the pathname
+ * @param name_sz Stores the size of the pathname. 0 for chunks not backed by a file
+ * @return First character of the next line. NULL if the line is malformed
+ */
+static const CHAR* parse_maps_line(const CHAR *line, MU_MEM_CHUNK *chunk, const CHAR **name, ULONG *name_sz)
+{
+    const CHAR *c = line;
+
+    /* start-end perms offset major:minor inode   pathname */
+    ULONG addr_start = parse_hex(&c);
+    if(*c++ != '-') return NULL;
+    ULONG addr_end = parse_hex(&c);
+    if(*c++ != ' ') return NULL;
+    if(c[0] == '\0' || c[1] == '\0' || c[2] == '\0' || c[3] == '\0' || c[4] != ' ') return NULL;
+    chunk->is_readable = c[0] == 'r';
+    chunk->is_writable = c[1] == 'w';
+    chunk->is_private = c[3] == 'p';
+    c += 5;
+    chunk->offset = parse_hex(&c);
+    if(*c++ != ' ') return NULL;
+    chunk->dev_major = (UINT32) parse_hex(&c);
+    if(*c++ != ':') return NULL;
+    chunk->dev_minor = (UINT32) parse_hex(&c);
+    if(*c++ != ' ') return NULL;
+    chunk->inode = parse_dec(&c);
+    while(*c == ' ') c++;
 
-    chunk.addr_start = addr_start; 
-    chunk.chunk_size = size; 
-    chunk.is_readable = readable;
-    chunk.is_writable = writable; 
-    chunk.is_private = priv;
+    /* Pathnames run to the end of the line and may contain spaces */
+    const CHAR *eol = strchr(c, '\n');
+    if(eol == NULL) eol = c + strlen(c);
+    *name = c;
+    *name_sz = (ULONG) (eol - c);
 
-    free(start);
-    free(end);
-    free(r);
-    free(w);
-    free(p);
+    chunk->addr_start = addr_start;
+    chunk->chunk_size = addr_end - addr_start;
 
-    return chunk;
+    return (*eol == '\n') ? eol + 1 : eol;
 }
 
 MU_MEM_CHUNK* get_memory_chunks(PID target, INT option, INT *size)
@@ -128,15 +130,11 @@ MU_MEM_CHUNK* get_memory_chunks(PID target, INT option, INT *size)
     }
     else
     {
-        /* Open maps file and parse each line. Add to array if necessary */
+        /* Read the whole maps file at once and parse it in a single pass */
+        UINT64 start = metrics_clock();
         CHAR *path_maps = get_maps_path(target);
-        FILE *maps;
-        INT n_chunks = 0;
-
-        /* Reserve memory for at least one chunk */
-        chunks = malloc(sizeof(*chunks)*(n_chunks + 1));
-        CHAR line[LINE_BUFFER];
-        maps = fopen(path_maps, "r");
+        ULONG len = 0;
+        CHAR *maps = read_proc_file(path_maps, &len);
         if(maps == NULL)
         {
             is_ok = ERR_GENERIC;
@@ -144,28 +142,75 @@ MU_MEM_CHUNK* get_memory_chunks(PID target, INT option, INT *size)
             diag_critical(trace, is_ok);
             exit(is_ok);
         }
+
+        /* One line per chunk at most, and the names are never longer than the file: the chunks and
+           a string arena with their names fit in one block */
+        ULONG n_lines = 0;
+        for(const CHAR *c = maps; (c = memchr(c, '\n', len - (c - maps))) != NULL; c++) n_lines++;
+        n_lines++;
+        ULONG arena_size = len + sizeof(ANON_CHNK_NAME);
+        chunks = malloc(n_lines * sizeof *chunks + arena_size);
+        if(chunks == NULL)
+        {
+            is_ok = ERR_GENERIC;
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+        CHAR *arena = (CHAR *) (chunks + n_lines);
+        CHAR *anon_name = arena;
+        memcpy(anon_name, ANON_CHNK_NAME, sizeof(ANON_CHNK_NAME));
+        ULONG arena_used = sizeof(ANON_CHNK_NAME);
+        CHAR *last_name = NULL;
+        ULONG last_name_sz = 0;
+
         /* It will process chunks as long as they are modifiable AND MODIF option OR ALL option */
-        INT flag = option;  /* Store parameter to local variable */
-        while(fgets(line, LINE_BUFFER, maps))
+        INT n_chunks = 0;
+        const CHAR *line = maps;
+        while(line != NULL && *line != '\0')
         {
-            MU_MEM_CHUNK chunk = parse_maps_line(line);
-            if((flag == MODIFIABLE_CHUNKS && IS_MODIFIABLE(chunk)) || flag == ALL_CHUNKS)
+            MU_MEM_CHUNK chunk;
+            const CHAR *name;
+            ULONG name_sz;
+            const CHAR *next = parse_maps_line(line, &chunk, &name, &name_sz);
+            if(next == NULL)
+            {
+                is_ok = ERR_GENERIC;
+                sprintf(trace, "%s | Error in memory map line format!", __func__);
+                diag_critical(trace, is_ok);
+                exit(is_ok);
+            }
+            line = next;
+            if(option == MODIFIABLE_CHUNKS && !IS_MODIFIABLE(chunk)) continue;
+
+            /* Segments of a file come one after another, so interning against the last name is enough */
+            if(name_sz == 0)
+            {
+                chunk.chunk_name = anon_name;
+                chunk.chnk_name_sz = sizeof(ANON_CHNK_NAME) - 1;
+            }
+            else if(last_name != NULL && name_sz == last_name_sz && memcmp(name, last_name, name_sz) == 0)
+            {
+                chunk.chunk_name = last_name;
+                chunk.chnk_name_sz = name_sz;
+            }
+            else
             {
-                chunks = realloc(chunks, ((sizeof(*chunks))*(n_chunks + 1)));
-                if(chunks == NULL)
-                {
-                    is_ok = ERR_GENERIC;
-                    sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
-                    diag_critical(trace, is_ok);
-                    exit(is_ok);
-                }
-                chunks[n_chunks++] = chunk;
+                last_name = arena + arena_used;
+                last_name_sz = name_sz;
+                memcpy(last_name, name, name_sz);
+                last_name[name_sz] = '\0';
+                arena_used += name_sz + 1;
+                chunk.chunk_name = last_name;
+                chunk.chnk_name_sz = name_sz;
             }
+            chunks[n_chunks++] = chunk;
         }
         /* Update size and liberate resources */
         *size = n_chunks;
-        fclose(maps);
+        free(maps);
         free(path_maps);
+        metrics_since(MET_ENUM_NS, start);
     }
 
     return chunks;
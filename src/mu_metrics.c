@@ -0,0 +1,268 @@
+/**
+ * @file mu_metrics.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_metrics.h
+ * @version 0.1
+ * @date 2022-10-26
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_metrics.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define METRICS_MAX_NAME    32
+
+/* Counters of one thread. Only the thread writes them, the aggregator reads them at any time */
+typedef struct metrics_block
+{
+    UINT64                  counters[MET_COUNT];
+    struct metrics_block    *next;
+
+} __attribute__((aligned(64))) MU_METRICS_BLOCK;
+
+static const CHAR *names[MET_COUNT] =
+{
+    "bytes_read", "read_calls", "short_reads", "failed_reads", "bytes_written", "write_calls", "failed_writes",
+    "regions_scanned", "regions_skipped", "filter_in", "filter_out", "enum_ns", "copy_ns", "search_ns", "merge_ns"
+};
+
+static BOOL enabled = true;
+static MU_METRICS_FORMAT report = METRICS_OFF;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static MU_METRICS_BLOCK *blocks = NULL;     /* Of the running threads */
+static MU_METRICS retired;                  /* Sum of the blocks of finished threads */
+static MU_METRICS last;
+static CHAR last_name[METRICS_MAX_NAME];
+
+static __thread MU_METRICS_BLOCK *local = NULL;
+static __thread UINT32 depth = 0;           /* Operations of the thread running now */
+
+/**
+ * @brief Folds the block of a finishing thread into the retired totals
+ *
+ * @param arg Block of the thread
+ */
+static void retire_block(void *arg)
+{
+    MU_METRICS_BLOCK *block = arg;
+
+    pthread_mutex_lock(&lock);
+    for(INT m = 0; m < MET_COUNT; m++) retired.counters[m] += block->counters[m];
+    for(MU_METRICS_BLOCK **link = &blocks; *link != NULL; link = &(*link)->next)
+    {
+        if(*link == block)
+        {
+            *link = block->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    free(block);
+}
+
+static void create_key()
+{
+    pthread_key_create(&key, &retire_block);
+}
+
+/**
+ * @brief Gives the calling thread a block, the first time it counts something
+ *
+ * @return Block of the thread
+ */
+static MU_METRICS_BLOCK* register_thread()
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+
+    pthread_once(&key_once, &create_key);
+    local = aligned_alloc(64, sizeof *local);
+    if(local == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    memset(local, 0, sizeof *local);
+    pthread_mutex_lock(&lock);
+    local->next = blocks;
+    blocks = local;
+    pthread_mutex_unlock(&lock);
+    pthread_setspecific(key, local);
+
+    return local;
+}
+
+void metrics_add(MU_METRIC metric, UINT64 value)
+{
+    if(!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) return;
+    MU_METRICS_BLOCK *block = (local != NULL) ? local : register_thread();
+
+    /* A plain add: the block has a single writer, the store only has to be seen whole */
+    __atomic_store_n(&block->counters[metric], block->counters[metric] + value, __ATOMIC_RELAXED);
+}
+
+UINT64 metrics_clock(void)
+{
+    struct timespec ts;
+
+    if(!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (UINT64) ts.tv_sec * 1000000000UL + (UINT64) ts.tv_nsec;
+}
+
+void metrics_since(MU_METRIC metric, UINT64 start)
+{
+    /* Start is 0 if counting was disabled when it was taken */
+    if(start == 0) return;
+    metrics_add(metric, metrics_clock() - start);
+}
+
+void metrics_count_read(ULONG requested, INT64 got, UINT64 start)
+{
+    if(!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) return;
+
+    metrics_add(MET_READ_CALLS, 1);
+    if(got > 0) metrics_add(MET_BYTES_READ, (UINT64) got);
+    if(got <= 0) metrics_add(MET_FAILED_READS, 1);
+    else if((ULONG) got < requested) metrics_add(MET_SHORT_READS, 1);
+    metrics_since(MET_COPY_NS, start);
+}
+
+void metrics_count_write(ULONG requested, INT64 got, UINT64 start)
+{
+    if(!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) return;
+
+    metrics_add(MET_WRITE_CALLS, 1);
+    if(got > 0) metrics_add(MET_BYTES_WRITTEN, (UINT64) got);
+    if(got < 0 || (ULONG) got < requested) metrics_add(MET_FAILED_WRITES, 1);
+    metrics_since(MET_COPY_NS, start);
+}
+
+void metrics_total(MU_METRICS *totals)
+{
+    pthread_mutex_lock(&lock);
+    *totals = retired;
+    for(MU_METRICS_BLOCK *block = blocks; block != NULL; block = block->next)
+    {
+        for(INT m = 0; m < MET_COUNT; m++) totals->counters[m] += __atomic_load_n(&block->counters[m], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void metrics_begin(MU_METRICS *mark)
+{
+    if(depth++ == 0) metrics_total(mark);
+}
+
+void metrics_end(const CHAR *operation, const MU_METRICS *mark)
+{
+    MU_METRICS done;
+
+    if(depth == 0 || --depth > 0) return;
+    metrics_total(&done);
+    for(INT m = 0; m < MET_COUNT; m++) done.counters[m] -= mark->counters[m];
+
+    pthread_mutex_lock(&lock);
+    last = done;
+    snprintf(last_name, sizeof last_name, "%s", operation);
+    pthread_mutex_unlock(&lock);
+
+    MU_METRICS_FORMAT format = __atomic_load_n(&report, __ATOMIC_RELAXED);
+    if(format != METRICS_OFF)
+    {
+        CHAR line[METRICS_MAX_TEXT];
+        metrics_format(&done, operation, format, line, sizeof line);
+        fprintf(stderr, (format == METRICS_TEXT) ? "METRICS: %s\n" : "%s\n", line);
+    }
+}
+
+const CHAR* metrics_last(MU_METRICS *metrics)
+{
+    pthread_mutex_lock(&lock);
+    *metrics = last;
+    const CHAR *name = (last_name[0] != '\0') ? last_name : NULL;
+    pthread_mutex_unlock(&lock);
+
+    return name;
+}
+
+/**
+ * @brief Appends formatted text after the previous one, or nowhere once the buffer is full
+ *
+ * @param buffer Output
+ * @param size Size of the output
+ * @param len Length of the whole output so far. Updated
+ * @param fmt Format, as printf
+ */
+static void put(CHAR *buffer, ULONG size, ULONG *len, const CHAR *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    INT n = vsnprintf(buffer + ((*len < size) ? *len : size), (*len < size) ? size - *len : 0, fmt, args);
+    va_end(args);
+    if(n > 0) *len += (ULONG) n;
+}
+
+ULONG metrics_format(const MU_METRICS *metrics, const CHAR *operation, MU_METRICS_FORMAT format, CHAR *buffer, ULONG size)
+{
+    ULONG len = 0;
+
+    if(size > 0) buffer[0] = '\0';
+    if(format == METRICS_JSON)
+    {
+        put(buffer, size, &len, "{");
+        if(operation != NULL) put(buffer, size, &len, "\"operation\":\"%s\",", operation);
+        for(INT m = 0; m < MET_COUNT; m++)
+        {
+            put(buffer, size, &len, "%s\"%s\":%lu", (m > 0) ? "," : "", names[m], metrics->counters[m]);
+        }
+        put(buffer, size, &len, "}");
+    }
+    else
+    {
+        if(operation != NULL) put(buffer, size, &len, "%s:", operation);
+        for(INT m = 0; m < MET_COUNT; m++)
+        {
+            put(buffer, size, &len, "%s%s=%lu", (m > 0 || operation != NULL) ? " " : "", names[m], metrics->counters[m]);
+        }
+    }
+
+    return len;
+}
+
+MU_ERROR metrics_set_report(MU_METRICS_FORMAT format)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+
+    if(format != METRICS_OFF && format != METRICS_TEXT && format != METRICS_JSON)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Format of the metrics is unknown!", __func__);
+        diag_error(trace, is_ok);
+        return is_ok;
+    }
+    __atomic_store_n(&report, format, __ATOMIC_RELAXED);
+
+    return is_ok;
+}
+
+void metrics_enable(BOOL enable)
+{
+    __atomic_store_n(&enabled, enable, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,751 @@
+/**
+ * @file mu_pointer.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_pointer.h
+ * @version 0.1
+ * @date 2022-10-21
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_pointer.h"
+#include "inc/mu_memchunk.h"
+#include "inc/mu_index.h"
+#include "inc/mu_io.h"
+#include "inc/mu_utils.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PTR_SIZE            8
+#define BUILD_RANGE_SIZE    (4UL << 20)     /* Unit of work of the pass that builds the map */
+#define BFS_BLOCK           64              /* Nodes taken at once by a thread of the search */
+#define MAX_FRONTIER        (1UL << 22)     /* Nodes kept per level of the search, so memory stays bounded */
+#define PTRMAP_MAGIC        "MUPTRMAP"
+
+/* Growing array of entries or nodes, private to a thread */
+typedef struct ptr_vec
+{
+    void    *items;
+    UINT64  n;
+    UINT64  cap;
+
+} MU_PTR_VEC;
+
+/* Shared state of the pass that builds the map */
+typedef struct build_job
+{
+    PID             target;
+    MU_REGION_INDEX *index;
+    ULONG           lowest;         /* Start of the first mapped chunk */
+    ULONG           highest;        /* End of the last mapped chunk */
+    ULONG           *starts;        /* Ranges to read */
+    ULONG           *lens;
+    ULONG           n_ranges;
+    ULONG           next;           /* Next range to take */
+
+} MU_BUILD_JOB;
+
+/* Node of the backward search: a location that leads to the address */
+typedef struct bfs_node
+{
+    UINT64  address;
+    INT64   parent;         /* Node this one points near. -1 for the address itself */
+    INT64   offset;         /* Parent address minus the value stored here */
+
+} MU_BFS_NODE;
+
+/* Location in a module that points near a node: the start of a path */
+typedef struct bfs_found
+{
+    UINT64  region;
+    UINT64  module_offset;
+    INT64   node;
+    INT64   offset;
+
+} MU_BFS_FOUND;
+
+/* Shared state of one level of the backward search */
+typedef struct bfs_job
+{
+    MU_POINTER_MAP  *map;
+    MU_BFS_NODE     *nodes;
+    UINT64          first;          /* Frontier: nodes [first, last) */
+    UINT64          last;
+    ULONG           max_offset;
+    BOOL            expand;         /* False on the last level: only paths are collected */
+    UINT64          next;           /* Next frontier node to take */
+
+} MU_BFS_JOB;
+
+/* Private state of each thread, for both passes */
+typedef struct ptr_worker
+{
+    pthread_t       tid;
+    void            *job;
+    MU_PTR_VEC      out;            /* Entries, or children */
+    MU_PTR_VEC      found;          /* Paths, in the search */
+
+} MU_PTR_WORKER;
+
+/* Header of a saved map. The arrays follow, at the offsets given */
+typedef struct ptrmap_header
+{
+    CHAR    magic[8];
+    UINT32  version;
+    INT32   target;
+    UINT64  n_statics;
+    UINT64  n_entries;
+    UINT64  statics_off;
+    UINT64  entries_off;
+
+} MU_PTRMAP_HEADER;
+
+/**
+ * @brief Appends an item to a vector, growing it if needed
+ *
+ * @param vec Vector
+ * @param item Item to copy
+ * @param size Size in bytes of an item
+ */
+static void vec_push(MU_PTR_VEC *vec, const void *item, ULONG size)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+
+    if(vec->n == vec->cap)
+    {
+        vec->cap = (vec->cap == 0) ? 1024 : vec->cap * 2;
+        vec->items = realloc(vec->items, vec->cap * size);
+        if(vec->items == NULL)
+        {
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+    }
+    memcpy((UCHAR *) vec->items + vec->n * size, item, size);
+    vec->n++;
+}
+
+/**
+ * @brief Orders entries by value, then by location
+ */
+static INT cmp_entries(const void *a, const void *b)
+{
+    const MU_POINTER_ENTRY *x = a;
+    const MU_POINTER_ENTRY *y = b;
+
+    if(x->value != y->value) return (x->value < y->value) ? -1 : 1;
+    if(x->location != y->location) return (x->location < y->location) ? -1 : 1;
+
+    return 0;
+}
+
+/**
+ * @brief Gets the base name of a path
+ */
+static const CHAR* base_name(const CHAR *path)
+{
+    const CHAR *slash = strrchr(path, '/');
+
+    return (slash != NULL) ? slash + 1 : path;
+}
+
+/**
+ * @brief Gets the module region holding a location
+ *
+ * @param map Pointer map
+ * @param location Address to look up
+ * @return Index of the region in map->statics, or -1 if the location is not in a module
+ */
+static INT64 find_static(MU_POINTER_MAP *map, UINT64 location)
+{
+    UINT64 lo = 0;
+    UINT64 hi = map->n_statics;
+
+    /* Last region starting at or before the location */
+    while(lo < hi)
+    {
+        UINT64 mid = lo + (hi - lo) / 2;
+        if(map->statics[mid].start <= location) lo = mid + 1;
+        else hi = mid;
+    }
+    if(lo == 0 || location >= map->statics[lo - 1].end) return -1;
+
+    return (INT64) (lo - 1);
+}
+
+/**
+ * @brief Gets the module regions of a target: chunks backed by a file, and anonymous chunks right after
+ * a writable one, which hold the .bss of the module
+ *
+ * @param chunks All the chunks of the target, in address order
+ * @param n_chunks Number of chunks
+ * @param n_statics Stores the number of regions
+ * @return Regions, in address order. REMEMBER TO FREE
+ */
+static MU_STATIC_REGION* get_statics(MU_MEM_CHUNK *chunks, INT n_chunks, UINT64 *n_statics)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    MU_STATIC_REGION *statics = calloc(n_chunks + 1, sizeof *statics);
+
+    if(statics == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    *n_statics = 0;
+    for(INT i = 0; i < n_chunks; i++)
+    {
+        MU_MEM_CHUNK *chunk = &chunks[i];
+        BOOL is_file = chunk->inode != 0 && chunk->chunk_name[0] == '/';
+        BOOL is_bss = chunk->inode == 0 && i > 0 && chunks[i - 1].inode != 0 && chunks[i - 1].is_writable &&
+                      chunks[i - 1].addr_start + chunks[i - 1].chunk_size == chunk->addr_start;
+        if(!is_file && !is_bss) continue;
+
+        MU_STATIC_REGION *region = &statics[(*n_statics)++];
+        const MU_MEM_CHUNK *file = is_file ? chunk : &chunks[i - 1];
+        region->start = chunk->addr_start;
+        region->end = chunk->addr_start + chunk->chunk_size;
+        snprintf(region->name, sizeof region->name, "%s", base_name(file->chunk_name));
+
+        /* Base of the module: its first mapping */
+        region->base = file->addr_start;
+        for(INT j = 0; j < n_chunks && chunks[j].addr_start < file->addr_start; j++)
+        {
+            if(chunks[j].inode == file->inode && chunks[j].dev_major == file->dev_major && chunks[j].dev_minor == file->dev_minor)
+            {
+                region->base = chunks[j].addr_start;
+                break;
+            }
+        }
+    }
+
+    return statics;
+}
+
+/**
+ * @brief Thread routine of the pass that builds the map. Takes ranges until none is left, keeps every
+ * aligned value that points into a mapped chunk, and sorts what it found
+ *
+ * @param arg Pointer to the MU_PTR_WORKER of this thread
+ * @return NULL
+ */
+static void *collect_pointers(void *arg)
+{
+    MU_PTR_WORKER *self = (MU_PTR_WORKER *) arg;
+    MU_BUILD_JOB *job = (MU_BUILD_JOB *) self->job;
+    MU_CHUNK_READER reader;
+    ULONG r;
+
+    reader_init(&reader, job->target, DEFAULT_WINDOW_SIZE, 0);
+    while((r = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->n_ranges)
+    {
+        reader_seek(&reader, job->starts[r], job->lens[r]);
+        while(reader_next(&reader))
+        {
+            ULONG skip = (PTR_SIZE - reader.win_addr % PTR_SIZE) % PTR_SIZE;
+            for(ULONG off = skip; off + PTR_SIZE <= reader.win_len; off += PTR_SIZE)
+            {
+                MU_POINTER_ENTRY entry;
+                memcpy(&entry.value, reader.buffer + off, PTR_SIZE);
+                /* Most values are small numbers or flags: one compare rejects them */
+                if(entry.value < job->lowest || entry.value >= job->highest) continue;
+                if(index_lookup(job->index, entry.value, 1) == INDEX_NOT_FOUND) continue;
+                entry.location = reader.win_addr + off;
+                vec_push(&self->out, &entry, sizeof entry);
+            }
+        }
+    }
+    reader_free(&reader);
+    qsort(self->out.items, self->out.n, sizeof(MU_POINTER_ENTRY), cmp_entries);
+
+    return NULL;
+}
+
+/**
+ * @brief Runs a thread routine on all cores and waits for it
+ *
+ * @param routine Thread routine
+ * @param job Shared state
+ * @param n_workers Stores the number of workers
+ * @return Workers, with their outputs. REMEMBER TO FREE along with their vectors
+ */
+static MU_PTR_WORKER* run_workers(void *(*routine)(void *), void *job, INT *n_workers)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    INT n = get_usable_cores();
+    MU_PTR_WORKER *workers = calloc(n, sizeof *workers);
+
+    if(workers == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    for(INT i = 0; i < n; i++)
+    {
+        workers[i].job = job;
+        if(pthread_create(&workers[i].tid, NULL, routine, &workers[i]) != 0)
+        {
+            sprintf(trace, "%s | Error creating thread %d!", __func__, i);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+    }
+    for(INT i = 0; i < n; i++)
+    {
+        pthread_join(workers[i].tid, NULL);
+    }
+    *n_workers = n;
+
+    return workers;
+}
+
+MU_POINTER_MAP* ptrmap_build(PID target)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    MU_BUILD_JOB job;
+    INT n_chunks = 0;
+    INT n_readable = 0;
+
+    MU_MEM_CHUNK *chunks = get_memory_chunks(target, 0, &n_chunks);
+    if(chunks == NULL || n_chunks == 0)
+    {
+        free(chunks);
+        return NULL;
+    }
+    MU_POINTER_MAP *map = calloc(1, sizeof *map);
+    MU_MEM_CHUNK *readable = malloc(n_chunks * sizeof *readable);
+    memset(&job, 0, sizeof job);
+    ULONG max_ranges = n_chunks;
+    for(INT i = 0; i < n_chunks; i++) max_ranges += chunks[i].chunk_size / BUILD_RANGE_SIZE;
+    job.starts = malloc(max_ranges * sizeof *job.starts);
+    job.lens = malloc(max_ranges * sizeof *job.lens);
+    if(map == NULL || readable == NULL || job.starts == NULL || job.lens == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    /* Pointers may point into any readable chunk. Ranges cut big chunks so all threads stay busy */
+    for(INT i = 0; i < n_chunks; i++)
+    {
+        if(!chunks[i].is_readable) continue;
+        readable[n_readable++] = chunks[i];
+        for(ULONG off = 0; off < chunks[i].chunk_size; off += BUILD_RANGE_SIZE)
+        {
+            ULONG left = chunks[i].chunk_size - off;
+            job.starts[job.n_ranges] = chunks[i].addr_start + off;
+            job.lens[job.n_ranges++] = (left < BUILD_RANGE_SIZE) ? left : BUILD_RANGE_SIZE;
+        }
+    }
+    map->target = target;
+    map->statics = get_statics(chunks, n_chunks, &map->n_statics);
+    job.target = target;
+    job.index = index_build(readable, n_readable);
+    if(n_readable > 0)
+    {
+        job.lowest = readable[0].addr_start;
+        job.highest = readable[n_readable - 1].addr_start + readable[n_readable - 1].chunk_size;
+    }
+
+    INT n_workers = 0;
+    MU_PTR_WORKER *workers = run_workers(collect_pointers, &job, &n_workers);
+
+    /* Merge the sorted outputs of the threads */
+    UINT64 total = 0;
+    for(INT i = 0; i < n_workers; i++) total += workers[i].out.n;
+    map->entries = malloc((total + 1) * sizeof *map->entries);
+    UINT64 *pos = calloc(n_workers, sizeof *pos);
+    if(map->entries == NULL || pos == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    for(UINT64 k = 0; k < total; k++)
+    {
+        INT best = -1;
+        for(INT i = 0; i < n_workers; i++)
+        {
+            MU_POINTER_ENTRY *items = workers[i].out.items;
+            if(pos[i] == workers[i].out.n) continue;
+            if(best < 0 || cmp_entries(&items[pos[i]], &((MU_POINTER_ENTRY *) workers[best].out.items)[pos[best]]) < 0) best = i;
+        }
+        map->entries[k] = ((MU_POINTER_ENTRY *) workers[best].out.items)[pos[best]++];
+    }
+    map->n_entries = total;
+
+    for(INT i = 0; i < n_workers; i++) free(workers[i].out.items);
+    free(workers);
+    free(pos);
+    index_free(job.index);
+    free(job.starts);
+    free(job.lens);
+    free(readable);
+    free(chunks);
+
+    return map;
+}
+
+void ptrmap_free(MU_POINTER_MAP *map)
+{
+    if(map == NULL) return;
+    if(map->mapping != NULL) munmap(map->mapping, map->map_size);
+    else
+    {
+        free(map->entries);
+        free(map->statics);
+    }
+    free(map);
+}
+
+/**
+ * @brief Writes a whole buffer to a file
+ *
+ * @return True if every byte was written
+ */
+static BOOL write_all(INT fd, const void *data, ULONG size)
+{
+    const UCHAR *p = data;
+
+    while(size > 0)
+    {
+        ssize_t n = write(fd, p, size);
+        if(n <= 0) return false;
+        p += n;
+        size -= (ULONG) n;
+    }
+
+    return true;
+}
+
+MU_ERROR ptrmap_save(MU_POINTER_MAP *map, const CHAR *path)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    MU_PTRMAP_HEADER header;
+
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, PTRMAP_MAGIC, sizeof header.magic);
+    header.version = PTRMAP_VERSION;
+    header.target = map->target;
+    header.n_statics = map->n_statics;
+    header.n_entries = map->n_entries;
+    header.statics_off = sizeof header;
+    header.entries_off = header.statics_off + map->n_statics * sizeof *map->statics;
+
+    INT fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0 || !write_all(fd, &header, sizeof header) ||
+       !write_all(fd, map->statics, map->n_statics * sizeof *map->statics) ||
+       !write_all(fd, map->entries, map->n_entries * sizeof *map->entries))
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot write the pointer map to %.100s", __func__, path);
+        diag_error(trace, is_ok);
+    }
+    if(fd >= 0) close(fd);
+
+    return is_ok;
+}
+
+MU_POINTER_MAP* ptrmap_load(const CHAR *path)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    struct stat st;
+
+    INT fd = open(path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0 || (ULONG) st.st_size < sizeof(MU_PTRMAP_HEADER))
+    {
+        if(fd >= 0) close(fd);
+        sprintf(trace, "%s | Cannot open the pointer map %.100s", __func__, path);
+        diag_error(trace, is_ok);
+        return NULL;
+    }
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        sprintf(trace, "%s | Cannot map the pointer map %.100s", __func__, path);
+        diag_error(trace, is_ok);
+        return NULL;
+    }
+
+    /* Every array must be inside the file */
+    const MU_PTRMAP_HEADER *header = mapping;
+    ULONG size = (ULONG) st.st_size;
+    if(memcmp(header->magic, PTRMAP_MAGIC, sizeof header->magic) != 0 || header->version != PTRMAP_VERSION ||
+       header->statics_off > size || header->n_statics > (size - header->statics_off) / sizeof(MU_STATIC_REGION) ||
+       header->entries_off > size || header->n_entries > (size - header->entries_off) / sizeof(MU_POINTER_ENTRY))
+    {
+        munmap(mapping, size);
+        sprintf(trace, "%s | %.100s is not a pointer map of version %d", __func__, path, PTRMAP_VERSION);
+        diag_error(trace, is_ok);
+        return NULL;
+    }
+
+    MU_POINTER_MAP *map = calloc(1, sizeof *map);
+    if(map == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    map->target = header->target;
+    map->n_statics = header->n_statics;
+    map->n_entries = header->n_entries;
+    map->statics = (MU_STATIC_REGION *) ((UCHAR *) mapping + header->statics_off);
+    map->entries = (MU_POINTER_ENTRY *) ((UCHAR *) mapping + header->entries_off);
+    map->mapping = mapping;
+    map->map_size = size;
+
+    return map;
+}
+
+/**
+ * @brief Gets the first entry whose value is at least a given one
+ */
+static UINT64 lower_bound(MU_POINTER_MAP *map, UINT64 value)
+{
+    UINT64 lo = 0;
+    UINT64 hi = map->n_entries;
+
+    while(lo < hi)
+    {
+        UINT64 mid = lo + (hi - lo) / 2;
+        if(map->entries[mid].value < value) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+/**
+ * @brief Thread routine of one level of the search. For each frontier node, every location pointing at most
+ * max_offset bytes before it is either the start of a path (in a module) or a node of the next level
+ *
+ * @param arg Pointer to the MU_PTR_WORKER of this thread
+ * @return NULL
+ */
+static void *expand_level(void *arg)
+{
+    MU_PTR_WORKER *self = (MU_PTR_WORKER *) arg;
+    MU_BFS_JOB *job = (MU_BFS_JOB *) self->job;
+    MU_POINTER_MAP *map = job->map;
+    UINT64 first;
+
+    while((first = job->first + __atomic_fetch_add(&job->next, BFS_BLOCK, __ATOMIC_RELAXED)) < job->last)
+    {
+        UINT64 last = (first + BFS_BLOCK < job->last) ? first + BFS_BLOCK : job->last;
+        for(UINT64 n = first; n < last; n++)
+        {
+            UINT64 address = job->nodes[n].address;
+            UINT64 lowest = (address > job->max_offset) ? address - job->max_offset : 0;
+
+            for(UINT64 k = lower_bound(map, lowest); k < map->n_entries && map->entries[k].value <= address; k++)
+            {
+                UINT64 location = map->entries[k].location;
+                INT64 offset = (INT64) (address - map->entries[k].value);
+                INT64 region = find_static(map, location);
+                if(region >= 0)
+                {
+                    MU_BFS_FOUND found = {(UINT64) region, location - map->statics[region].base, (INT64) n, offset};
+                    vec_push(&self->found, &found, sizeof found);
+                }
+                else if(job->expand)
+                {
+                    MU_BFS_NODE child = {location, (INT64) n, offset};
+                    vec_push(&self->out, &child, sizeof child);
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Orders nodes by address, then by parent, so the first of each address is kept
+ */
+static INT cmp_nodes(const void *a, const void *b)
+{
+    const MU_BFS_NODE *x = a;
+    const MU_BFS_NODE *y = b;
+
+    if(x->address != y->address) return (x->address < y->address) ? -1 : 1;
+    if(x->parent != y->parent) return (x->parent < y->parent) ? -1 : 1;
+
+    return (x->offset < y->offset) ? -1 : (x->offset > y->offset);
+}
+
+/**
+ * @brief Orders the starts of paths by node, then by module location, so results do not depend on threads
+ */
+static INT cmp_found(const void *a, const void *b)
+{
+    const MU_BFS_FOUND *x = a;
+    const MU_BFS_FOUND *y = b;
+
+    if(x->node != y->node) return (x->node < y->node) ? -1 : 1;
+    if(x->region != y->region) return (x->region < y->region) ? -1 : 1;
+    if(x->module_offset != y->module_offset) return (x->module_offset < y->module_offset) ? -1 : 1;
+
+    return (x->offset < y->offset) ? -1 : (x->offset > y->offset);
+}
+
+/**
+ * @brief Orders addresses, for bsearch
+ */
+static INT cmp_addresses(const void *a, const void *b)
+{
+    UINT64 x = *(const UINT64 *) a;
+    UINT64 y = *(const UINT64 *) b;
+
+    return (x < y) ? -1 : (x > y);
+}
+
+MU_POINTER_PATH* ptrmap_find_paths(MU_POINTER_MAP *map, ULONG address, UINT32 max_depth, ULONG max_offset,
+                                   ULONG max_paths, ULONG *n_paths)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    MU_PTR_VEC nodes = {NULL, 0, 0};
+    MU_PTR_VEC paths = {NULL, 0, 0};
+    UINT64 *visited = NULL;         /* Addresses of all the nodes, sorted */
+    UINT64 n_visited = 0;
+
+    *n_paths = 0;
+    if(max_depth == 0 || max_depth > POINTER_MAX_DEPTH)
+    {
+        sprintf(trace, "%s | Depth must be 1 to %d!", __func__, POINTER_MAX_DEPTH);
+        diag_error(trace, ERR_FUNC_OPT);
+        return NULL;
+    }
+
+    MU_BFS_NODE root = {address, -1, 0};
+    vec_push(&nodes, &root, sizeof root);
+    UINT64 first = 0;
+    for(UINT32 depth = 1; depth <= max_depth && paths.n < max_paths && first < nodes.n; depth++)
+    {
+        MU_BFS_JOB job = {map, nodes.items, first, nodes.n, max_offset, depth < max_depth, 0};
+        INT n_workers = 0;
+        MU_PTR_WORKER *workers = run_workers(expand_level, &job, &n_workers);
+
+        /* Paths of this level, in a fixed order */
+        MU_PTR_VEC found = {NULL, 0, 0};
+        for(INT i = 0; i < n_workers; i++)
+        {
+            for(UINT64 k = 0; k < workers[i].found.n; k++) vec_push(&found, (MU_BFS_FOUND *) workers[i].found.items + k, sizeof(MU_BFS_FOUND));
+            free(workers[i].found.items);
+        }
+        qsort(found.items, found.n, sizeof(MU_BFS_FOUND), cmp_found);
+        for(UINT64 k = 0; k < found.n && paths.n < max_paths; k++)
+        {
+            MU_BFS_FOUND *f = (MU_BFS_FOUND *) found.items + k;
+            MU_POINTER_PATH path;
+            memset(&path, 0, sizeof path);
+            path.static_region = f->region;
+            path.module_offset = f->module_offset;
+            path.offsets[path.depth++] = f->offset;
+            for(INT64 n = f->node; ((MU_BFS_NODE *) nodes.items)[n].parent >= 0; n = ((MU_BFS_NODE *) nodes.items)[n].parent)
+            {
+                path.offsets[path.depth++] = ((MU_BFS_NODE *) nodes.items)[n].offset;
+            }
+            vec_push(&paths, &path, sizeof path);
+        }
+        free(found.items);
+
+        /* Next frontier: new locations only, each reached the first time through its lowest parent */
+        MU_PTR_VEC children = {NULL, 0, 0};
+        for(INT i = 0; i < n_workers; i++)
+        {
+            for(UINT64 k = 0; k < workers[i].out.n; k++) vec_push(&children, (MU_BFS_NODE *) workers[i].out.items + k, sizeof(MU_BFS_NODE));
+            free(workers[i].out.items);
+        }
+        free(workers);
+        qsort(children.items, children.n, sizeof(MU_BFS_NODE), cmp_nodes);
+
+        visited = realloc(visited, (nodes.n + 1) * sizeof *visited);
+        if(visited == NULL)
+        {
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+        for(UINT64 n = first; n < nodes.n; n++) visited[n_visited++] = ((MU_BFS_NODE *) nodes.items)[n].address;
+        qsort(visited, n_visited, sizeof *visited, cmp_addresses);
+
+        first = nodes.n;
+        MU_BFS_NODE *child = children.items;
+        for(UINT64 k = 0; k < children.n && nodes.n - first < MAX_FRONTIER; k++)
+        {
+            if(k > 0 && child[k].address == child[k - 1].address) continue;
+            if(bsearch(&child[k].address, visited, n_visited, sizeof *visited, cmp_addresses) != NULL) continue;
+            vec_push(&nodes, &child[k], sizeof child[k]);
+        }
+        free(children.items);
+    }
+
+    free(visited);
+    free(nodes.items);
+    *n_paths = paths.n;
+
+    return paths.items;
+}
+
+MU_ERROR ptrmap_resolve(PID target, MU_POINTER_MAP *map, const MU_POINTER_PATH *path, ULONG *address)
+{
+    MU_ERROR is_ok = ERR_GENERIC;
+    INT n_chunks = 0;
+    ULONG base = 0;
+    BOOL found = false;
+
+    /* Base of the module in the current run: its first mapping */
+    MU_MEM_CHUNK *chunks = get_memory_chunks(target, 0, &n_chunks);
+    for(INT i = 0; chunks != NULL && i < n_chunks && !found; i++)
+    {
+        if(chunks[i].inode != 0 && strcmp(base_name(chunks[i].chunk_name), map->statics[path->static_region].name) == 0)
+        {
+            base = chunks[i].addr_start;
+            found = true;
+        }
+    }
+    free(chunks);
+    if(!found) return is_ok;
+
+    ULONG p = base + path->module_offset;
+    for(UINT32 level = 0; level < path->depth; level++)
+    {
+        UINT64 value = 0;
+        if(read_memory_range(target, p, (UCHAR *) &value, PTR_SIZE) != PTR_SIZE) return is_ok;
+        p = value + path->offsets[level];
+    }
+    *address = p;
+
+    return ERR_OK;
+}
+
+void ptrmap_path_string(MU_POINTER_MAP *map, const MU_POINTER_PATH *path, CHAR *text, ULONG size)
+{
+    ULONG len = snprintf(text, size, "%s+%#lx", map->statics[path->static_region].name, path->module_offset);
+
+    for(UINT32 level = 0; level < path->depth && len < size; level++)
+    {
+        len += snprintf(text + len, size - len, " -> +%#lx", path->offsets[level]);
+    }
+}
@@ -0,0 +1,197 @@
+/**
+ * @file mu_regions.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_regions.h
+ * @version 0.1
+ * @date 2022-10-04
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_regions.h"
+#include "inc/mu_memchunk.h"
+#include "inc/mu_io.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAME_PERMS(a, b)    ((a).is_readable == (b).is_readable && (a).is_writable == (b).is_writable && \
+                             (a).is_private == (b).is_private)
+#define SAME_BACKING(a, b)  ((a).inode == (b).inode && (a).offset == (b).offset && \
+                             (a).dev_major == (b).dev_major && (a).dev_minor == (b).dev_minor)
+
+/**
+ * @brief Adds a change to the deltas of a table
+ *
+ * @param table Table being refreshed
+ * @param addr_start Start of the region
+ * @param old_size Previous size of the region. 0 if added
+ * @param new_size Current size of the region. 0 if removed
+ * @param changes MU_REGION_CHANGE flags
+ * @param chunk Index of the region in the current table. -1 if removed
+ */
+static void push_delta(MU_REGION_TABLE *table, ULONG addr_start, ULONG old_size, ULONG new_size, INT changes, INT chunk)
+{
+    MU_REGION_DELTA *delta = &table->deltas[table->n_deltas++];
+
+    delta->addr_start = addr_start;
+    delta->old_size = old_size;
+    delta->new_size = new_size;
+    delta->changes = changes;
+    delta->chunk = chunk;
+}
+
+MU_REGION_TABLE* regions_open(PID target, INT option)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    INT size = 0;
+
+    MU_MEM_CHUNK *chunks = get_memory_chunks(target, option, &size);
+    if(chunks == NULL)
+    {
+        return NULL;
+    }
+    MU_REGION_TABLE *table = calloc(1, sizeof *table);
+    if(table == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    table->target = target;
+    table->option = option;
+    table->chunks = chunks;
+    table->n_chunks = size;
+
+    return table;
+}
+
+MU_ERROR regions_refresh(MU_REGION_TABLE *table)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    INT size = 0;
+
+    MU_MEM_CHUNK *chunks = get_memory_chunks(table->target, table->option, &size);
+    if(chunks == NULL)
+    {
+        return ERR_FUNC_OPT;
+    }
+
+    /* Every region is in at most one delta of each table */
+    free(table->deltas);
+    table->n_deltas = 0;
+    table->deltas = malloc((sizeof *table->deltas)*(table->n_chunks + size + 1));
+    if(table->deltas == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    /* Both tables are in address order: merge them */
+    INT i = 0;
+    INT j = 0;
+    while(i < table->n_chunks || j < size)
+    {
+        MU_MEM_CHUNK *old = (i < table->n_chunks) ? &table->chunks[i] : NULL;
+        MU_MEM_CHUNK *cur = (j < size) ? &chunks[j] : NULL;
+
+        /* Something else mapped at the same start replaced the region */
+        if(old != NULL && cur != NULL && old->addr_start == cur->addr_start && !SAME_BACKING(*old, *cur))
+        {
+            push_delta(table, old->addr_start, old->chunk_size, 0, REGION_REMOVED, -1);
+            push_delta(table, cur->addr_start, 0, cur->chunk_size, REGION_ADDED, j);
+            i++;
+            j++;
+        }
+        else if(old != NULL && cur != NULL && old->addr_start == cur->addr_start)
+        {
+            INT changes = 0;
+            if(cur->chunk_size > old->chunk_size) changes |= REGION_GROWN;
+            if(cur->chunk_size < old->chunk_size) changes |= REGION_SHRUNK;
+            if(!SAME_PERMS(*old, *cur)) changes |= REGION_PERMS;
+            if(changes != 0)
+            {
+                push_delta(table, cur->addr_start, old->chunk_size, cur->chunk_size, changes, j);
+            }
+            i++;
+            j++;
+        }
+        else if(cur == NULL || (old != NULL && old->addr_start < cur->addr_start))
+        {
+            push_delta(table, old->addr_start, old->chunk_size, 0, REGION_REMOVED, -1);
+            i++;
+        }
+        else
+        {
+            push_delta(table, cur->addr_start, 0, cur->chunk_size, REGION_ADDED, j);
+            j++;
+        }
+    }
+
+    /* Pages mapped again may be readable now */
+    for(INT d = 0; d < table->n_deltas; d++)
+    {
+        MU_REGION_DELTA *delta = &table->deltas[d];
+        if(delta->changes & (REGION_ADDED | REGION_GROWN | REGION_PERMS))
+        {
+            io_bad_ranges_forget(table->target, delta->addr_start, delta->new_size);
+        }
+    }
+
+    free(table->chunks);
+    table->chunks = chunks;
+    table->n_chunks = size;
+
+    return is_ok;
+}
+
+MU_MEM_CHUNK* regions_new_ranges(MU_REGION_TABLE *table, INT *size)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    INT n_ranges = 0;
+
+    MU_MEM_CHUNK *ranges = malloc((sizeof *ranges)*(table->n_deltas + 1));
+    if(ranges == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    for(INT d = 0; d < table->n_deltas; d++)
+    {
+        MU_REGION_DELTA *delta = &table->deltas[d];
+        if(delta->changes & REGION_ADDED)
+        {
+            ranges[n_ranges++] = table->chunks[delta->chunk];
+        }
+        else if(delta->changes & REGION_GROWN)
+        {
+            /* Only the tail is new */
+            MU_MEM_CHUNK tail = table->chunks[delta->chunk];
+            tail.addr_start += delta->old_size;
+            tail.chunk_size = delta->new_size - delta->old_size;
+            tail.offset += delta->old_size;
+            ranges[n_ranges++] = tail;
+        }
+    }
+    *size = n_ranges;
+
+    return ranges;
+}
+
+void regions_close(MU_REGION_TABLE *table)
+{
+    if(table == NULL) return;
+
+    free(table->chunks);
+    free(table->deltas);
+    free(table);
+}
@@ -0,0 +1,241 @@
+/**
+ * @file mu_residency.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_residency.h
+ * @version 0.1
+ * @date 2022-10-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_residency.h"
+#include "inc/mu_utils.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#define RES_PAGE_SIZE       4096
+#define PAGEMAP_BLOCK       8192            /* Pagemap entries read per pread (one per page) */
+#define PM_PRESENT          (1UL << 63)
+#define PM_SWAPPED          (1UL << 62)
+#define RUN_GAP_PAGES       8               /* Runs closer than this are merged: one read beats two */
+#define KIBIBYTE            1024UL
+
+/**
+ * @brief Parses the value in kB of a line of smaps such as "Rss:   124 kB"
+ *
+ * @param line Start of the line
+ * @param key Key of the line, with the colon
+ * @param value Stores the value in bytes if the key matches
+ * @return True if the line has the key
+ */
+static BOOL smaps_field(const CHAR *line, const CHAR *key, ULONG *value)
+{
+    ULONG key_len = strlen(key);
+
+    if(strncmp(line, key, key_len) != 0) return false;
+    *value = strtoul(line + key_len, NULL, 10) * KIBIBYTE;
+
+    return true;
+}
+
+MU_ERROR residency_smaps(PID target, MU_MEM_CHUNK *chunks, INT n_chunks, ULONG *rss, ULONG *swap)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    CHAR path[PATH_MAX];
+    ULONG len = 0;
+
+    snprintf(path, sizeof path, "/proc/%d/smaps", target);
+    CHAR *smaps = read_proc_file(path, &len);
+    if(smaps == NULL)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Cannot open smaps of %d!", __func__, target);
+        diag_error(trace, is_ok);
+        return is_ok;
+    }
+
+    memset(rss, 0, n_chunks * sizeof *rss);
+    memset(swap, 0, n_chunks * sizeof *swap);
+
+    /* Both lists are in address order. c is the chunk of the current block of fields, -1 if untracked */
+    INT next = 0;
+    INT c = -1;
+    for(CHAR *line = smaps; line != NULL && *line != '\0'; )
+    {
+        CHAR *eol = strchr(line, '\n');
+        if((*line >= '0' && *line <= '9') || (*line >= 'a' && *line <= 'f'))
+        {
+            ULONG start = strtoul(line, NULL, 16);
+            while(next < n_chunks && chunks[next].addr_start < start) next++;
+            c = (next < n_chunks && chunks[next].addr_start == start) ? next : -1;
+        }
+        else if(c >= 0)
+        {
+            ULONG value;
+            if(smaps_field(line, "Rss:", &value)) rss[c] = value;
+            else if(smaps_field(line, "Swap:", &value)) swap[c] = value;
+        }
+        line = (eol != NULL) ? eol + 1 : NULL;
+    }
+    free(smaps);
+
+    return is_ok;
+}
+
+/**
+ * @brief Adds a run of pages to the result, merging it with the previous one when they are close
+ *
+ * @param runs Runs found so far
+ * @param n_runs Number of runs. Updated
+ * @param chunk Chunk the run belongs to
+ * @param start First address of the run
+ * @param end Address after the run
+ */
+static void push_run(MU_MEM_CHUNK *runs, INT *n_runs, MU_MEM_CHUNK *chunk, ULONG start, ULONG end)
+{
+    if(*n_runs > 0)
+    {
+        MU_MEM_CHUNK *last = &runs[*n_runs - 1];
+        ULONG last_end = last->addr_start + last->chunk_size;
+        if(last->chunk_name == chunk->chunk_name && last->inode == chunk->inode &&
+           last_end >= chunk->addr_start && start - last_end <= RUN_GAP_PAGES * RES_PAGE_SIZE)
+        {
+            last->chunk_size = end - last->addr_start;
+            return;
+        }
+    }
+    MU_MEM_CHUNK *run = &runs[(*n_runs)++];
+    *run = *chunk;
+    run->offset += start - chunk->addr_start;
+    run->addr_start = start;
+    run->chunk_size = end - start;
+}
+
+/**
+ * @brief Makes room for one more run, doubling the array when it is full
+ * 
+ * @param runs Runs
+ * @param n_runs Number of runs
+ * @param cap_runs Capacity of the array. Updated
+ * @return Runs, maybe moved
+ */
+static MU_MEM_CHUNK* grow_runs(MU_MEM_CHUNK *runs, INT n_runs, INT *cap_runs)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+
+    if(n_runs + 1 <= *cap_runs) return runs;
+    *cap_runs *= 2;
+    runs = realloc(runs, *cap_runs * sizeof *runs);
+    if(runs == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    return runs;
+}
+
+MU_MEM_CHUNK* residency_filter(PID target, MU_MEM_CHUNK *chunks, INT n_chunks, INT mode, INT *size)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    CHAR path[PATH_MAX];
+    UINT64 want = (mode == RESIDENCY_SWAPPED) ? (PM_PRESENT | PM_SWAPPED) : PM_PRESENT;
+    INT n_runs = 0;
+    INT cap_runs = n_chunks + 1;
+
+    ULONG *rss = malloc((n_chunks + 1) * sizeof *rss);
+    ULONG *swap = malloc((n_chunks + 1) * sizeof *swap);
+    UINT64 *entries = malloc(PAGEMAP_BLOCK * sizeof *entries);
+    MU_MEM_CHUNK *runs = malloc(cap_runs * sizeof *runs);
+    if(rss == NULL || swap == NULL || entries == NULL || runs == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    snprintf(path, sizeof path, "/proc/%d/pagemap", target);
+    INT fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0 || residency_smaps(target, chunks, n_chunks, rss, swap) != ERR_OK)
+    {
+        sprintf(trace, "%s | Cannot read residency of %d!", __func__, target);
+        diag_error(trace, ERR_FUNC_OPT);
+        if(fd >= 0) close(fd);
+        free(rss);
+        free(swap);
+        free(entries);
+        free(runs);
+        return NULL;
+    }
+
+    for(INT c = 0; c < n_chunks; c++)
+    {
+        MU_MEM_CHUNK *chunk = &chunks[c];
+        ULONG chunk_end = chunk->addr_start + chunk->chunk_size;
+        ULONG in_memory = rss[c] + ((mode == RESIDENCY_SWAPPED) ? swap[c] : 0);
+
+        /* Region-level answers first: pagemap is only read for partly resident chunks */
+        if(in_memory == 0) continue;
+        if(rss[c] >= chunk->chunk_size)
+        {
+            runs = grow_runs(runs, n_runs, &cap_runs);
+            push_run(runs, &n_runs, chunk, chunk->addr_start, chunk_end);
+            continue;
+        }
+
+        ULONG run_start = 0;
+        BOOL in_run = false;
+        for(ULONG page = chunk->addr_start; page < chunk_end; )
+        {
+            ULONG n_pages = (chunk_end - page) / RES_PAGE_SIZE;
+            if(n_pages > PAGEMAP_BLOCK) n_pages = PAGEMAP_BLOCK;
+            ssize_t n_read = pread(fd, entries, n_pages * sizeof *entries, (off_t) (page / RES_PAGE_SIZE * sizeof *entries));
+            if(n_read <= 0)
+            {
+                /* Unknown: keep the rest of the chunk rather than lose matches */
+                if(!in_run) run_start = page;
+                in_run = true;
+                page = chunk_end;
+                break;
+            }
+            n_pages = (ULONG) n_read / sizeof *entries;
+            for(ULONG p = 0; p < n_pages; p++, page += RES_PAGE_SIZE)
+            {
+                BOOL resident = (entries[p] & want) != 0;
+                if(resident && !in_run)
+                {
+                    run_start = page;
+                    in_run = true;
+                }
+                else if(!resident && in_run)
+                {
+                    runs = grow_runs(runs, n_runs, &cap_runs);
+                    push_run(runs, &n_runs, chunk, run_start, page);
+                    in_run = false;
+                }
+            }
+        }
+        if(in_run)
+        {
+            runs = grow_runs(runs, n_runs, &cap_runs);
+            push_run(runs, &n_runs, chunk, run_start, chunk_end);
+        }
+    }
+    close(fd);
+    free(rss);
+    free(swap);
+    free(entries);
+    *size = n_runs;
+
+    return runs;
+}
@@ -1,7 +1,7 @@
 /**
  * @file mu_scanner.c
  * @author Mark Dervishaj
- * @brief Implementation of mu_scanner.h
+ * @brief Implementation of mu_scanner.h. The scanner itself lives in mu_scanner_mth.c
  * @version 0.1
  * @date 2022-08-19
  * 
@@ -12,7 +12,11 @@
 #include "inc/mu_scanner.h"
 #include "inc/mu_memchunk.h"
 #include "inc/mu_io.h"
+#include "inc/mu_matchset.h"
 #include "inc/mu_diag.h"
+#include "inc/mu_metrics.h"
+#include "inc/mu_index.h"
+#include "inc/mu_softdirty.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
@@ -28,101 +32,292 @@
 #endif  /* _GNU_SOURCE */
 
 #define MODIF_CHNKS     1
+#define FILTER_BLOCK    65536   /* Candidates re-read per call to read_values_batched */
 
-ULONG* execute_scanner(PID target, UCHAR *data, INT data_size, INT *n_matches)
+/* Buffers of one block of candidates being filtered */
+typedef struct filter_block
+{
+    ULONG   *addresses;
+    UCHAR   *values;
+    BOOL    *valid;
+    INT     *chunks;        /* Chunk of each candidate in the index, or INDEX_NOT_FOUND */
+    ULONG   *mapped;        /* Candidates still mapped, compacted */
+    UCHAR   *mapped_values;
+    BOOL    *mapped_valid;
+    BOOL    *dirty;         /* Whether the page of each candidate was written since the previous pass */
+
+} MU_FILTER_BLOCK;
+
+/**
+ * @brief Reserves the buffers of a block of candidates
+ * 
+ * @param block Block to prepare
+ * @param data_size Size in bytes of each value
+ */
+static void block_init(MU_FILTER_BLOCK *block, ULONG data_size)
 {
-    MU_ERROR is_ok = ERR_OK;
     diag_trace trace;
-    INT size = 0;
-    INT nmatches = 0;
-    ULONG *matches = malloc((sizeof *matches)*(nmatches + 1));
-    MU_MEM_CHUNK *filtered = get_memory_chunks(target, 1, &size);
+    MU_ERROR is_ok = ERR_GENERIC;
+
+    block->addresses = malloc((sizeof *block->addresses)*FILTER_BLOCK);
+    block->values = malloc(data_size * FILTER_BLOCK);
+    block->valid = malloc((sizeof *block->valid)*FILTER_BLOCK);
+    block->chunks = malloc((sizeof *block->chunks)*FILTER_BLOCK);
+    block->mapped = malloc((sizeof *block->mapped)*FILTER_BLOCK);
+    block->mapped_values = malloc(data_size * FILTER_BLOCK);
+    block->mapped_valid = malloc((sizeof *block->mapped_valid)*FILTER_BLOCK);
+    block->dirty = malloc((sizeof *block->dirty)*FILTER_BLOCK);
+    if(block->addresses == NULL || block->values == NULL || block->valid == NULL || block->chunks == NULL ||
+       block->mapped == NULL || block->mapped_values == NULL || block->mapped_valid == NULL || block->dirty == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+}
+
+/**
+ * @brief Frees the buffers of a block of candidates
+ * 
+ * @param block Block to free
+ */
+static void block_free(MU_FILTER_BLOCK *block)
+{
+    free(block->addresses);
+    free(block->values);
+    free(block->valid);
+    free(block->chunks);
+    free(block->mapped);
+    free(block->mapped_values);
+    free(block->mapped_valid);
+    free(block->dirty);
+}
 
-    for(INT i = 0; i < size; i++)
+/**
+ * @brief Re-reads a block of candidates. Candidates that are not mapped anymore are rejected with
+ * the index before any syscall, so unmapped memory never breaks a batch. With a valid dirty map
+ * (see set_scan_dirty_map) and the previous values, candidates on pages not written since the
+ * previous pass keep their previous value and are not read at all
+ * 
+ * @param target PID of the target process
+ * @param index Index of the current chunks of the target
+ * @param block Block whose addresses are read into values and valid
+ * @param n Number of candidates
+ * @param data_size Size in bytes of each value
+ * @param old Previous values of the candidates. NULL to read them all
+ */
+static void read_block(PID target, MU_REGION_INDEX *index, MU_FILTER_BLOCK *block, ULONG n, ULONG data_size, const UCHAR *old)
+{
+    MU_DIRTY_MAP *dirty = get_scan_dirty_map();
+    BOOL incremental = old != NULL && dirty != NULL && dirty->valid && dirty->target == target;
+    ULONG n_mapped = index_lookup_batch(index, block->addresses, n, data_size, block->chunks);
+
+    if(incremental)
     {
-        MU_MEM_CHUNK chnk = filtered[i];
-        UCHAR *bytes = read_chunk_data(target, chnk);
-        UCHAR *ptr = NULL;
-        ptr = memmem(bytes, chnk.chunk_size, data, data_size);
+        dirty_range_batch(dirty, block->addresses, n, data_size, block->dirty);
+    }
+    else if(n_mapped == n)
+    {
+        read_values_batched(target, block->addresses, n, data_size, block->values, block->valid);
+        return;
+    }
 
-        while(ptr)
+    ULONG m = 0;
+    for(ULONG i = 0; i < n; i++)
+    {
+        if(block->chunks[i] != INDEX_NOT_FOUND && (!incremental || block->dirty[i])) block->mapped[m++] = block->addresses[i];
+    }
+    read_values_batched(target, block->mapped, m, data_size, block->mapped_values, block->mapped_valid);
+    m = 0;
+    for(ULONG i = 0; i < n; i++)
+    {
+        block->valid[i] = false;
+        if(block->chunks[i] == INDEX_NOT_FOUND) continue;
+        if(incremental && !block->dirty[i])
         {
-            ULONG offset = ptr - bytes;
-            ULONG match = chnk.addr_start + offset;
-            matches = realloc(matches, ((sizeof *matches)*(nmatches + 1)));
-            if(matches == NULL)
-            {
-                is_ok = ERR_GENERIC;
-                sprintf(trace, "%s | Error writing into memory of target process!", __func__);
-                diag_critical(trace, is_ok);
-                exit(is_ok);
-            }
-            matches[nmatches] = match;
-            nmatches++;
-            ptr = memmem(&bytes[offset + data_size], (chnk.chunk_size - offset - data_size), data, data_size);
+            /* Clean page: the value is the one seen in the previous pass */
+            block->valid[i] = true;
+            memcpy(&block->values[i * data_size], &old[i * data_size], data_size);
+            continue;
         }
-        free(chnk.chunk_name);
-        free(bytes);
+        block->valid[i] = block->mapped_valid[m];
+        memcpy(&block->values[i * data_size], &block->mapped_values[m * data_size], data_size);
+        m++;
     }
-    *n_matches = nmatches;
-    free(filtered);
+}
+
+/**
+ * @brief Builds an index of the current chunks of a target
+ * 
+ * @param target PID of the target process
+ * @return Index of the chunks. REMEMBER TO FREE with index_free
+ */
+static MU_REGION_INDEX* current_index(PID target)
+{
+    INT size = 0;
+    MU_MEM_CHUNK *chunks = get_memory_chunks(target, MODIF_CHNKS, &size);
+    MU_REGION_INDEX *index = index_build(chunks, size);
+    free(chunks);
 
-    return matches;
+    return index;
 }
 
-MU_ERROR execute_filtering(PID target, ULONG **addresses, UCHAR *data, ULONG data_size, INT *n_matches)
+MU_ERROR execute_filtering(PID target, MU_MATCH_SET *matches, UCHAR *data, ULONG data_size, UINT64 *n_matches)
 {
-    MU_ERROR is_ok = ERR_OK;
     diag_trace trace;
-    INT nmatches = 0;
-    INT og_n_matches = *n_matches;
-    ULONG *matches = malloc((sizeof *matches)*(nmatches + 1));
-    INT i = 0;
-    while(i < og_n_matches)
+    MU_ERROR is_ok = ERR_OK;
+    MU_FILTER_BLOCK block;
+    MU_METRICS mark;
+
+    *n_matches = matches->n_matches;
+    if(data_size != matches->data_size)
     {
-        struct iovec local[1];
-        struct iovec remote[1];
-        UCHAR read[data_size];
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | The value is not of the size of the matches!", __func__);
+        diag_error(trace, is_ok);
+        return is_ok;
+    }
 
-        local[0].iov_base = read;
-        local[0].iov_len = data_size;
-        remote[0].iov_base = (void *) (*addresses)[i];
-        remote[0].iov_len = data_size;
+    metrics_begin(&mark);
+    metrics_add(MET_FILTER_IN, matches->n_matches);
+    MU_REGION_INDEX *index = current_index(target);
+    MU_DIRTY_MAP *dirty = get_scan_dirty_map();
+    UCHAR *old = NULL;
 
-        INT64 n_read = process_vm_readv(target, local, 1, remote, 1, 0);
+    block_init(&block, data_size);
 
-        if(n_read < 0 || (ULONG) n_read != data_size)
+    /* Previous values let clean pages skip the read (see read_block) */
+    if(dirty != NULL && dirty->valid && matchset_has_values(matches))
+    {
+        old = malloc(data_size * FILTER_BLOCK);
+        if(old == NULL)
         {
             is_ok = ERR_GENERIC;
-            sprintf(trace, "%s | Error writing into memory of target process!", __func__);
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
             diag_critical(trace, is_ok);
             exit(is_ok);
         }
-        int cmp = memcmp(read, data, data_size);
-        if(cmp == 0)
+    }
+
+    /* Re-read each region block by block and compact its survivors in place */
+    for(ULONG r = 0; r < matches->n_regions; r++)
+    {
+        UINT64 pos = 0;
+        UINT64 seen = 0;
+        UINT64 kept = 0;
+        ULONG n;
+        while((n = matchset_gather(matches, r, &pos, block.addresses, FILTER_BLOCK)) > 0)
         {
-            ULONG match = (*addresses)[i];
-            matches = realloc(matches, ((sizeof *matches)*(nmatches + 1)));
-            if(matches == NULL)
+            if(old != NULL) matchset_get_values(matches, r, seen, n, old);
+            read_block(target, index, &block, n, data_size, old);
+            UINT64 start = metrics_clock();
+            for(ULONG i = 0; i < n; i++)
             {
-                is_ok = ERR_GENERIC;
-                sprintf(trace, "%s | Error writing into memory of target process!", __func__);
-                diag_critical(trace, is_ok);
-                exit(is_ok);
+                block.valid[i] = block.valid[i] && memcmp(&block.values[i * data_size], data, data_size) == 0;
             }
-            matches[nmatches] = match;
-            nmatches++;
+            metrics_since(MET_SEARCH_NS, start);
+            start = metrics_clock();
+            matchset_keep(matches, r, &kept, block.addresses, block.valid, NULL, n);
+            metrics_since(MET_MERGE_NS, start);
+            seen += n;
         }
-        i++;
+        metrics_add((seen > 0) ? MET_REGIONS_SCANNED : MET_REGIONS_SKIPPED, 1);
+        matchset_region_done(matches, r, kept);
+    }
+    /* Every survivor holds the searched value */
+    matchset_set_common_value(matches, data);
+    block_free(&block);
+    index_free(index);
+    free(old);
+
+    *n_matches = matches->n_matches;
+    metrics_add(MET_FILTER_OUT, matches->n_matches);
+    metrics_end("filter", &mark);
+
+    return is_ok;
+}
+
+MU_ERROR execute_relational_filtering(PID target, MU_MATCH_SET *matches, MU_VALUE_TYPE type, MU_PREDICATE pred, UCHAR *delta, UINT64 *n_matches)
+{
+    MU_ERROR is_ok = ERR_OK;
+    diag_trace trace;
+    ULONG data_size = matches->data_size;
+
+    *n_matches = matches->n_matches;
+    if(!matchset_has_values(matches))
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Previous values of the matches are not known!", __func__);
+        diag_error(trace, is_ok);
+        return is_ok;
     }
+    if(type == VAL_STRING && pred != PRED_CHANGED && pred != PRED_UNCHANGED)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Strings can only be compared for changes!", __func__);
+        diag_error(trace, is_ok);
+        return is_ok;
+    }
+
+    MU_FILTER_BLOCK block;
+    MU_METRICS mark;
+
+    metrics_begin(&mark);
+    metrics_add(MET_FILTER_IN, matches->n_matches);
+    MU_REGION_INDEX *index = current_index(target);
+    UCHAR *old = malloc(data_size * FILTER_BLOCK);
+    UINT64 *mask = malloc((sizeof *mask)*(FILTER_BLOCK / MASK_WORD_BITS + 1));
+    if(old == NULL || mask == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    block_init(&block, data_size);
+
+    /* One batched re-read per block both evaluates the predicate and refreshes the stored values */
+    for(ULONG r = 0; r < matches->n_regions; r++)
+    {
+        UINT64 pos = 0;
+        UINT64 seen = 0;
+        UINT64 kept = 0;
+        ULONG n;
+        while((n = matchset_gather(matches, r, &pos, block.addresses, FILTER_BLOCK)) > 0)
+        {
+            matchset_get_values(matches, r, seen, n, old);
+            read_block(target, index, &block, n, data_size, old);
 
-    *n_matches = nmatches;
+            /* Values are packed, so the kernels compare whole vectors of them */
+            UINT64 start = metrics_clock();
+            kernel_compare(block.values, old, n * data_size, type, data_size, data_size, pred, delta, mask);
+            for(ULONG i = 0; i < n; i++)
+            {
+                block.valid[i] = block.valid[i] && ((mask[i / MASK_WORD_BITS] >> (i % MASK_WORD_BITS)) & 1);
+            }
+            metrics_since(MET_SEARCH_NS, start);
+            start = metrics_clock();
+            matchset_keep(matches, r, &kept, block.addresses, block.valid, block.values, n);
+            metrics_since(MET_MERGE_NS, start);
+            seen += n;
+        }
+        metrics_add((seen > 0) ? MET_REGIONS_SCANNED : MET_REGIONS_SKIPPED, 1);
+        matchset_region_done(matches, r, kept);
+    }
+    /* Every surviving region holds its own values now */
+    if(matches->common_value != NULL)
+    {
+        free(matches->common_value);
+        matches->common_value = NULL;
+    }
+    block_free(&block);
+    index_free(index);
+    free(old);
+    free(mask);
 
-    free(*addresses);
- 
-    *addresses = malloc((sizeof *addresses)*(nmatches + 1));
-    memcpy(*addresses, matches, (sizeof *matches)*(nmatches + 1));
-    free(matches);
+    *n_matches = matches->n_matches;
+    metrics_add(MET_FILTER_OUT, matches->n_matches);
+    metrics_end("filter", &mark);
 
-    return ERR_OK;
-}
\ No newline at end of file
+    return is_ok;
+}
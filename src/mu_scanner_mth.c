@@ -1,7 +1,7 @@
 /**
  * @file mu_scanner_mth.c
  * @author Mark Dervishaj
- * @brief Multithreaded implementation of mu_scanner.h
+ * @brief Multithreaded implementation of execute_scanner from mu_scanner.h
  * @version 0.1
  * @date 2022-09-07
  * 
@@ -9,9 +9,23 @@
  * 
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  /* _GNU_SOURCE */
+
 #include "inc/mu_scanner.h"
 #include "inc/mu_memchunk.h"
+#include "inc/mu_utils.h"
 #include "inc/mu_io.h"
+#include "inc/mu_matchset.h"
+#include "inc/mu_kernels.h"
+#include "inc/mu_snapshot.h"
+#include "inc/mu_residency.h"
+#include "inc/mu_softdirty.h"
+#include "inc/mu_uring.h"
+#include "inc/mu_spsc.h"
+#include "inc/mu_valueset.h"
+#include "inc/mu_metrics.h"
 #include "inc/mu_diag.h"
 #include <stdio.h>
 #include <stdint.h>
@@ -20,221 +34,1540 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/uio.h>
 #include <sched.h>
 #include <pthread.h>
+#include <time.h>
 
-#ifndef _GNU_SOURCE
-#define _GNU_SOURCE
-#endif  /* _GNU_SOURCE */
+#define MODIF_CHNKS         1
+#define WINDOWS_PER_RANGE   16              /* Windows streamed per unit of work */
+#define MIN_WINDOW_SIZE     4096
+#define RANGE_ALIGN         4096            /* Keeps range parts aligned to words of the region bitmaps */
+
+#define SCAN_VALUE          0               /* Search a value */
+#define SCAN_COPY           1               /* Copy memory into a snapshot */
+#define SCAN_COMPARE        2               /* Compare memory to a snapshot and refresh it */
+
+/* Double ended queue of ranges. Owner pops from the bottom, thieves steal from the top */
+typedef struct work_deque
+{
+    ULONG           *items;     /* Indexes into the global ranges array */
+    ULONG           top;
+    ULONG           bottom;
+    pthread_mutex_t lock;
+
+} MU_DEQUE;
+
+/* Thread of the resident pool. Keeps the buffers of its last scan while window and overlap do not change */
+typedef struct pool_worker
+{
+    INT             id;
+    pthread_t       tid;
+    UINT64          seen;       /* Last generation of work started */
+    MU_CHUNK_READER reader;
+    UINT64          *mask;
+    UCHAR           *old;       /* Only after a compare */
+
+} MU_POOL_WORKER;
+
+/* Threads parked between scans, woken for each one. Used when set_scan_resident_pool is enabled */
+typedef struct scan_pool
+{
+    MU_POOL_WORKER  *workers;
+    INT             n_workers;
+    INT             running;    /* Workers that have not finished the current generation */
+    UINT64          generation;
+    BOOL            quit;
+    pthread_mutex_t lock;
+    pthread_cond_t  start;
+    pthread_cond_t  done;
 
-#define MODIF_CHNKS     1
-#define NUM_CORES       16
+} MU_SCAN_POOL;
 
-/* GLOBAL VARIABLES USED BY ALL FUNCTIONS */
-MU_OFFSETS offsets[NUM_CORES];
-MU_MEM_CHUNK *filtered;
-ULONG *matches;
-INT mt_curr_index;  /* To know where is the next available position to write a match */
-pthread_mutex_t mt_mutex;
-pthread_t tid[NUM_CORES];
+/* Private state of each scanning thread. Matches are stored in the part of each range */
+typedef struct scan_thread
+{
+    INT                 id;
+    pthread_t           tid;
+    MU_DEQUE            deque;
+    MU_PIPELINE_STATS   stats;      /* Of the pipeline of this thread, if any */
+    MU_POOL_WORKER      *worker;    /* Resident thread running it. NULL for a thread of this scan only */
+
+} MU_SCAN_THREAD;
+
+/* Window read by the reader thread of a pipeline, waiting in its buffer to be searched */
+typedef struct pipe_window
+{
+    ULONG           r_index;
+    ULONG           address;
+    ULONG           len;
+
+} MU_PIPE_WINDOW;
+
+/* Reader thread feeding a scanning thread through a ring of buffers */
+typedef struct scan_pipe
+{
+    MU_SCAN_THREAD  *owner;     /* Scanning thread. The reader takes ranges on its behalf */
+    MU_CHUNK_READER *reader;    /* Reader of the scanning thread, for windows with bad pages */
+    MU_SPSC         queue;
+    MU_PIPE_WINDOW  *windows;   /* One per slot of the queue */
+    UCHAR           *buffers;   /* One of window + overlap bytes per slot */
+
+} MU_SCAN_PIPE;
 
-void *finder(void *arg)
+/* State shared (read-only while scanning) by all threads */
+typedef struct scan_context
+{
+    INT             mode;
+    PID             target;
+    UCHAR           *data;
+    const MU_VALUE_SET *values; /* Values searched at once instead of data. NULL to search data */
+    ULONG           data_size;
+    ULONG           stride;
+    ULONG           window;
+    MU_SNAPSHOT     *snap;
+    MU_PREDICATE    pred;
+    const UCHAR     *delta;     /* Delta of the by-N predicates */
+    MU_MATCH_SET    *prev;      /* Candidates of the previous snapshot pass. NULL for all slots */
+    MU_DIRTY_MAP    *dirty;     /* Pages written since the previous pass. NULL to read every page */
+    UINT32          depth;      /* Windows each thread keeps in flight with io_uring. 0 to read synchronously */
+    ULONG           n_slots;    /* Buffers between each reader and scanner thread. 0 for no pipeline */
+    MU_SCAN_RANGE   *ranges;
+    ULONG           n_ranges;
+    MU_SCAN_THREAD  *threads;
+    INT             n_threads;
+
+} MU_SCAN_CONTEXT;
+
+static MU_SCAN_CONTEXT ctx;
+static ULONG scan_window = DEFAULT_WINDOW_SIZE;
+static ULONG scan_mem_budget = 0;      /* 0 means no limit */
+static ULONG scan_alignment = 0;       /* 0 means natural alignment of the value */
+static INT scan_residency = RESIDENCY_OFF;
+static MU_DIRTY_MAP *scan_dirty = NULL;
+static UINT32 scan_queue_depth = 0;    /* 0 means synchronous reads */
+static ULONG scan_pipeline = 0;        /* 0 means each thread reads and searches in turn */
+static MU_PIPELINE_STATS pipeline_stats;
+static MU_SCAN_POOL pool = { NULL, 0, 0, 0, false, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+MU_ERROR set_scan_window(ULONG window_size)
 {
     diag_trace trace;
-    INT *core_id = (INT *) arg;
-    pthread_t id = pthread_self();
-    cpu_set_t cpuset;
+    MU_ERROR is_ok = ERR_OK;
 
-    if(*core_id < 0 || *core_id >= NUM_CORES)
+    if(window_size < MIN_WINDOW_SIZE)
     {
-        sprintf(trace, "%s | Invalid core ID!", __func__);
-        diag_critical(trace, ERR_GENERIC);
-        return NULL;
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Window size must be at least %d bytes!", __func__, MIN_WINDOW_SIZE);
+        diag_error(trace, is_ok);
     }
+    else scan_window = window_size;
 
-    CPU_ZERO(&cpuset);
-    CPU_SET(*core_id, &cpuset);
+    return is_ok;
+}
+
+MU_ERROR set_scan_mem_budget(ULONG budget)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
 
-    INT rv = pthread_setaffinity_np(id, sizeof(cpu_set_t), &cpuset);
-    if(rv != 0)
+    if(budget != 0 && budget < MIN_WINDOW_SIZE)
     {
-        sprintf(trace, "%s | Cannot set thread affinity to core!", __func__);
-        diag_critical(trace, ERR_GENERIC);
-        return NULL;
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Memory budget must be 0 (no limit) or at least %d bytes!", __func__, MIN_WINDOW_SIZE);
+        diag_error(trace, is_ok);
     }
+    else scan_mem_budget = budget;
+
+    return is_ok;
+}
 
-    /* Find matches only in chunks assigned to this core */
-    ULONG start = offsets[*core_id].off_start;
-    ULONG end = start + offsets[*core_id].off_len;
-    for(INT i = start; i < end; i++)
+MU_ERROR set_scan_alignment(ULONG alignment)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+
+    if(alignment != 0 && alignment != 1 && alignment != 2 && alignment != 4 && alignment != 8)
     {
-        pthread_mutex_lock(&mt_mutex);
-        /**
-         * @TODO: Find matches and store them
-         */
-        mt_curr_index++;
-        pthread_mutex_unlock(&mt_mutex);
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Alignment must be 0 (natural), 1, 2, 4 or 8 bytes!", __func__);
+        diag_error(trace, is_ok);
     }
+    else scan_alignment = alignment;
 
+    return is_ok;
 }
 
-ULONG* execute_scanner(PID target, UCHAR *data, INT data_size, INT *n_matches)
+MU_ERROR set_scan_residency(INT mode)
 {
+    diag_trace trace;
     MU_ERROR is_ok = ERR_OK;
+
+    if(mode != RESIDENCY_OFF && mode != RESIDENCY_PRESENT && mode != RESIDENCY_SWAPPED)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Residency must be 0 (off), 1 (in RAM) or 2 (in RAM or swap)!", __func__);
+        diag_error(trace, is_ok);
+    }
+    else scan_residency = mode;
+
+    return is_ok;
+}
+
+INT get_scan_residency(void)
+{
+    return scan_residency;
+}
+
+void set_scan_dirty_map(MU_DIRTY_MAP *map)
+{
+    scan_dirty = map;
+}
+
+MU_DIRTY_MAP* get_scan_dirty_map(void)
+{
+    return scan_dirty;
+}
+
+MU_ERROR set_scan_queue_depth(UINT32 depth)
+{
     diag_trace trace;
-    INT size = 0;
-    INT nmatches = 0;
-    ULONG *matches = malloc((sizeof *matches)*(nmatches + 1));
-    filtered = get_memory_chunks(target, 1, &size);
+    MU_ERROR is_ok = ERR_OK;
+
+    if(depth > URING_MAX_DEPTH)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Queue depth must be 0 (synchronous) to %d!", __func__, URING_MAX_DEPTH);
+        diag_error(trace, is_ok);
+    }
+    else scan_queue_depth = depth;
+
+    return is_ok;
+}
+
+MU_ERROR set_scan_pipeline(ULONG n_buffers)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+
+    if(n_buffers == 1)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | A pipeline needs at least 2 buffers, or 0 to disable it!", __func__);
+        diag_error(trace, is_ok);
+    }
+    else scan_pipeline = n_buffers;
+
+    return is_ok;
+}
+
+void get_scan_pipeline_stats(MU_PIPELINE_STATS *stats)
+{
+    *stats = pipeline_stats;
+}
+
+/**
+ * @brief Gets the writable chunks of the target to scan, narrowed down to their resident pages if
+ * set with set_scan_residency. Names point into *owner
+ * 
+ * @param target PID of the target process
+ * @param size Stores the number of chunks
+ * @param owner Stores the array to free along with the returned one. NULL if there is none
+ * @return Chunks to scan, in address order. REMEMBER TO FREE along with *owner
+ */
+static MU_MEM_CHUNK* get_scan_chunks(PID target, INT *size, MU_MEM_CHUNK **owner)
+{
+    INT n_chunks = 0;
+    MU_MEM_CHUNK *chunks = get_memory_chunks(target, MODIF_CHNKS, &n_chunks);
+
+    *owner = NULL;
+    *size = n_chunks;
+    if(scan_residency == RESIDENCY_OFF || chunks == NULL) return chunks;
+
+    INT n_runs = 0;
+    MU_MEM_CHUNK *runs = residency_filter(target, chunks, n_chunks, scan_residency, &n_runs);
+    /* Without residency info every page is scanned */
+    if(runs == NULL) return chunks;
+    *owner = chunks;
+    *size = n_runs;
+
+    /* Runs are in address order: a chunk is skipped if none of them starts inside it */
+    INT r = 0;
+    UINT64 n_skipped = 0;
+    for(INT c = 0; c < n_chunks; c++)
+    {
+        while(r < n_runs && runs[r].addr_start < chunks[c].addr_start) r++;
+        if(r >= n_runs || runs[r].addr_start >= chunks[c].addr_start + chunks[c].chunk_size) n_skipped++;
+    }
+    metrics_add(MET_REGIONS_SKIPPED, n_skipped);
+
+    return runs;
+}
+
+/**
+ * @brief Gets the alignment of the matches for a value size
+ * 
+ * @param data_size Size in bytes of the searched value
+ * @return Configured alignment, or the natural one: the size itself for 2, 4 and 8 bytes, 1 otherwise
+ */
+static ULONG get_stride(ULONG data_size)
+{
+    if(scan_alignment != 0) return scan_alignment;
+
+    return (data_size == 2 || data_size == 4 || data_size == 8) ? data_size : 1;
+}
+
+/**
+ * @brief Gets the bytes of match mask needed to search a buffer
+ * 
+ * @param len Size in bytes of the buffer
+ * @return Size in bytes of the mask, in the worst case (stride 1)
+ */
+static ULONG mask_bytes(ULONG len)
+{
+    return (len / MASK_WORD_BITS + 1) * sizeof(UINT64);
+}
+
+/**
+ * @brief Gets the number of threads to use, based on the cores online and available to this process
+ * 
+ * @return Number of threads for the pool
+ */
+static INT get_pool_size()
+{
+    return get_usable_cores();
+}
+
+/**
+ * @brief Pins the calling thread to the n-th CPU allowed for this process. Failure is not fatal
+ * 
+ * @param n Position of the CPU inside the affinity mask of the process
+ */
+static void pin_thread(INT n)
+{
+    diag_trace trace;
+    cpu_set_t allowed;
+    cpu_set_t cpuset;
+
+    CPU_ZERO(&allowed);
+    if(sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+    {
+        return;
+    }
+    n %= CPU_COUNT(&allowed);
+
+    INT cpu = 0;
+    for(INT seen = -1; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(CPU_ISSET(cpu, &allowed) && ++seen == n) break;
+    }
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0)
+    {
+        sprintf(trace, "%s | Cannot set thread affinity to core %d!", __func__, cpu);
+        diag_error(trace, ERR_GENERIC);
+    }
+}
+
+/**
+ * @brief Cuts the regions of the match set into ranges of range_size starting positions. Each range
+ * reads data_size - 1 extra bytes so matches crossing into the next range are still found
+ * 
+ * @param chunks Chunks the regions of the set were created from
+ * @param n_chunks Number of chunks
+ * @param set Empty match set
+ * @param range_size Maximum number of starting positions per range. Multiple of 4096
+ * @param n_ranges Stores the number of ranges created
+ * @return Array of ranges, in address order. REMEMBER TO FREE
+ */
+static MU_SCAN_RANGE* split_chunks(MU_MEM_CHUNK *chunks, INT n_chunks, MU_MATCH_SET *set, ULONG range_size, ULONG *n_ranges)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    ULONG data_size = set->data_size;
+    ULONG total = 0;
 
-    /* Get number of threads of the CPU running this program */
-    INT64 n_cores = sysconf(_SC_NPROCESSORS_ONLN);
-    if(n_cores != NUM_CORES)
+    for(ULONG r = 0; r < set->n_regions; r++)
+    {
+        total += (set->regions[r].size + range_size - 1) / range_size;
+    }
+
+    MU_SCAN_RANGE *ranges = calloc(total + 1, sizeof *ranges);
+    if(ranges == NULL)
     {
         is_ok = ERR_GENERIC;
-        sprintf(trace, "%s | Mismatch between number of configured cores and real available cores!", __func__);
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
         diag_critical(trace, is_ok);
-        exit(is_ok); 
+        exit(is_ok);
+    }
+
+    /* Regions were created in chunk order, so both lists can be walked together */
+    ULONG n = 0;
+    ULONG r = 0;
+    for(INT i = 0; i < n_chunks; i++)
+    {
+        ULONG chunk_end = chunks[i].addr_start + chunks[i].chunk_size;
+        while(r < set->n_regions && set->regions[r].addr_start < chunk_end)
+        {
+            MU_MATCH_REGION *region = &set->regions[r];
+            ULONG positions = region->size;
+            if(region->addr_start + positions + data_size - 1 > chunk_end)
+            {
+                positions = (chunk_end - region->addr_start >= data_size) ? chunk_end - region->addr_start - data_size + 1 : 0;
+            }
+
+            for(ULONG off = 0; off < positions; off += range_size)
+            {
+                ULONG len = positions - off;
+                if(len > range_size) len = range_size;
+
+                ranges[n].addr_start = region->addr_start + off;
+                ranges[n].scan_len = len;
+                ranges[n].read_len = len + data_size - 1;
+                ranges[n].region = r;
+                ranges[n].part.addr_start = ranges[n].addr_start;
+                ranges[n].part.size = len;
+                n++;
+            }
+            r++;
+        }
     }
+    *n_ranges = n;
+
+    return ranges;
+}
 
-    /* INT id[NUM_CORES]; */
-    INT n_elems = size/NUM_CORES;
-    INT remnant = size%NUM_CORES;
-    INT n_elem_in_index[NUM_CORES];
+/**
+ * @brief Takes the next range from the own deque or, if empty, steals one from another thread
+ * 
+ * @param self Calling thread
+ * @param range Stores the index of the range taken
+ * @return True if a range was taken, false if there is no work left
+ */
+static BOOL take_range(MU_SCAN_THREAD *self, ULONG *range)
+{
+    BOOL found = false;
 
-    /* Distribute number of memory chunks into the threads */
-    for(INT i = 0; i < NUM_CORES; i++)
+    pthread_mutex_lock(&self->deque.lock);
+    if(self->deque.bottom > self->deque.top)
     {
-        n_elem_in_index[i] = n_elems;
+        *range = self->deque.items[--self->deque.bottom];
+        found = true;
     }
-    if(remnant != 0)
+    pthread_mutex_unlock(&self->deque.lock);
+
+    /* No work is created while scanning, so once every deque is empty the thread is done */
+    for(INT i = 1; !found && i < ctx.n_threads; i++)
     {
-        for(INT i = 0; i < remnant; i++)
+        MU_DEQUE *victim = &ctx.threads[(self->id + i) % ctx.n_threads].deque;
+        pthread_mutex_lock(&victim->lock);
+        if(victim->bottom > victim->top)
         {
-            n_elem_in_index[i]++;
+            *range = victim->items[victim->top++];
+            found = true;
         }
+        pthread_mutex_unlock(&victim->lock);
     }
 
-    /* Pre-process chunks to create an array of offsets and lengths */
-    INT offst = 0;
-    for(INT i = 0; i < NUM_CORES; i++)
+    return found;
+}
+
+/**
+ * @brief Searches a buffer for the value, or the set of values, of the context
+ * 
+ * @param buf Buffer starting at a slot
+ * @param len Size in bytes of the buffer
+ * @param mask Stores one bit per slot
+ * @return Number of slots covered by the mask
+ */
+static ULONG find_slots(const UCHAR *buf, ULONG len, UINT64 *mask)
+{
+    if(ctx.values != NULL) return valueset_find(ctx.values, buf, len, ctx.stride, mask);
+
+    return kernel_find(buf, len, ctx.data, ctx.data_size, ctx.stride, mask);
+}
+
+/**
+ * @brief Stores in the part of a range the slots set in a match mask
+ * 
+ * @param range Range being searched
+ * @param base Offset from the range start of the first slot of the mask
+ * @param mask Match mask
+ * @param n_slots Slots covered by the mask
+ * @param slots Bytes of the first slot of the mask. The current value of each match is stored in compare mode
+ * and when searching a set of values
+ * @param hint Position of the last candidate of the previous pass found in the range
+ */
+static void push_mask(MU_SCAN_RANGE *range, ULONG base, UINT64 *mask, ULONG n_slots, const UCHAR *slots, UINT64 *hint)
+{
+    BOOL check_bad = (ctx.mode == SCAN_COMPARE) && snapshot_is_bad(ctx.snap, range->addr_start + base, n_slots * ctx.stride);
+    MU_MATCH_REGION *prev = (ctx.prev != NULL) ? &ctx.prev->regions[range->region] : NULL;
+
+    if(n_slots == 0) return;
+
+    /* Few candidates left: walk them and test their bits instead of looking up every hit */
+    if(prev != NULL && !prev->is_bitmap)
     {
-        offsets[i].off_start = offst;
-        INT len = n_elem_in_index[i];
-        offsets[i].off_len = len;
-        offst += len;
+        ULONG first = range->addr_start + base - prev->addr_start;
+        ULONG last = first + n_slots * ctx.stride;
+        matchset_contains(ctx.prev, range->region, prev->addr_start + first, hint);
+        for(UINT64 i = *hint; i < prev->n_matches && prev->offsets[i] < last; i++)
+        {
+            ULONG slot = (prev->offsets[i] - first) / ctx.stride;
+            ULONG address = prev->addr_start + prev->offsets[i];
+            if(((mask[slot / MASK_WORD_BITS] >> (slot % MASK_WORD_BITS)) & 1) == 0) continue;
+            if(check_bad && snapshot_is_bad(ctx.snap, address, ctx.data_size)) continue;
+
+            matchset_region_push(&range->part, ctx.stride, (UINT32) (address - range->addr_start));
+            if(ctx.mode == SCAN_COMPARE || ctx.values != NULL)
+            {
+                matchset_region_push_value(&range->part, ctx.data_size, slots + slot * ctx.stride);
+            }
+        }
+        return;
     }
 
-    /* Create threads */
-    for(INT i = 0; i < NUM_CORES; i++)
+    for(ULONG w = 0; w * MASK_WORD_BITS < n_slots; w++)
     {
-        /* id[i] = i; */  /* Use id to pass a different pointer to each thread */
-        INT rv = phtread_create(&(tid[i]), NULL, &finder, (void *)(i));
-        if(rv != 0)
+        UINT64 word = mask[w];
+        while(word)
         {
-            is_ok = ERR_GENERIC;
-            sprintf(trace, "%s | Error creating thread %d!", __func__, i);
-            diag_critical(trace, is_ok);
-            exit(is_ok); 
+            ULONG slot = w * MASK_WORD_BITS + __builtin_ctzl(word);
+            ULONG offset = base + slot * ctx.stride;
+            ULONG address = range->addr_start + offset;
+            word &= word - 1;
+
+            /* Old value unknown, or already discarded by a previous pass */
+            if(check_bad && snapshot_is_bad(ctx.snap, address, ctx.data_size)) continue;
+            if(prev != NULL && !matchset_contains(ctx.prev, range->region, address, hint)) continue;
+
+            matchset_region_push(&range->part, ctx.stride, (UINT32) offset);
+            if(ctx.mode == SCAN_COMPARE || ctx.values != NULL)
+            {
+                matchset_region_push_value(&range->part, ctx.data_size, slots + slot * ctx.stride);
+            }
         }
     }
+}
 
-    /* Join threads */
-    for(INT i = 0; i < NUM_CORES; i++)
+/**
+ * @brief Gets the end of the bytes of a range that this range must copy into the snapshot.
+ * Bytes read past it belong to the next range
+ * 
+ * @param r_index Index of the range
+ * @return Address after the last byte owned by the range
+ */
+static ULONG owned_end(ULONG r_index)
+{
+    MU_SCAN_RANGE *range = &ctx.ranges[r_index];
+    ULONG end = range->addr_start + range->scan_len;
+
+    if(r_index + 1 < ctx.n_ranges && ctx.ranges[r_index + 1].addr_start == end)
     {
-        pthread_join(tid[i], NULL);
+        return end;
     }
 
-    pthread_exit(NULL);
+    return range->addr_start + range->read_len;
+}
+
+/**
+ * @brief Copies the new bytes of a window into the snapshot. Pages that could not be read become unknown
+ * 
+ * @param reader Reader with the window
+ * @param fresh Address of the first byte not carried from the previous window
+ * @param end Address after the last byte owned by the range
+ */
+static void sync_window(MU_CHUNK_READER *reader, ULONG fresh, ULONG end)
+{
+    ULONG win_end = reader->win_addr + reader->win_len;
+    ULONG next = (reader->next < end) ? reader->next : end;
+
+    if(win_end > end) win_end = end;
+    if(win_end > fresh)
+    {
+        if(snapshot_store(ctx.snap, fresh, reader->buffer + (fresh - reader->win_addr), win_end - fresh) == ERR_OK)
+        {
+            snapshot_mark(ctx.snap, fresh, win_end - fresh, false);
+        }
+        else snapshot_mark(ctx.snap, fresh, win_end - fresh, true);
+        fresh = win_end;
+    }
+    /* Whatever was not read: failed window, or the end of a partial one */
+    if(next > fresh)
+    {
+        snapshot_mark(ctx.snap, fresh, next - fresh, true);
+    }
+}
 
-    return matches;
+/**
+ * @brief Streams part of a range from the target. Depending on the mode, each window is searched with the
+ * vector kernels, copied into the snapshot, or compared to the snapshot and copied
+ * 
+ * @param reader Reader of the thread
+ * @param r_index Index of the range
+ * @param start First address to read. Matches are pushed from here on, so parts must come in address order
+ * @param len Bytes to read
+ * @param end Address after the last byte that this part must copy into the snapshot
+ * @param mask Match mask of the thread
+ * @param old Snapshot buffer of the thread in compare mode
+ * @param hint Position of the last lookup in the previous matches of the range. Updated
+ */
+static void stream_part(MU_CHUNK_READER *reader, ULONG r_index, ULONG start, ULONG len, ULONG end, UINT64 *mask, UCHAR *old, UINT64 *hint)
+{
+    MU_SCAN_RANGE *range = &ctx.ranges[r_index];
+    ULONG old_end = start;
+    ULONG old_len = 0;
 
-/*     for(INT i = 0; i < size; i++)
+    reader_seek(reader, start, len);
+    while(reader_next(reader))
     {
-        MU_MEM_CHUNK chnk = filtered[i];
-        UCHAR *bytes = read_chunk_data(target, chnk);
-        UCHAR *ptr = NULL;
-        ptr = memmem(bytes, chnk.chunk_size, data, data_size);
+        /* Bytes carried from the previous window were already copied into the snapshot */
+        ULONG fresh = (reader->win_addr < old_end) ? old_end : reader->win_addr;
+        ULONG win_end = reader->win_addr + reader->win_len;
 
-        while(ptr)
+        if(ctx.mode == SCAN_COMPARE && reader->win_len > 0)
         {
-            ULONG offset = ptr - bytes;
-            ULONG match = chnk.addr_start + offset;
-            matches = realloc(matches, ((sizeof *matches)*(nmatches + 1)));
-            if(matches == NULL)
+            /* So their old contents are carried too, and only the new ones are loaded */
+            ULONG keep = fresh - reader->win_addr;
+            memmove(old, old + old_len - keep, keep);
+            if(snapshot_load(ctx.snap, fresh, old + keep, win_end - fresh) != ERR_OK)
             {
-                is_ok = ERR_GENERIC;
-                sprintf(trace, "%s | Error writing into memory of target process!", __func__);
-                diag_critical(trace, is_ok);
-                exit(is_ok);
+                reader->win_len = 0;
             }
-            matches[nmatches] = match;
-            nmatches++;
-            ptr = memmem(&bytes[offset + data_size], (chnk.chunk_size - offset - data_size), data, data_size);
+            old_len = reader->win_len;
         }
-        free(chnk.chunk_name);
-        free(bytes);
-    }
-    *n_matches = nmatches;
-    free(filtered);
+        if(ctx.mode != SCAN_COPY && reader->win_len >= ctx.data_size)
+        {
+            /* Windows do not have to start at a slot boundary: skip to the first aligned slot */
+            ULONG skip = (ctx.stride - (reader->win_addr - range->addr_start) % ctx.stride) % ctx.stride;
+            ULONG base = reader->win_addr + skip - range->addr_start;
+            ULONG n_slots = 0;
+            UINT64 start = metrics_clock();
 
-    return matches; */
+            /* Carried bytes were too short for a match in the previous window, so nothing is reported twice */
+            if(skip < reader->win_len && ctx.mode == SCAN_VALUE)
+            {
+                n_slots = find_slots(reader->buffer + skip, reader->win_len - skip, mask);
+            }
+            else if(skip < reader->win_len)
+            {
+                n_slots = kernel_compare(reader->buffer + skip, old + skip, reader->win_len - skip, ctx.snap->type,
+                                         ctx.data_size, ctx.stride, ctx.pred, ctx.delta, mask);
+            }
+            metrics_since(MET_SEARCH_NS, start);
+            start = metrics_clock();
+            push_mask(range, base, mask, n_slots, reader->buffer + skip, hint);
+            metrics_since(MET_MERGE_NS, start);
+        }
+        if(ctx.mode != SCAN_VALUE)
+        {
+            sync_window(reader, fresh, end);
+        }
+        old_end = (reader->win_len > 0) ? reader->win_addr + reader->win_len : reader->next;
+    }
 }
 
-MU_ERROR execute_filtering(PID target, ULONG **addresses, UCHAR *data, ULONG data_size, INT *n_matches)
+/**
+ * @brief Compares part of a range whose pages were not written since the previous pass. The memory equals
+ * the snapshot there, so the snapshot is compared with itself and nothing is read from the target
+ * 
+ * @param r_index Index of the range
+ * @param start First starting position of the part
+ * @param end Address after the last starting position of the part
+ * @param mask Match mask of the thread
+ * @param old Snapshot buffer of the thread
+ * @param hint Position of the last lookup in the previous matches of the range. Updated
+ */
+static void compare_clean(ULONG r_index, ULONG start, ULONG end, UINT64 *mask, UCHAR *old, UINT64 *hint)
 {
-    MU_ERROR is_ok = ERR_OK;
-    diag_trace trace;
-    INT nmatches = 0;
-    INT og_n_matches = *n_matches;
-    ULONG *matches = malloc((sizeof *matches)*(nmatches + 1));
-    INT i = 0;
-    while(i < og_n_matches)
+    MU_SCAN_RANGE *range = &ctx.ranges[r_index];
+    ULONG overlap = ctx.data_size - 1;
+
+    /* No slot can meet these against its own value */
+    if(ctx.pred == PRED_CHANGED || ctx.pred == PRED_INCREASED || ctx.pred == PRED_DECREASED) return;
+
+    for(ULONG pos = start; pos < end; )
     {
-        struct iovec local[1];
-        struct iovec remote[1];
-        UCHAR read[data_size];
+        ULONG n = (end - pos < ctx.window) ? end - pos : ctx.window;
+        ULONG len = n + overlap;
+        ULONG skip = (ctx.stride - (pos - range->addr_start) % ctx.stride) % ctx.stride;
 
-        local[0].iov_base = read;
-        local[0].iov_len = data_size;
-        remote[0].iov_base = (void *) (*addresses)[i];
-        remote[0].iov_len = data_size;
+        /* Unknown contents are dropped, as in a read */
+        if(skip < n && snapshot_load(ctx.snap, pos, old, len) == ERR_OK)
+        {
+            UINT64 start = metrics_clock();
+            ULONG n_slots = kernel_compare(old + skip, old + skip, len - skip, ctx.snap->type, ctx.data_size,
+                                           ctx.stride, ctx.pred, ctx.delta, mask);
+            metrics_since(MET_SEARCH_NS, start);
+            start = metrics_clock();
+            push_mask(range, pos + skip - range->addr_start, mask, n_slots, old + skip, hint);
+            metrics_since(MET_MERGE_NS, start);
+        }
+        pos += n;
+    }
+}
 
-        INT64 n_read = process_vm_readv(target, local, 1, remote, 1, 0);
+/**
+ * @brief Compares a range with the snapshot reading only the pages written since the previous pass.
+ * The range is cut into runs of clean and dirty pages. A slot belongs to a clean run only if all its
+ * bytes are clean, so clean runs stop data_size - 1 bytes before the next dirty page
+ * 
+ * @param reader Reader of the thread
+ * @param r_index Index of the range
+ * @param mask Match mask of the thread
+ * @param old Snapshot buffer of the thread
+ * @param hint Position of the last lookup in the previous matches of the range. Updated
+ */
+static void compare_incremental(MU_CHUNK_READER *reader, ULONG r_index, UINT64 *mask, UCHAR *old, UINT64 *hint)
+{
+    MU_SCAN_RANGE *range = &ctx.ranges[r_index];
+    ULONG overlap = ctx.data_size - 1;
+    ULONG scan_end = range->addr_start + range->scan_len;
+    ULONG read_end = range->addr_start + range->read_len;
 
-        if(n_read < 0 || (ULONG) n_read != data_size)
+    for(ULONG pos = range->addr_start; pos < scan_end; )
+    {
+        ULONG clean_end = dirty_run_end(ctx.dirty, pos, read_end, false);
+        if(clean_end < read_end) clean_end = (clean_end > pos + overlap) ? clean_end - overlap : pos;
+        if(clean_end > scan_end) clean_end = scan_end;
+        if(clean_end > pos)
         {
-            is_ok = ERR_GENERIC;
-            sprintf(trace, "%s | Error writing into memory of target process!", __func__);
-            diag_critical(trace, is_ok);
-            exit(is_ok);
+            compare_clean(r_index, pos, clean_end, mask, old, hint);
+            pos = clean_end;
+            continue;
         }
-        int cmp = memcmp(read, data, data_size);
-        if(cmp == 0)
+
+        /* The end of a short clean run is read along with the dirty pages that follow it */
+        ULONG dirty_end = dirty_run_end(ctx.dirty, dirty_run_end(ctx.dirty, pos, scan_end, false), scan_end, true);
+        if(dirty_end <= pos) dirty_end = scan_end;
+        ULONG part_end = (dirty_end + overlap < read_end) ? dirty_end + overlap : read_end;
+        stream_part(reader, r_index, pos, part_end - pos, (dirty_end == scan_end) ? owned_end(r_index) : dirty_end,
+                    mask, old, hint);
+        pos = dirty_end;
+    }
+}
+
+/**
+ * @brief Searches ranges keeping up to depth windows in flight with io_uring, so the reads of the next
+ * windows (of this range or the following ones) overlap with the search of the current one. Windows are
+ * consumed in the order they were queued, so matches are pushed in address order. A window that comes
+ * back short is streamed again with the synchronous reader, which skips its bad pages
+ * 
+ * @param self Thread
+ * @param ring Open engine of the thread
+ * @param reader Reader of the thread, for short windows
+ * @param mask Match mask of the thread
+ */
+static void stream_async(MU_SCAN_THREAD *self, MU_URING *ring, MU_CHUNK_READER *reader, UINT64 *mask)
+{
+    ULONG overlap = ctx.data_size - 1;
+    ULONG r_index = 0;
+    ULONG next = 0;
+    ULONG end = 0;
+    BOOL more = true;
+    UINT64 last = UINT64_MAX;
+    UINT64 hint = 0;
+
+    while(true)
+    {
+        /* Refill once half the queue is consumed, so reads are submitted in batches */
+        while(more && uring_can_queue(ring) && (ring->n_unsubmitted > 0 || ring->n_pending <= ctx.depth / 2))
         {
-            ULONG match = (*addresses)[i];
-            matches = realloc(matches, ((sizeof *matches)*(nmatches + 1)));
-            if(matches == NULL)
+            if(next >= end)
             {
-                is_ok = ERR_GENERIC;
-                sprintf(trace, "%s | Error writing into memory of target process!", __func__);
-                diag_critical(trace, is_ok);
-                exit(is_ok);
+                if(!take_range(self, &r_index))
+                {
+                    more = false;
+                    break;
+                }
+                next = ctx.ranges[r_index].addr_start;
+                end = next + ctx.ranges[r_index].read_len;
+                continue;
             }
-            matches[nmatches] = match;
-            nmatches++;
+            ULONG len = (end - next < ctx.window + overlap) ? end - next : ctx.window + overlap;
+            uring_queue(ring, next, len, r_index);
+            next = (next + len >= end) ? end : next + ctx.window;
         }
-        i++;
-    }
+        if(ring->n_pending == 0) break;
 
-    *n_matches = nmatches;
+        UCHAR *buffer = NULL;
+        MU_URING_READ *read = uring_wait_head(ring, &buffer);
+        MU_SCAN_RANGE *range = &ctx.ranges[read->tag];
+        if(read->tag != last)
+        {
+            last = read->tag;
+            hint = 0;
+        }
 
-    free(*addresses);
- 
-    *addresses = malloc((sizeof *addresses)*(nmatches + 1));
-    memcpy(*addresses, matches, (sizeof *matches)*(nmatches + 1));
-    free(matches);
+        if(read->result == (INT64) read->size)
+        {
+            ULONG skip = (ctx.stride - (read->address - range->addr_start) % ctx.stride) % ctx.stride;
+            if(skip < read->size && read->size >= ctx.data_size)
+            {
+                UINT64 start = metrics_clock();
+                ULONG n_slots = find_slots(buffer + skip, read->size - skip, mask);
+                metrics_since(MET_SEARCH_NS, start);
+                start = metrics_clock();
+                push_mask(range, read->address + skip - range->addr_start, mask, n_slots, buffer + skip, &hint);
+                metrics_since(MET_MERGE_NS, start);
+            }
+        }
+        else stream_part(reader, read->tag, read->address, read->size, read->address + read->size, mask, NULL, &hint);
+        uring_pop_head(ring);
+    }
+}
+
+/**
+ * @brief Gets the time of a monotonic clock
+ * 
+ * @return Nanoseconds since an arbitrary point
+ */
+static UINT64 now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (UINT64) ts.tv_sec * 1000000000UL + (UINT64) ts.tv_nsec;
+}
+
+/**
+ * @brief Waits for a free buffer of the pipeline. The time blocked is backpressure from the scanner
+ * 
+ * @param pipe Pipeline
+ * @return Slot to fill
+ */
+static ULONG pipe_reserve(MU_SCAN_PIPE *pipe)
+{
+    INT64 slot = spsc_reserve(&pipe->queue);
+
+    if(slot < 0)
+    {
+        UINT64 start = now_ns();
+        slot = spsc_reserve_wait(&pipe->queue);
+        pipe->owner->stats.read_wait_ns += now_ns() - start;
+    }
+
+    return (ULONG) slot;
+}
+
+/**
+ * @brief Hands a filled buffer over to the scanner
+ * 
+ * @param pipe Pipeline
+ * @param slot Slot got from pipe_reserve
+ * @param r_index Range of the window
+ * @param address Address of the first byte of the buffer
+ * @param len Valid bytes in the buffer
+ */
+static void pipe_publish(MU_SCAN_PIPE *pipe, ULONG slot, ULONG r_index, ULONG address, ULONG len)
+{
+    pipe->windows[slot].r_index = r_index;
+    pipe->windows[slot].address = address;
+    pipe->windows[slot].len = len;
+    pipe->owner->stats.bytes += len;
+    pipe->owner->stats.windows++;
+    spsc_publish(&pipe->queue);
+}
+
+/**
+ * @brief Reader thread of a pipeline. Takes ranges on behalf of its scanner and reads them window by
+ * window straight into the free buffers. Windows overlap by data_size - 1 bytes, as in the async reads.
+ * A window that comes back short is streamed again with the synchronous reader, which skips its bad pages,
+ * and its pieces are copied into buffers
+ * 
+ * @param arg Pointer to the MU_SCAN_PIPE
+ * @return NULL
+ */
+static void *pipe_reader(void *arg)
+{
+    MU_SCAN_PIPE *pipe = (MU_SCAN_PIPE *) arg;
+    MU_PIPELINE_STATS *stats = &pipe->owner->stats;
+    ULONG overlap = ctx.data_size - 1;
+    ULONG buf_size = ctx.window + overlap;
+    ULONG r_index;
+
+    while(take_range(pipe->owner, &r_index))
+    {
+        MU_SCAN_RANGE *range = &ctx.ranges[r_index];
+        ULONG end = range->addr_start + range->read_len;
+
+        for(ULONG next = range->addr_start; next < end; )
+        {
+            ULONG len = (end - next < buf_size) ? end - next : buf_size;
+            ULONG slot = pipe_reserve(pipe);
+            UINT64 start = now_ns();
+            INT64 n = read_memory_range(ctx.target, next, pipe->buffers + slot * buf_size, len);
+            stats->read_ns += now_ns() - start;
+
+            if(n == (INT64) len) pipe_publish(pipe, slot, r_index, next, len);
+            else
+            {
+                start = now_ns();
+                reader_seek(pipe->reader, next, len);
+                while(reader_next(pipe->reader))
+                {
+                    if(pipe->reader->win_len < ctx.data_size) continue;
+                    stats->read_ns += now_ns() - start;
+                    slot = pipe_reserve(pipe);
+                    start = now_ns();
+                    memcpy(pipe->buffers + slot * buf_size, pipe->reader->buffer, pipe->reader->win_len);
+                    pipe_publish(pipe, slot, r_index, pipe->reader->win_addr, pipe->reader->win_len);
+                }
+                stats->read_ns += now_ns() - start;
+            }
+            next = (next + len >= end) ? end : next + ctx.window;
+        }
+    }
+    spsc_close(&pipe->queue);
+
+    return NULL;
+}
+
+/**
+ * @brief Searches ranges with a reader thread that copies the next windows while this thread searches
+ * the current one, so a scan takes about as long as its slowest stage instead of the sum of both.
+ * Windows are searched in the order they were read, so matches are pushed in address order
+ * 
+ * @param self Thread
+ * @param reader Reader of the thread, lent to the reader thread
+ * @param mask Match mask of the thread
+ */
+static void scan_pipelined(MU_SCAN_THREAD *self, MU_CHUNK_READER *reader, UINT64 *mask)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    MU_SCAN_PIPE pipe;
+    pthread_t tid;
+    ULONG buf_size = ctx.window + ctx.data_size - 1;
+    UINT64 last = UINT64_MAX;
+    UINT64 hint = 0;
+
+    pipe.owner = self;
+    pipe.reader = reader;
+    spsc_init(&pipe.queue, ctx.n_slots);
+    pipe.windows = malloc(ctx.n_slots * sizeof *pipe.windows);
+    pipe.buffers = malloc(ctx.n_slots * buf_size);
+    if(pipe.windows == NULL || pipe.buffers == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    if(pthread_create(&tid, NULL, &pipe_reader, &pipe) != 0)
+    {
+        /* The thread reads on its own (see finder) */
+        sprintf(trace, "%s | Cannot create the reader thread of pipeline %d!", __func__, self->id);
+        diag_error(trace, ERR_GENERIC);
+        spsc_destroy(&pipe.queue);
+        free(pipe.windows);
+        free(pipe.buffers);
+        return;
+    }
+
+    while(true)
+    {
+        INT64 slot = spsc_front(&pipe.queue);
+        if(slot < 0)
+        {
+            UINT64 start = now_ns();
+            slot = spsc_front_wait(&pipe.queue);
+            self->stats.scan_wait_ns += now_ns() - start;
+            if(slot < 0) break;
+        }
+
+        MU_PIPE_WINDOW *win = &pipe.windows[slot];
+        MU_SCAN_RANGE *range = &ctx.ranges[win->r_index];
+        UCHAR *buffer = pipe.buffers + slot * buf_size;
+        UINT64 start = now_ns();
+        if(win->r_index != last)
+        {
+            last = win->r_index;
+            hint = 0;
+        }
+        ULONG skip = (ctx.stride - (win->address - range->addr_start) % ctx.stride) % ctx.stride;
+        if(skip < win->len)
+        {
+            UINT64 found = metrics_clock();
+            ULONG n_slots = find_slots(buffer + skip, win->len - skip, mask);
+            metrics_since(MET_SEARCH_NS, found);
+            found = metrics_clock();
+            push_mask(range, win->address + skip - range->addr_start, mask, n_slots, buffer + skip, &hint);
+            metrics_since(MET_MERGE_NS, found);
+        }
+        self->stats.scan_ns += now_ns() - start;
+        spsc_pop(&pipe.queue);
+    }
+
+    pthread_join(tid, NULL);
+    spsc_destroy(&pipe.queue);
+    free(pipe.windows);
+    free(pipe.buffers);
+}
+
+/**
+ * @brief Gets the buffers of a resident thread ready for the scan in the context. They are only
+ * reallocated when the window or the overlap changed since its last scan
+ * 
+ * @param worker Resident thread
+ * @param overlap Bytes carried between windows
+ */
+static void worker_buffers(MU_POOL_WORKER *worker, ULONG overlap)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    MU_CHUNK_READER *reader = &worker->reader;
+
+    if(reader->buffer == NULL || reader->window != ctx.window || reader->overlap != overlap)
+    {
+        reader_free(reader);
+        free(worker->mask);
+        free(worker->old);
+        worker->old = NULL;
+        reader_init(reader, ctx.target, ctx.window, overlap);
+        worker->mask = malloc(mask_bytes(ctx.window + overlap));
+    }
+    reader->target = ctx.target;
+    reader->win_len = 0;
+    if(ctx.mode == SCAN_COMPARE && worker->old == NULL) worker->old = malloc(ctx.window + overlap);
+    if(worker->mask == NULL || (ctx.mode == SCAN_COMPARE && worker->old == NULL))
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+}
+
+/**
+ * @brief Thread routine. Streams ranges until no work is left (see stream_part). In compare mode with
+ * a valid dirty map, only the pages written since the previous pass are read. Value scans with a queue
+ * depth read through io_uring (see stream_async), or else with a pipeline through a reader thread
+ * (see scan_pipelined)
+ * 
+ * @param arg Pointer to the MU_SCAN_THREAD of this thread
+ * @return NULL
+ */
+static void *finder(void *arg)
+{
+    MU_SCAN_THREAD *self = (MU_SCAN_THREAD *) arg;
+    MU_CHUNK_READER own_reader;
+    MU_CHUNK_READER *reader = &own_reader;
+    ULONG r_index;
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    ULONG overlap = ctx.data_size - 1;
+    UINT64 *mask = NULL;
+    UCHAR *old = NULL;
+    BOOL incremental = ctx.mode == SCAN_COMPARE && ctx.dirty != NULL && ctx.dirty->valid;
+
+    pin_thread(self->id);
+
+    /* The only buffers of this thread: window plus the overlap carried between windows, its match mask,
+       and in compare mode the same window of the snapshot. A resident thread brings its own */
+    if(self->worker != NULL)
+    {
+        worker_buffers(self->worker, overlap);
+        reader = &self->worker->reader;
+        mask = self->worker->mask;
+        old = self->worker->old;
+    }
+    else
+    {
+        reader_init(reader, ctx.target, ctx.window, overlap);
+        mask = malloc(mask_bytes(ctx.window + overlap));
+        if(ctx.mode == SCAN_COMPARE) old = malloc(ctx.window + overlap);
+        if(mask == NULL || (ctx.mode == SCAN_COMPARE && old == NULL))
+        {
+            is_ok = ERR_GENERIC;
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+    }
+
+    if(ctx.depth > 0)
+    {
+        MU_URING ring;
+        if(uring_open(&ring, ctx.target, ctx.depth, ctx.window + overlap) == ERR_OK)
+        {
+            stream_async(self, &ring, reader, mask);
+            uring_close(&ring);
+        }
+    }
+    else if(ctx.n_slots > 0) scan_pipelined(self, reader, mask);
+
+    /* Also the whole scan when the ring could not be set up */
+    while(take_range(self, &r_index))
+    {
+        MU_SCAN_RANGE *range = &ctx.ranges[r_index];
+        UINT64 hint = 0;
+
+        /* Nothing left to compare here. The snapshot of this range will not be needed again */
+        if(ctx.prev != NULL && ctx.prev->regions[range->region].n_matches == 0) continue;
+
+        if(incremental) compare_incremental(reader, r_index, mask, old, &hint);
+        else stream_part(reader, r_index, range->addr_start, range->read_len, owned_end(r_index), mask, old, &hint);
+    }
+
+    if(self->worker == NULL)
+    {
+        free(old);
+        free(mask);
+        reader_free(reader);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Routine of a resident thread. Waits for a new generation of work, runs the finder of its
+ * position if the scan uses that many threads, and reports back. Ends when the pool quits
+ * 
+ * @param arg Pointer to the MU_POOL_WORKER of this thread
+ * @return NULL
+ */
+static void *pool_routine(void *arg)
+{
+    MU_POOL_WORKER *worker = (MU_POOL_WORKER *) arg;
+
+    pthread_mutex_lock(&pool.lock);
+    while(true)
+    {
+        while(worker->seen == pool.generation && !pool.quit) pthread_cond_wait(&pool.start, &pool.lock);
+        if(pool.quit) break;
+        worker->seen = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+
+        if(worker->id < ctx.n_threads) finder(&ctx.threads[worker->id]);
+
+        pthread_mutex_lock(&pool.lock);
+        if(--pool.running == 0) pthread_cond_signal(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    return NULL;
+}
+
+MU_ERROR set_scan_resident_pool(BOOL resident)
+{
+    MU_ERROR is_ok = ERR_OK;
+    diag_trace trace;
+
+    if(resident && pool.workers == NULL)
+    {
+        pool.n_workers = get_pool_size();
+        pool.workers = calloc(pool.n_workers, sizeof *pool.workers);
+        if(pool.workers == NULL)
+        {
+            is_ok = ERR_GENERIC;
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+        for(INT i = 0; i < pool.n_workers; i++)
+        {
+            pool.workers[i].id = i;
+            pool.workers[i].seen = pool.generation;
+            if(pthread_create(&pool.workers[i].tid, NULL, &pool_routine, &pool.workers[i]) != 0)
+            {
+                is_ok = ERR_GENERIC;
+                sprintf(trace, "%s | Error creating thread %d!", __func__, i);
+                diag_critical(trace, is_ok);
+                exit(is_ok);
+            }
+        }
+    }
+    else if(!resident && pool.workers != NULL)
+    {
+        pthread_mutex_lock(&pool.lock);
+        pool.quit = true;
+        pthread_cond_broadcast(&pool.start);
+        pthread_mutex_unlock(&pool.lock);
+
+        for(INT i = 0; i < pool.n_workers; i++)
+        {
+            pthread_join(pool.workers[i].tid, NULL);
+            reader_free(&pool.workers[i].reader);
+            free(pool.workers[i].mask);
+            free(pool.workers[i].old);
+        }
+        free(pool.workers);
+        pool.workers = NULL;
+        pool.n_workers = 0;
+        pool.quit = false;
+    }
+
+    return is_ok;
+}
+
+/**
+ * @brief Decides window size and number of threads so the buffers fit the memory budget.
+ * The mode of the context must be set
+ * 
+ * @param overlap Bytes carried between windows
+ * @param n_threads Stores the maximum number of threads allowed by the budget
+ * @return Error code indicating this operation status
+ */
+static MU_ERROR plan_memory(ULONG overlap, INT *n_threads)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    ULONG n_buffers = (ctx.mode == SCAN_COMPARE) ? 2 : 1;
+
+    ctx.depth = 0;
+    ctx.n_slots = 0;
+    ctx.window = scan_window;
+    *n_threads = get_pool_size();
+    if(ctx.mode == SCAN_VALUE && scan_queue_depth > 0)
+    {
+        if(uring_supported())
+        {
+            ctx.depth = scan_queue_depth;
+            n_buffers = ctx.depth;
+        }
+        else
+        {
+            sprintf(trace, "%s | io_uring is not available, reading synchronously", __func__);
+            diag_info(trace);
+        }
+    }
+    if(ctx.mode == SCAN_VALUE && ctx.depth == 0 && scan_pipeline > 0)
+    {
+        /* A reader thread per scanning thread: half the cores copy while the other half search */
+        ctx.n_slots = scan_pipeline;
+        n_buffers = ctx.n_slots + 1;
+        *n_threads = (*n_threads > 1) ? *n_threads / 2 : 1;
+    }
+
+    if(scan_mem_budget != 0)
+    {
+        ULONG per_thread = n_buffers * (ctx.window + overlap) + mask_bytes(ctx.window + overlap);
+        ULONG fit = scan_mem_budget / per_thread;
+        if(fit == 0)
+        {
+            /* Not even one full window fits: shrink it for a single thread. The mask takes 1/8 of a buffer */
+            ULONG buffer = (scan_mem_budget - sizeof(UINT64)) / (8 * n_buffers + 1) * 8;
+            if(buffer < overlap + MIN_WINDOW_SIZE)
+            {
+                is_ok = ERR_FUNC_OPT;
+                sprintf(trace, "%s | Memory budget of %lu bytes is too small for the searched data!", __func__, scan_mem_budget);
+                diag_error(trace, is_ok);
+                return is_ok;
+            }
+            ctx.window = buffer - overlap;
+            fit = 1;
+        }
+        if(fit < (ULONG) *n_threads) *n_threads = (INT) fit;
+    }
+
+    /* Snapshot windows start at page boundaries, so the unknown pages can be tracked exactly */
+    if(ctx.mode != SCAN_VALUE)
+    {
+        ctx.window = ctx.window / SNAP_PAGE_SIZE * SNAP_PAGE_SIZE;
+    }
+
+    return is_ok;
+}
+
+/**
+ * @brief Cuts the chunks into ranges and streams them with a pool of threads, as set in the context.
+ * The matches found are stored in the set
+ * 
+ * @param chunks Chunks to stream, in address order
+ * @param n_chunks Number of chunks
+ * @param set Empty match set created from the chunks
+ * @param max_threads Maximum number of threads allowed by the memory budget
+ */
+static void run_pool(MU_MEM_CHUNK *chunks, INT n_chunks, MU_MATCH_SET *set, INT max_threads)
+{
+    MU_ERROR is_ok = ERR_OK;
+    diag_trace trace;
+
+    ULONG range_size = ctx.window * WINDOWS_PER_RANGE;
+    range_size = (range_size + RANGE_ALIGN - 1) / RANGE_ALIGN * RANGE_ALIGN;
+    ctx.ranges = split_chunks(chunks, n_chunks, set, range_size, &ctx.n_ranges);
+    ctx.stride = set->stride;
+
+    /* No point in having more threads than units of work */
+    ctx.n_threads = max_threads;
+    if((ULONG) ctx.n_threads > ctx.n_ranges) ctx.n_threads = (ctx.n_ranges == 0) ? 1 : (INT) ctx.n_ranges;
+
+    ctx.threads = calloc(ctx.n_threads, sizeof *ctx.threads);
+    if(ctx.threads == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    /* Deal ranges round-robin so big chunks are spread through all deques from the start */
+    for(INT i = 0; i < ctx.n_threads; i++)
+    {
+        MU_SCAN_THREAD *th = &ctx.threads[i];
+        th->id = i;
+        th->deque.items = malloc((sizeof *th->deque.items)*(ctx.n_ranges / ctx.n_threads + 1));
+        if(th->deque.items == NULL)
+        {
+            is_ok = ERR_GENERIC;
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+        pthread_mutex_init(&th->deque.lock, NULL);
+    }
+    /* Push in reverse so each owner pops its ranges in ascending address order */
+    for(ULONG r = ctx.n_ranges; r-- > 0; )
+    {
+        MU_DEQUE *dq = &ctx.threads[r % ctx.n_threads].deque;
+        dq->items[dq->bottom++] = r;
+    }
+
+    UINT64 start = now_ns();
+    if(ctx.n_threads <= pool.n_workers)
+    {
+        /* Wake the resident threads and wait until all of them are parked again */
+        for(INT i = 0; i < ctx.n_threads; i++) ctx.threads[i].worker = &pool.workers[i];
+        pthread_mutex_lock(&pool.lock);
+        pool.running = pool.n_workers;
+        pool.generation++;
+        pthread_cond_broadcast(&pool.start);
+        while(pool.running > 0) pthread_cond_wait(&pool.done, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    else
+    {
+        /* Create threads */
+        for(INT i = 0; i < ctx.n_threads; i++)
+        {
+            INT rv = pthread_create(&ctx.threads[i].tid, NULL, &finder, &ctx.threads[i]);
+            if(rv != 0)
+            {
+                is_ok = ERR_GENERIC;
+                sprintf(trace, "%s | Error creating thread %d!", __func__, i);
+                diag_critical(trace, is_ok);
+                exit(is_ok);
+            }
+        }
+
+        /* Join threads */
+        for(INT i = 0; i < ctx.n_threads; i++)
+        {
+            pthread_join(ctx.threads[i].tid, NULL);
+        }
+    }
+    if(ctx.n_slots > 0)
+    {
+        memset(&pipeline_stats, 0, sizeof pipeline_stats);
+        for(INT i = 0; i < ctx.n_threads; i++)
+        {
+            MU_PIPELINE_STATS *stats = &ctx.threads[i].stats;
+            pipeline_stats.read_ns += stats->read_ns;
+            pipeline_stats.scan_ns += stats->scan_ns;
+            pipeline_stats.read_wait_ns += stats->read_wait_ns;
+            pipeline_stats.scan_wait_ns += stats->scan_wait_ns;
+            pipeline_stats.bytes += stats->bytes;
+            pipeline_stats.windows += stats->windows;
+        }
+        pipeline_stats.wall_ns = now_ns() - start;
+    }
+
+    /* Merge the parts. Ranges are in address order, so appending them one by one keeps regions sorted */
+    start = metrics_clock();
+    for(ULONG r = 0; r < ctx.n_ranges; r++)
+    {
+        matchset_region_append(set, ctx.ranges[r].region, &ctx.ranges[r].part);
+    }
+    metrics_since(MET_MERGE_NS, start);
+
+    /* Regions without previous matches were not read (see finder) */
+    UINT64 n_skipped = 0;
+    for(ULONG r = 0; ctx.prev != NULL && r < ctx.prev->n_regions; r++)
+    {
+        if(ctx.prev->regions[r].n_matches == 0) n_skipped++;
+    }
+    metrics_add(MET_REGIONS_SCANNED, set->n_regions - n_skipped);
+    metrics_add(MET_REGIONS_SKIPPED, n_skipped);
+
+    for(INT i = 0; i < ctx.n_threads; i++)
+    {
+        pthread_mutex_destroy(&ctx.threads[i].deque.lock);
+        free(ctx.threads[i].deque.items);
+    }
+    free(ctx.threads);
+    free(ctx.ranges);
+}
+
+MU_MATCH_SET* execute_scanner_chunks(PID target, MU_MEM_CHUNK *chunks, INT n_chunks, UCHAR *data, ULONG data_size, UINT64 *n_matches)
+{
+    INT max_threads = 0;
+    MU_METRICS mark;
+
+    *n_matches = 0;
+    metrics_begin(&mark);
+    ctx.mode = SCAN_VALUE;
+    if(plan_memory(data_size - 1, &max_threads) != ERR_OK)
+    {
+        metrics_end("scan", &mark);
+        return NULL;
+    }
+
+    MU_MATCH_SET *set = matchset_create(chunks, n_chunks, get_stride(data_size), data_size);
+    ctx.target = target;
+    ctx.data = data;
+    ctx.values = NULL;
+    ctx.data_size = data_size;
+    ctx.snap = NULL;
+    ctx.prev = NULL;
+    ctx.dirty = NULL;
+    run_pool(chunks, n_chunks, set, max_threads);
+    *n_matches = set->n_matches;
+    /* Every match holds the searched value, so relational filters can follow */
+    matchset_set_common_value(set, data);
+    metrics_end("scan", &mark);
+
+    return set;
+}
+
+MU_MATCH_SET* execute_scanner(PID target, UCHAR *data, ULONG data_size, UINT64 *n_matches)
+{
+    INT size = 0;
+    MU_MEM_CHUNK *owner = NULL;
+    MU_METRICS mark;
+
+    /* The enumeration is part of the scan */
+    metrics_begin(&mark);
+    MU_MEM_CHUNK *filtered = get_scan_chunks(target, &size, &owner);
+    MU_MATCH_SET *set = execute_scanner_chunks(target, filtered, size, data, data_size, n_matches);
+    free(filtered);
+    free(owner);
+    metrics_end("scan", &mark);
+
+    return set;
+}
+
+MU_MATCH_SET* execute_scanner_set(PID target, const MU_VALUE_SET *values, UINT64 *n_matches)
+{
+    INT size = 0;
+    INT max_threads = 0;
+    MU_MEM_CHUNK *owner = NULL;
+    MU_METRICS mark;
+
+    *n_matches = 0;
+    metrics_begin(&mark);
+    ctx.mode = SCAN_VALUE;
+    if(plan_memory(values->width - 1, &max_threads) != ERR_OK)
+    {
+        metrics_end("scan_set", &mark);
+        return NULL;
+    }
+
+    MU_MEM_CHUNK *filtered = get_scan_chunks(target, &size, &owner);
+    MU_MATCH_SET *set = matchset_create(filtered, size, get_stride(values->width), values->width);
+    ctx.target = target;
+    ctx.data = NULL;
+    ctx.values = values;
+    ctx.data_size = values->width;
+    ctx.snap = NULL;
+    ctx.prev = NULL;
+    ctx.dirty = NULL;
+    run_pool(filtered, size, set, max_threads);
+    ctx.values = NULL;
+    *n_matches = set->n_matches;
+    free(filtered);
+    free(owner);
+    metrics_end("scan_set", &mark);
+
+    return set;
+}
+
+MU_SNAPSHOT* execute_snapshot(PID target, ULONG data_size, MU_VALUE_TYPE type)
+{
+    INT size = 0;
+    INT max_threads = 0;
+    MU_METRICS mark;
+
+    metrics_begin(&mark);
+    ctx.mode = SCAN_COPY;
+    if(plan_memory(data_size - 1, &max_threads) != ERR_OK)
+    {
+        metrics_end("snapshot", &mark);
+        return NULL;
+    }
+
+    MU_MEM_CHUNK *owner = NULL;
+    MU_MEM_CHUNK *filtered = get_scan_chunks(target, &size, &owner);
+    MU_SNAPSHOT *snap = snapshot_open(target, filtered, size, data_size, type);
+    free(filtered);
+    free(owner);
+    if(snap == NULL)
+    {
+        metrics_end("snapshot", &mark);
+        return NULL;
+    }
 
-    return ERR_OK;
-}
\ No newline at end of file
+    /* The set is only used to cut the chunks into ranges: nothing is searched */
+    MU_MATCH_SET *set = matchset_create(snap->chunks, snap->n_chunks, get_stride(data_size), data_size);
+    ctx.target = target;
+    ctx.data = NULL;
+    ctx.values = NULL;
+    ctx.data_size = data_size;
+    ctx.snap = snap;
+    ctx.prev = NULL;
+    ctx.dirty = NULL;
+    run_pool(snap->chunks, snap->n_chunks, set, max_threads);
+    matchset_free(set);
+    metrics_end("snapshot", &mark);
+
+    return snap;
+}
+
+MU_MATCH_SET* execute_snapshot_filter(MU_SNAPSHOT *snap, MU_MATCH_SET *prev, MU_PREDICATE pred, const UCHAR *delta, UINT64 *n_matches)
+{
+    diag_trace trace;
+    INT max_threads = 0;
+
+    *n_matches = 0;
+    if(snap->type == VAL_STRING && pred != PRED_CHANGED && pred != PRED_UNCHANGED)
+    {
+        sprintf(trace, "%s | Strings can only be compared for changes!", __func__);
+        diag_error(trace, ERR_FUNC_OPT);
+        return NULL;
+    }
+
+    MU_METRICS mark;
+    metrics_begin(&mark);
+    ctx.mode = SCAN_COMPARE;
+    if(plan_memory(snap->data_size - 1, &max_threads) != ERR_OK)
+    {
+        metrics_end("snapshot_filter", &mark);
+        return NULL;
+    }
+
+    /* Same regions and stride as the previous pass, so their region IDs match */
+    ULONG stride = (prev != NULL) ? prev->stride : get_stride(snap->data_size);
+    MU_MATCH_SET *set = matchset_create(snap->chunks, snap->n_chunks, stride, snap->data_size);
+    ctx.target = snap->target;
+    ctx.data = NULL;
+    ctx.values = NULL;
+    ctx.data_size = snap->data_size;
+    ctx.snap = snap;
+    ctx.pred = pred;
+    ctx.delta = delta;
+    ctx.prev = prev;
+    ctx.dirty = (scan_dirty != NULL && scan_dirty->target == snap->target) ? scan_dirty : NULL;
+    run_pool(snap->chunks, snap->n_chunks, set, max_threads);
+    *n_matches = set->n_matches;
+    /* Without previous matches every slot was a candidate, which is not a filter of candidates */
+    if(prev != NULL)
+    {
+        metrics_add(MET_FILTER_IN, prev->n_matches);
+        metrics_add(MET_FILTER_OUT, set->n_matches);
+    }
+    metrics_end("snapshot_filter", &mark);
+
+    return set;
+}
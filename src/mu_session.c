@@ -0,0 +1,557 @@
+/**
+ * @file mu_session.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_session.h
+ * @version 0.1
+ * @date 2022-10-23
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_session.h"
+#include "inc/mu_matchset.h"
+#include "inc/mu_snapshot.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SESSION_MAGIC       "MUSESSN"
+#define SECTION_ALIGN       64
+#define COPY_BUFFER_SIZE    (1UL << 20)
+#define BITS_PER_WORD       64
+#define N_WORDS(sz, st)     ((((sz) + (st) - 1) / (st) + BITS_PER_WORD - 1) / BITS_PER_WORD)
+#define ALIGN_UP(x, a)      (((x) + (a) - 1) / (a) * (a))
+
+#define CHUNK_READABLE      1
+#define CHUNK_WRITABLE      2
+#define CHUNK_PRIVATE       4
+
+/* Header of a session file. Offsets are from the start of the file, 0 for an absent section */
+typedef struct session_header
+{
+    CHAR    magic[8];
+    UINT32  version;
+    INT32   target;
+    INT32   type;
+    INT32   snap_type;
+    UINT64  file_size;
+    UINT64  n_chunks;
+    UINT64  chunks_off;
+    UINT64  names_off;          /* Chunk names, each ending with a null byte */
+    UINT64  names_size;
+    UINT64  regions_off;        /* Match regions. 0 if the session has no match set */
+    UINT64  n_regions;
+    UINT64  stride;
+    UINT64  data_size;
+    UINT64  n_matches;
+    UINT64  common_off;         /* Common last value of the matches. 0 if none */
+    UINT64  snap_chunks_off;    /* Chunks of the snapshot. 0 if the session has no snapshot */
+    UINT64  snap_n_chunks;
+    UINT64  snap_bad_off;
+    UINT64  snap_data_off;      /* Page aligned copy of the memory */
+    UINT64  snap_total;
+    UINT64  snap_data_size;
+
+} MU_SESSION_HEADER;
+
+/* Chunk as stored in a session file */
+typedef struct session_chunk
+{
+    UINT64  addr_start;
+    UINT64  chunk_size;
+    UINT64  offset;             /* Offset in the backing file. For the snapshot, offset in its copy */
+    UINT64  inode;
+    UINT64  name_off;           /* From the start of the names */
+    UINT32  name_size;
+    UINT32  dev_major;
+    UINT32  dev_minor;
+    UINT32  flags;              /* CHUNK_* */
+
+} MU_SESSION_CHUNK;
+
+/* Match region as stored in a session file */
+typedef struct session_region
+{
+    UINT64  addr_start;
+    UINT64  size;
+    UINT64  n_matches;
+    UINT64  data_off;           /* Offsets or bitmap. 0 if there are no matches */
+    UINT64  values_off;         /* Last values. 0 if not known */
+    UINT64  is_bitmap;
+
+} MU_SESSION_REGION;
+
+/**
+ * @brief Writes a buffer at an offset of a file
+ *
+ * @return True if every byte was written
+ */
+static BOOL put(INT fd, UINT64 off, const void *data, ULONG size)
+{
+    const UCHAR *p = data;
+
+    while(size > 0)
+    {
+        ssize_t n = pwrite(fd, p, size, (off_t) off);
+        if(n <= 0) return false;
+        p += n;
+        off += (UINT64) n;
+        size -= (ULONG) n;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Copies the pages of a snapshot into the session file, in the kernel when the filesystem allows it
+ *
+ * @return True if every byte was copied
+ */
+static BOOL copy_snapshot(MU_SNAPSHOT *snap, INT fd, UINT64 off)
+{
+    loff_t in = (loff_t) snap->base_off;
+    loff_t out = (loff_t) off;
+    ULONG left = snap->total;
+
+    while(left > 0)
+    {
+        ssize_t n = copy_file_range(snap->fd, &in, fd, &out, left, 0);
+        if(n <= 0) break;
+        left -= (ULONG) n;
+    }
+    if(left == 0) return true;
+
+    /* Filesystems that cannot copy between them */
+    UCHAR *buffer = malloc(COPY_BUFFER_SIZE);
+    if(buffer == NULL) return false;
+    while(left > 0)
+    {
+        ULONG len = (left < COPY_BUFFER_SIZE) ? left : COPY_BUFFER_SIZE;
+        ssize_t n = pread(snap->fd, buffer, len, in);
+        if(n <= 0 || !put(fd, (UINT64) out, buffer, (ULONG) n)) break;
+        in += n;
+        out += n;
+        left -= (ULONG) n;
+    }
+    free(buffer);
+
+    return left == 0;
+}
+
+/**
+ * @brief Writes chunks as session records
+ *
+ * @param fd Session file
+ * @param off Offset of the records
+ * @param chunks Chunks to write
+ * @param n_chunks Number of chunks
+ * @param file_off Offset in the snapshot copy of each chunk. NULL for the region table
+ * @param names_off Offset of the names. Ignored for the snapshot, whose chunks have no names
+ * @return True if every record and name was written
+ */
+static BOOL put_chunks(INT fd, UINT64 off, MU_MEM_CHUNK *chunks, INT n_chunks, ULONG *file_off, UINT64 names_off)
+{
+    UINT64 name_pos = 0;
+
+    for(INT i = 0; i < n_chunks; i++)
+    {
+        MU_SESSION_CHUNK rec;
+        memset(&rec, 0, sizeof rec);
+        rec.addr_start = chunks[i].addr_start;
+        rec.chunk_size = chunks[i].chunk_size;
+        rec.offset = (file_off != NULL) ? file_off[i] : chunks[i].offset;
+        rec.inode = chunks[i].inode;
+        rec.dev_major = chunks[i].dev_major;
+        rec.dev_minor = chunks[i].dev_minor;
+        rec.flags = (chunks[i].is_readable ? CHUNK_READABLE : 0) | (chunks[i].is_writable ? CHUNK_WRITABLE : 0) |
+                    (chunks[i].is_private ? CHUNK_PRIVATE : 0);
+        if(file_off == NULL && chunks[i].chunk_name != NULL)
+        {
+            rec.name_off = name_pos;
+            rec.name_size = (UINT32) chunks[i].chnk_name_sz;
+            if(!put(fd, names_off + name_pos, chunks[i].chunk_name, chunks[i].chnk_name_sz)) return false;
+            name_pos += chunks[i].chnk_name_sz + 1;
+        }
+        if(!put(fd, off + i * sizeof rec, &rec, sizeof rec)) return false;
+    }
+
+    return true;
+}
+
+MU_ERROR session_save(MU_SESSION *session, const CHAR *path)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    MU_SESSION_HEADER header;
+    MU_MATCH_SET *set = session->matches;
+    MU_SNAPSHOT *snap = session->snap;
+    CHAR tmp_path[PATH_MAX];
+    BOOL written = true;
+
+    /* Layout: header, region table, names, match regions with their arrays, snapshot */
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, SESSION_MAGIC, sizeof SESSION_MAGIC);
+    header.version = SESSION_VERSION;
+    header.target = session->target;
+    header.type = session->type;
+    header.n_chunks = session->n_chunks;
+    header.chunks_off = ALIGN_UP(sizeof header, SECTION_ALIGN);
+    header.names_off = header.chunks_off + header.n_chunks * sizeof(MU_SESSION_CHUNK);
+    for(INT i = 0; i < session->n_chunks; i++)
+    {
+        if(session->chunks[i].chunk_name != NULL) header.names_size += session->chunks[i].chnk_name_sz + 1;
+    }
+    UINT64 pos = ALIGN_UP(header.names_off + header.names_size, SECTION_ALIGN);
+
+    MU_SESSION_REGION *regions = NULL;
+    if(set != NULL)
+    {
+        header.regions_off = pos;
+        header.n_regions = set->n_regions;
+        header.stride = set->stride;
+        header.data_size = set->data_size;
+        header.n_matches = set->n_matches;
+        pos = ALIGN_UP(pos + set->n_regions * sizeof *regions, SECTION_ALIGN);
+        if(set->common_value != NULL)
+        {
+            header.common_off = pos;
+            pos = ALIGN_UP(pos + set->data_size, SECTION_ALIGN);
+        }
+
+        regions = calloc(set->n_regions + 1, sizeof *regions);
+        if(regions == NULL)
+        {
+            is_ok = ERR_GENERIC;
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+        for(ULONG r = 0; r < set->n_regions; r++)
+        {
+            MU_MATCH_REGION *region = &set->regions[r];
+            regions[r].addr_start = region->addr_start;
+            regions[r].size = region->size;
+            regions[r].n_matches = region->n_matches;
+            regions[r].is_bitmap = region->is_bitmap;
+            if(region->n_matches == 0) continue;
+            regions[r].data_off = pos;
+            pos = ALIGN_UP(pos + (region->is_bitmap ? N_WORDS(region->size, set->stride) * sizeof(UINT64)
+                                                    : region->n_matches * sizeof(UINT32)), SECTION_ALIGN);
+            if(region->values != NULL)
+            {
+                regions[r].values_off = pos;
+                pos = ALIGN_UP(pos + region->n_matches * set->data_size, SECTION_ALIGN);
+            }
+        }
+    }
+
+    ULONG bad_words = 0;
+    if(snap != NULL)
+    {
+        bad_words = snap->total / SNAP_PAGE_SIZE / BITS_PER_WORD + 1;
+        header.snap_n_chunks = snap->n_chunks;
+        header.snap_total = snap->total;
+        header.snap_data_size = snap->data_size;
+        header.snap_type = snap->type;
+        header.snap_chunks_off = pos;
+        header.snap_bad_off = ALIGN_UP(pos + snap->n_chunks * sizeof(MU_SESSION_CHUNK), SECTION_ALIGN);
+        header.snap_data_off = ALIGN_UP(header.snap_bad_off + bad_words * sizeof(UINT64), SNAP_PAGE_SIZE);
+        pos = header.snap_data_off + snap->total;
+    }
+    header.file_size = pos;
+
+    snprintf(tmp_path, sizeof tmp_path, "%s.tmp", path);
+    INT fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot create the session file %.100s", __func__, tmp_path);
+        diag_error(trace, is_ok);
+        free(regions);
+        return is_ok;
+    }
+
+    /* Gaps between sections are left as holes */
+    written = ftruncate(fd, (off_t) header.file_size) == 0 && put(fd, 0, &header, sizeof header) &&
+              put_chunks(fd, header.chunks_off, session->chunks, session->n_chunks, NULL, header.names_off);
+    if(set != NULL && written)
+    {
+        written = put(fd, header.regions_off, regions, set->n_regions * sizeof *regions);
+        if(written && set->common_value != NULL) written = put(fd, header.common_off, set->common_value, set->data_size);
+        for(ULONG r = 0; r < set->n_regions && written; r++)
+        {
+            MU_MATCH_REGION *region = &set->regions[r];
+            if(region->n_matches == 0) continue;
+            if(region->is_bitmap) written = put(fd, regions[r].data_off, region->bitmap, N_WORDS(region->size, set->stride) * sizeof(UINT64));
+            else written = put(fd, regions[r].data_off, region->offsets, region->n_matches * sizeof(UINT32));
+            if(written && region->values != NULL) written = put(fd, regions[r].values_off, region->values, region->n_matches * set->data_size);
+        }
+    }
+    if(snap != NULL && written)
+    {
+        written = put_chunks(fd, header.snap_chunks_off, snap->chunks, snap->n_chunks, snap->file_off, 0) &&
+                  put(fd, header.snap_bad_off, snap->bad, bad_words * sizeof(UINT64)) &&
+                  copy_snapshot(snap, fd, header.snap_data_off);
+    }
+    free(regions);
+
+    if(close(fd) != 0 || !written || rename(tmp_path, path) != 0)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot write the session file %.100s", __func__, path);
+        diag_error(trace, is_ok);
+        unlink(tmp_path);
+    }
+
+    return is_ok;
+}
+
+/**
+ * @brief Checks that an array lies inside the file
+ */
+static BOOL in_file(UINT64 off, UINT64 count, UINT64 size, UINT64 file_size)
+{
+    return off <= file_size && (size == 0 || count <= (file_size - off) / size);
+}
+
+/**
+ * @brief Rebuilds chunks from session records
+ *
+ * @param map Mapping of the session file
+ * @param off Offset of the records
+ * @param n_chunks Number of records
+ * @param names Names of the chunks, in the mapping. NULL for the snapshot
+ * @param file_off Stores the offset of each chunk in the snapshot copy. NULL for the region table
+ * @return Chunks. REMEMBER TO FREE
+ */
+static MU_MEM_CHUNK* get_chunks(const UCHAR *map, UINT64 off, UINT64 n_chunks, CHAR *names, ULONG *file_off)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    const MU_SESSION_CHUNK *recs = (const MU_SESSION_CHUNK *) (map + off);
+
+    MU_MEM_CHUNK *chunks = calloc(n_chunks + 1, sizeof *chunks);
+    if(chunks == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    for(UINT64 i = 0; i < n_chunks; i++)
+    {
+        chunks[i].addr_start = recs[i].addr_start;
+        chunks[i].chunk_size = recs[i].chunk_size;
+        chunks[i].is_readable = (recs[i].flags & CHUNK_READABLE) != 0;
+        chunks[i].is_writable = (recs[i].flags & CHUNK_WRITABLE) != 0;
+        chunks[i].is_private = (recs[i].flags & CHUNK_PRIVATE) != 0;
+        chunks[i].inode = recs[i].inode;
+        chunks[i].dev_major = recs[i].dev_major;
+        chunks[i].dev_minor = recs[i].dev_minor;
+        if(names != NULL)
+        {
+            chunks[i].offset = recs[i].offset;
+            chunks[i].chunk_name = names + recs[i].name_off;
+            chunks[i].chnk_name_sz = recs[i].name_size;
+        }
+        if(file_off != NULL) file_off[i] = recs[i].offset;
+    }
+
+    return chunks;
+}
+
+/**
+ * @brief Checks the sections of a session header against the size of its file
+ */
+static BOOL header_valid(const MU_SESSION_HEADER *header, const UCHAR *map, UINT64 file_size)
+{
+    if(memcmp(header->magic, SESSION_MAGIC, sizeof SESSION_MAGIC) != 0 || header->version != SESSION_VERSION ||
+       header->file_size != file_size || !in_file(header->chunks_off, header->n_chunks, sizeof(MU_SESSION_CHUNK), file_size) ||
+       !in_file(header->names_off, header->names_size, 1, file_size))
+    {
+        return false;
+    }
+
+    /* Names must stay inside their section */
+    const MU_SESSION_CHUNK *recs = (const MU_SESSION_CHUNK *) (map + header->chunks_off);
+    for(UINT64 i = 0; i < header->n_chunks; i++)
+    {
+        if(recs[i].name_size > 0 && (recs[i].name_off >= header->names_size || recs[i].name_size > header->names_size - recs[i].name_off - 1)) return false;
+    }
+
+    if(header->regions_off != 0)
+    {
+        if(header->stride == 0 || header->data_size == 0 || !in_file(header->regions_off, header->n_regions, sizeof(MU_SESSION_REGION), file_size) ||
+           (header->common_off != 0 && !in_file(header->common_off, header->data_size, 1, file_size)))
+        {
+            return false;
+        }
+        const MU_SESSION_REGION *regions = (const MU_SESSION_REGION *) (map + header->regions_off);
+        for(UINT64 r = 0; r < header->n_regions; r++)
+        {
+            if(regions[r].n_matches == 0) continue;
+            BOOL data_ok = regions[r].is_bitmap ? in_file(regions[r].data_off, N_WORDS(regions[r].size, header->stride), sizeof(UINT64), file_size)
+                                                : in_file(regions[r].data_off, regions[r].n_matches, sizeof(UINT32), file_size);
+            if(!data_ok || (regions[r].values_off != 0 && !in_file(regions[r].values_off, regions[r].n_matches, header->data_size, file_size)))
+            {
+                return false;
+            }
+        }
+    }
+
+    if(header->snap_chunks_off != 0)
+    {
+        if(!in_file(header->snap_chunks_off, header->snap_n_chunks, sizeof(MU_SESSION_CHUNK), file_size) ||
+           !in_file(header->snap_bad_off, header->snap_total / SNAP_PAGE_SIZE / BITS_PER_WORD + 1, sizeof(UINT64), file_size) ||
+           !in_file(header->snap_data_off, header->snap_total, 1, file_size))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+MU_SESSION* session_load(const CHAR *path)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    struct stat st;
+
+    INT fd = open(path, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0 || (ULONG) st.st_size < sizeof(MU_SESSION_HEADER))
+    {
+        if(fd >= 0) close(fd);
+        sprintf(trace, "%s | Cannot open the session file %.100s", __func__, path);
+        diag_error(trace, is_ok);
+        return NULL;
+    }
+    UCHAR *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        sprintf(trace, "%s | Cannot map the session file %.100s", __func__, path);
+        diag_error(trace, is_ok);
+        return NULL;
+    }
+    const MU_SESSION_HEADER *header = (const MU_SESSION_HEADER *) map;
+    if(!header_valid(header, map, (UINT64) st.st_size))
+    {
+        munmap(map, st.st_size);
+        sprintf(trace, "%s | %.100s is not a session of version %d", __func__, path, SESSION_VERSION);
+        diag_error(trace, is_ok);
+        return NULL;
+    }
+
+    MU_SESSION *session = calloc(1, sizeof *session);
+    if(session == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    session->target = header->target;
+    session->type = (MU_VALUE_TYPE) header->type;
+    session->mapping = map;
+    session->map_size = (ULONG) st.st_size;
+    session->n_chunks = (INT) header->n_chunks;
+    session->chunks = get_chunks(map, header->chunks_off, header->n_chunks, (CHAR *) map + header->names_off, NULL);
+
+    /* The match arrays are used in place */
+    if(header->regions_off != 0)
+    {
+        const MU_SESSION_REGION *recs = (const MU_SESSION_REGION *) (map + header->regions_off);
+        MU_MATCH_SET *set = calloc(1, sizeof *set);
+        if(set == NULL || (set->regions = calloc(header->n_regions + 1, sizeof *set->regions)) == NULL)
+        {
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+        set->n_regions = header->n_regions;
+        set->stride = header->stride;
+        set->data_size = header->data_size;
+        set->n_matches = header->n_matches;
+        for(UINT64 r = 0; r < header->n_regions; r++)
+        {
+            MU_MATCH_REGION *region = &set->regions[r];
+            region->addr_start = recs[r].addr_start;
+            region->size = recs[r].size;
+            region->n_matches = recs[r].n_matches;
+            region->is_bitmap = recs[r].is_bitmap != 0;
+            if(region->n_matches == 0) continue;
+            region->is_mapped = true;
+            if(region->is_bitmap) region->bitmap = (UINT64 *) (map + recs[r].data_off);
+            else
+            {
+                region->offsets = (UINT32 *) (map + recs[r].data_off);
+                region->cap_offsets = region->n_matches;
+            }
+            if(recs[r].values_off != 0)
+            {
+                region->values = map + recs[r].values_off;
+                region->cap_values = region->n_matches;
+            }
+        }
+        if(header->common_off != 0)
+        {
+            set->common_value = malloc(set->data_size);
+            if(set->common_value == NULL)
+            {
+                sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+                diag_critical(trace, is_ok);
+                exit(is_ok);
+            }
+            memcpy(set->common_value, map + header->common_off, set->data_size);
+        }
+        session->matches = set;
+    }
+
+    /* The copy stays in the session file and is updated there */
+    if(header->snap_chunks_off != 0)
+    {
+        ULONG bad_words = header->snap_total / SNAP_PAGE_SIZE / BITS_PER_WORD + 1;
+        MU_SNAPSHOT *snap = calloc(1, sizeof *snap);
+        if(snap == NULL || (snap->file_off = calloc(header->snap_n_chunks + 1, sizeof *snap->file_off)) == NULL ||
+           (snap->bad = malloc(bad_words * sizeof *snap->bad)) == NULL)
+        {
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+        snap->chunks = get_chunks(map, header->snap_chunks_off, header->snap_n_chunks, NULL, snap->file_off);
+        snap->n_chunks = (INT) header->snap_n_chunks;
+        memcpy(snap->bad, map + header->snap_bad_off, bad_words * sizeof *snap->bad);
+        snap->target = header->target;
+        snap->total = header->snap_total;
+        snap->data_size = header->snap_data_size;
+        snap->type = (MU_VALUE_TYPE) header->snap_type;
+        snap->base_off = header->snap_data_off;
+        snap->fd = open(path, O_RDWR);
+        if(snap->fd < 0)
+        {
+            sprintf(trace, "%s | Snapshot of %.100s cannot be updated", __func__, path);
+            diag_info(trace);
+            snap->fd = open(path, O_RDONLY);
+        }
+        session->snap = snap;
+    }
+
+    return session;
+}
+
+void session_close(MU_SESSION *session)
+{
+    if(session == NULL) return;
+
+    matchset_free(session->matches);
+    snapshot_close(session->snap);
+    free(session->chunks);
+    if(session->mapping != NULL) munmap(session->mapping, session->map_size);
+    free(session);
+}
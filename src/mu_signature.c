@@ -0,0 +1,309 @@
+/**
+ * @file mu_signature.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_signature.h
+ * @version 0.1
+ * @date 2022-10-20
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_signature.h"
+#include "inc/mu_memchunk.h"
+#include "inc/mu_io.h"
+#include "inc/mu_kernels.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#define BLOCK_WORDS         64          /* Mask words of anchor matches computed per step */
+#define MAX_TOKEN_SZ        16
+
+/**
+ * @brief Gets the value of a hex digit
+ *
+ * @return Value from 0 to 15, or -1 if c is not a hex digit
+ */
+static INT hex_value(CHAR c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+
+    return -1;
+}
+
+/**
+ * @brief Parses one byte of a signature
+ *
+ * @param token Text of the byte
+ * @param value Stores the value of the byte, with the wildcard bits cleared
+ * @param mask Stores the bits that must match
+ * @return True if the token is valid
+ */
+static BOOL parse_token(const CHAR *token, UCHAR *value, UCHAR *mask)
+{
+    ULONG len = strlen(token);
+    const CHAR *amp = strchr(token, '&');
+
+    if(strcmp(token, "?") == 0 || strcmp(token, "??") == 0)
+    {
+        *value = 0;
+        *mask = 0;
+        return true;
+    }
+    /* Known bits: 0100x1xx */
+    if(len == 8 && strspn(token, "01x?") == 8)
+    {
+        *value = 0;
+        *mask = 0;
+        for(INT i = 0; i < 8; i++)
+        {
+            if(token[i] == 'x' || token[i] == '?') continue;
+            *mask |= 0x80 >> i;
+            if(token[i] == '1') *value |= 0x80 >> i;
+        }
+        return true;
+    }
+    /* Explicit mask: 8B&F0 */
+    if(amp != NULL && amp - token == 2 && len == 5)
+    {
+        INT v[4] = {hex_value(token[0]), hex_value(token[1]), hex_value(token[3]), hex_value(token[4])};
+        if(v[0] < 0 || v[1] < 0 || v[2] < 0 || v[3] < 0) return false;
+        *mask = (UCHAR) (v[2] << 4 | v[3]);
+        *value = (UCHAR) (v[0] << 4 | v[1]) & *mask;
+        return true;
+    }
+    /* Known byte or nibble: 8B, 4?, ?B */
+    if(len == 2)
+    {
+        INT hi = hex_value(token[0]);
+        INT lo = hex_value(token[1]);
+        if((hi < 0 && token[0] != '?') || (lo < 0 && token[1] != '?')) return false;
+        *mask = (UCHAR) (((hi >= 0) ? 0xF0 : 0) | ((lo >= 0) ? 0x0F : 0));
+        *value = (UCHAR) (((hi >= 0) ? hi << 4 : 0) | ((lo >= 0) ? lo : 0));
+        return true;
+    }
+
+    return false;
+}
+
+MU_ERROR signature_parse(const CHAR *text, MU_SIGNATURE *sig)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    ULONG max_len = strlen(text) / 2 + 1;
+
+    memset(sig, 0, sizeof *sig);
+    sig->bytes = malloc(max_len);
+    sig->mask = malloc(max_len);
+    if(sig->bytes == NULL || sig->mask == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    const CHAR *p = text;
+    while(*p != '\0')
+    {
+        while(isspace((UCHAR) *p)) p++;
+        if(*p == '\0') break;
+
+        CHAR token[MAX_TOKEN_SZ];
+        ULONG len = strcspn(p, " \t\n");
+        if(len < MAX_TOKEN_SZ)
+        {
+            memcpy(token, p, len);
+            token[len] = '\0';
+        }
+        if(len >= MAX_TOKEN_SZ || !parse_token(token, &sig->bytes[sig->length], &sig->mask[sig->length]))
+        {
+            is_ok = ERR_FUNC_OPT;
+            sprintf(trace, "%s | Wrong byte %lu of signature, near '%.16s'", __func__, sig->length, p);
+            diag_error(trace, is_ok);
+            signature_free(sig);
+            return is_ok;
+        }
+        p += len;
+        sig->length++;
+    }
+    if(sig->length == 0)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Empty signature!", __func__);
+        diag_error(trace, is_ok);
+        signature_free(sig);
+        return is_ok;
+    }
+
+    /* Anchors: the fully known bytes nearest to both ends, so their positions are far apart */
+    sig->anchor_first = -1;
+    sig->anchor_last = -1;
+    for(ULONG i = 0; i < sig->length; i++)
+    {
+        if(sig->mask[i] != 0xFF) continue;
+        if(sig->anchor_first < 0) sig->anchor_first = (INT64) i;
+        else sig->anchor_last = (INT64) i;
+    }
+
+    return is_ok;
+}
+
+void signature_free(MU_SIGNATURE *sig)
+{
+    free(sig->bytes);
+    free(sig->mask);
+    free(sig->matches);
+    memset(sig, 0, sizeof *sig);
+}
+
+/**
+ * @brief Compares the whole signature at a position
+ */
+static BOOL matches_at(const MU_SIGNATURE *sig, const UCHAR *p)
+{
+    for(ULONG i = 0; i < sig->length; i++)
+    {
+        if((p[i] & sig->mask[i]) != sig->bytes[i]) return false;
+    }
+
+    return true;
+}
+
+ULONG signature_find(const MU_SIGNATURE *sig, const UCHAR *buf, ULONG len, UINT64 *mask)
+{
+    const MU_KERNELS *k = kernels_get();
+    UINT64 last[BLOCK_WORDS];
+
+    if(len < sig->length)
+    {
+        return 0;
+    }
+    ULONG n_pos = len - sig->length + 1;
+
+    for(ULONG base = 0; base < n_pos; base += BLOCK_WORDS * MASK_WORD_BITS)
+    {
+        ULONG cnt = (n_pos - base < BLOCK_WORDS * MASK_WORD_BITS) ? n_pos - base : BLOCK_WORDS * MASK_WORD_BITS;
+        ULONG n_words = (cnt + MASK_WORD_BITS - 1) / MASK_WORD_BITS;
+        UINT64 *block = mask + base / MASK_WORD_BITS;
+
+        /* Positions where both anchors are found. Without anchors, every position is a candidate */
+        if(sig->anchor_first >= 0)
+        {
+            k->eq8(buf + base + sig->anchor_first, cnt, &sig->bytes[sig->anchor_first], block);
+        }
+        else memset(block, 0xff, n_words * sizeof *block);
+        if(sig->anchor_last >= 0)
+        {
+            k->eq8(buf + base + sig->anchor_last, cnt, &sig->bytes[sig->anchor_last], last);
+            for(ULONG w = 0; w < n_words; w++) block[w] &= last[w];
+        }
+        if(cnt % MASK_WORD_BITS != 0) block[n_words - 1] &= (1UL << (cnt % MASK_WORD_BITS)) - 1;
+
+        for(ULONG w = 0; w < n_words; w++)
+        {
+            for(UINT64 left = block[w]; left; left &= left - 1)
+            {
+                ULONG bit = __builtin_ctzl(left);
+                if(!matches_at(sig, buf + base + w * MASK_WORD_BITS + bit)) block[w] &= ~(1UL << bit);
+            }
+        }
+    }
+
+    return n_pos;
+}
+
+/**
+ * @brief Adds a match to a signature
+ */
+static void push_match(MU_SIGNATURE *sig, ULONG address)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+
+    if(sig->n_matches == sig->cap_matches)
+    {
+        sig->cap_matches = (sig->cap_matches == 0) ? 16 : sig->cap_matches * 2;
+        sig->matches = realloc(sig->matches, sig->cap_matches * sizeof *sig->matches);
+        if(sig->matches == NULL)
+        {
+            is_ok = ERR_GENERIC;
+            sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+            diag_critical(trace, is_ok);
+            exit(is_ok);
+        }
+    }
+    sig->matches[sig->n_matches++] = address;
+}
+
+MU_ERROR signature_scan(PID target, MU_SIGNATURE *sigs, ULONG n_sigs, INT option, ULONG max_matches)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    MU_CHUNK_READER reader;
+    INT n_chunks = 0;
+    ULONG max_len = 1;
+
+    for(ULONG s = 0; s < n_sigs; s++)
+    {
+        sigs[s].n_matches = 0;
+        if(sigs[s].length > max_len) max_len = sigs[s].length;
+    }
+
+    MU_MEM_CHUNK *chunks = get_memory_chunks(target, option, &n_chunks);
+    if(chunks == NULL)
+    {
+        return ERR_GENERIC;
+    }
+    ULONG *scanned_to = calloc(n_sigs, sizeof *scanned_to);
+    UINT64 *mask = malloc(((DEFAULT_WINDOW_SIZE + max_len) / MASK_WORD_BITS + 1) * sizeof *mask);
+    if(scanned_to == NULL || mask == NULL || reader_init(&reader, target, DEFAULT_WINDOW_SIZE, max_len - 1) != ERR_OK)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    for(INT c = 0; c < n_chunks; c++)
+    {
+        if(!chunks[c].is_readable) continue;
+
+        reader_seek(&reader, chunks[c].addr_start, chunks[c].chunk_size);
+        while(reader_next(&reader))
+        {
+            for(ULONG s = 0; s < n_sigs; s++)
+            {
+                MU_SIGNATURE *sig = &sigs[s];
+                ULONG win_end = reader.win_addr + reader.win_len;
+
+                /* Windows overlap by the longest signature, so shorter ones skip what they already searched */
+                ULONG from = (scanned_to[s] > reader.win_addr) ? scanned_to[s] - reader.win_addr : 0;
+                if(from + sig->length > reader.win_len) continue;
+                if(max_matches != 0 && sig->n_matches >= max_matches) continue;
+
+                ULONG n_pos = signature_find(sig, reader.buffer + from, reader.win_len - from, mask);
+                for(ULONG w = 0; w * MASK_WORD_BITS < n_pos; w++)
+                {
+                    for(UINT64 left = mask[w]; left; left &= left - 1)
+                    {
+                        if(max_matches != 0 && sig->n_matches >= max_matches) break;
+                        push_match(sig, reader.win_addr + from + w * MASK_WORD_BITS + __builtin_ctzl(left));
+                    }
+                }
+                scanned_to[s] = win_end - sig->length + 1;
+            }
+        }
+    }
+
+    reader_free(&reader);
+    free(mask);
+    free(scanned_to);
+    free(chunks);
+
+    return is_ok;
+}
@@ -0,0 +1,252 @@
+/**
+ * @file mu_snapshot.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_snapshot.h
+ * @version 0.1
+ * @date 2022-09-28
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_snapshot.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#define BITS_PER_WORD       64
+
+static const CHAR *snap_dir = NULL;
+
+MU_ERROR set_snapshot_dir(const CHAR *dir)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+
+    if(dir == NULL || access(dir, W_OK) != 0)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | Snapshot directory is not writable!", __func__);
+        diag_error(trace, is_ok);
+    }
+    else snap_dir = dir;
+
+    return is_ok;
+}
+
+/**
+ * @brief Gets the chunk of a snapshot that contains an address
+ *
+ * @param snap Snapshot
+ * @param address Address in the target
+ * @return Index of the chunk. -1 if no chunk contains the address
+ */
+static INT find_chunk(MU_SNAPSHOT *snap, ULONG address)
+{
+    INT lo = 0;
+    INT hi = snap->n_chunks - 1;
+
+    while(lo <= hi)
+    {
+        INT mid = lo + (hi - lo) / 2;
+        MU_MEM_CHUNK *chunk = &snap->chunks[mid];
+        if(address < chunk->addr_start) hi = mid - 1;
+        else if(address >= chunk->addr_start + chunk->chunk_size) lo = mid + 1;
+        else return mid;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Gets the file offset of a range of the target
+ *
+ * @param snap Snapshot
+ * @param address Address in the target of the first byte
+ * @param size Number of bytes
+ * @return Offset in the file. -1 if the range is not inside one chunk
+ */
+static INT64 file_offset(MU_SNAPSHOT *snap, ULONG address, ULONG size)
+{
+    diag_trace trace;
+    INT c = find_chunk(snap, address);
+
+    if(c < 0 || address + size > snap->chunks[c].addr_start + snap->chunks[c].chunk_size)
+    {
+        sprintf(trace, "%s | Range at %#lx of %lu bytes is not in the snapshot!", __func__, address, size);
+        diag_error(trace, ERR_FUNC_OPT);
+        return -1;
+    }
+
+    return (INT64) (snap->file_off[c] + (address - snap->chunks[c].addr_start));
+}
+
+MU_SNAPSHOT* snapshot_open(PID target, MU_MEM_CHUNK *chunks, INT n_chunks, ULONG data_size, MU_VALUE_TYPE type)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    CHAR path[PATH_MAX];
+    const CHAR *dir = snap_dir;
+
+    if(dir == NULL) dir = getenv("TMPDIR");
+    if(dir == NULL) dir = DEFAULT_SNAP_DIR;
+
+    MU_SNAPSHOT *snap = calloc(1, sizeof *snap);
+    if(snap == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    snap->chunks = calloc(n_chunks + 1, sizeof *snap->chunks);
+    snap->file_off = calloc(n_chunks + 1, sizeof *snap->file_off);
+    if(snap->chunks == NULL || snap->file_off == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    for(INT i = 0; i < n_chunks; i++)
+    {
+        snap->chunks[i].addr_start = chunks[i].addr_start;
+        snap->chunks[i].chunk_size = chunks[i].chunk_size;
+        snap->chunks[i].is_readable = chunks[i].is_readable;
+        snap->chunks[i].is_writable = chunks[i].is_writable;
+        snap->chunks[i].is_private = chunks[i].is_private;
+        snap->file_off[i] = snap->total;
+        /* Chunks are page aligned, so pages of the file match pages of the target */
+        snap->total += (chunks[i].chunk_size + SNAP_PAGE_SIZE - 1) / SNAP_PAGE_SIZE * SNAP_PAGE_SIZE;
+    }
+    snap->n_chunks = n_chunks;
+    snap->target = target;
+    snap->data_size = data_size;
+    snap->type = type;
+
+    ULONG n_pages = snap->total / SNAP_PAGE_SIZE;
+    snap->bad = calloc(n_pages / BITS_PER_WORD + 1, sizeof *snap->bad);
+    if(snap->bad == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    /* Nothing is known until the first copy */
+    memset(snap->bad, 0xFF, (n_pages / BITS_PER_WORD + 1) * sizeof *snap->bad);
+
+    /* Unlinked right away: the space is given back even if the scanner dies */
+    snprintf(path, sizeof path, "%s/mu_snapshot_XXXXXX", dir);
+    snap->fd = mkstemp(path);
+    if(snap->fd < 0 || unlink(path) != 0 || ftruncate(snap->fd, (off_t) snap->total) != 0)
+    {
+        sprintf(trace, "%s | Cannot create snapshot file in %s!", __func__, dir);
+        diag_error(trace, is_ok);
+        if(snap->fd >= 0) close(snap->fd);
+        snap->fd = -1;
+        snapshot_close(snap);
+        return NULL;
+    }
+
+    return snap;
+}
+
+void snapshot_close(MU_SNAPSHOT *snap)
+{
+    if(snap == NULL) return;
+
+    if(snap->fd >= 0) close(snap->fd);
+    free(snap->chunks);
+    free(snap->file_off);
+    free(snap->bad);
+    free(snap);
+}
+
+MU_ERROR snapshot_load(MU_SNAPSHOT *snap, ULONG address, UCHAR *buffer, ULONG size)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    INT64 off = file_offset(snap, address, size);
+    ULONG done = 0;
+
+    if(off < 0) return ERR_FUNC_OPT;
+
+    while(done < size)
+    {
+        ssize_t n = pread(snap->fd, buffer + done, size - done, snap->base_off + off + done);
+        if(n <= 0)
+        {
+            is_ok = ERR_GENERIC;
+            sprintf(trace, "%s | Cannot read snapshot file at %#lx!", __func__, address + done);
+            diag_error(trace, is_ok);
+            break;
+        }
+        done += (ULONG) n;
+    }
+
+    return is_ok;
+}
+
+MU_ERROR snapshot_store(MU_SNAPSHOT *snap, ULONG address, UCHAR *buffer, ULONG size)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+    INT64 off = file_offset(snap, address, size);
+    ULONG done = 0;
+
+    if(off < 0) return ERR_FUNC_OPT;
+
+    while(done < size)
+    {
+        ssize_t n = pwrite(snap->fd, buffer + done, size - done, snap->base_off + off + done);
+        if(n <= 0)
+        {
+            is_ok = ERR_GENERIC;
+            sprintf(trace, "%s | Cannot write snapshot file at %#lx!", __func__, address + done);
+            diag_error(trace, is_ok);
+            break;
+        }
+        done += (ULONG) n;
+    }
+
+    return is_ok;
+}
+
+void snapshot_mark(MU_SNAPSHOT *snap, ULONG address, ULONG size, BOOL bad)
+{
+    INT64 off = file_offset(snap, address, size);
+
+    if(off < 0 || size == 0) return;
+
+    ULONG first = (ULONG) off / SNAP_PAGE_SIZE;
+    ULONG last = ((ULONG) off + size - 1) / SNAP_PAGE_SIZE;
+    for(ULONG p = first; p <= last; p++)
+    {
+        /* Neighbour pages may be updated at the same time by other threads */
+        UINT64 bit = 1UL << (p % BITS_PER_WORD);
+        if(bad) __atomic_fetch_or(&snap->bad[p / BITS_PER_WORD], bit, __ATOMIC_RELAXED);
+        else __atomic_fetch_and(&snap->bad[p / BITS_PER_WORD], ~bit, __ATOMIC_RELAXED);
+    }
+}
+
+BOOL snapshot_is_bad(MU_SNAPSHOT *snap, ULONG address, ULONG size)
+{
+    INT64 off = file_offset(snap, address, size);
+
+    if(off < 0) return true;
+    if(size == 0) return false;
+
+    ULONG first = (ULONG) off / SNAP_PAGE_SIZE;
+    ULONG last = ((ULONG) off + size - 1) / SNAP_PAGE_SIZE;
+    for(ULONG p = first; p <= last; p++)
+    {
+        if(__atomic_load_n(&snap->bad[p / BITS_PER_WORD], __ATOMIC_RELAXED) & (1UL << (p % BITS_PER_WORD)))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,404 @@
+/**
+ * @file mu_softdirty.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_softdirty.h
+ * @version 0.1
+ * @date 2022-10-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_softdirty.h"
+#include "inc/mu_index.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define DIRTY_PAGE_SIZE     4096
+#define PAGEMAP_BLOCK       8192            /* Pagemap entries read per pread (one per page) */
+#define PM_SOFT_DIRTY       (1UL << 55)
+#define CLEAR_SOFT_DIRTY    "4"             /* Value for /proc/PID/clear_refs */
+#define STOP_POLL_NS        100000          /* Time between checks of the target while stopping it */
+#define STOP_MAX_POLLS      2000            /* Gives up stopping the target after 200 ms */
+#define BITS_WORD           64
+
+/**
+ * @brief Clears the soft-dirty bits of a process
+ *
+ * @param target PID of the process. 0 for this process
+ * @return Error code indicating this operation status
+ */
+static MU_ERROR clear_soft_dirty(PID target)
+{
+    CHAR path[PATH_MAX];
+
+    if(target == 0) snprintf(path, sizeof path, "/proc/self/clear_refs");
+    else snprintf(path, sizeof path, "/proc/%d/clear_refs", target);
+    INT fd = open(path, O_WRONLY | O_CLOEXEC);
+    if(fd < 0) return ERR_GENERIC;
+    ssize_t written = write(fd, CLEAR_SOFT_DIRTY, 1);
+    close(fd);
+
+    return (written == 1) ? ERR_OK : ERR_GENERIC;
+}
+
+/**
+ * @brief Reads the pagemap entry of a page of this process
+ *
+ * @param page Address in the page
+ * @return Entry of the page. 0 if it cannot be read
+ */
+static UINT64 self_entry(void *page)
+{
+    UINT64 entry = 0;
+    INT fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0) return 0;
+    if(pread(fd, &entry, sizeof entry, (off_t) ((ULONG) page / DIRTY_PAGE_SIZE * sizeof entry)) != sizeof entry) entry = 0;
+    close(fd);
+
+    return entry;
+}
+
+BOOL dirty_supported(void)
+{
+    static INT supported = -1;
+
+    if(supported >= 0) return supported;
+
+    /* Kernels without CONFIG_MEM_SOFT_DIRTY accept the clear but never set the bit */
+    supported = 0;
+    volatile UCHAR *page = mmap(NULL, DIRTY_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(page == MAP_FAILED) return false;
+    page[0] = 1;
+    if(clear_soft_dirty(0) == ERR_OK && (self_entry((void *) page) & PM_SOFT_DIRTY) == 0)
+    {
+        page[0] = 2;
+        supported = (self_entry((void *) page) & PM_SOFT_DIRTY) != 0;
+    }
+    munmap((void *) page, DIRTY_PAGE_SIZE);
+
+    return supported;
+}
+
+/**
+ * @brief Checks if every thread of a target is stopped
+ *
+ * @param target PID of the target process
+ * @param stopped Stores whether all threads are stopped
+ * @return Error code indicating this operation status
+ */
+static MU_ERROR all_stopped(PID target, BOOL *stopped)
+{
+    CHAR path[PATH_MAX];
+    CHAR stat[512];
+
+    snprintf(path, sizeof path, "/proc/%d/task", target);
+    DIR *tasks = opendir(path);
+    if(tasks == NULL) return ERR_GENERIC;
+
+    *stopped = true;
+    struct dirent *task;
+    while(*stopped && (task = readdir(tasks)) != NULL)
+    {
+        if(task->d_name[0] == '.') continue;
+        snprintf(path, sizeof path, "/proc/%d/task/%s/stat", target, task->d_name);
+        INT fd = open(path, O_RDONLY | O_CLOEXEC);
+        if(fd < 0) continue;    /* Thread gone meanwhile */
+        ssize_t len = read(fd, stat, sizeof stat - 1);
+        close(fd);
+        if(len <= 0) continue;
+        stat[len] = '\0';
+
+        /* State follows the command name, which may contain spaces and parentheses */
+        CHAR *state = strrchr(stat, ')');
+        *stopped = state != NULL && (state[2] == 'T' || state[2] == 't');
+    }
+    closedir(tasks);
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Stops a target and waits until all its threads are stopped
+ *
+ * @param target PID of the target process
+ * @param by_us Stores whether the target was stopped by this call (false if it already was)
+ * @return Error code indicating this operation status
+ */
+static MU_ERROR stop_target(PID target, BOOL *by_us)
+{
+    BOOL stopped = false;
+    struct timespec poll = {0, STOP_POLL_NS};
+
+    *by_us = false;
+    if(all_stopped(target, &stopped) != ERR_OK) return ERR_GENERIC;
+    if(stopped) return ERR_OK;
+
+    if(kill(target, SIGSTOP) != 0) return ERR_GENERIC;
+    *by_us = true;
+    for(INT i = 0; i < STOP_MAX_POLLS; i++)
+    {
+        if(all_stopped(target, &stopped) != ERR_OK) return ERR_GENERIC;
+        if(stopped) return ERR_OK;
+        nanosleep(&poll, NULL);
+    }
+
+    return ERR_GENERIC;
+}
+
+/**
+ * @brief Reads the soft-dirty bits of some chunks into the map
+ *
+ * @param map Map with first_page and bits ready for the chunks
+ * @param chunks Chunks of the target, in address order
+ * @param n_chunks Number of chunks
+ * @return Error code indicating this operation status
+ */
+static MU_ERROR read_bits(MU_DIRTY_MAP *map, MU_MEM_CHUNK *chunks, INT n_chunks)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    CHAR path[PATH_MAX];
+
+    snprintf(path, sizeof path, "/proc/%d/pagemap", map->target);
+    INT fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return ERR_GENERIC;
+    UINT64 *entries = malloc(PAGEMAP_BLOCK * sizeof *entries);
+    if(entries == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    is_ok = ERR_OK;
+    map->n_dirty = 0;
+    for(INT c = 0; c < n_chunks && is_ok == ERR_OK; c++)
+    {
+        ULONG bit = map->first_page[c];
+        ULONG page = chunks[c].addr_start / DIRTY_PAGE_SIZE;
+        ULONG left = chunks[c].chunk_size / DIRTY_PAGE_SIZE;
+        while(left > 0)
+        {
+            ULONG n_pages = (left < PAGEMAP_BLOCK) ? left : PAGEMAP_BLOCK;
+            ssize_t n_read = pread(fd, entries, n_pages * sizeof *entries, (off_t) (page * sizeof *entries));
+            if(n_read != (ssize_t) (n_pages * sizeof *entries))
+            {
+                is_ok = ERR_GENERIC;
+                break;
+            }
+            for(ULONG p = 0; p < n_pages; p++, bit++)
+            {
+                if(entries[p] & PM_SOFT_DIRTY)
+                {
+                    map->bits[bit / BITS_WORD] |= 1UL << (bit % BITS_WORD);
+                    map->n_dirty++;
+                }
+            }
+            page += n_pages;
+            left -= n_pages;
+        }
+    }
+    free(entries);
+    close(fd);
+
+    return is_ok;
+}
+
+/**
+ * @brief Frees the bits of a map and leaves it invalid
+ *
+ * @param map Map to reset
+ */
+static void drop_bits(MU_DIRTY_MAP *map)
+{
+    if(map->index != NULL) index_free(map->index);
+    free(map->first_page);
+    free(map->bits);
+    map->index = NULL;
+    map->first_page = NULL;
+    map->bits = NULL;
+    map->n_pages = 0;
+    map->n_dirty = 0;
+    map->valid = false;
+}
+
+MU_DIRTY_MAP* dirty_open(PID target, BOOL stop)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+
+    if(!dirty_supported())
+    {
+        sprintf(trace, "%s | Soft-dirty bits are not available in this kernel", __func__);
+        diag_info(trace);
+        return NULL;
+    }
+    if(clear_soft_dirty(target) != ERR_OK)
+    {
+        sprintf(trace, "%s | Cannot clear the soft-dirty bits of %d!", __func__, target);
+        diag_error(trace, ERR_FUNC_OPT);
+        return NULL;
+    }
+
+    MU_DIRTY_MAP *map = calloc(1, sizeof *map);
+    if(map == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    map->target = target;
+    map->stop = stop;
+
+    return map;
+}
+
+MU_ERROR dirty_refresh(MU_DIRTY_MAP *map, MU_MEM_CHUNK *chunks, INT n_chunks)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    BOOL by_us = false;
+
+    drop_bits(map);
+    map->index = index_build(chunks, n_chunks);
+    map->first_page = malloc((n_chunks + 1) * sizeof *map->first_page);
+    if(map->first_page == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    for(INT c = 0; c < n_chunks; c++)
+    {
+        map->first_page[c] = map->n_pages;
+        map->n_pages += chunks[c].chunk_size / DIRTY_PAGE_SIZE;
+    }
+    map->bits = calloc(map->n_pages / BITS_WORD + 1, sizeof *map->bits);
+    if(map->bits == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    /* A write between reading the bits and clearing them is lost, unless the target waits meanwhile */
+    is_ok = (map->stop) ? stop_target(map->target, &by_us) : ERR_OK;
+    if(is_ok == ERR_OK) is_ok = read_bits(map, chunks, n_chunks);
+    if(is_ok == ERR_OK) is_ok = clear_soft_dirty(map->target);
+    if(by_us) kill(map->target, SIGCONT);
+
+    if(is_ok != ERR_OK)
+    {
+        drop_bits(map);
+        sprintf(trace, "%s | Cannot take the soft-dirty bits of %d. Every page will be read", __func__, map->target);
+        diag_error(trace, is_ok);
+        return is_ok;
+    }
+    map->valid = true;
+
+    return is_ok;
+}
+
+/**
+ * @brief Checks the state of a page
+ *
+ * @param map Valid map
+ * @param chunk Chunk of the page in the index of the map
+ * @param address Address in the page
+ * @return True if the page was written
+ */
+static inline BOOL page_dirty(MU_DIRTY_MAP *map, INT chunk, ULONG address)
+{
+    ULONG bit = map->first_page[chunk] + (address - map->index->starts[chunk]) / DIRTY_PAGE_SIZE;
+
+    return (map->bits[bit / BITS_WORD] >> (bit % BITS_WORD)) & 1;
+}
+
+BOOL dirty_range(MU_DIRTY_MAP *map, ULONG address, ULONG size)
+{
+    if(map == NULL || !map->valid || size == 0) return true;
+
+    INT chunk = index_lookup(map->index, address, size);
+    if(chunk == INDEX_NOT_FOUND) return true;
+    for(ULONG page = address & ~(ULONG) (DIRTY_PAGE_SIZE - 1); page < address + size; page += DIRTY_PAGE_SIZE)
+    {
+        if(page_dirty(map, chunk, (page < address) ? address : page)) return true;
+    }
+
+    return false;
+}
+
+ULONG dirty_range_batch(MU_DIRTY_MAP *map, ULONG *addresses, ULONG n_addr, ULONG size, BOOL *dirty)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    ULONG n_dirty = 0;
+
+    if(map == NULL || !map->valid)
+    {
+        for(ULONG i = 0; i < n_addr; i++) dirty[i] = true;
+        return n_addr;
+    }
+
+    INT *chunks = malloc((n_addr + 1) * sizeof *chunks);
+    if(chunks == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    index_lookup_batch(map->index, addresses, n_addr, size, chunks);
+    for(ULONG i = 0; i < n_addr; i++)
+    {
+        ULONG last = addresses[i] + size - 1;
+        dirty[i] = chunks[i] == INDEX_NOT_FOUND || page_dirty(map, chunks[i], addresses[i]) ||
+                   page_dirty(map, chunks[i], last);
+        n_dirty += dirty[i];
+    }
+    free(chunks);
+
+    return n_dirty;
+}
+
+ULONG dirty_run_end(MU_DIRTY_MAP *map, ULONG address, ULONG end, BOOL dirty)
+{
+    if(map == NULL || !map->valid) return dirty ? end : address;
+
+    while(address < end)
+    {
+        INT chunk = index_lookup(map->index, address, 1);
+        if(chunk == INDEX_NOT_FOUND)
+        {
+            /* Unknown memory is dirty */
+            if(!dirty) return address;
+            address = (address | (DIRTY_PAGE_SIZE - 1)) + 1;
+            continue;
+        }
+        ULONG chunk_end = (map->index->ends[chunk] < end) ? map->index->ends[chunk] : end;
+        while(address < chunk_end)
+        {
+            if(page_dirty(map, chunk, address) != dirty) return address;
+            address = (address | (DIRTY_PAGE_SIZE - 1)) + 1;
+        }
+    }
+
+    return end;
+}
+
+void dirty_close(MU_DIRTY_MAP *map)
+{
+    if(map == NULL) return;
+    drop_bits(map);
+    free(map);
+}
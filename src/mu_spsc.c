@@ -0,0 +1,156 @@
+/**
+ * @file mu_spsc.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_spsc.h
+ * @version 0.1
+ * @date 2022-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_spsc.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <sched.h>
+
+#define SPSC_SPINS  32      /* Yields before a waiting side goes to sleep */
+
+MU_ERROR spsc_init(MU_SPSC *queue, ULONG capacity)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+
+    if(capacity == 0)
+    {
+        is_ok = ERR_FUNC_OPT;
+        sprintf(trace, "%s | A queue needs at least one slot!", __func__);
+        diag_error(trace, is_ok);
+        return is_ok;
+    }
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->closed = false;
+    queue->sleeping = false;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->wake, NULL);
+
+    return is_ok;
+}
+
+void spsc_destroy(MU_SPSC *queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->wake);
+}
+
+/**
+ * @brief Wakes the other side if it went to sleep. Called after a counter or closed was stored
+ *
+ * @param queue Queue
+ */
+static void wake_other(MU_SPSC *queue)
+{
+    /* Pairs with the fence in wait_for: either this side sees sleeping, or the sleeper sees the store */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(!__atomic_load_n(&queue->sleeping, __ATOMIC_RELAXED)) return;
+
+    pthread_mutex_lock(&queue->lock);
+    pthread_cond_signal(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * @brief Waits until a condition of the queue holds: spins for a short while, then sleeps until
+ * the other side wakes it
+ *
+ * @param queue Queue
+ * @param ready Condition
+ */
+static void wait_for(MU_SPSC *queue, BOOL (*ready)(MU_SPSC *))
+{
+    for(INT i = 0; i < SPSC_SPINS; i++)
+    {
+        if(ready(queue)) return;
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    __atomic_store_n(&queue->sleeping, true, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while(!ready(queue)) pthread_cond_wait(&queue->wake, &queue->lock);
+    __atomic_store_n(&queue->sleeping, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* Each side only writes its own counter. The release store of a counter makes the slot contents
+   written before it visible to the other side, which reads the counter with acquire */
+
+INT64 spsc_reserve(MU_SPSC *queue)
+{
+    UINT64 head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    if(queue->tail - head >= queue->capacity) return -1;
+
+    return (INT64) (queue->tail % queue->capacity);
+}
+
+static BOOL can_reserve(MU_SPSC *queue)
+{
+    return spsc_reserve(queue) >= 0;
+}
+
+INT64 spsc_reserve_wait(MU_SPSC *queue)
+{
+    wait_for(queue, &can_reserve);
+
+    return spsc_reserve(queue);
+}
+
+void spsc_publish(MU_SPSC *queue)
+{
+    __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+    wake_other(queue);
+}
+
+void spsc_close(MU_SPSC *queue)
+{
+    __atomic_store_n(&queue->closed, true, __ATOMIC_RELEASE);
+    wake_other(queue);
+}
+
+INT64 spsc_front(MU_SPSC *queue)
+{
+    UINT64 tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    if(queue->head == tail) return -1;
+
+    return (INT64) (queue->head % queue->capacity);
+}
+
+static BOOL can_front(MU_SPSC *queue)
+{
+    return spsc_front(queue) >= 0 || spsc_drained(queue);
+}
+
+INT64 spsc_front_wait(MU_SPSC *queue)
+{
+    wait_for(queue, &can_front);
+
+    return spsc_front(queue);
+}
+
+void spsc_pop(MU_SPSC *queue)
+{
+    __atomic_store_n(&queue->head, queue->head + 1, __ATOMIC_RELEASE);
+    wake_other(queue);
+}
+
+BOOL spsc_drained(MU_SPSC *queue)
+{
+    /* Closed is set after the last publish, so once it is seen the tail is final */
+    if(!__atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE)) return false;
+
+    return queue->head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+}
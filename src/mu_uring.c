@@ -0,0 +1,285 @@
+/**
+ * @file mu_uring.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_uring.h
+ * @version 0.1
+ * @date 2022-10-17
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_uring.h"
+#include "inc/mu_utils.h"
+#include "inc/mu_diag.h"
+#include "inc/mu_metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#define URING_PAGE_SIZE     4096
+#define FIXED_MEM_FD        0           /* Index of the /proc/PID/mem descriptor among the registered files */
+
+/**
+ * @brief Raw io_uring_setup
+ */
+static INT sys_uring_setup(UINT32 entries, struct io_uring_params *params)
+{
+    return (INT) syscall(__NR_io_uring_setup, entries, params);
+}
+
+/**
+ * @brief Raw io_uring_enter
+ */
+static INT sys_uring_enter(INT fd, UINT32 to_submit, UINT32 min_complete, UINT32 flags)
+{
+    return (INT) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/**
+ * @brief Raw io_uring_register
+ */
+static INT sys_uring_register(INT fd, UINT32 opcode, void *arg, UINT32 n_args)
+{
+    return (INT) syscall(__NR_io_uring_register, fd, opcode, arg, n_args);
+}
+
+static BOOL supported = false;
+static pthread_once_t supported_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Creates and destroys a tiny ring to see if io_uring is allowed
+ */
+static void probe_uring()
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof params);
+    INT fd = sys_uring_setup(1, &params);
+    supported = fd >= 0;
+    if(fd >= 0) close(fd);
+}
+
+BOOL uring_supported()
+{
+    pthread_once(&supported_once, probe_uring);
+
+    return supported;
+}
+
+/**
+ * @brief Maps the rings of a ring descriptor
+ *
+ * @param ring Engine with ring_fd set
+ * @param params Parameters filled by io_uring_setup
+ * @return Error code indicating this operation status
+ */
+static MU_ERROR map_rings(MU_URING *ring, struct io_uring_params *params)
+{
+    ring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(UINT32);
+    ring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    if(params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED) return ERR_GENERIC;
+    if(params->features & IORING_FEAT_SINGLE_MMAP) ring->cq_ring = ring->sq_ring;
+    else
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ring == MAP_FAILED) return ERR_GENERIC;
+    }
+    ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED) return ERR_GENERIC;
+
+    UCHAR *sq = ring->sq_ring;
+    UCHAR *cq = ring->cq_ring;
+    ring->sq_tail = (UINT32 *) (sq + params->sq_off.tail);
+    ring->sq_mask = *(UINT32 *) (sq + params->sq_off.ring_mask);
+    ring->sq_array = (UINT32 *) (sq + params->sq_off.array);
+    ring->cq_head = (UINT32 *) (cq + params->cq_off.head);
+    ring->cq_tail = (UINT32 *) (cq + params->cq_off.tail);
+    ring->cq_mask = *(UINT32 *) (cq + params->cq_off.ring_mask);
+    ring->cqes = cq + params->cq_off.cqes;
+
+    return ERR_OK;
+}
+
+MU_ERROR uring_open(MU_URING *ring, PID target, UINT32 depth, ULONG buf_size)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof *ring);
+    ring->ring_fd = -1;
+    ring->mem_fd = -1;
+    if(!uring_supported() || depth == 0 || depth > URING_MAX_DEPTH) return ERR_FUNC_OPT;
+
+    ring->depth = depth;
+    ring->buf_size = buf_size;
+    ring->reads = calloc(depth, sizeof *ring->reads);
+    ring->buffers = aligned_alloc(URING_PAGE_SIZE, (depth * buf_size + URING_PAGE_SIZE - 1) / URING_PAGE_SIZE * URING_PAGE_SIZE);
+    if(ring->reads == NULL || ring->buffers == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+
+    memset(&params, 0, sizeof params);
+    ring->ring_fd = sys_uring_setup(depth, &params);
+    CHAR *path = get_mem_path(target);
+    ring->mem_fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    is_ok = (ring->ring_fd >= 0 && ring->mem_fd >= 0) ? map_rings(ring, &params) : ERR_GENERIC;
+
+    /* Registered buffers and file skip the page pinning and fd lookup of every read */
+    struct iovec *iovecs = malloc(depth * sizeof *iovecs);
+    if(is_ok == ERR_OK && iovecs != NULL)
+    {
+        for(UINT32 i = 0; i < depth; i++)
+        {
+            iovecs[i].iov_base = ring->buffers + i * buf_size;
+            iovecs[i].iov_len = buf_size;
+        }
+        if(sys_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, iovecs, depth) < 0 ||
+           sys_uring_register(ring->ring_fd, IORING_REGISTER_FILES, &ring->mem_fd, 1) < 0)
+        {
+            is_ok = ERR_GENERIC;
+        }
+    }
+    free(iovecs);
+
+    if(is_ok != ERR_OK)
+    {
+        sprintf(trace, "%s | Cannot set up io_uring for %d (%s)", __func__, target, strerror(errno));
+        diag_error(trace, ERR_FUNC_OPT);
+        uring_close(ring);
+        return ERR_FUNC_OPT;
+    }
+
+    return is_ok;
+}
+
+BOOL uring_can_queue(MU_URING *ring)
+{
+    return ring->n_pending < ring->depth;
+}
+
+void uring_queue(MU_URING *ring, ULONG address, ULONG size, UINT64 tag)
+{
+    UINT32 slot = (ring->head + ring->n_pending) % ring->depth;
+    UINT32 tail = *ring->sq_tail;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *) ring->sqes)[slot];
+
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = FIXED_MEM_FD;
+    sqe->addr = (UINT64) (ring->buffers + slot * ring->buf_size);
+    sqe->len = (UINT32) size;
+    sqe->off = address;
+    sqe->buf_index = slot;
+    sqe->user_data = slot;
+
+    ring->reads[slot].address = address;
+    ring->reads[slot].size = size;
+    ring->reads[slot].done = false;
+    ring->reads[slot].tag = tag;
+
+    ring->sq_array[tail & ring->sq_mask] = slot;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->n_pending++;
+    ring->n_unsubmitted++;
+}
+
+/**
+ * @brief Marks the reads of all the available completions as done
+ *
+ * @param ring Engine
+ */
+static void reap(MU_URING *ring)
+{
+    UINT32 head = *ring->cq_head;
+    UINT32 tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for(; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &((struct io_uring_cqe *) ring->cqes)[head & ring->cq_mask];
+        MU_URING_READ *read = &ring->reads[cqe->user_data];
+        read->result = cqe->res;
+        read->done = true;
+        if(cqe->res > 0) metrics_add(MET_BYTES_READ, (UINT64) cqe->res);
+        if(cqe->res <= 0) metrics_add(MET_FAILED_READS, 1);
+        else if((ULONG) cqe->res < read->size) metrics_add(MET_SHORT_READS, 1);
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+MU_URING_READ* uring_wait_head(MU_URING *ring, UCHAR **buffer)
+{
+    MU_URING_READ *read = &ring->reads[ring->head];
+
+    reap(ring);
+    while(!read->done)
+    {
+        /* One syscall submits and waits for any number of reads: it is counted as one read */
+        UINT64 start = metrics_clock();
+        INT n = sys_uring_enter(ring->ring_fd, ring->n_unsubmitted, 1, IORING_ENTER_GETEVENTS);
+        metrics_add(MET_READ_CALLS, 1);
+        metrics_since(MET_COPY_NS, start);
+        ring->n_enters++;
+        if(n >= 0) ring->n_unsubmitted -= (UINT32) n;
+        else if(errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            /* The ring is broken: report the read as failed so the caller reads it another way */
+            read->result = -errno;
+            read->done = true;
+            break;
+        }
+        reap(ring);
+    }
+    *buffer = ring->buffers + ring->head * ring->buf_size;
+
+    return read;
+}
+
+void uring_pop_head(MU_URING *ring)
+{
+    ring->head = (ring->head + 1) % ring->depth;
+    ring->n_pending--;
+}
+
+void uring_close(MU_URING *ring)
+{
+    /* Buffers cannot be freed while the kernel may still write into them */
+    while(ring->ring_fd >= 0 && ring->n_pending > 0)
+    {
+        UCHAR *buffer;
+        MU_URING_READ *read = uring_wait_head(ring, &buffer);
+        if(read->result < 0 && read->result != -EIO && read->result != -EFAULT && ring->n_unsubmitted > 0) break;
+        uring_pop_head(ring);
+    }
+    if(ring->sqes != NULL && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if(ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+    if(ring->ring_fd >= 0) close(ring->ring_fd);
+    if(ring->mem_fd >= 0) close(ring->mem_fd);
+    free(ring->buffers);
+    free(ring->reads);
+    memset(ring, 0, sizeof *ring);
+    ring->ring_fd = -1;
+    ring->mem_fd = -1;
+}
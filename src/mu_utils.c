@@ -9,16 +9,25 @@
  * 
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif  /* _GNU_SOURCE */
+
 #include "inc/mu_utils.h"
 #include "inc/mu_diag.h"
+#include <sched.h>
 #include <sys/types.h>
 #include <signal.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #define CHECK_EXISTENCE_AND_PERMS       0
 #define MIN_BYTES_MAPS_STR              12
 #define MIN_BYTES_MEM_EXE_STR           11
+#define PROC_READ_SIZE                  65536   /* Initial size of the buffer holding a whole /proc file */
 
 MU_ERROR pid_exists(PID target)
 {
@@ -125,4 +134,61 @@ CHAR* get_exe_path(PID target)
         exit(is_ok);
     }
     return path;  
-}
\ No newline at end of file
+}
+
+CHAR* read_proc_file(const CHAR *path, ULONG *len)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_GENERIC;
+    ULONG cap = PROC_READ_SIZE;
+    ULONG done = 0;
+
+    INT fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return NULL;
+
+    CHAR *buffer = malloc(cap + 1);
+    while(buffer != NULL)
+    {
+        ssize_t n = read(fd, buffer + done, cap - done);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0)
+        {
+            /* A partial file would pass for the whole one */
+            free(buffer);
+            close(fd);
+            return NULL;
+        }
+        if(n == 0) break;
+        done += (ULONG) n;
+        if(done == cap)
+        {
+            cap *= 2;
+            buffer = realloc(buffer, cap + 1);
+        }
+    }
+    close(fd);
+    if(buffer == NULL)
+    {
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    buffer[done] = '\0';
+    *len = done;
+
+    return buffer;
+}
+
+INT get_usable_cores()
+{
+    INT64 n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t cpuset;
+
+    CPU_ZERO(&cpuset);
+    if(sched_getaffinity(0, sizeof(cpu_set_t), &cpuset) == 0 && CPU_COUNT(&cpuset) < n_cores)
+    {
+        n_cores = CPU_COUNT(&cpuset);
+    }
+
+    return (n_cores < 1) ? 1 : (INT) n_cores;
+}
@@ -0,0 +1,223 @@
+/**
+ * @file mu_valueset.c
+ * @author Mark Dervishaj
+ * @brief Implementation of mu_valueset.h
+ * @version 0.1
+ * @date 2022-10-19
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "inc/mu_valueset.h"
+#include "inc/mu_kernels.h"
+#include "inc/mu_diag.h"
+#include <stdio.h>
+#include <string.h>
+
+#define FILTER_BITS_PER_VALUE   64          /* About 1 in 64 slots goes on to the table */
+#define FILTER_MIN_BITS         12
+#define FILTER_MAX_BITS         22          /* 512 KiB: stays in L2 */
+#define TABLE_EMPTY             UINT32_MAX
+#define BROADCAST_BLOCK_WORDS   64          /* Mask words searched per block with the broadcast compare */
+
+/**
+ * @brief Gets the key of a value: its first bytes, zero extended
+ */
+static UINT64 get_key(const UCHAR *value, ULONG width)
+{
+    UINT64 key = 0;
+
+    memcpy(&key, value, (width < sizeof key) ? width : sizeof key);
+
+    return key;
+}
+
+/**
+ * @brief Mixes the bits of a key, so values that differ in any byte spread over the filter and the table
+ */
+static inline UINT64 hash_key(UINT64 key)
+{
+    key ^= key >> 29;
+    key *= 0xbf58476d1ce4e5b9UL;
+    key ^= key >> 32;
+
+    return key;
+}
+
+/**
+ * @brief Gets the smallest number of bits that can count up to n
+ */
+static UINT32 bits_for(ULONG n)
+{
+    UINT32 bits = 0;
+
+    while((1UL << bits) < n) bits++;
+
+    return bits;
+}
+
+INT64 valueset_index(const MU_VALUE_SET *set, const UCHAR *value)
+{
+    UINT64 hash = hash_key(get_key(value, set->width));
+    ULONG mask = (1UL << set->table_bits) - 1;
+
+    for(ULONG b = hash & mask; set->table[b] != TABLE_EMPTY; b = (b + 1) & mask)
+    {
+        if(memcmp(set->values + (ULONG) set->table[b] * set->width, value, set->width) == 0)
+        {
+            return set->table[b];
+        }
+    }
+
+    return VALUESET_NOT_FOUND;
+}
+
+MU_VALUE_SET* valueset_create(const UCHAR *values, ULONG n_values, ULONG width)
+{
+    diag_trace trace;
+    MU_ERROR is_ok = ERR_OK;
+
+    if(n_values == 0 || n_values > VALUESET_MAX_VALUES || width == 0)
+    {
+        sprintf(trace, "%s | A set needs 1 to %lu values of at least 1 byte!", __func__, VALUESET_MAX_VALUES);
+        diag_error(trace, ERR_FUNC_OPT);
+        return NULL;
+    }
+
+    MU_VALUE_SET *set = calloc(1, sizeof *set);
+    if(set == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    set->width = width;
+    set->table_bits = bits_for(n_values * 2);
+    set->filter_bits = bits_for(n_values * FILTER_BITS_PER_VALUE);
+    if(set->filter_bits < FILTER_MIN_BITS) set->filter_bits = FILTER_MIN_BITS;
+    if(set->filter_bits > FILTER_MAX_BITS) set->filter_bits = FILTER_MAX_BITS;
+    set->values = malloc(n_values * width);
+    set->table = malloc((1UL << set->table_bits) * sizeof *set->table);
+    set->filter = calloc((1UL << set->filter_bits) / 64, sizeof *set->filter);
+    if(set->values == NULL || set->table == NULL || set->filter == NULL)
+    {
+        is_ok = ERR_GENERIC;
+        sprintf(trace, "%s | Cannot reserve more dynamic memory!", __func__);
+        diag_critical(trace, is_ok);
+        exit(is_ok);
+    }
+    memset(set->table, 0xff, (1UL << set->table_bits) * sizeof *set->table);
+
+    /* The filter uses the top bits of the hash and the table the bottom ones, so they do not correlate */
+    for(ULONG i = 0; i < n_values; i++)
+    {
+        const UCHAR *value = values + i * width;
+        if(valueset_index(set, value) != VALUESET_NOT_FOUND) continue;
+
+        UINT64 hash = hash_key(get_key(value, width));
+        ULONG mask = (1UL << set->table_bits) - 1;
+        ULONG b = hash & mask;
+        while(set->table[b] != TABLE_EMPTY) b = (b + 1) & mask;
+        memcpy(set->values + set->n_values * width, value, width);
+        set->table[b] = (UINT32) set->n_values++;
+
+        ULONG bit = hash >> (64 - set->filter_bits);
+        set->filter[bit / 64] |= 1UL << (bit % 64);
+    }
+
+    return set;
+}
+
+void valueset_free(MU_VALUE_SET *set)
+{
+    if(set == NULL) return;
+    free(set->values);
+    free(set->table);
+    free(set->filter);
+    free(set);
+}
+
+/* Hashes every slot of one key width and tests the prefilter. Most slots stop there */
+#define DEFINE_FIND_SET(NAME, KEY)                                                      \
+static void NAME(const MU_VALUE_SET *set, const UCHAR *buf, ULONG n_slots, ULONG stride, UINT64 *mask) \
+{                                                                                       \
+    UINT32 shift = 64 - set->filter_bits;                                               \
+    for(ULONG w = 0; w * MASK_WORD_BITS < n_slots; w++)                                 \
+    {                                                                                   \
+        ULONG first = w * MASK_WORD_BITS;                                               \
+        ULONG end = (n_slots - first < MASK_WORD_BITS) ? n_slots - first : MASK_WORD_BITS; \
+        UINT64 word = 0;                                                                \
+        for(ULONG b = 0; b < end; b++)                                                  \
+        {                                                                               \
+            const UCHAR *p = buf + (first + b) * stride;                                \
+            ULONG bit = hash_key(KEY) >> shift;                                         \
+            word |= ((set->filter[bit / 64] >> (bit % 64)) & 1) << b;                   \
+        }                                                                               \
+        /* Confirm the few survivors */                                                 \
+        for(UINT64 left = word; left; left &= left - 1)                                 \
+        {                                                                               \
+            ULONG b = __builtin_ctzl(left);                                             \
+            if(valueset_index(set, buf + (first + b) * stride) == VALUESET_NOT_FOUND)   \
+            {                                                                           \
+                word &= ~(1UL << b);                                                    \
+            }                                                                           \
+        }                                                                               \
+        mask[w] = word;                                                                 \
+    }                                                                                   \
+}
+
+/* Loads of a key, the first min(width, 8) bytes of a slot */
+static inline UINT64 load16(const UCHAR *p) { uint16_t x; memcpy(&x, p, sizeof x); return x; }
+static inline UINT64 load32(const UCHAR *p) { UINT32 x; memcpy(&x, p, sizeof x); return x; }
+static inline UINT64 load64(const UCHAR *p) { UINT64 x; memcpy(&x, p, sizeof x); return x; }
+
+DEFINE_FIND_SET(find_set8, (UINT64) *p)
+DEFINE_FIND_SET(find_set16, load16(p))
+DEFINE_FIND_SET(find_set32, load32(p))
+DEFINE_FIND_SET(find_set64, load64(p))
+DEFINE_FIND_SET(find_set_any, get_key(p, set->width))
+
+ULONG valueset_find(const MU_VALUE_SET *set, const UCHAR *buf, ULONG len, ULONG stride, UINT64 *mask)
+{
+    if(len < set->width)
+    {
+        return 0;
+    }
+    ULONG n_slots = (len - set->width) / stride + 1;
+    ULONG n_words = (n_slots + MASK_WORD_BITS - 1) / MASK_WORD_BITS;
+
+    if(set->n_values <= VALUESET_BROADCAST_MAX)
+    {
+        /* Vector compare against each value in turn, block by block so the block stays in cache */
+        UINT64 one[BROADCAST_BLOCK_WORDS + 1];
+        for(ULONG w0 = 0; w0 < n_words; w0 += BROADCAST_BLOCK_WORDS)
+        {
+            ULONG first = w0 * MASK_WORD_BITS;
+            ULONG cnt = (n_slots - first < BROADCAST_BLOCK_WORDS * MASK_WORD_BITS) ? n_slots - first : BROADCAST_BLOCK_WORDS * MASK_WORD_BITS;
+            const UCHAR *block = buf + first * stride;
+            ULONG block_len = (cnt - 1) * stride + set->width;
+            kernel_find(block, block_len, set->values, set->width, stride, mask + w0);
+            for(ULONG v = 1; v < set->n_values; v++)
+            {
+                kernel_find(block, block_len, set->values + v * set->width, set->width, stride, one);
+                for(ULONG w = 0; w * MASK_WORD_BITS < cnt; w++) mask[w0 + w] |= one[w];
+            }
+        }
+        return n_slots;
+    }
+
+    /* Keys are the first 8 bytes of wider values, and the table compares the whole value */
+    switch(set->width)
+    {
+        case 1: find_set8(set, buf, n_slots, stride, mask); break;
+        case 2: find_set16(set, buf, n_slots, stride, mask); break;
+        case 4: find_set32(set, buf, n_slots, stride, mask); break;
+        default: if(set->width >= 8) find_set64(set, buf, n_slots, stride, mask);
+                 else find_set_any(set, buf, n_slots, stride, mask);
+                 break;
+    }
+
+    return n_slots;
+}